@@ -0,0 +1,60 @@
+#include "AllocationCounter.h"
+
+#include <stdlib.h>
+
+#if (defined(RUNBENCHMARKS) || defined(RUNTESTS)) && defined(__GLIBC__)
+
+#include <atomic>
+
+// Zero-initialized before any allocation, thus, before the constructors of
+// the static objects.
+static std::atomic<quint64> allocationCount(0);
+
+// The glibc implementation, which the functions below forward to.
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *p, size_t size);
+}
+
+extern "C" void *malloc(size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *p, size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(p, size);
+}
+
+bool AllocationCounter::isAvailable()
+{
+    return true;
+}
+
+quint64 AllocationCounter::getCount()
+{
+    return allocationCount.load(std::memory_order_relaxed);
+}
+
+#else // (defined(RUNBENCHMARKS) || defined(RUNTESTS)) && defined(__GLIBC__)
+
+bool AllocationCounter::isAvailable()
+{
+    return false;
+}
+
+quint64 AllocationCounter::getCount()
+{
+    return 0;
+}
+
+#endif // (defined(RUNBENCHMARKS) || defined(RUNTESTS)) && defined(__GLIBC__)
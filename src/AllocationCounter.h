@@ -0,0 +1,28 @@
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+// Counting of heap allocations, for benchmarks and tests.
+
+#include <QtGlobal>
+
+/**
+ * Counts the calls of malloc(), calloc() and realloc() by all the threads,
+ * including the ones by operator new and by the Qt containers, by
+ * interposing the glibc allocator.
+ *
+ * Counts only in the benchmark and test build configurations (see
+ * main.cpp) on glibc; otherwise, isAvailable() is false.
+ */
+class AllocationCounter
+{
+public:
+    static bool isAvailable();
+
+    /**
+     * @return The allocations since the process start; the difference of
+     * two values is the allocations in between.
+     */
+    static quint64 getCount();
+};
+
+#endif // ALLOCATIONCOUNTER_H
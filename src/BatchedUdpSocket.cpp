@@ -0,0 +1,276 @@
+#include "BatchedUdpSocket.h"
+
+#ifdef Q_OS_LINUX
+
+#include <QVarLengthArray>
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+///////////////////////////////////////////////////////////////////////////
+// Utils.
+
+static sockaddr_in toSockAddr(const QHostAddress &address, quint16 port)
+{
+    sockaddr_in result;
+    memset(&result, 0, sizeof(result));
+    result.sin_family = AF_INET;
+    result.sin_addr.s_addr = htonl(address.toIPv4Address());
+    result.sin_port = htons(port);
+    return result;
+}
+
+// Room for SO_RXQ_OVFL and SO_TIMESTAMPNS, aligned for cmsghdr.
+union ControlBuffer
+{
+    char data[CMSG_SPACE(sizeof(quint32)) + CMSG_SPACE(sizeof(timespec))];
+    cmsghdr align;
+};
+
+static QString errnoString()
+{
+    return QString::fromLocal8Bit(strerror(errno));
+}
+
+///////////////////////////////////////////////////////////////////////////
+
+BatchedUdpSocket::BatchedUdpSocket(int batchSize)
+    : batchSize(qMax(batchSize, 1))
+{
+}
+
+BatchedUdpSocket::~BatchedUdpSocket()
+{
+    if (fd != -1) {
+        ::close(fd);
+    }
+}
+
+BatchedUdpSocket::Stats BatchedUdpSocket::getStats() const
+{
+    Stats stats;
+    stats.receiveSyscalls = counters.receiveSyscalls.load();
+    stats.sendSyscalls = counters.sendSyscalls.load();
+    stats.datagramsReceived = counters.datagramsReceived.load();
+    stats.datagramsSent = counters.datagramsSent.load();
+    stats.kernelDrops = counters.kernelDrops.load();
+    return stats;
+}
+
+bool BatchedUdpSocket::setError(const QString &what)
+{
+    error = what + ": " + errnoString();
+    return false;
+}
+
+bool BatchedUdpSocket::bind(const QHostAddress &address, quint16 port)
+{
+    fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return setError("socket() failed");
+    }
+
+    int on = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1) {
+        return setError("setsockopt(SO_REUSEADDR) failed");
+    }
+
+    // Report the drop count with each received datagram.
+    if (setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on)) == -1) {
+        return setError("setsockopt(SO_RXQ_OVFL) failed");
+    }
+
+    // Report the kernel arrival time with each received datagram.
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == -1) {
+        return setError("setsockopt(SO_TIMESTAMPNS) failed");
+    }
+
+    sockaddr_in addr = toSockAddr(address, port);
+    if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr))
+        == -1) {
+
+        return setError("bind() failed");
+    }
+
+    return true;
+}
+
+bool BatchedUdpSocket::setBufferSizes(
+    int receiveBufferSize, int sendBufferSize)
+{
+    if (receiveBufferSize > 0 && setsockopt(fd, SOL_SOCKET, SO_RCVBUF,
+        &receiveBufferSize, sizeof(receiveBufferSize)) == -1) {
+
+        return setError("setsockopt(SO_RCVBUF) failed");
+    }
+
+    if (sendBufferSize > 0 && setsockopt(fd, SOL_SOCKET, SO_SNDBUF,
+        &sendBufferSize, sizeof(sendBufferSize)) == -1) {
+
+        return setError("setsockopt(SO_SNDBUF) failed");
+    }
+
+    return true;
+}
+
+bool BatchedUdpSocket::setBusyPoll(int busyPollUs)
+{
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL,
+        &busyPollUs, sizeof(busyPollUs)) == -1) {
+
+        return setError("setsockopt(SO_BUSY_POLL) failed");
+    }
+    return true;
+}
+
+bool BatchedUdpSocket::joinMulticastGroup(
+    const QHostAddress &groupAddress, const QHostAddress &ifaceIp)
+{
+    ip_mreq mreq;
+    mreq.imr_multiaddr.s_addr = htonl(groupAddress.toIPv4Address());
+    mreq.imr_interface.s_addr = htonl(ifaceIp.toIPv4Address());
+    if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq))
+        == -1) {
+
+        return setError("setsockopt(IP_ADD_MEMBERSHIP) failed");
+    }
+
+    // Receive only the groups joined by this socket on this interface,
+    // rather than those joined by any socket of the host.
+    int off = 0;
+    if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_ALL, &off, sizeof(off))
+        == -1) {
+
+        return setError("setsockopt(IP_MULTICAST_ALL) failed");
+    }
+
+    in_addr iface = mreq.imr_interface;
+    if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &iface, sizeof(iface))
+        == -1) {
+
+        return setError("setsockopt(IP_MULTICAST_IF) failed");
+    }
+
+    return true;
+}
+
+int BatchedUdpSocket::receiveBatch(DatagramSlot *const *batch, int count)
+{
+    count = qMin(count, batchSize);
+
+    QVarLengthArray<mmsghdr, 64> msgs(count);
+    QVarLengthArray<iovec, 64> iovs(count);
+    QVarLengthArray<sockaddr_in, 64> addrs(count);
+    QVarLengthArray<ControlBuffer, 64> controls(count);
+    memset(msgs.data(), 0, sizeof(mmsghdr) * count);
+
+    for (int i = 0; i < count; ++i) {
+        iovs[i].iov_base = batch[i]->data;
+        iovs[i].iov_len = DatagramSlot::cCapacity;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        msgs[i].msg_hdr.msg_control = controls[i].data;
+        msgs[i].msg_hdr.msg_controllen = sizeof(controls[i].data);
+    }
+
+    ++counters.receiveSyscalls;
+    int n = recvmmsg(fd, msgs.data(), count, MSG_DONTWAIT, nullptr);
+    if (n == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        setError("recvmmsg() failed");
+        return -1;
+    }
+
+    counters.datagramsReceived += n;
+    for (int i = 0; i < n; ++i) {
+        DatagramSlot *slot = batch[i];
+        // Truncated datagrams are treated as UDP unreliability.
+        slot->size = (msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+            ? -1 : int(msgs[i].msg_len);
+        slot->sender.ip = ntohl(addrs[i].sin_addr.s_addr);
+        slot->sender.port = ntohs(addrs[i].sin_port);
+        slot->kernelTimestampNs = 0;
+
+        msghdr *hdr = &msgs[i].msg_hdr;
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(hdr); cmsg != nullptr;
+            cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+
+            if (cmsg->cmsg_level != SOL_SOCKET) {
+                continue;
+            }
+            if (cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+                timespec arrival;
+                memcpy(&arrival, CMSG_DATA(cmsg), sizeof(arrival));
+                slot->kernelTimestampNs =
+                    qint64(arrival.tv_sec) * 1000000000 + arrival.tv_nsec;
+            } else if (cmsg->cmsg_type == SO_RXQ_OVFL) {
+                // The counter is cumulative; it is reported only once
+                // anything has been dropped.
+                quint32 drops;
+                memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+                counters.kernelDrops.store(drops);
+            }
+        }
+    }
+
+    return n;
+}
+
+bool BatchedUdpSocket::sendBatch(const QList<QByteArray> &datagrams,
+    const QHostAddress &address, quint16 port)
+{
+    sockaddr_in addr = toSockAddr(address, port);
+
+    int sent = 0;
+    while (sent < datagrams.size()) {
+        const int count = qMin(batchSize, datagrams.size() - sent);
+
+        QVarLengthArray<mmsghdr, 64> msgs(count);
+        QVarLengthArray<iovec, 64> iovs(count);
+        memset(msgs.data(), 0, sizeof(mmsghdr) * count);
+
+        for (int i = 0; i < count; ++i) {
+            const QByteArray &datagram = datagrams.at(sent + i);
+            iovs[i].iov_base = const_cast<char *>(datagram.constData());
+            iovs[i].iov_len = datagram.size();
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &addr;
+            msgs[i].msg_hdr.msg_namelen = sizeof(addr);
+        }
+
+        ++counters.sendSyscalls;
+        int n = sendmmsg(fd, msgs.data(), count, 0);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return setError("sendmmsg() failed");
+        }
+
+        for (int i = 0; i < n; ++i) {
+            if (msgs[i].msg_len != iovs[i].iov_len) {
+                error = "Unable to send datagram of "
+                    + QString::number(iovs[i].iov_len) + " bytes.";
+                return false;
+            }
+        }
+
+        counters.datagramsSent += n;
+        sent += n;
+    }
+
+    return true;
+}
+
+#endif // Q_OS_LINUX
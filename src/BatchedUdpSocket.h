@@ -0,0 +1,140 @@
+#ifndef BATCHEDUDPSOCKET_H
+#define BATCHEDUDPSOCKET_H
+
+// Native UDP socket which sends and receives datagrams in batches (Linux).
+
+#include <QtGlobal>
+#ifdef Q_OS_LINUX
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QHostAddress>
+#include <QAtomicInteger>
+
+#include "DatagramPool.h"
+
+/**
+ * UDP socket which drains the receive queue with recvmmsg() and sends
+ * queued datagrams with sendmmsg(), thus, performing one syscall per batch
+ * instead of one or two syscalls per datagram (as QUdpSocket does).
+ *
+ * The socket is non-blocking; the user is expected to watch
+ * socketDescriptor() for readability (e.g. via QSocketNotifier) and call
+ * receiveBatch() until it returns 0.
+ *
+ * Errors are reported QUdpSocket-style: the method returns false (or -1),
+ * and errorString() describes the error.
+ */
+class BatchedUdpSocket
+{
+public:
+    /**
+     * Counters for measuring the effect of batching.
+     */
+    struct Stats
+    {
+        quint64 receiveSyscalls = 0;
+        quint64 sendSyscalls = 0;
+        quint64 datagramsReceived = 0;
+        quint64 datagramsSent = 0;
+
+        // Datagrams dropped by the kernel for this socket so far, as last
+        // reported via SO_RXQ_OVFL: because the receive buffer was full,
+        // or by the socket filter (the kernel does not tell them apart).
+        quint64 kernelDrops = 0;
+    };
+
+    /**
+     * @param batchSize Max number of datagrams per syscall.
+     */
+    explicit BatchedUdpSocket(int batchSize);
+
+    ~BatchedUdpSocket();
+
+    /**
+     * Create the socket and bind it to the address, allowing other sockets
+     * to bind to the same port.
+     */
+    bool bind(const QHostAddress &address, quint16 port);
+
+    /**
+     * Set SO_RCVBUF and SO_SNDBUF; zero leaves the system default. The
+     * kernel doubles the values, and caps them by net.core.rmem_max and
+     * net.core.wmem_max.
+     */
+    bool setBufferSizes(int receiveBufferSize, int sendBufferSize);
+
+    /**
+     * Set SO_BUSY_POLL: receive calls poll the device queue for up to the
+     * specified time instead of waiting for an interrupt (if the driver
+     * supports it). Raising it above net.core.busy_read requires
+     * CAP_NET_ADMIN.
+     */
+    bool setBusyPoll(int busyPollUs);
+
+    /**
+     * Join the group on the interface having the specified IP, and use
+     * this interface for outgoing multicast. The socket receives only the
+     * groups it has joined, on the interfaces it has joined them on.
+     */
+    bool joinMulticastGroup(
+        const QHostAddress &groupAddress, const QHostAddress &ifaceIp);
+
+    int socketDescriptor() const
+    {
+        return fd;
+    }
+
+    /**
+     * Receive up to min(count, batchSize) datagrams with a single syscall,
+     * directly into the slots, including the kernel arrival time.
+     * Truncated datagrams get negative size.
+     * @return Number of slots filled, 0 if there are no pending datagrams,
+     * -1 on error.
+     */
+    int receiveBatch(DatagramSlot *const *batch, int count);
+
+    /**
+     * Send all the datagrams to the same destination, using one syscall
+     * per batchSize datagrams.
+     * @return Whether all the datagrams have been sent.
+     */
+    bool sendBatch(const QList<QByteArray> &datagrams,
+        const QHostAddress &address, quint16 port);
+
+    QString errorString() const
+    {
+        return error;
+    }
+
+    /**
+     * Can be called from any thread, while another one is receiving or
+     * sending.
+     */
+    Stats getStats() const;
+
+private:
+    const int batchSize;
+    int fd = -1;
+    QString error;
+
+    // Of Stats.
+    struct Counters
+    {
+        QAtomicInteger<quint64> receiveSyscalls;
+        QAtomicInteger<quint64> sendSyscalls;
+        QAtomicInteger<quint64> datagramsReceived;
+        QAtomicInteger<quint64> datagramsSent;
+        QAtomicInteger<quint64> kernelDrops;
+    };
+    Counters counters;
+
+    bool setError(const QString &what);
+
+    Q_DISABLE_COPY(BatchedUdpSocket)
+};
+
+#endif // Q_OS_LINUX
+
+#endif // BATCHEDUDPSOCKET_H
@@ -0,0 +1,90 @@
+#ifndef BATCHEDUDPSOCKETBENCHMARK_H
+#define BATCHEDUDPSOCKETBENCHMARK_H
+
+#include <QtTest>
+
+#include "BatchedUdpSocket.h"
+
+#ifdef Q_OS_LINUX
+
+/**
+ * Measures syscalls and datagrams per second for exchanging small
+ * (ack-sized) datagrams over the loopback interface. Batch size 1 is
+ * equivalent to per-datagram I/O; note that QUdpSocket performs two
+ * syscalls per received datagram (pendingDatagramSize() + readDatagram()).
+ */
+class BatchedUdpSocketBenchmark : public QObject
+{
+    Q_OBJECT
+private:
+    // Datagrams sent before receiving; should fit the socket buffer.
+    static const int cRoundSize = 64;
+
+    static const quint16 cPort = 42425;
+
+private slots:
+    void benchmarkExchange_data()
+    {
+        QTest::addColumn<int>("batchSize");
+
+        QTest::newRow("per-datagram") << 1;
+        QTest::newRow("batch of 8") << 8;
+        QTest::newRow("batch of 32") << 32;
+        QTest::newRow("batch of 64") << 64;
+    }
+
+    void benchmarkExchange()
+    {
+        QFETCH(int, batchSize);
+
+        BatchedUdpSocket receiver(batchSize);
+        QVERIFY2(receiver.bind(QHostAddress::LocalHost, cPort),
+            qPrintable(receiver.errorString()));
+
+        BatchedUdpSocket sender(batchSize);
+        QVERIFY2(sender.bind(QHostAddress::LocalHost, 0),
+            qPrintable(sender.errorString()));
+
+        QList<QByteArray> datagrams;
+        for (int i = 0; i < cRoundSize; ++i) {
+            datagrams.append("ack|192.168.1.100|" + QByteArray::number(i));
+        }
+
+        DatagramPool pool(batchSize);
+        QVector<DatagramSlot *> batch;
+        for (int i = 0; i < batchSize; ++i) {
+            batch.append(pool.acquire());
+        }
+        qint64 rounds = 0;
+        QElapsedTimer timer;
+        timer.start();
+
+        QBENCHMARK {
+            QVERIFY(sender.sendBatch(
+                datagrams, QHostAddress::LocalHost, cPort));
+
+            int count = 0;
+            while (count < cRoundSize) {
+                int r = receiver.receiveBatch(batch.data(), batchSize);
+                QVERIFY2(r > 0, "Datagrams lost on loopback.");
+                count += r;
+            }
+            ++rounds;
+        }
+
+        const qint64 elapsedNs = timer.nsecsElapsed();
+        const double total = double(rounds) * cRoundSize;
+        const BatchedUdpSocket::Stats sent = sender.getStats();
+        const BatchedUdpSocket::Stats got = receiver.getStats();
+
+        qDebug() << "batchSize" << batchSize
+            << "| send syscalls/datagram:" << sent.sendSyscalls / total
+            << "| receive syscalls/datagram:"
+            << got.receiveSyscalls / total
+            << "| datagrams/s:" << total * 1e9 / elapsedNs;
+    }
+};
+
+#endif // Q_OS_LINUX
+
+#endif // BATCHEDUDPSOCKETBENCHMARK_H
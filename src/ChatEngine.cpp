@@ -1,20 +1,36 @@
 #include "ChatEngine.h"
 
+#include <chrono>
+#include <QLoggingCategory>
+
 #include "ContactList.h"
-#include "Multicaster.h"
+#include "Transport.h"
 #include "ReliableTextSender.h"
 #include "ReliableTextReceiver.h"
+#include "TextReassembler.h"
 #include "ChatMessages.h"
+#include "TextCompressor.h"
 
 using namespace Chat;
 
 static const QVector<Message::Type> cMessageTypesToLog{
-    TextMessage::cType, AckMessage::cType};
+    TextMessage::cType, AckMessage::cType, FragmentMessage::cType,
+    FragmentAckMessage::cType};
 
 const Engine::Settings Engine::defaultSettings;
 
 static const int cMaxNickUtf8Size = 64;
-static const int cMaxTextUtf8Size = 255;
+
+// Longer texts are sent in fragments of up to this size; leaves room for
+// the other fields of "text" and "frag" in a datagram.
+static const int cMaxFragmentUtf8Size = Transport::cMaxDatagramSize - 160;
+
+static_assert(TextCompressor::cMaxDecompressedSize
+        == FragmentMessage::cMaxCount * cMaxFragmentUtf8Size,
+    "Decompressing should be bounded by the longest text.");
+
+// More senders than this are unlikely; the cache is just reset then.
+static const int cMaxCachedSenderIds = 1024;
 
 ///////////////////////////////////////////////////////////////////////////
 // Utils.
@@ -40,19 +56,32 @@ static const QString &validateNick(const QString &nick)
 static const QString &validateText(const QString &text)
     throw (BadValueEx)
 {
-    if (text.toUtf8().length() > cMaxTextUtf8Size) {
+    if (text.toUtf8().length() > cMaxFragmentUtf8Size
+        && ReliableTextSender::splitIntoFragments(text, cMaxFragmentUtf8Size)
+            .size() > FragmentMessage::cMaxCount) {
+
         throw BadValueEx("Text is too long.");
     }
 
     return text;
 }
 
+/**
+ * @return Current time in the clock of DatagramView::kernelTimestampNs().
+ */
+static qint64 realtimeNowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
 static ReliableTextSender::Settings buildSenderSettings(
     const Engine::Settings &settings)
 {
     ReliableTextSender::Settings result;
     result.maxAttempts = settings.textMaxAttempts;
     result.attemptPeriodMs = settings.textAttemptPeriodMs;
+    result.maxFragmentUtf8Size = cMaxFragmentUtf8Size;
     return result;
 }
 
@@ -64,6 +93,18 @@ static ReliableTextReceiver::Settings buildReceiverSettings(
     return result;
 }
 
+static TextReassembler::Settings buildReassemblerSettings(
+    const Engine::Settings &settings)
+{
+    TextReassembler::Settings result;
+    result.maxBufferedUtf8SizePerSender = settings.fragmentBufferMaxSize;
+    result.maxPartialTextsPerSender =
+        settings.fragmentMaxPartialTextsPerSender;
+    result.maxPartialTexts = settings.fragmentMaxPartialTexts;
+    result.maxStoredCompletedRecords = settings.textMaxStoredRecords;
+    return result;
+}
+
 static ContactList::Settings buildContactListSettings(
     const Engine::Settings &settings)
 {
@@ -75,20 +116,23 @@ static ContactList::Settings buildContactListSettings(
 /**
  * Should be called before sending a message.
  */
-static QByteArray toUtf8AndLogIfNeeded(const Message &message)
+static void logIfNeeded(const Message &message)
 {
-    QByteArray utf8 = message.toUtf8();
-
     if (cMessageTypesToLog.contains(message.type)) {
-        qDebug() << "===>" << utf8;
+        qDebug() << "===>" << message.toUtf8();
     }
+}
 
-    return utf8;
+static QByteArray serializeAndLogIfNeeded(const Message &message,
+    bool binary)
+{
+    logIfNeeded(message);
+    return message.serialize(binary);
 }
 
 ///////////////////////////////////////////////////////////////////////////
 
-class Engine::MessageHandler : public Message::Handler
+class Engine::MessageHandler
 {
 private:
     Engine *const engine;
@@ -98,37 +142,53 @@ public:
         : engine(engine)
     {}
 
-    virtual void handleUserMessage(const UserMessage &message) override
+    void handle(const UserMessageView &message)
     {
         engine->handleUserMessage(message);
     }
 
-    virtual void handleLeaveMessage(const LeaveMessage &message) override
+    void handle(const LeaveMessageView &message)
     {
         engine->handleLeaveMessage(message);
     }
 
-    virtual void handleTextMessage(const TextMessage &message) override
+    void handle(const TextMessageView &message)
     {
         engine->handleTextMessage(message);
     }
 
-    virtual void handleAckMessage(const AckMessage &message) override
+    void handle(const AckMessageView &message)
     {
         engine->handleAckMessage(message);
     }
+
+    void handle(const FragmentMessageView &message)
+    {
+        engine->handleFragmentMessage(message);
+    }
+
+    void handle(const FragmentAckMessageView &message)
+    {
+        engine->handleFragmentAckMessage(message);
+    }
 };
 
 ///////////////////////////////////////////////////////////////////////////
 
 Engine::Engine(QObject *parent, const Settings &settings,
-    const QString &ownNick, Multicaster *multicaster)
+    const QString &ownNick, Transport *transport)
     throw (BadValueEx)
     : QObject(parent), settings(settings), ownNick(validateNick(ownNick)),
-        multicaster(multicaster), messageHandler(new MessageHandler(this))
+        transport(transport), channelName(settings.channel),
+        channelId(Transport::cDefaultChannel),
+        controlBatch(new MessageBatch(
+            settings.controlBatchMaxSize, settings.binaryMessages))
 {
-    connect(multicaster, SIGNAL(datagramReceived(QByteArray,QString)),
-        this, SLOT(datagramReceived(QByteArray,QString)));
+    // Direct: the datagram view is valid only during the signal.
+    connect(transport, SIGNAL(datagramReceived(DatagramView)),
+        this, SLOT(datagramReceived(DatagramView)), Qt::DirectConnection);
+    connect(transport, SIGNAL(networkError(QString)),
+        this, SIGNAL(networkError(QString)));
 
     contactList = new ContactList(this,
         buildContactListSettings(settings));
@@ -141,24 +201,90 @@ Engine::Engine(QObject *parent, const Settings &settings,
         this, SLOT(sendAdvertising()));
     advertisingTimer.setInterval(settings.advertisingPeriodMs);
 
+    connect(&controlBatchTimer, SIGNAL(timeout()),
+        this, SLOT(flushControlMessages()));
+    controlBatchTimer.setSingleShot(true);
+    controlBatchTimer.setInterval(settings.controlCoalescingPeriodMs);
+
     receiver.reset(new ReliableTextReceiver(
-        buildReceiverSettings(settings), multicaster->getOwnId()));
+        buildReceiverSettings(settings), transport->getOwnId()));
+    reassembler.reset(new TextReassembler(
+        buildReassemblerSettings(settings)));
 }
 
 Engine::~Engine()
 {
-    // Do nothing: needed by this class because it contains QScopedPointer.
+    qDeleteAll(unicastAckBatches);
 }
 
 void Engine::start()
 {
+    try {
+        channelId = transport->joinChannel(channelName);
+    } catch (Transport::NetworkEx &e) {
+        emit networkError(e.what());
+        return;
+    }
+
+    // Acks of texts sent by others are dropped before reaching here.
+    QList<QByteArray> ownIdFields;
+    foreach (const QString &id, transport->getOwnIds()) {
+        ownIdFields.append(
+            AckMessage::addresseeField(id, settings.binaryMessages));
+    }
+    transport->setAddressedFilter(
+        AckMessage::addressedPrefix(settings.binaryMessages), ownIdFields);
+
     sendAdvertising();
     advertisingTimer.start();
 }
 
 void Engine::leaveChat()
 {
-    sendMessageIgnoringError(LeaveMessage(ownNick));
+    sendControlMessage(LeaveMessage(ownNick));
+
+    // The App is about to close.
+    flushControlMessages();
+}
+
+void Engine::joinChannel(const QString &name)
+    throw (InvalidCallEx)
+{
+    if (name == channelName) {
+        return;
+    }
+
+    if (sender != nullptr) {
+        throw InvalidCallEx("Sending the text is not finished yet.");
+    }
+
+    int newChannelId;
+    try {
+        newChannelId = transport->joinChannel(name);
+    } catch (Transport::NetworkEx &e) {
+        emit networkError(e.what());
+        return;
+    }
+
+    // Sent before leaving the transport channel.
+    sendControlMessage(LeaveMessage(ownNick));
+    flushControlMessages();
+    if (channelId != Transport::cDefaultChannel) {
+        transport->leaveChannel(channelId);
+    }
+
+    channelName = name;
+    channelId = newChannelId;
+    contactList->removeAllUsers();
+
+    sendAdvertising();
+    advertisingTimer.start();
+}
+
+void Engine::leaveChannel()
+    throw (InvalidCallEx)
+{
+    joinChannel(QString());
 }
 
 void Engine::sendText(const QString &text)
@@ -171,47 +297,132 @@ void Engine::sendText(const QString &text)
     }
 
     sender = new ReliableTextSender(this, buildSenderSettings(settings),
-        multicaster->getOwnId(), text, contactList->buildUserIds());
+        transport->getOwnId(), text, contactList->buildUserIds());
 
     connect(sender, SIGNAL(finished(QSet<QString>)),
             this, SLOT(senderFinished(QSet<QString>)));
     connect(sender, SIGNAL(needToSendText(QString,qint64)),
         this, SLOT(senderNeedToSendText(QString,qint64)));
+    connect(sender, SIGNAL(needToSendFragment(QString,qint64,int,int)),
+        this, SLOT(senderNeedToSendFragment(QString,qint64,int,int)));
+    connect(sender, SIGNAL(attemptCompleted(int,int)),
+        this, SLOT(senderAttemptCompleted(int,int)));
 
     sender->start();
 }
 
+void Engine::senderAttemptCompleted(int ackedCount, int unackedCount)
+{
+    transport->reportDeliveryFeedback(ackedCount, unackedCount);
+}
+
 void Engine::senderNeedToSendText(QString text, qint64 textId)
 {
-    sendMessageReportingError(TextMessage(ownNick, textId, text));
+    const TextMessage message(ownNick, textId, text);
+    if (settings.binaryMessages && settings.compressTexts) {
+        logIfNeeded(message);
+        sendDatagramReportingError(message.toCompressedBinary());
+    } else {
+        sendDatagramReportingError(
+            serializeAndLogIfNeeded(message, settings.binaryMessages));
+    }
 }
 
-void Engine::datagramReceived(QByteArray datagram, QString senderId)
+void Engine::senderNeedToSendFragment(QString fragment, qint64 textId,
+    int index, int count)
 {
-    QScopedPointer<Message> pMessage;
-    try {
-        pMessage.reset(Message::createFromUtf8(datagram, senderId));
-    } catch (ParseEx &e) {
-        // Ignore unparsable datagrams.
-        qDebug() << "Chat::Engine: Unable to parse received datagram:\n"
-            << e.what();
+    sendDatagramReportingError(serializeAndLogIfNeeded(
+        FragmentMessage(ownNick, textId, index, count, fragment),
+        settings.binaryMessages));
+}
+
+QString Engine::senderIdOf(const SenderAddress &sender)
+{
+    auto it = senderIds.constFind(sender);
+    if (it != senderIds.constEnd()) {
+        return it.value();
+    }
+
+    if (senderIds.size() >= cMaxCachedSenderIds) {
+        senderIds.clear();
+    }
+    return senderIds.insert(sender, transport->senderIdOf(sender))
+        .value();
+}
+
+void Engine::datagramReceived(const DatagramView &datagram)
+{
+    if (datagram.channel() != channelId) {
+        // Ignore other channels of the shared transport.
         return;
     }
 
-    if (cMessageTypesToLog.contains(pMessage->type)) {
-        qDebug() << "    " << pMessage->toUtf8() << "<==="
-            << qUtf8Printable(senderId);
+    handledSender = datagram.sender();
+    handledKernelTimestampNs = datagram.kernelTimestampNs();
+    if (handledKernelTimestampNs != 0) {
+        latencyStats.toDatagramReceived.add(
+            realtimeNowNs() - handledKernelTimestampNs);
     }
 
-    pMessage->handleBy(messageHandler.data());
+    handledSenderId = senderIdOf(datagram.sender());
+
+    bool unparsable = false;
+    MessageHandler handler(this);
+    Message::Reader reader(datagram.data(), datagram.size());
+    while (!reader.atEnd()) {
+        MessageView view;
+        const ParseStatus status = reader.next(&view);
+        if (status == ParseUnsupportedDictionary) {
+            // Not malformed: the sender runs another version of the App.
+            ++unsupportedDictionaryTexts;
+            qDebug() << "Chat::Engine: Unable to read a text of"
+                << qUtf8Printable(handledSenderId)
+                << "compressed with another dictionary version; texts so far:"
+                << unsupportedDictionaryTexts;
+            continue;
+        }
+        if (status != ParseOk) {
+            // Ignore unparsable messages.
+            qDebug() << "Chat::Engine: Unable to parse received datagram:"
+                << describeParseStatus(status);
+            unparsable = true;
+            continue;
+        }
+
+        // From the view: building the message just for the log would
+        // allocate per message, even with the debug output disabled.
+        if (cMessageTypesToLog.contains(view.getType())
+            && QLoggingCategory::defaultCategory()->isDebugEnabled()) {
+
+            qDebug() << "    " << view.getType() << "<==="
+                << qUtf8Printable(handledSenderId);
+        }
+
+        view.dispatchTo(&handler);
+    }
+    handledKernelTimestampNs = 0;
+
+    if (unparsable) {
+        transport->reportUnparsable(datagram);
+    }
 }
 
 void Engine::sendAdvertising()
 {
-    sendMessageIgnoringError(UserMessage(ownNick));
+    sendControlMessage(UserMessage(ownNick));
 
     // It looks reasonable to perform this as frequently as advertising.
     contactList->removeExpiredUsers();
+
+    for (auto it = unicastUnreachable.begin();
+        it != unicastUnreachable.end(); ) {
+
+        if (it.value().hasExpired(settings.unicastRetryPeriodMs)) {
+            it = unicastUnreachable.erase(it);
+        } else {
+            ++it;
+        }
+    }
 }
 
 void Engine::senderFinished(QSet<QString> failedUserIds)
@@ -221,53 +432,260 @@ void Engine::senderFinished(QSet<QString> failedUserIds)
     emit textSent(QStringList::fromSet(failedUserIds));
 }
 
-void Engine::handleUserMessage(const UserMessage &message)
+void Engine::handleUserMessage(const UserMessageView &message)
 {
     contactList->confirmUser(
-        message.getSenderId(), message.getSenderNick());
+        handledSenderId, message.senderNick.toString());
 }
 
-void Engine::handleLeaveMessage(const LeaveMessage &message)
+void Engine::handleLeaveMessage(const LeaveMessageView &message)
 {
     contactList->removeUser(
-        message.getSenderId(), message.getSenderNick());
+        handledSenderId, message.senderNick.toString());
+}
+
+void Engine::handleTextMessage(const TextMessageView &message)
+{
+    const bool isNew = receiver->handleMessage(
+        handledSenderId, message.textId);
+
+    if (!isNew && unicastUnreachable.size() < cMaxCachedSenderIds) {
+        // Resent although acked.
+        unicastUnreachable[handledSender].start();
+    }
+    sendAck(AckMessage(handledSenderId, message.textId), handledSender,
+        isNew && message.textId > 0);
+
+    if (isNew) {
+        if (handledKernelTimestampNs != 0) {
+            latencyStats.toTextReceived.add(
+                realtimeNowNs() - handledKernelTimestampNs);
+        }
+        emit textReceived(message.decodeText(),
+            message.senderNick.toString());
+    }
 }
 
-void Engine::handleTextMessage(const TextMessage &message)
+void Engine::handleAckMessage(const AckMessageView &message)
 {
-    sendMessageIgnoringError(
-        AckMessage(message.getSenderId(), message.getTextId()));
+    // A multi-homed App has the same instance id on all of its interfaces;
+    // still, a transport may have other own ids (see getOwnIds()), and the
+    // sender expects the main one.
+    if (sender != nullptr
+        && transport->isOwnId(message.textSenderId.toString())) {
+
+        sender->handleAck(transport->getOwnId(), message.textId,
+            handledSenderId);
+    }
+}
 
-    if (receiver->handleMessage(
-        message.getSenderId(), message.getTextId())) {
+void Engine::handleFragmentMessage(const FragmentMessageView &message)
+{
+    QByteArray text;
+    const quint32 receivedFragments = reassembler->handleFragment(
+        handledSenderId, message.textId, message.index, message.count,
+        QByteArray(message.fragment.data, message.fragment.size), &text);
+    if (receivedFragments == 0) {
+        // Dropped: left unacked to be resent.
+        return;
+    }
 
-        emit textReceived(message.getText(), message.getSenderNick());
+    // Resent fragments have negative ids, as resent texts do.
+    sendFragmentAck(PendingFragmentAck{handledSender, handledSenderId,
+        message.textId, receivedFragments, message.textId > 0});
+
+    if (!text.isEmpty()) {
+        if (handledKernelTimestampNs != 0) {
+            latencyStats.toTextReceived.add(
+                realtimeNowNs() - handledKernelTimestampNs);
+        }
+        emit textReceived(QString::fromUtf8(text),
+            message.senderNick.toString());
     }
 }
 
-void Engine::handleAckMessage(const AckMessage &message)
+void Engine::handleFragmentAckMessage(
+    const FragmentAckMessageView &message)
 {
-    if (sender != nullptr) {
-        sender->handleAck(message.getTextSenderId(), message.getTextId(),
-            message.getSenderId());
+    if (sender != nullptr
+        && transport->isOwnId(message.textSenderId.toString())) {
+
+        sender->handleFragmentAck(transport->getOwnId(), message.textId,
+            message.receivedFragments, handledSenderId);
+    }
+}
+
+void Engine::sendAck(const Message &ack, const SenderAddress &textSender,
+    bool toSenderOnly)
+{
+    const QByteArray serialized =
+        serializeAndLogIfNeeded(ack, settings.binaryMessages);
+
+    // The sender resends the text if it has not got the ack.
+    if (settings.unicastAcks && toSenderOnly
+        && !isUnicastUnreachable(textSender)) {
+
+        sendUnicastAck(serialized, textSender);
+        return;
+    }
+
+    // Not coalesced: the addressed filter of the other Apps drops only the
+    // datagrams starting with an ack.
+    sendDatagramIgnoringError(serialized);
+}
+
+bool Engine::isUnicastUnreachable(const SenderAddress &textSender)
+{
+    auto it = unicastUnreachable.find(textSender);
+    if (it == unicastUnreachable.end()) {
+        return false;
+    }
+    if (it.value().hasExpired(settings.unicastRetryPeriodMs)) {
+        unicastUnreachable.erase(it);
+        return false;
     }
+    return true;
+}
+
+void Engine::sendUnicastAck(const QByteArray &serialized,
+    const SenderAddress &recipient)
+{
+    if (settings.controlCoalescingPeriodMs > 0
+        && MessageBatch::canContain(serialized)) {
+
+        MessageBatch *batch = unicastAckBatches.value(recipient);
+        if (batch != nullptr && !batch->append(serialized)) {
+            // Full.
+            flushControlMessages();
+            batch = nullptr;
+        }
+        if (batch == nullptr) {
+            batch = new MessageBatch(
+                settings.controlBatchMaxSize, settings.binaryMessages);
+            batch->append(serialized);
+            unicastAckBatches.insert(recipient, batch);
+        }
+
+        if (!controlBatchTimer.isActive()) {
+            controlBatchTimer.start();
+        }
+        return;
+    }
+
+    try {
+        transport->sendDatagramTo(serialized, recipient, channelId);
+    } catch (Transport::NetworkEx &e) {
+        qDebug() << "Chat::Engine: Error sending ack, multicasting it: "
+            << e.what();
+        sendDatagramIgnoringError(serialized);
+    }
+}
+
+void Engine::sendFragmentAck(const PendingFragmentAck &ack)
+{
+    if (settings.controlCoalescingPeriodMs <= 0) {
+        sendAck(FragmentAckMessage(ack.textSenderId, ack.textId,
+            ack.receivedFragments), ack.textSender, ack.toSenderOnly);
+        return;
+    }
+
+    // The received fragments only grow, and the text sender merges them
+    // regardless of the sign of the id.
+    for (int i = 0; i < pendingFragmentAcks.size(); ++i) {
+        PendingFragmentAck &pending = pendingFragmentAcks[i];
+        if (pending.textSender == ack.textSender
+            && qAbs(pending.textId) == qAbs(ack.textId)) {
+
+            pending.textId = ack.textId;
+            pending.receivedFragments |= ack.receivedFragments;
+            pending.toSenderOnly = pending.toSenderOnly && ack.toSenderOnly;
+            return;
+        }
+    }
+    pendingFragmentAcks.append(ack);
+
+    if (!controlBatchTimer.isActive()) {
+        controlBatchTimer.start();
+    }
+}
+
+void Engine::sendControlMessage(const Message &message)
+{
+    const QByteArray serialized = serializeAndLogIfNeeded(
+        message, settings.binaryMessages);
+
+    if (settings.controlCoalescingPeriodMs <= 0
+        || !MessageBatch::canContain(serialized)) {
+
+        sendDatagramIgnoringError(serialized);
+        return;
+    }
+
+    if (!controlBatch->append(serialized)) {
+        // Full.
+        flushControlMessages();
+        controlBatch->append(serialized);
+    }
+
+    if (!controlBatchTimer.isActive()) {
+        controlBatchTimer.start();
+    }
+}
+
+void Engine::flushControlMessages()
+{
+    // Before stopping the timer: unicast ones join the batches below.
+    QList<PendingFragmentAck> fragmentAcks;
+    fragmentAcks.swap(pendingFragmentAcks);
+    foreach (const PendingFragmentAck &ack, fragmentAcks) {
+        sendAck(FragmentAckMessage(ack.textSenderId, ack.textId,
+            ack.receivedFragments), ack.textSender, ack.toSenderOnly);
+    }
+
+    controlBatchTimer.stop();
+
+    QHash<SenderAddress, MessageBatch *> ackBatches;
+    ackBatches.swap(unicastAckBatches);
+    for (auto it = ackBatches.constBegin(); it != ackBatches.constEnd();
+        ++it) {
+
+        const QByteArray payload = it.value()->toPayload();
+        delete it.value();
+        try {
+            transport->sendDatagramTo(payload, it.key(), channelId);
+        } catch (Transport::NetworkEx &e) {
+            // Reaches all the Apps, since the batch does not start with
+            // an ack, but only the recipient handles the acks.
+            qDebug() << "Chat::Engine: Error sending acks, multicasting them: "
+                << e.what();
+            sendDatagramIgnoringError(payload);
+        }
+    }
+
+    if (controlBatch->isEmpty()) {
+        return;
+    }
+
+    const QByteArray payload = controlBatch->toPayload();
+    controlBatch->clear();
+    sendDatagramIgnoringError(payload);
 }
 
-void Engine::sendMessageIgnoringError(const Message &message)
+void Engine::sendDatagramIgnoringError(const QByteArray &datagram)
 {
     try {
-        multicaster->sendDatagram(toUtf8AndLogIfNeeded(message));
-    } catch (Multicaster::NetworkEx &e) {
+        transport->sendDatagram(datagram, channelId);
+    } catch (Transport::NetworkEx &e) {
         // Ignore error.
         qDebug() << "Chat::Engine: Error sending datagram: " << e.what();
     }
 }
 
-void Engine::sendMessageReportingError(const Message &message)
+void Engine::sendDatagramReportingError(const QByteArray &datagram)
 {
     try {
-        multicaster->sendDatagram(toUtf8AndLogIfNeeded(message));
-    } catch (Multicaster::NetworkEx &e) {
+        transport->sendDatagram(datagram, channelId);
+    } catch (Transport::NetworkEx &e) {
         emit networkError(e.what());
     }
 }
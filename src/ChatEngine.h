@@ -9,21 +9,35 @@
 #include <QString>
 #include <QStringList>
 #include <QTimer>
-class Multicaster;
+#include "DatagramPool.h"
+#include "Transport.h"
+#include "LatencyHistogram.h"
 
 // private:
+#include <QHash>
+#include <QSet>
+#include <QElapsedTimer>
+
 class ContactList;
 class ReliableTextSender;
 class ReliableTextReceiver;
+class TextReassembler;
 
 namespace Chat {
 
 // private:
 class Message;
+class MessageBatch;
 class UserMessage;
 class LeaveMessage;
 class TextMessage;
 class AckMessage;
+struct UserMessageView;
+struct LeaveMessageView;
+struct TextMessageView;
+struct AckMessageView;
+struct FragmentMessageView;
+struct FragmentAckMessageView;
 
 class InvalidCallEx : public std::logic_error
 {
@@ -51,7 +65,12 @@ public:
  *   populates its contact list with such announcements received from other
  *   Apps.
  * - When an App sends a message, it is delivered to all other Apps.
- *   Sender's nick and IP address are included with the message.
+ *   Sender's nick and instance id are included with the message.
+ * - Apps are identified by a random instance id (the IP address is only
+ *   where to reply), thus, any number of Apps can run on the same host,
+ *   and a multi-homed App is a single user, with a single id, on all of
+ *   its interfaces. Apps identifying each other by IP (older than the
+ *   instance id) can not talk to these.
  * - Messages are guaranteed to be delivered (via waiting for an
  *   acknowledgement and resending on timeout) to the Apps which were
  *   on the contact list of the sender at the moment of sending.
@@ -59,7 +78,8 @@ public:
  * Here are the current implementation limitations:
  * - Nick length in UTF-8 should not exceed 64 bytes, and it should neither
  *   contain ASCII control codes, nor '|'. Nicks need not be unique.
- * - Message length in UTF-8 should not exceed 255 bytes.
+ * - A message longer than about 1.2 KB of UTF-8 is sent in fragments,
+ *   each acked separately, and it should fit into 32 fragments.
  */
 class Engine : public QObject
 {
@@ -72,16 +92,72 @@ public:
         int textMaxStoredRecords = 10;
         int advertisingPeriodMs = 5000;
         int contactExpiryPeriodMs = 11000;
+
+        // Transport channel to chat in initially; empty means the default
+        // one. See joinChannel().
+        QString channel;
+
+        // Control messages ("user", "leave") sent within this period are
+        // coalesced into a single datagram of up to controlBatchMaxSize
+        // bytes; 0 means sending each right away. So are the unicast acks
+        // to the same App. Multicast acks are sent each in its own
+        // datagram, to be dropped by the addressed filter of the Apps they
+        // are not addressed to. The acks of fragments of the same text
+        // within this period are sent as a single one, since each covers
+        // the fragments acked before.
+        int controlCoalescingPeriodMs = 20;
+        int controlBatchMaxSize = Transport::cMaxDatagramSize;
+
+        // Send acks only to the sender of the text (if the transport can),
+        // instead of to all the Apps. A resent text is acked to all, in
+        // case unicast does not reach the sender; so is any text of a
+        // sender which has resent a text already acked.
+        bool unicastAcks = true;
+
+        // Such a sender is acked to all for this period, then via unicast
+        // again (e.g. once a firewall lets unicast through).
+        int unicastRetryPeriodMs = 60 * 1000;
+
+        // Send messages in the compact binary form (see Chat::Message);
+        // both forms are received anyway, thus, enable it once all the
+        // Apps are able to parse it. The addressed filter of the transport
+        // then drops only the acks in the same form.
+        bool binaryMessages = false;
+
+        // Compress the texts sent in the binary form with the shared
+        // dictionary (see TextCompressor) when it makes them shorter; the
+        // Apps of another dictionary version are then unable to read them.
+        bool compressTexts = false;
+
+        // Bounds of the buffer of the texts received in fragments: per
+        // sender, in UTF-8 bytes and in partial texts, and in partial texts
+        // of all senders.
+        int fragmentBufferMaxSize = 64 * 1024;
+        int fragmentMaxPartialTextsPerSender = 4;
+        int fragmentMaxPartialTexts = 64;
     };
 
     static const Settings defaultSettings;
 
     /**
-     * @param multicaster Should be started before Manager::start().
+     * Measured from the kernel arrival time of received datagrams, for the
+     * ones the transport reports it for.
+     */
+    struct LatencyStats
+    {
+        // Until the datagram is passed to this Engine.
+        LatencyHistogram toDatagramReceived;
+
+        // Until textReceived() is emitted for a text in the datagram.
+        LatencyHistogram toTextReceived;
+    };
+
+    /**
+     * @param transport Should be started before Manager::start().
      * @throw BadValueEx if ownNick is empty, too long, or contains '|'.
      */
     Engine(QObject *parent, const Settings &settings,
-        const QString &ownNick, Multicaster *multicaster)
+        const QString &ownNick, Transport *transport)
         throw (BadValueEx);
 
     virtual ~Engine() override;
@@ -92,7 +168,8 @@ public:
     }
 
     /**
-     * Should be called once after the signals are connected.
+     * Should be called once after the signals are connected. Failing to
+     * join the channel is reported via networkError().
      */
     void start();
 
@@ -107,6 +184,43 @@ public:
     void sendText(const QString &text)
         throw (BadValueEx);
 
+    /**
+     * Move the chat to the named transport channel (see Settings::channel):
+     * the Apps in the current channel see this one leave, and its users
+     * leave the contact list; then this App advertises itself in the new
+     * channel. Failing to join the channel is reported via networkError(),
+     * and the chat stays in the current channel.
+     * @throw InvalidCallEx if sending a text is not finished yet.
+     */
+    void joinChannel(const QString &name)
+        throw (InvalidCallEx);
+
+    /**
+     * Move the chat back to the default channel, like joinChannel().
+     */
+    void leaveChannel()
+        throw (InvalidCallEx);
+
+    QString getChannel() const
+    {
+        return channelName;
+    }
+
+    LatencyStats getLatencyStats() const
+    {
+        return latencyStats;
+    }
+
+    /**
+     * @return Number of received texts (including the resent ones) which
+     * are compressed with another dictionary version (see
+     * Settings::compressTexts), thus, this App is unable to read them.
+     */
+    quint64 getUnsupportedDictionaryTexts() const
+    {
+        return unsupportedDictionaryTexts;
+    }
+
 public slots:
     /**
      * Should be called before the App is closed.
@@ -135,17 +249,26 @@ signals:
     void networkError(QString errorMessage);
 
 private slots:
-    void datagramReceived(QByteArray datagram, QString senderId);
+    void datagramReceived(const DatagramView &datagram);
     void sendAdvertising();
     void senderNeedToSendText(QString text, qint64 textId);
+    void senderNeedToSendFragment(QString fragment, qint64 textId,
+        int index, int count);
     void senderFinished(QSet<QString> failedUserIds);
+    void senderAttemptCompleted(int ackedCount, int unackedCount);
+    void flushControlMessages();
 
 private:    
     const Settings settings;
     const QString ownNick;
 
     // Neither created nor owned here.
-    Multicaster *multicaster = nullptr;
+    Transport *transport = nullptr;
+
+    // Transport channel the chat is in; settings.channel is joined in
+    // start().
+    QString channelName;
+    int channelId;
 
     // Created and owned here, is QObject.
     ContactList *contactList = nullptr;
@@ -156,18 +279,77 @@ private:
     // Created and owned here.
     QScopedPointer<ReliableTextReceiver> receiver;
 
+    // Created and owned here.
+    QScopedPointer<TextReassembler> reassembler;
+
     QTimer advertisingTimer;
 
-    // Handling messages using a Visitor-pattern adapter.
+    LatencyStats latencyStats;
+
+    quint64 unsupportedDictionaryTexts = 0;
+
+    // Of the datagram being handled; 0 if unknown.
+    qint64 handledKernelTimestampNs = 0;
+
+    SenderAddress handledSender;
+    QString handledSenderId;
+
+    // Control messages waiting for controlBatchTimer.
+    QScopedPointer<MessageBatch> controlBatch;
+    QTimer controlBatchTimer;
+
+    // Unicast acks waiting for controlBatchTimer, by the recipient; owned.
+    QHash<SenderAddress, MessageBatch *> unicastAckBatches;
+
+    // Senders which unicast acks seem not to reach, since the last resent
+    // text already acked; pruned upon advertising.
+    QHash<SenderAddress, QElapsedTimer> unicastUnreachable;
+
+    // Fragment acks waiting for controlBatchTimer, the latest of each text
+    // only.
+    struct PendingFragmentAck
+    {
+        SenderAddress textSender;
+        QString textSenderId;
+        qint64 textId;
+        quint32 receivedFragments;
+        bool toSenderOnly;
+    };
+    QList<PendingFragmentAck> pendingFragmentAcks;
+
+    // Avoids building id strings per datagram.
+    QHash<SenderAddress, QString> senderIds;
+    QString senderIdOf(const SenderAddress &sender);
+
+    // Handling the views of received messages, dispatched at compile time
+    // via MessageView::dispatchTo(); the sender is handledSenderId.
     class MessageHandler;
-    QScopedPointer<MessageHandler> messageHandler;
-    void handleUserMessage(const UserMessage &message);
-    void handleLeaveMessage(const LeaveMessage &message);
-    void handleTextMessage(const TextMessage &message);
-    void handleAckMessage(const AckMessage &message);
-
-    void sendMessageIgnoringError(const Message &message);
-    void sendMessageReportingError(const Message &message);
+    void handleUserMessage(const UserMessageView &message);
+    void handleLeaveMessage(const LeaveMessageView &message);
+    void handleTextMessage(const TextMessageView &message);
+    void handleAckMessage(const AckMessageView &message);
+    void handleFragmentMessage(const FragmentMessageView &message);
+    void handleFragmentAckMessage(const FragmentAckMessageView &message);
+
+    /**
+     * @param textSender Of the acked text.
+     * @param toSenderOnly Whether the ack can be unicast.
+     */
+    void sendAck(const Message &ack, const SenderAddress &textSender,
+        bool toSenderOnly);
+
+    /**
+     * @return Whether unicast acks seem not to reach the sender, as of
+     * less than unicastRetryPeriodMs ago.
+     */
+    bool isUnicastUnreachable(const SenderAddress &textSender);
+
+    void sendUnicastAck(const QByteArray &serialized,
+        const SenderAddress &recipient);
+    void sendFragmentAck(const PendingFragmentAck &ack);
+    void sendControlMessage(const Message &message);
+    void sendDatagramIgnoringError(const QByteArray &datagram);
+    void sendDatagramReportingError(const QByteArray &datagram);
 };
 
 } // namespace Chat
@@ -0,0 +1,193 @@
+#ifndef CHATENGINEBENCHMARK_H
+#define CHATENGINEBENCHMARK_H
+
+#include <QtTest>
+
+#include "ChatEngine.h"
+#include "LoopbackHub.h"
+
+/**
+ * Disables the debug output of the default logging category (Engines log
+ * each text and ack) while in scope, on top of the rules in effect; then
+ * restores the previous filter, thus, e.g. the rules of QT_LOGGING_RULES.
+ */
+class DebugOutputSuppressor
+{
+public:
+    DebugOutputSuppressor()
+    {
+        previousFilter() = QLoggingCategory::installFilter(filter);
+    }
+
+    ~DebugOutputSuppressor()
+    {
+        QLoggingCategory::installFilter(previousFilter());
+    }
+
+private:
+    static QLoggingCategory::CategoryFilter &previousFilter()
+    {
+        static QLoggingCategory::CategoryFilter previous = nullptr;
+        return previous;
+    }
+
+    static void filter(QLoggingCategory *category)
+    {
+        previousFilter()(category);
+        if (qstrcmp(category->categoryName(), "default") == 0) {
+            category->setEnabled(QtDebugMsg, false);
+        }
+    }
+};
+
+/**
+ * Measures a text round (sending a text and receiving acks from all the
+ * peers) for many Chat::Engine-s exchanging datagrams via LoopbackHub in
+ * this process, thus, the cost of the protocol itself, without network.
+ */
+class ChatEngineBenchmark : public QObject
+{
+    Q_OBJECT
+private slots:
+    void benchmarkTextRound_data()
+    {
+        QTest::addColumn<int>("peerCount");
+        QTest::addColumn<int>("fanOutCostNs");
+
+        QTest::newRow("10 peers") << 10 << 0;
+        QTest::newRow("100 peers") << 100 << 0;
+        QTest::newRow("500 peers") << 500 << 0;
+        QTest::newRow("500 peers, 1 us per recipient") << 500 << 1000;
+    }
+
+    void benchmarkTextRound()
+    {
+        QFETCH(int, peerCount);
+        QFETCH(int, fanOutCostNs);
+
+        LoopbackHub::Settings hubSettings;
+        hubSettings.fanOutCostNs = fanOutCostNs;
+        LoopbackHub hub(nullptr, hubSettings);
+
+        // Coalescing would make each round wait for the timer.
+        Chat::Engine::Settings engineSettings;
+        engineSettings.controlCoalescingPeriodMs = 0;
+
+        QList<LoopbackTransport *> transports;
+        QList<Chat::Engine *> engines;
+        for (int i = 0; i < peerCount; ++i) {
+            transports.append(new LoopbackTransport(nullptr, &hub));
+            engines.append(new Chat::Engine(nullptr, engineSettings,
+                "peer" + QString::number(i), transports.last()));
+        }
+
+        QSignalSpy textSent(engines.first(), SIGNAL(textSent(QStringList)));
+        LoopbackHub::Stats before;
+        int rounds = 0;
+        {
+            DebugOutputSuppressor suppressor;
+
+            // Advertising makes each peer a contact of all others.
+            foreach (Chat::Engine *engine, engines) {
+                engine->start();
+            }
+            hub.deliverPending();
+
+            before = hub.getStats();
+            QBENCHMARK {
+                engines.first()->sendText("Hello");
+                hub.deliverPending();
+                ++rounds;
+
+                QCOMPARE(textSent.size(), rounds);
+                QVERIFY(textSent.last().first().toStringList().isEmpty());
+            }
+        }
+
+        const LoopbackHub::Stats after = hub.getStats();
+        qDebug() << peerCount << "peers"
+            << "| datagrams sent/round:"
+            << double(after.datagramsSent - before.datagramsSent) / rounds
+            << "| delivered/round:" << double(
+                after.datagramsDelivered - before.datagramsDelivered) / rounds
+            << "| filtered/round:" << double(
+                after.datagramsFiltered - before.datagramsFiltered) / rounds;
+
+        qDeleteAll(engines);
+        qDeleteAll(transports);
+    }
+
+    void benchmarkReceiveLoad_data()
+    {
+        QTest::addColumn<int>("peerCount");
+        QTest::addColumn<bool>("unicastAcks");
+
+        foreach (int peerCount, QList<int>() << 10 << 100 << 500) {
+            const QByteArray name = QByteArray::number(peerCount) + " peers";
+            QTest::newRow((name + ", multicast acks").constData())
+                << peerCount << false;
+            QTest::newRow((name + ", unicast acks").constData())
+                << peerCount << true;
+        }
+    }
+
+    /**
+     * Datagrams reaching each host per text, whether handled or dropped by
+     * the addressed filter (which, on a real network, still costs the NIC
+     * and the kernel of the host).
+     */
+    void benchmarkReceiveLoad()
+    {
+        QFETCH(int, peerCount);
+        QFETCH(bool, unicastAcks);
+
+        LoopbackHub hub(nullptr, LoopbackHub::defaultSettings);
+
+        Chat::Engine::Settings engineSettings;
+        engineSettings.controlCoalescingPeriodMs = 0;
+        engineSettings.unicastAcks = unicastAcks;
+
+        QList<LoopbackTransport *> transports;
+        QList<Chat::Engine *> engines;
+        for (int i = 0; i < peerCount; ++i) {
+            transports.append(new LoopbackTransport(nullptr, &hub));
+            engines.append(new Chat::Engine(nullptr, engineSettings,
+                "peer" + QString::number(i), transports.last()));
+        }
+
+        LoopbackHub::Stats before;
+        int rounds = 0;
+        {
+            DebugOutputSuppressor suppressor;
+
+            foreach (Chat::Engine *engine, engines) {
+                engine->start();
+            }
+            hub.deliverPending();
+
+            before = hub.getStats();
+
+            // Each peer in turn sends a text, thus, all the hosts are
+            // loaded alike.
+            QBENCHMARK {
+                engines.at(rounds % peerCount)->sendText("Hello");
+                hub.deliverPending();
+                ++rounds;
+            }
+        }
+
+        const LoopbackHub::Stats after = hub.getStats();
+        const double received = double(
+            after.datagramsDelivered - before.datagramsDelivered
+            + after.datagramsFiltered - before.datagramsFiltered);
+        qDebug() << peerCount << "peers"
+            << (unicastAcks ? "| unicast acks" : "| multicast acks")
+            << "| datagrams received per host per text:"
+            << received / rounds / peerCount;
+
+        qDeleteAll(engines);
+        qDeleteAll(transports);
+    }
+};
+
+#endif // CHATENGINEBENCHMARK_H
@@ -0,0 +1,209 @@
+#ifndef CHATENGINETEST_H
+#define CHATENGINETEST_H
+
+#include <QtTest>
+
+#include "ChatEngine.h"
+#include "ChatMessages.h"
+#include "TextCompressor.h"
+#include "LoopbackHub.h"
+
+/**
+ * Counts the unicast datagrams, and loses them while unreachable.
+ */
+class UnicastLosingTransport : public LoopbackTransport
+{
+public:
+    bool unreachable = true;
+    int unicastCount = 0;
+
+    explicit UnicastLosingTransport(LoopbackHub *hub)
+        : LoopbackTransport(nullptr, hub)
+    {}
+
+    virtual void sendDatagramTo(const QByteArray &datagram,
+        const SenderAddress &recipient, int channel = cDefaultChannel)
+        throw (NetworkEx) override
+    {
+        ++unicastCount;
+        if (!unreachable) {
+            LoopbackTransport::sendDatagramTo(datagram, recipient, channel);
+        }
+    }
+};
+
+/**
+ * Chat::Engine-s exchanging datagrams via LoopbackHub, whose addressed
+ * filter drops the same datagrams as the socket filter of Multicaster.
+ */
+class ChatEngineTest : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testForeignAcksFiltered_data()
+    {
+        QTest::addColumn<bool>("binaryMessages");
+
+        QTest::newRow("text form") << false;
+        QTest::newRow("binary form") << true;
+    }
+
+    void testForeignAcksFiltered()
+    {
+        QFETCH(bool, binaryMessages);
+
+        LoopbackHub hub(nullptr, LoopbackHub::defaultSettings);
+        LoopbackTransport transportA(nullptr, &hub);
+        LoopbackTransport transportB(nullptr, &hub);
+        LoopbackTransport transportC(nullptr, &hub);
+
+        // Acks are multicast, while control messages are coalesced.
+        Chat::Engine::Settings settings;
+        settings.unicastAcks = false;
+        settings.binaryMessages = binaryMessages;
+        QVERIFY(settings.controlCoalescingPeriodMs > 0);
+
+        Chat::Engine a(nullptr, settings, "a", &transportA);
+        Chat::Engine b(nullptr, settings, "b", &transportB);
+        Chat::Engine c(nullptr, settings, "c", &transportC);
+        a.start();
+        b.start();
+        c.start();
+        hub.deliverPending();
+        const LoopbackHub::Stats before = hub.getStats();
+
+        a.sendText("Hello");
+        hub.deliverPending();
+
+        // The ack of each of b and c reaches a, and is dropped at the other.
+        const LoopbackHub::Stats after = hub.getStats();
+        QCOMPARE(int(after.datagramsSent - before.datagramsSent), 3);
+        QCOMPARE(int(after.datagramsFiltered - before.datagramsFiltered), 2);
+    }
+
+    void testUnicastAcksCoalesced()
+    {
+        LoopbackHub hub(nullptr, LoopbackHub::defaultSettings);
+        LoopbackTransport transportA(nullptr, &hub);
+        LoopbackTransport transportB(nullptr, &hub);
+
+        Chat::Engine::Settings settings;
+        QVERIFY(settings.unicastAcks);
+        QVERIFY(settings.controlCoalescingPeriodMs > 0);
+
+        Chat::Engine a(nullptr, settings, "a", &transportA);
+        Chat::Engine b(nullptr, settings, "b", &transportB);
+        a.start();
+        b.start();
+
+        // The advertising, to make b a contact of a.
+        QTRY_COMPARE(int(hub.getStats().datagramsSent), 2);
+        hub.deliverPending();
+        const LoopbackHub::Stats before = hub.getStats();
+
+        // Three fragments; b acks each to a.
+        QSignalSpy textSent(&a, SIGNAL(textSent(QStringList)));
+        a.sendText(QString(3000, 'x'));
+        QTRY_COMPARE(textSent.size(), 1);
+        QVERIFY(textSent.first().first().toStringList().isEmpty());
+
+        // The fragment acks are coalesced into one.
+        const LoopbackHub::Stats after = hub.getStats();
+        QCOMPARE(int(after.datagramsSent - before.datagramsSent), 4);
+    }
+
+    void testUnicastAcksRetried()
+    {
+        LoopbackHub hub(nullptr, LoopbackHub::defaultSettings);
+        LoopbackTransport transportA(nullptr, &hub);
+        UnicastLosingTransport transportB(&hub);
+
+        Chat::Engine::Settings settings;
+        settings.textAttemptPeriodMs = 100;
+        settings.unicastRetryPeriodMs = 500;
+        QVERIFY(settings.unicastAcks);
+
+        Chat::Engine a(nullptr, settings, "a", &transportA);
+        Chat::Engine b(nullptr, settings, "b", &transportB);
+        a.start();
+        b.start();
+        QTRY_COMPARE(int(hub.getStats().datagramsSent), 2);
+        hub.deliverPending();
+
+        // The unicast ack is lost; the resent text is acked to all.
+        QSignalSpy textSent(&a, SIGNAL(textSent(QStringList)));
+        a.sendText("first");
+        QTRY_COMPARE(textSent.size(), 1);
+        QVERIFY(textSent.last().first().toStringList().isEmpty());
+        QCOMPARE(transportB.unicastCount, 1);
+
+        // So is the next text, until the retry period is over.
+        transportB.unreachable = false;
+        a.sendText("second");
+        QTRY_COMPARE(textSent.size(), 2);
+        QCOMPARE(transportB.unicastCount, 1);
+
+        QTest::qWait(settings.unicastRetryPeriodMs + 100);
+        a.sendText("third");
+        QTRY_COMPARE(textSent.size(), 3);
+        QVERIFY(textSent.last().first().toStringList().isEmpty());
+        QCOMPARE(transportB.unicastCount, 2);
+    }
+
+    void testMulticastFragmentAcksCoalesced()
+    {
+        LoopbackHub hub(nullptr, LoopbackHub::defaultSettings);
+        LoopbackTransport transportA(nullptr, &hub);
+        LoopbackTransport transportB(nullptr, &hub);
+
+        Chat::Engine::Settings settings;
+        settings.unicastAcks = false;
+        QVERIFY(settings.controlCoalescingPeriodMs > 0);
+
+        Chat::Engine a(nullptr, settings, "a", &transportA);
+        Chat::Engine b(nullptr, settings, "b", &transportB);
+        a.start();
+        b.start();
+        QTRY_COMPARE(int(hub.getStats().datagramsSent), 2);
+        hub.deliverPending();
+        const LoopbackHub::Stats before = hub.getStats();
+
+        QSignalSpy textSent(&a, SIGNAL(textSent(QStringList)));
+        a.sendText(QString(3000, 'x'));
+        QTRY_COMPARE(textSent.size(), 1);
+        QVERIFY(textSent.first().first().toStringList().isEmpty());
+
+        // Three fragments, and a single ack covering them.
+        const LoopbackHub::Stats after = hub.getStats();
+        QCOMPARE(int(after.datagramsSent - before.datagramsSent), 4);
+    }
+
+    void testUnsupportedDictionaryCounted()
+    {
+        LoopbackHub hub(nullptr, LoopbackHub::defaultSettings);
+        LoopbackTransport transportA(nullptr, &hub);
+        LoopbackTransport transportB(nullptr, &hub);
+
+        Chat::Engine b(nullptr, Chat::Engine::defaultSettings, "b",
+            &transportB);
+        b.start();
+        hub.deliverPending();
+
+        // As sent by an App of the next dictionary version: magic, version,
+        // type, nick "a", text id, dictionary version.
+        QByteArray datagram = Chat::TextMessage("a", 1,
+            "See https://jira.example.com/browse/TICKET-1234")
+            .toCompressedBinary();
+        QCOMPARE(int(datagram.at(2)), 6);
+        QCOMPARE(int(datagram.at(6)), TextCompressor::cDictionaryVersion);
+        datagram[6] = char(TextCompressor::cDictionaryVersion + 1);
+
+        QSignalSpy textReceived(&b, SIGNAL(textReceived(QString,QString)));
+        transportA.sendDatagram(datagram);
+        hub.deliverPending();
+        QCOMPARE(int(b.getUnsupportedDictionaryTexts()), 1);
+        QCOMPARE(textReceived.size(), 0);
+    }
+};
+
+#endif // CHATENGINETEST_H
@@ -1,192 +1,1054 @@
 #include "ChatMessages.h"
 
+#include <string.h>
+#include <limits>
+
+#include "FieldScanner.h"
+#include "TextCompressor.h"
+#include "MessageSchema.h"
+
 using namespace Chat;
 
-const Message::Type UserMessage::cType("user");
-const Message::Type LeaveMessage::cType("leave");
-const Message::Type TextMessage::cType("text");
-const Message::Type AckMessage::cType("ack");
+static const char cBatchHeader[] = "batch|";
+static const int cBatchHeaderSize = sizeof(cBatchHeader) - 1;
+
+static const char cBinaryBatchType = 5;
+
+const char *Chat::describeParseStatus(ParseStatus status)
+{
+    switch (status) {
+        case ParseOk:
+            return "OK.";
+        case ParseUnknownType:
+            return "Unknown message type.";
+        case ParseMissingField:
+            return "Too few fields.";
+        case ParseEmptyField:
+            return "A field which should not be empty is empty.";
+        case ParseTrailingData:
+            return "Unexpected data found after the last field.";
+        case ParseBadTextId:
+            return "Text Id is not a valid int64.";
+        case ParseBadBinaryHeader:
+            return "Binary header is truncated or of unsupported version.";
+        case ParseTruncated:
+            return "Binary message is truncated.";
+        case ParseBadVarint:
+            return "Varint is longer than 64 bits.";
+        case ParseBadUtf8:
+            return "A field is not valid UTF-8.";
+        case ParseUnsupportedDictionary:
+            return "Text is compressed with an unsupported dictionary.";
+        case ParseBadCompression:
+            return "Compressed text is malformed.";
+        case ParseBadFragment:
+            return "Fragment numbers are out of range.";
+    }
+    return "Unknown parse status.";
+}
 
 ///////////////////////////////////////////////////////////////////////////
-// Parsing utils.
+// Parsing utils. They parse in place and do not allocate memory.
 
-static qint64 parseTextId(const QStringRef &s)
-    throw (ParseEx)
+/**
+ * Decimal, optionally negative, without leading '+' or spaces.
+ */
+static ParseStatus parseTextId(const Utf8View &field, qint64 *pTextId)
 {
-    bool success = false;
-    qint64 result = s.toLongLong(&success);
-    if (!success) {
-        throw ParseEx("\"" + s.toString() + "\" " +
-            "is not a valid Text Id, int64 expected.");
+    const char *pos = field.data;
+    const char *const end = field.data + field.size;
+    const bool negative = pos != end && *pos == '-';
+    if (negative) {
+        ++pos;
+    }
+    if (pos == end) {
+        return ParseBadTextId;
     }
 
-    return result;
+    // Accumulated as negative, to reach the min value.
+    const qint64 min = std::numeric_limits<qint64>::min();
+    qint64 result = 0;
+    for (; pos != end; ++pos) {
+        if (*pos < '0' || *pos > '9') {
+            return ParseBadTextId;
+        }
+        const int digit = *pos - '0';
+        if (result < (min + digit) / 10) {
+            return ParseBadTextId;
+        }
+        result = result * 10 - digit;
+    }
+
+    if (!negative) {
+        if (result == min) {
+            return ParseBadTextId;
+        }
+        result = -result;
+    }
+    *pTextId = result;
+    return ParseOk;
+}
+
+/**
+ * Checks the fields of a fragment, parsed from either form.
+ */
+static ParseStatus checkFragment(quint64 index, quint64 count)
+{
+    return (count >= 1 && count <= quint64(FragmentMessage::cMaxCount)
+        && index < count) ? ParseOk : ParseBadFragment;
+}
+
+static ParseStatus checkReceivedFragments(quint64 receivedFragments,
+    quint32 *pReceivedFragments)
+{
+    if (receivedFragments == 0
+        || receivedFragments >> FragmentMessage::cMaxCount != 0) {
+
+        return ParseBadFragment;
+    }
+    *pReceivedFragments = quint32(receivedFragments);
+    return ParseOk;
+}
+
+/**
+ * Fragment index, count or mask: decimal, not negative.
+ */
+static ParseStatus parseFragmentNumber(const Utf8View &field,
+    quint64 *pValue)
+{
+    qint64 value = 0;
+    if (parseTextId(field, &value) != ParseOk || value < 0) {
+        return ParseBadFragment;
+    }
+    *pValue = quint64(value);
+    return ParseOk;
 }
 
 /**
  * Parse next (non-last) field of a '|'-separated string. The field value
- * can not be empty, otherwise ParseEx is thrown.
- * @param pRest The string to parse; after parsing, is set to the rest of
+ * can not be empty.
+ * @param pPos The string to parse; after parsing, is set to the rest of
  * the string.
  */
-static QStringRef parseNextField(
-    QStringRef *pRest, const QString &fieldName)
-    throw (ParseEx)
+static ParseStatus parseNextField(const char **pPos, const char *end,
+    Utf8View *pField, const FieldScanner &scanner)
 {
-    int pos = pRest->indexOf('|');
-    if (pos == -1) {
-        throw ParseEx("<" + fieldName + "> should not be the last field.");
+    const char *delimiter = scanner.findDelimiter('|', *pPos, end);
+    if (delimiter == nullptr) {
+        return ParseMissingField;
     }
 
-    QStringRef result = pRest->left(pos);
-    *pRest = pRest->right(pRest->length() - pos - 1);
+    pField->data = *pPos;
+    pField->size = int(delimiter - *pPos);
+    *pPos = delimiter + 1;
+    return pField->isEmpty() ? ParseEmptyField : ParseOk;
+}
 
-    if (result.isEmpty()) {
-        throw ParseEx("<" + fieldName + "> should not be empty.");
+/**
+ * Parse the last field of a '|'-separated string. Thus, the field can not
+ * contain '|' chars. The field value can not be empty.
+ * @param pPos The string to parse; after parsing, is set to its end.
+ */
+static ParseStatus parseLastField(const char **pPos, const char *end,
+    Utf8View *pField, const FieldScanner &scanner)
+{
+    if (scanner.findDelimiter('|', *pPos, end) != nullptr) {
+        return ParseTrailingData;
     }
 
+    pField->data = *pPos;
+    pField->size = int(end - *pPos);
+    *pPos = end;
+    return pField->isEmpty() ? ParseEmptyField : ParseOk;
+}
+///////////////////////////////////////////////////////////////////////////
+// Binary form utils.
+
+static QByteArray binaryHeader(char type)
+{
+    QByteArray result;
+    result.append(cBinaryMagic);
+    result.append(cBinaryVersion);
+    result.append(type);
     return result;
 }
 
+static void appendVarint(QByteArray *pBytes, quint64 value)
+{
+    while (value >= 0x80) {
+        pBytes->append(char((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    pBytes->append(char(value));
+}
+
+static void appendTextId(QByteArray *pBytes, qint64 textId)
+{
+    // Zigzag: small negative ids are short as well.
+    appendVarint(pBytes, (quint64(textId) << 1) ^ quint64(textId >> 63));
+}
+
+static void appendField(QByteArray *pBytes, const QString &value)
+{
+    const QByteArray utf8 = value.toUtf8();
+    appendVarint(pBytes, quint64(utf8.size()));
+    pBytes->append(utf8);
+}
+
 /**
- * Parse the last field of a '|'-separated string. Thus, the field can not
- * contain '|' chars. The field value can not be empty, otherwise ParseEx
- * is thrown.
- * @param pRest The string to parse; after parsing, is set empty.
+ * @param pPos The data to parse; after parsing, is set past the varint.
  */
-static QStringRef parseLastField(
-    QStringRef *pRest, const QString &fieldName)
-    throw (ParseEx)
+static ParseStatus parseVarint(const char **pPos, const char *end,
+    quint64 *pValue)
 {
-    int pos = pRest->indexOf('|');
-    if (pos != -1) {
-        throw ParseEx("Unexpected trailing fields found after <"
-            + fieldName + ">: \"" + pRest->toString() + "\".");
+    quint64 result = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (*pPos == end) {
+            return ParseTruncated;
+        }
+        const uchar byte = uchar(*(*pPos)++);
+        result |= quint64(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            *pValue = result;
+            return ParseOk;
+        }
     }
+    return ParseBadVarint;
+}
 
-    QStringRef result = *pRest;
-    *pRest = QStringRef();
+static ParseStatus parseBinaryTextId(const char **pPos, const char *end,
+    qint64 *pTextId)
+{
+    quint64 zigzag = 0;
+    RETURN_IF_FAILED(parseVarint(pPos, end, &zigzag));
+    *pTextId = qint64(zigzag >> 1) ^ -qint64(zigzag & 1);
+    return ParseOk;
+}
 
-    if (result.isEmpty()) {
-        throw ParseEx("<" + fieldName + "> should not be empty.");
+/**
+ * Parse a size-prefixed field of any bytes.
+ * @param pPos The data to parse; after parsing, is set past the field.
+ */
+static ParseStatus parseBinaryBytes(const char **pPos, const char *end,
+    Utf8View *pField)
+{
+    quint64 size = 0;
+    RETURN_IF_FAILED(parseVarint(pPos, end, &size));
+    if (size > quint64(end - *pPos)) {
+        return ParseTruncated;
     }
 
-    return result;
+    pField->data = *pPos;
+    pField->size = int(size);
+    *pPos += size;
+    return ParseOk;
 }
 
+/**
+ * Parse a size-prefixed string field.
+ * @param pPos The data to parse; after parsing, is set past the field.
+ */
+static ParseStatus parseBinaryField(const char **pPos, const char *end,
+    Utf8View *pField, bool canBeEmpty = false)
+{
+    RETURN_IF_FAILED(parseBinaryBytes(pPos, end, pField));
+    if (pField->isEmpty() && !canBeEmpty) {
+        return ParseEmptyField;
+    }
+    return FieldScanner::isValidUtf8(pField->data, pField->size)
+        ? ParseOk : ParseBadUtf8;
+}
+
+/**
+ * Parse the dictionary version and the compressed text, checking the
+ * latter without decompressing it.
+ */
+static ParseStatus parseCompressedText(const char **pPos, const char *end,
+    Utf8View *pText)
+{
+    quint64 version = 0;
+    RETURN_IF_FAILED(parseVarint(pPos, end, &version));
+    if (version != quint64(TextCompressor::cDictionaryVersion)) {
+        return ParseUnsupportedDictionary;
+    }
+
+    RETURN_IF_FAILED(parseBinaryBytes(pPos, end, pText));
+    return TextCompressor::decompressedSize(pText->data, pText->size) > 0
+        ? ParseOk : ParseBadCompression;
+}
 ///////////////////////////////////////////////////////////////////////////
+// Field codecs; see Field in MessageSchema.h.
+
+/**
+ * Not empty; in the text form, only the last field can contain '|'.
+ */
+struct StringCodec
+{
+    typedef Utf8View Value;
+
+    static ParseStatus parseUtf8(const char **pPos, const char *end,
+        const FieldScanner &scanner, bool isLast, Utf8View *pValue)
+    {
+        return isLast
+            ? parseLastField(pPos, end, pValue, scanner)
+            : parseNextField(pPos, end, pValue, scanner);
+    }
+
+    static ParseStatus parseBinary(const char **pPos, const char *end,
+        Utf8View *pValue)
+    {
+        return parseBinaryField(pPos, end, pValue);
+    }
+
+    static QString decode(const Utf8View &value)
+    {
+        return value.toString();
+    }
+
+    static void appendUtf8(QByteArray *pBytes, const QString &value)
+    {
+        pBytes->append(value.toUtf8());
+    }
+
+    static void appendBinary(QByteArray *pBytes, const QString &value)
+    {
+        appendField(pBytes, value);
+    }
+};
+
+/**
+ * The rest of the message, which can contain '|' and '\n' chars. Should be
+ * the last field.
+ */
+template<bool canBeEmpty>
+struct TailCodec : StringCodec
+{
+    static ParseStatus parseUtf8(const char **pPos, const char *end,
+        const FieldScanner &, bool isLast, Utf8View *pValue)
+    {
+        Q_ASSERT(isLast);
+        pValue->data = *pPos;
+        pValue->size = int(end - *pPos);
+        *pPos = end;
+        return (pValue->isEmpty() && !canBeEmpty) ? ParseEmptyField : ParseOk;
+    }
+
+    static ParseStatus parseBinary(const char **pPos, const char *end,
+        Utf8View *pValue)
+    {
+        return parseBinaryField(pPos, end, pValue, canBeEmpty);
+    }
+};
+
+struct TextIdCodec
+{
+    typedef qint64 Value;
+
+    static ParseStatus parseUtf8(const char **pPos, const char *end,
+        const FieldScanner &scanner, bool isLast, qint64 *pValue)
+    {
+        Utf8View field;
+        RETURN_IF_FAILED(
+            StringCodec::parseUtf8(pPos, end, scanner, isLast, &field));
+        return parseTextId(field, pValue);
+    }
+
+    static ParseStatus parseBinary(const char **pPos, const char *end,
+        qint64 *pValue)
+    {
+        return parseBinaryTextId(pPos, end, pValue);
+    }
+
+    static qint64 decode(qint64 value)
+    {
+        return value;
+    }
+
+    static void appendUtf8(QByteArray *pBytes, qint64 value)
+    {
+        pBytes->append(QByteArray::number(value));
+    }
+
+    static void appendBinary(QByteArray *pBytes, qint64 value)
+    {
+        appendTextId(pBytes, value);
+    }
+};
+
+/**
+ * Fragment index or count; checked against each other by FragmentSchema.
+ */
+struct FragmentNumberCodec
+{
+    typedef int Value;
+
+    static ParseStatus parseUtf8(const char **pPos, const char *end,
+        const FieldScanner &scanner, bool isLast, int *pValue)
+    {
+        Utf8View field;
+        quint64 value = 0;
+        RETURN_IF_FAILED(
+            StringCodec::parseUtf8(pPos, end, scanner, isLast, &field));
+        RETURN_IF_FAILED(parseFragmentNumber(field, &value));
+        return check(value, pValue);
+    }
+
+    static ParseStatus parseBinary(const char **pPos, const char *end,
+        int *pValue)
+    {
+        quint64 value = 0;
+        RETURN_IF_FAILED(parseVarint(pPos, end, &value));
+        return check(value, pValue);
+    }
+
+    static int decode(int value)
+    {
+        return value;
+    }
+
+    static void appendUtf8(QByteArray *pBytes, int value)
+    {
+        pBytes->append(QByteArray::number(value));
+    }
+
+    static void appendBinary(QByteArray *pBytes, int value)
+    {
+        appendVarint(pBytes, quint64(value));
+    }
+
+private:
+    static ParseStatus check(quint64 value, int *pValue)
+    {
+        if (value > quint64(FragmentMessage::cMaxCount)) {
+            return ParseBadFragment;
+        }
+        *pValue = int(value);
+        return ParseOk;
+    }
+};
+
+/**
+ * Bit i is set if fragment i has been received.
+ */
+struct FragmentMaskCodec
+{
+    typedef quint32 Value;
+
+    static ParseStatus parseUtf8(const char **pPos, const char *end,
+        const FieldScanner &scanner, bool isLast, quint32 *pValue)
+    {
+        Utf8View field;
+        quint64 value = 0;
+        RETURN_IF_FAILED(
+            StringCodec::parseUtf8(pPos, end, scanner, isLast, &field));
+        RETURN_IF_FAILED(parseFragmentNumber(field, &value));
+        return checkReceivedFragments(value, pValue);
+    }
+
+    static ParseStatus parseBinary(const char **pPos, const char *end,
+        quint32 *pValue)
+    {
+        quint64 value = 0;
+        RETURN_IF_FAILED(parseVarint(pPos, end, &value));
+        return checkReceivedFragments(value, pValue);
+    }
+
+    static quint32 decode(quint32 value)
+    {
+        return value;
+    }
+
+    static void appendUtf8(QByteArray *pBytes, quint32 value)
+    {
+        pBytes->append(QByteArray::number(value));
+    }
+
+    static void appendBinary(QByteArray *pBytes, quint32 value)
+    {
+        appendVarint(pBytes, value);
+    }
+};
+
+/**
+ * Binary form only: the dictionary version, followed by the compressed
+ * text as a field of any bytes.
+ */
+struct CompressedTextCodec
+{
+    typedef Utf8View Value;
+
+    static ParseStatus parseBinary(const char **pPos, const char *end,
+        Utf8View *pValue)
+    {
+        return parseCompressedText(pPos, end, pValue);
+    }
+
+    static QString decode(const Utf8View &value)
+    {
+        return QString::fromUtf8(
+            TextCompressor::decompress(value.data, value.size));
+    }
+
+    static void appendBinary(QByteArray *pBytes, const QByteArray &compressed)
+    {
+        appendVarint(pBytes, quint64(TextCompressor::cDictionaryVersion));
+        appendVarint(pBytes, quint64(compressed.size()));
+        pBytes->append(compressed);
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Message schemas.
+//
+// Adding a message type:
+// - Declare the Message subclass and its view in ChatMessages.h, add the
+//   view to MessageViewTypes, and the handle method to Message::Handler.
+// - Declare the schema of the type below, and add it to Schemas at the
+//   index of its view.
+// - Implement toUtf8() and toBinary() of the message via the schema.
+// The parsers of both forms, the type lookup and createFromView() are
+// generated from the schemas; the conflicts (e.g. of the binary types)
+// are reported at compile time.
 
 // user|<sender.nick>
+struct UserSchema : MessageSchema<UserSchema, UserMessage, UserMessageView,
+    Field<UserMessageView, StringCodec, &UserMessageView::senderNick>>
+{
+    static constexpr const char *name()
+    {
+        return "user";
+    }
+
+    static const char cBinaryType = 1;
+};
+
+// leave|<sender.nick>
+struct LeaveSchema : MessageSchema<LeaveSchema, LeaveMessage, LeaveMessageView,
+    Field<LeaveMessageView, StringCodec, &LeaveMessageView::senderNick>>
+{
+    static constexpr const char *name()
+    {
+        return "leave";
+    }
+
+    static const char cBinaryType = 2;
+};
+
+/**
+ * The text of a "text" view, which can be compressed (see
+ * CompressedTextSchema).
+ */
+struct TextBodyField
+    : Field<TextMessageView, TailCodec<true>, &TextMessageView::text>
+{
+    static QString decode(const TextMessageView &view)
+    {
+        return view.decodeText();
+    }
+};
+
+// text|<sender.nick>|<text.id>|<text>
+struct TextSchema : MessageSchema<TextSchema, TextMessage, TextMessageView,
+    Field<TextMessageView, StringCodec, &TextMessageView::senderNick>,
+    Field<TextMessageView, TextIdCodec, &TextMessageView::textId>,
+    TextBodyField>
+{
+    static constexpr const char *name()
+    {
+        return "text";
+    }
+
+    static const char cBinaryType = 3;
+};
+
+// ack|<text.sender.id>|<text.id>
+struct AckSchema : MessageSchema<AckSchema, AckMessage, AckMessageView,
+    Field<AckMessageView, StringCodec, &AckMessageView::textSenderId>,
+    Field<AckMessageView, TextIdCodec, &AckMessageView::textId>>
+{
+    static constexpr const char *name()
+    {
+        return "ack";
+    }
+
+    static const char cBinaryType = 4;
+};
+
+// frag|<sender.nick>|<text.id>|<fragment.index>|<fragment.count>|<fragment>
+struct FragmentSchema : MessageSchema<FragmentSchema, FragmentMessage,
+    FragmentMessageView,
+    Field<FragmentMessageView, StringCodec, &FragmentMessageView::senderNick>,
+    Field<FragmentMessageView, TextIdCodec, &FragmentMessageView::textId>,
+    Field<FragmentMessageView, FragmentNumberCodec,
+        &FragmentMessageView::index>,
+    Field<FragmentMessageView, FragmentNumberCodec,
+        &FragmentMessageView::count>,
+    Field<FragmentMessageView, TailCodec<false>,
+        &FragmentMessageView::fragment>>
+{
+    static constexpr const char *name()
+    {
+        return "frag";
+    }
+
+    static const char cBinaryType = 7;
+
+    static ParseStatus finishParsing(FragmentMessageView *pView)
+    {
+        return checkFragment(pView->index, pView->count);
+    }
+};
+
+// fragack|<text.sender.id>|<text.id>|<fragments.received>
+struct FragmentAckSchema : MessageSchema<FragmentAckSchema, FragmentAckMessage,
+    FragmentAckMessageView,
+    Field<FragmentAckMessageView, StringCodec,
+        &FragmentAckMessageView::textSenderId>,
+    Field<FragmentAckMessageView, TextIdCodec,
+        &FragmentAckMessageView::textId>,
+    Field<FragmentAckMessageView, FragmentMaskCodec,
+        &FragmentAckMessageView::receivedFragments>>
+{
+    static constexpr const char *name()
+    {
+        return "fragack";
+    }
+
+    static const char cBinaryType = 8;
+};
+
+/**
+ * Binary form only: a "text" with the compressed text; the fields of the
+ * message are the ones of TextSchema.
+ */
+struct CompressedTextSchema : MessageSchema<CompressedTextSchema, TextMessage,
+    TextMessageView,
+    Field<TextMessageView, StringCodec, &TextMessageView::senderNick>,
+    Field<TextMessageView, TextIdCodec, &TextMessageView::textId>,
+    Field<TextMessageView, CompressedTextCodec, &TextMessageView::text>>
+{
+    static const char cBinaryType = 6;
+
+    static ParseStatus finishParsing(TextMessageView *pView)
+    {
+        pView->isTextCompressed = true;
+        return ParseOk;
+    }
+};
+
+// In the order of MessageViewTypes.
+typedef TypeList<UserSchema, LeaveSchema, TextSchema, AckSchema,
+    FragmentSchema, FragmentAckSchema> Schemas;
+
+static_assert(SchemasMatchViews<Schemas, MessageViewTypes>::value,
+    "Schemas should be in the order of MessageViewTypes.");
+
+typedef TypeList<UserSchema, LeaveSchema, TextSchema, AckSchema,
+    FragmentSchema, FragmentAckSchema, CompressedTextSchema> BinarySchemas;
+
+typedef BinaryTypes<BinarySchemas> BinarySchemaTypes;
+
+static const int cMaxBinaryType = 15;
+
+static_assert(BinarySchemaTypes::areUnique()
+    && BinarySchemaTypes::isMissing(cBinaryBatchType)
+    && BinarySchemaTypes::maxType() <= cMaxBinaryType,
+    "Binary types should be unique, and within the parser table.");
+
+// The text form type lookup table has twice as many slots as the types at
+// least, thus, a perfect seed is found after a few attempts.
+static const int cTypeHashBits = 4;
+
+static_assert(Schemas::cSize * 2 <= 1 << cTypeHashBits,
+    "Too few bits of the type hash.");
+
+typedef TypeNameHash<Schemas, cTypeHashBits> TypeHash;
+
+static constexpr quint32 cTypeHashSeed = TypeHash::findSeed();
+
+const Message::Type UserMessage::cType(UserSchema::name());
+const Message::Type LeaveMessage::cType(LeaveSchema::name());
+const Message::Type TextMessage::cType(TextSchema::name());
+const Message::Type AckMessage::cType(AckSchema::name());
+const Message::Type FragmentMessage::cType(FragmentSchema::name());
+const Message::Type FragmentAckMessage::cType(FragmentAckSchema::name());
+
+///////////////////////////////////////////////////////////////////////////
 
 QByteArray UserMessage::toUtf8() const
 {
-    return QByteArray(type) + "|" + senderNick.toUtf8();
+    return UserSchema::toUtf8(senderNick);
 }
 
-static UserMessage *createUserMessageFromString(
-    const QStringRef &body, const QString &senderId)
-    throw (ParseEx)
+QByteArray UserMessage::toBinary() const
 {
-    QStringRef rest = body;
-    QStringRef senderNick = parseLastField(&rest, "sender.nick");
+    return UserSchema::toBinary(senderNick);
+}
 
-    return new UserMessage(senderNick.toString(), senderId);
+QByteArray LeaveMessage::toUtf8() const
+{
+    return LeaveSchema::toUtf8(senderNick);
 }
 
-// leave|<sender.nick>
+QByteArray LeaveMessage::toBinary() const
+{
+    return LeaveSchema::toBinary(senderNick);
+}
 
-QByteArray LeaveMessage::toUtf8() const
+QByteArray TextMessage::toUtf8() const
 {
-    return QByteArray(cType) + "|" + senderNick.toUtf8();
+    return TextSchema::toUtf8(senderNick, textId, text);
 }
 
-static LeaveMessage *createLeaveMessageFromString(
-    const QStringRef &body, const QString &senderId)
-    throw (ParseEx)
+QByteArray TextMessage::toBinary() const
 {
-    QStringRef rest = body;
-    QStringRef senderNick = parseLastField(&rest, "sender.nick");
+    return TextSchema::toBinary(senderNick, textId, text);
+}
 
-    return new LeaveMessage(senderNick.toString(), senderId);
+QByteArray TextMessage::toCompressedBinary() const
+{
+    const QByteArray compressed = TextCompressor::compress(text.toUtf8());
+    if (compressed.isEmpty()) {
+        return toBinary();
+    }
+
+    const QByteArray result =
+        CompressedTextSchema::toBinary(senderNick, textId, compressed);
+
+    // The version byte can outweigh the saving.
+    const QByteArray uncompressed = toBinary();
+    return result.size() < uncompressed.size() ? result : uncompressed;
 }
 
-// text|<sender.nick>|<text.id>|<text>
+QString TextMessageView::decodeText() const
+{
+    if (!isTextCompressed) {
+        return text.toString();
+    }
+    return CompressedTextCodec::decode(text);
+}
 
-QByteArray TextMessage::toUtf8() const
+QByteArray AckMessage::toUtf8() const
 {
-    return QByteArray(cType) + "|" + senderNick.toUtf8() + "|"
-        + QByteArray::number(textId) + "|" + text.toUtf8();
+    return AckSchema::toUtf8(textSenderId, textId);
 }
 
-static TextMessage *createTextMessageFromString(
-    const QStringRef &body, const QString &senderId)
-    throw (ParseEx)
+QByteArray AckMessage::toBinary() const
 {
-    QStringRef rest = body;
-    QStringRef senderNick = parseNextField(&rest, "sender.nick");
-    QStringRef textId = parseNextField(&rest, "text.id");
+    return AckSchema::toBinary(textSenderId, textId);
+}
 
-    return new TextMessage(senderNick.toString(), parseTextId(textId),
-        rest.toString(), senderId);
+QByteArray FragmentMessage::toUtf8() const
+{
+    return FragmentSchema::toUtf8(senderNick, textId, index, count, fragment);
 }
 
-// ack|<text.sender.id>|<text.id>
+QByteArray FragmentMessage::toBinary() const
+{
+    return FragmentSchema::toBinary(
+        senderNick, textId, index, count, fragment);
+}
 
-QByteArray AckMessage::toUtf8() const
+QByteArray FragmentAckMessage::toUtf8() const
 {
-    return QByteArray(cType) + "|" + textSenderId.toUtf8() + "|"
-        + QByteArray::number(textId);
+    return FragmentAckSchema::toUtf8(
+        textSenderId, textId, receivedFragments);
 }
 
-AckMessage *createAckMessageFromString(
-    const QStringRef &body, const QString &senderId)
-    throw (ParseEx)
+QByteArray FragmentAckMessage::toBinary() const
+{
+    return FragmentAckSchema::toBinary(
+        textSenderId, textId, receivedFragments);
+}
+
+QByteArray AckMessage::addressedPrefix(bool binary)
 {
-    QStringRef rest = body;
-    QStringRef textSenderId = parseNextField(&rest, "text.sender.id");
-    QStringRef textId = parseLastField(&rest, "text.id");
+    if (binary) {
+        return binaryHeader(AckSchema::cBinaryType);
+    }
+    return QByteArray(cType) + "|";
+}
 
-    return new AckMessage(textSenderId.toString(), parseTextId(textId),
-        senderId);
+QByteArray AckMessage::addresseeField(const QString &textSenderId,
+    bool binary)
+{
+    if (binary) {
+        QByteArray result;
+        appendField(&result, textSenderId);
+        return result;
+    }
+    return textSenderId.toUtf8() + "|";
 }
 
 ///////////////////////////////////////////////////////////////////////////
 
+typedef ParseStatus (*Utf8Parser)(const char *pos, const char *end,
+    const FieldScanner &scanner, MessageView *pView);
+
+typedef ParseStatus (*BinaryParser)(const char *pos, const char *end,
+    MessageView *pView);
+
+struct TypeSlot
+{
+    const char *name = nullptr;
+    int nameSize = 0;
+    Utf8Parser parse = nullptr;
+};
+
 /**
- * ATTENTION: All message types should be registered in this function.
+ * Lookup tables of the parsers, generated from the schemas.
  */
-static Message *createMessageByType(
-    const QStringRef &messageType, const QStringRef &body,
-    const QString &senderId)
-    throw (ParseEx)
+struct ParserTables
 {
-    if (messageType == UserMessage::cType) {
-        return createUserMessageFromString(body, senderId);
-    } else if (messageType == LeaveMessage::cType) {
-        return createLeaveMessageFromString(body, senderId);
-    } else if (messageType == TextMessage::cType) {
-        return createTextMessageFromString(body, senderId);
-    } else if (messageType == AckMessage::cType) {
-        return createAckMessageFromString(body, senderId);
-    } else {
-        throw ParseEx("Unknown message type \"" +
-            messageType.toString() + "\".");
+    // Indexed by the type hash; the slots without types are empty.
+    TypeSlot typeSlots[1 << cTypeHashBits];
+
+    // Indexed by the binary type; null for unknown types.
+    BinaryParser binaryParsers[cMaxBinaryType + 1] = {};
+
+    ParserTables()
+    {
+        TypeHash::fill(cTypeHashSeed, typeSlots);
+        BinarySchemaTypes::fill(binaryParsers);
     }
+};
+
+static const ParserTables &parserTables()
+{
+    static const ParserTables tables;
+    return tables;
+}
+
+/**
+ * @param scanner Of the payload containing the message.
+ */
+static ParseStatus parseUtf8Message(const char *utf8, int size,
+    const FieldScanner &scanner, MessageView *pView)
+{
+    const char *pos = utf8;
+    const char *const end = utf8 + size;
+    if (!scanner.isValidUtf8Range(pos, end)) {
+        return ParseBadUtf8;
+    }
+
+    Utf8View type;
+    RETURN_IF_FAILED(parseNextField(&pos, end, &type, scanner));
+
+    // The hash is perfect for the known types, thus, a single comparison
+    // tells whether the type is known.
+    const TypeSlot &slot = parserTables().typeSlots[typeNameHash(
+        cTypeHashSeed, cTypeHashBits, type.data, type.size)];
+    if (slot.nameSize != type.size
+        || memcmp(slot.name, type.data, type.size) != 0) {
+
+        return ParseUnknownType;
+    }
+    return slot.parse(pos, end, scanner, pView);
+}
+
+/**
+ * @param body Starts with the type byte.
+ */
+static ParseStatus parseBinaryBody(const char *body, int size,
+    MessageView *pView)
+{
+    const int type = uchar(body[0]);
+    const BinaryParser parse = type <= cMaxBinaryType
+        ? parserTables().binaryParsers[type] : nullptr;
+    if (parse == nullptr) {
+        return ParseUnknownType;
+    }
+    return parse(body + 1, body + size, pView);
+}
+
+static ParseStatus parseBinaryMessage(const char *data, int size,
+    MessageView *pView)
+{
+    if (!Message::isBinary(data, size) || size < cBinaryHeaderSize
+        || data[1] != cBinaryVersion) {
+
+        return ParseBadBinaryHeader;
+    }
+    return parseBinaryBody(
+        data + cBinaryPrefixSize, size - cBinaryPrefixSize, pView);
+}
+
+ParseStatus Message::parse(const char *data, int size, MessageView *pView)
+{
+    if (isBinary(data, size)) {
+        return parseBinaryMessage(data, size, pView);
+    }
+    return parseUtf8Message(data, size, FieldScanner(data, size), pView);
+}
+
+Message::Type MessageView::getType() const
+{
+    return SchemaAt<Schemas>::getType(typeIndex);
+}
+
+Message *Message::createFromView(
+    const MessageView &view, const QString &senderId)
+{
+    return SchemaAt<Schemas>::create(view.getTypeIndex(), view, senderId);
 }
 
 Message *Message::createFromUtf8(
     const QByteArray &utf8, const QString &senderId)
     throw (ParseEx)
 {
-    QString s(utf8);
-    QStringRef body(&s);
-    QStringRef messageType = parseNextField(&body, "message.type");
+    return createFromUtf8(utf8.constData(), utf8.size(), senderId);
+}
 
-    try {
-        return createMessageByType(messageType, body, senderId);
-    } catch (ParseEx &e) {
+Message *Message::createFromUtf8(
+    const char *utf8, int size, const QString &senderId)
+    throw (ParseEx)
+{
+    MessageView view;
+    const ParseStatus status = parseUtf8Message(
+        utf8, size, FieldScanner(utf8, size), &view);
+    if (status != ParseOk) {
         throw ParseEx("Unable to parse message: "
-            + QString(e.what()) + " Message text:\n"
-            + utf8);
+            + QString(describeParseStatus(status)) + " Message text:\n"
+            + QString::fromUtf8(utf8, size));
+    }
+    return createFromView(view, senderId);
+}
+
+Message *Message::createFromBinary(
+    const char *data, int size, const QString &senderId)
+    throw (ParseEx)
+{
+    MessageView view;
+    const ParseStatus status = parseBinaryMessage(data, size, &view);
+    if (status != ParseOk) {
+        throw ParseEx("Unable to parse binary message: "
+            + QString(describeParseStatus(status)) + " Message bytes (hex): "
+            + QString::fromLatin1(QByteArray(data, size).toHex()));
     }
+    return createFromView(view, senderId);
+}
+
+bool Message::isBinary(const char *data, int size)
+{
+    return size > 0 && data[0] == cBinaryMagic;
+}
+
+///////////////////////////////////////////////////////////////////////////
+
+Message::Reader::Reader(const char *data, int size)
+    : pos(data), end(data + size), isBinary(Message::isBinary(data, size)),
+        isBatch(isBinary
+            ? size > cBinaryHeaderSize && data[1] == cBinaryVersion
+                && data[2] == cBinaryBatchType
+            : size > cBatchHeaderSize
+                && memcmp(data, cBatchHeader, cBatchHeaderSize) == 0),
+        scanner(data, isBinary ? 0 : size)
+{
+    if (isBatch) {
+        pos += isBinary ? cBinaryHeaderSize : cBatchHeaderSize;
+    }
+}
+
+ParseStatus Message::Reader::next(MessageView *pView)
+{
+    message.data = pos;
+    message.size = int(end - pos);
+
+    if (!isBatch) {
+        pos = nullptr;
+        if (isBinary) {
+            return parseBinaryMessage(message.data, message.size, pView);
+        }
+        return parseUtf8Message(
+            message.data, message.size, scanner, pView);
+    }
+
+    if (isBinary) {
+        // The size of a malformed message is unknown: skip the rest.
+        pos = nullptr;
+        quint64 size = 0;
+        const char *body = message.data;
+        RETURN_IF_FAILED(parseVarint(&body, end, &size));
+        if (size == 0 || size > quint64(end - body)) {
+            return ParseTruncated;
+        }
+        message.data = body;
+        message.size = int(size);
+        if (body + size != end) {
+            pos = body + size;
+        }
+        return parseBinaryBody(message.data, message.size, pView);
+    }
+
+    const char *newLine = scanner.findDelimiter('\n', pos, end);
+    if (newLine != nullptr) {
+        message.size = int(newLine - pos);
+        pos = newLine + 1;
+    } else {
+        pos = nullptr;
+    }
+    return parseUtf8Message(message.data, message.size, scanner, pView);
+}
+
+Message *Message::Reader::next(const QString &senderId)
+    throw (ParseEx)
+{
+    MessageView view;
+    const ParseStatus status = next(&view);
+    if (status != ParseOk) {
+        throw ParseEx("Unable to parse message: "
+            + QString(describeParseStatus(status)) + " Message bytes (hex): "
+            + QString::fromLatin1(
+                QByteArray(message.data, message.size).toHex()));
+    }
+    return createFromView(view, senderId);
+}
+
+bool MessageBatch::append(const QByteArray &message)
+{
+    QByteArray entry;
+    if (binary) {
+        // Without the magic and the version.
+        const int bodySize = message.size() - cBinaryPrefixSize;
+        appendVarint(&entry, quint64(bodySize));
+        entry.append(message.constData() + cBinaryPrefixSize, bodySize);
+    } else {
+        entry = message;
+    }
+
+    if (count > 0) {
+        const int separatorSize = binary ? 0 : 1;
+        if (payload.size() + separatorSize + entry.size() > maxSize) {
+            return false;
+        }
+        if (!binary) {
+            payload.append('\n');
+        }
+    } else {
+        if (binary) {
+            payload = binaryHeader(cBinaryBatchType);
+        } else {
+            payload.append(cBatchHeader, cBatchHeaderSize);
+        }
+        firstMessage = message;
+    }
+
+    payload.append(entry);
+    ++count;
+    return true;
+}
+
+QByteArray MessageBatch::toPayload() const
+{
+    if (count == 1) {
+        return firstMessage;
+    }
+    return payload;
+}
+
+void MessageBatch::clear()
+{
+    payload.clear();
+    firstMessage.clear();
+    count = 0;
 }
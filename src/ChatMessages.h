@@ -4,7 +4,13 @@
 // Classes for messages sent between Apps to implement the chat protocol.
 
 #include <QString>
+#include <QByteArray>
 #include <stdexcept>
+#include <string.h>
+#include <new>
+
+#include "FieldScanner.h"
+#include "TypeList.h"
 
 namespace Chat {
 
@@ -19,17 +25,89 @@ public:
     {}
 };
 
+/**
+ * Result of parsing a message without exceptions (see MessageView).
+ */
+enum ParseStatus
+{
+    ParseOk = 0,
+    ParseUnknownType,
+
+    // A field which should be followed by others is the last one.
+    ParseMissingField,
+
+    ParseEmptyField,
+
+    // Data found after the last field.
+    ParseTrailingData,
+
+    ParseBadTextId,
+
+    // The binary header is truncated, or of an unsupported version.
+    ParseBadBinaryHeader,
+
+    // Of the binary form: a size or a field exceeds the payload.
+    ParseTruncated,
+
+    ParseBadVarint,
+
+    ParseBadUtf8,
+
+    // Of a compressed text (see TextCompressor).
+    ParseUnsupportedDictionary,
+    ParseBadCompression,
+
+    // Fragment index, count, or the received fragments are out of range.
+    ParseBadFragment
+};
+
+/**
+ * @return Static description, e.g. for logging.
+ */
+const char *describeParseStatus(ParseStatus status);
+
+/**
+ * UTF-8 bytes of a field, viewed in place in the parsed payload.
+ */
+struct Utf8View
+{
+    const char *data = nullptr;
+    int size = 0;
+
+    bool isEmpty() const
+    {
+        return size == 0;
+    }
+
+    bool equals(const QByteArray &utf8) const
+    {
+        return size == utf8.size() && memcmp(data, utf8.constData(), size) == 0;
+    }
+
+    /**
+     * Decodes the bytes, thus, allocates memory.
+     */
+    QString toString() const
+    {
+        return QString::fromUtf8(data, size);
+    }
+};
+
 // forward:
 class UserMessage;
 class LeaveMessage;
 class TextMessage;
 class AckMessage;
+class FragmentMessage;
+class FragmentAckMessage;
+class MessageView;
 
 /**
  * Abstract base for messages sent via multicast.
  *
  * Each message is sent via multicast as a single UDP datagram. Each
- * datagram payload is a message serialized as a UTF-8 string.
+ * datagram payload is a message serialized either as a UTF-8 string (see
+ * toUtf8()), or in the compact binary form (see toBinary()).
  *
  * The following message types are supported:
  *
@@ -45,6 +123,19 @@ class AckMessage;
  * ack|<text.sender.id>|<text.id>
  *     Sent when the App receives a "text" message.
  *
+ * frag|<sender.nick>|<text.id>|<fragment.index>|<fragment.count>|<fragment>
+ *     Carries a part of a text too long for a single datagram. Leads to
+ *     sending "fragack".
+ *
+ * fragack|<text.sender.id>|<text.id>|<fragments.received>
+ *     Sent when the App receives a "frag" message. <fragments.received> is
+ *     a decimal bitmask: bit i is set if fragment i has been received.
+ *
+ * batch|<message>\n<message>[\n<message>...]
+ *     Carries several messages which do not contain '\n' chars (e.g.
+ *     "user", "leave" and "ack"), to save datagrams. Is not a message
+ *     itself: see MessageBatch and Message::Reader.
+ *
  * NOTES:
  * - The '|' char is used as a field delimiter, thus, ony the last field of
  *   a message is allowed to contain this char.
@@ -53,6 +144,34 @@ class AckMessage;
  *   semantics is not defined by the message class.
  * - <text.sender.id> is used to identify the sender of the text being
  *   acknowledged, its semantics it not defined by the message class.
+ * - <fragment.count> is within [1, FragmentMessage::cMaxCount], and
+ *   <fragment.index> is within [0, <fragment.count>). The fragments of a
+ *   text are split at UTF-8 char boundaries, and have the same <text.id>.
+ * - Each message type is declared once, as a schema of its fields in
+ *   ChatMessages.cpp, which generates its serializers and parsers of both
+ *   forms.
+ *
+ * The binary form has the same fields, without delimiters:
+ *
+ * <magic><version><type><fields>
+ *     The magic byte is 0xFE, which never occurs in UTF-8, thus, payloads
+ *     of both forms are told apart and accepted when received. The version
+ *     is 1. The type is 1 for "user", 2 "leave", 3 "text", 4 "ack",
+ *     5 "batch", 7 "frag", and 8 "fragack". A string field is its UTF-8
+ *     size as a varint followed by the UTF-8 bytes; <text.id> is a
+ *     zigzag-encoded varint; <fragment.index>, <fragment.count> and
+ *     <fragments.received> are varints. A varint is LEB128: 7 bits per
+ *     byte, the least significant first, with the high bit set in all the
+ *     bytes but the last.
+ *
+ * A binary "batch" is followed by the messages, each as its size (a varint)
+ * and the message without the magic and the version; any message can be
+ * batched.
+ *
+ * A binary "text" of type 6 has its <text> compressed (see TextCompressor):
+ * <text.id> is followed by the dictionary version as a varint, and by the
+ * compressed data as a string field. It is sent only if it is shorter
+ * than the type 3 one.
  */
 class Message
 {
@@ -84,6 +203,20 @@ public:
         return senderId;
     }
 
+    /**
+     * Parse a single message (not a batch) of either form in place,
+     * without allocating memory.
+     * @param pView Undefined unless ParseOk is returned.
+     */
+    static ParseStatus parse(const char *data, int size, MessageView *pView);
+
+    /**
+     * Factory: create a message of the proper type, decoding the fields;
+     * the view should not be default-constructed.
+     */
+    static Message *createFromView(
+        const MessageView &view, const QString &senderId);
+
     /**
      * Factory: parse the string to create a message of the proper type.
      */
@@ -92,7 +225,81 @@ public:
         throw (ParseEx);
 
     /**
-     * Visitor: handles all message types.
+     * Factory: the same as above, parsing the data in place (e.g. a view
+     * of a received datagram) instead of requiring a QByteArray.
+     */
+    static Message *createFromUtf8(
+        const char *utf8, int size, const QString &senderId)
+        throw (ParseEx);
+
+    /**
+     * Factory: parse the binary form to create a message of the proper
+     * type.
+     */
+    static Message *createFromBinary(
+        const char *data, int size, const QString &senderId)
+        throw (ParseEx);
+
+    /**
+     * @return Whether the payload is in the binary form (maybe malformed).
+     */
+    static bool isBinary(const char *data, int size);
+
+    static bool isBinary(const QByteArray &payload)
+    {
+        return isBinary(payload.constData(), payload.size());
+    }
+
+    /**
+     * Iterates over the messages of a payload, which is either a single
+     * message, or a batch of messages (see MessageBatch), in either form.
+     * Parses the data in place, thus, the data should outlive the reader.
+     */
+    class Reader
+    {
+    public:
+        Reader(const char *data, int size);
+
+        bool atEnd() const
+        {
+            return pos == nullptr;
+        }
+
+        /**
+         * Parse the next message of the payload in place, without
+         * allocating memory. If the message is invalid, the reader moves
+         * to the next message anyway.
+         * @param pView Undefined unless ParseOk is returned.
+         */
+        ParseStatus next(MessageView *pView);
+
+        /**
+         * Factory: parse the next message of the payload.
+         * @throw ParseEx if the message is invalid; the reader then moves
+         * to the next message anyway.
+         */
+        Message *next(const QString &senderId)
+            throw (ParseEx);
+
+    private:
+        // Null at end.
+        const char *pos;
+
+        // The one returned by next() last.
+        Utf8View message;
+
+        const char *const end;
+        const bool isBinary;
+        const bool isBatch;
+
+        // Of a payload in the text form.
+        const FieldScanner scanner;
+    };
+
+    /**
+     * Visitor: handles all message types. Messages created from received
+     * payloads are for compatibility; the views of them can be handled
+     * without allocations via MessageView::dispatchTo().
      */
     class Handler // interface
     {
@@ -104,11 +311,78 @@ public:
         virtual void handleLeaveMessage(const LeaveMessage &message) = 0;
         virtual void handleTextMessage(const TextMessage &message) = 0;
         virtual void handleAckMessage(const AckMessage &message) = 0;
+        virtual void handleFragmentMessage(
+            const FragmentMessage &message) = 0;
+        virtual void handleFragmentAckMessage(
+            const FragmentAckMessage &message) = 0;
     };
 
     virtual void handleBy(Handler *pHandler) const = 0;
 
     virtual QByteArray toUtf8() const = 0;
+
+    virtual QByteArray toBinary() const = 0;
+
+    QByteArray serialize(bool binary) const
+    {
+        return binary ? toBinary() : toUtf8();
+    }
+};
+
+/**
+ * Collects serialized messages into a "batch" payload of limited size.
+ */
+class MessageBatch
+{
+public:
+    /**
+     * @param binary Form of the batch, and of the messages to append.
+     */
+    explicit MessageBatch(int maxSize, bool binary = false)
+        : maxSize(maxSize), binary(binary)
+    {}
+
+    /**
+     * @return Whether the message can be a part of a batch.
+     */
+    static bool canContain(const QByteArray &message)
+    {
+        return Message::isBinary(message) || !message.contains('\n');
+    }
+
+    /**
+     * The first message is always appended.
+     * @return false if the message would exceed maxSize; then the batch is
+     * left unchanged.
+     */
+    bool append(const QByteArray &message);
+
+    bool isEmpty() const
+    {
+        return count == 0;
+    }
+
+    int getCount() const
+    {
+        return count;
+    }
+
+    /**
+     * A single message is returned as is, to be readable by any App.
+     */
+    QByteArray toPayload() const;
+
+    void clear();
+
+private:
+    const int maxSize;
+    const bool binary;
+    int count = 0;
+
+    // Includes the header.
+    QByteArray payload;
+
+    QByteArray firstMessage;
 };
 
 class UserMessage : public Message
@@ -138,6 +412,8 @@ public:
     }
 
     virtual QByteArray toUtf8() const override;
+
+    virtual QByteArray toBinary() const override;
 };
 
 class LeaveMessage : public Message
@@ -167,6 +443,8 @@ public:
     }
 
     virtual QByteArray toUtf8() const override;
+
+    virtual QByteArray toBinary() const override;
 };
 
 class TextMessage : public Message
@@ -209,6 +487,14 @@ public:
     }
 
     virtual QByteArray toUtf8() const override;
+
+    virtual QByteArray toBinary() const override;
+
+    /**
+     * @return The binary form with the text compressed, if it is shorter;
+     * otherwise, the same as toBinary().
+     */
+    QByteArray toCompressedBinary() const;
 };
 
 class AckMessage : public Message
@@ -239,12 +525,281 @@ public:
         return textId;
     }
 
+    /**
+     * For Transport::setAddressedFilter(): acks in the given form start
+     * with the prefix, followed by the addressee field of textSenderId.
+     */
+    static QByteArray addressedPrefix(bool binary);
+    static QByteArray addresseeField(const QString &textSenderId,
+        bool binary);
+
     virtual void handleBy(Handler *pHandler) const override
     {
         pHandler->handleAckMessage(*this);
     }
 
     virtual QByteArray toUtf8() const override;
+
+    virtual QByteArray toBinary() const override;
+};
+
+class FragmentMessage : public Message
+{
+private:
+    const QString senderNick;
+    const qint64 textId;
+    const int index;
+    const int count;
+    const QString fragment;
+
+public:
+    static const Type cType;
+
+    // Bits of the <fragments.received> mask.
+    static const int cMaxCount = 32;
+
+    FragmentMessage(const QString &senderNick, qint64 textId, int index,
+        int count, const QString &fragment, const QString &senderId = "")
+        : Message(cType, senderId), senderNick(senderNick), textId(textId),
+            index(index), count(count), fragment(fragment)
+    {}
+
+    virtual ~FragmentMessage() override
+    {}
+
+    QString getSenderNick() const
+    {
+        return senderNick;
+    }
+
+    qint64 getTextId() const
+    {
+        return textId;
+    }
+
+    int getIndex() const
+    {
+        return index;
+    }
+
+    int getCount() const
+    {
+        return count;
+    }
+
+    QString getFragment() const
+    {
+        return fragment;
+    }
+
+    virtual void handleBy(Handler *pHandler) const override
+    {
+        pHandler->handleFragmentMessage(*this);
+    }
+
+    virtual QByteArray toUtf8() const override;
+
+    virtual QByteArray toBinary() const override;
+};
+
+class FragmentAckMessage : public Message
+{
+private:
+    const QString textSenderId;
+    const qint64 textId;
+    const quint32 receivedFragments;
+
+public:
+    static const Type cType;
+
+    FragmentAckMessage(const QString &textSenderId, qint64 textId,
+        quint32 receivedFragments, const QString &senderId = "")
+        : Message(cType, senderId), textSenderId(textSenderId),
+            textId(textId), receivedFragments(receivedFragments)
+    {}
+
+    virtual ~FragmentAckMessage() override
+    {}
+
+    QString getTextSenderId() const
+    {
+        return textSenderId;
+    }
+
+    qint64 getTextId() const
+    {
+        return textId;
+    }
+
+    /**
+     * Bit i is set if fragment i has been received.
+     */
+    quint32 getReceivedFragments() const
+    {
+        return receivedFragments;
+    }
+
+    virtual void handleBy(Handler *pHandler) const override
+    {
+        pHandler->handleFragmentAckMessage(*this);
+    }
+
+    virtual QByteArray toUtf8() const override;
+
+    virtual QByteArray toBinary() const override;
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Messages viewed in place in the parsed payloads: valid while the payload
+// is, and decoded only when needed.
+
+struct UserMessageView
+{
+    Utf8View senderNick;
+};
+
+struct LeaveMessageView
+{
+    Utf8View senderNick;
+};
+
+struct TextMessageView
+{
+    Utf8View senderNick;
+    qint64 textId = 0;
+
+    // If compressed, the bytes are not UTF-8: see decodeText().
+    Utf8View text;
+    bool isTextCompressed = false;
+
+    /**
+     * Decompresses the text if needed, thus, allocates memory.
+     */
+    QString decodeText() const;
+};
+
+struct AckMessageView
+{
+    Utf8View textSenderId;
+    qint64 textId = 0;
+};
+
+struct FragmentMessageView
+{
+    Utf8View senderNick;
+    qint64 textId = 0;
+    int index = 0;
+    int count = 0;
+    Utf8View fragment;
+};
+
+struct FragmentAckMessageView
+{
+    Utf8View textSenderId;
+    qint64 textId = 0;
+    quint32 receivedFragments = 0;
+};
+
+/**
+ * The views of all the message types; see "Adding a message type" in
+ * ChatMessages.cpp.
+ */
+typedef TypeList<UserMessageView, LeaveMessageView, TextMessageView,
+    AckMessageView, FragmentMessageView, FragmentAckMessageView>
+    MessageViewTypes;
+
+/**
+ * Value holding a view of any message type, e.g. on the stack, instead of
+ * a Message subclass instance on the heap.
+ */
+class MessageView
+{
+public:
+    MessageView()
+        : typeIndex(-1)
+    {}
+
+    /**
+     * @param View One of MessageViewTypes.
+     */
+    template<class View>
+    MessageView(const View &view)
+        : typeIndex(TypeIndexOf<View, MessageViewTypes>::value)
+    {
+        new (storage) View(view);
+    }
+
+    /**
+     * @return Null if default-constructed.
+     */
+    Message::Type getType() const;
+
+    /**
+     * @return Index of the view type in MessageViewTypes; -1 if
+     * default-constructed.
+     */
+    int getTypeIndex() const
+    {
+        return typeIndex;
+    }
+
+    /**
+     * Should be called only for the view of the type.
+     */
+    template<class View>
+    const View &as() const
+    {
+        Q_ASSERT(typeIndex == (TypeIndexOf<View, MessageViewTypes>::value));
+        return *reinterpret_cast<const View *>(storage);
+    }
+
+    const UserMessageView &asUserMessage() const
+    {
+        return as<UserMessageView>();
+    }
+
+    const LeaveMessageView &asLeaveMessage() const
+    {
+        return as<LeaveMessageView>();
+    }
+
+    const TextMessageView &asTextMessage() const
+    {
+        return as<TextMessageView>();
+    }
+
+    const AckMessageView &asAckMessage() const
+    {
+        return as<AckMessageView>();
+    }
+
+    const FragmentMessageView &asFragmentMessage() const
+    {
+        return as<FragmentMessageView>();
+    }
+
+    const FragmentAckMessageView &asFragmentAckMessage() const
+    {
+        return as<FragmentAckMessageView>();
+    }
+
+    /**
+     * Calls pHandler->handle() overloaded for the view of the message
+     * type, resolved at compile time instead of via Message::Handler.
+     * Does nothing if default-constructed.
+     */
+    template<class Handler>
+    void dispatchTo(Handler *pHandler) const
+    {
+        TypeListDispatcher<MessageViewTypes>::dispatch(
+            typeIndex, storage, pHandler);
+    }
+
+private:
+    typedef TypeListStorage<MessageViewTypes> Storage;
+
+    int typeIndex;
+    alignas(Storage::cAlignment) char storage[Storage::cSize];
 };
 
 } // namespace Chat
@@ -0,0 +1,327 @@
+#ifndef CHATMESSAGESBENCHMARK_H
+#define CHATMESSAGESBENCHMARK_H
+
+#include <QtTest>
+
+#include "AllocationCounter.h"
+#include "ChatMessages.h"
+#include "FieldScanner.h"
+#include "Transport.h"
+
+/**
+ * Compares the text and the binary forms of messages: the bytes on the
+ * wire, and the cost of parsing a received payload. Measures the cost per
+ * message of each type, to be compared before and after a protocol
+ * change.
+ */
+class ChatMessagesBenchmark : public QObject
+{
+    Q_OBJECT
+private:
+    static QByteArray buildBatch(bool binary)
+    {
+        Chat::MessageBatch batch(Transport::cMaxDatagramSize, binary);
+        batch.append(Chat::UserMessage("John Doe").serialize(binary));
+        for (int i = 0; i < 10; ++i) {
+            batch.append(Chat::AckMessage("1a2b3c4d",
+                1000 + i).serialize(binary));
+        }
+        return batch.toPayload();
+    }
+
+    // How a payload is split into fields.
+    enum ScanMethod
+    {
+        // Decoding to UTF-16 and searching it, as parsing used to.
+        ScanTranscode,
+
+        // Searching the bytes with memchr(), validating each field apart.
+        ScanMemchr,
+
+        ScanFieldScanner
+    };
+
+    static void addScanRows(const char *name, const QByteArray &payload)
+    {
+        QTest::newRow((QByteArray(name) + ", transcode").constData())
+            << payload << int(ScanTranscode);
+        QTest::newRow((QByteArray(name) + ", memchr").constData())
+            << payload << int(ScanMemchr);
+        QTest::newRow((QByteArray(name) + ", FieldScanner").constData())
+            << payload << int(ScanFieldScanner);
+    }
+
+    /**
+     * @return The number of fields, so that the work is not optimized out.
+     */
+    static int splitFields(const QByteArray &payload, ScanMethod method)
+    {
+        const char *pos = payload.constData();
+        const char *const end = pos + payload.size();
+        int fieldCount = 0;
+
+        switch (method) {
+            case ScanTranscode:
+            {
+                const QString s = QString::fromUtf8(payload);
+                for (int i = 0; (i = s.indexOf('|', i)) != -1; ++i) {
+                    ++fieldCount;
+                }
+                break;
+            }
+            case ScanMemchr:
+                for (;;) {
+                    const char *delimiter = static_cast<const char *>(
+                        memchr(pos, '|', end - pos));
+                    const char *fieldEnd = delimiter ? delimiter : end;
+                    if (!FieldScanner::isValidUtf8(
+                            pos, int(fieldEnd - pos))) {
+                        return -1;
+                    }
+                    if (delimiter == nullptr) {
+                        break;
+                    }
+                    ++fieldCount;
+                    pos = delimiter + 1;
+                }
+                break;
+            case ScanFieldScanner:
+            {
+                const FieldScanner scanner(pos, payload.size());
+                if (!scanner.isValidUtf8Range(pos, end)) {
+                    return -1;
+                }
+                while ((pos = scanner.findDelimiter('|', pos, end))
+                    != nullptr) {
+                    ++fieldCount;
+                    ++pos;
+                }
+                break;
+            }
+        }
+        return fieldCount;
+    }
+
+    static void addRows(const char *name, const Chat::Message &message)
+    {
+        QTest::newRow((QByteArray(name) + ", text").constData())
+            << message.toUtf8();
+        QTest::newRow((QByteArray(name) + ", binary").constData())
+            << message.toBinary();
+    }
+
+    static const int cSampleSize = 10000;
+
+    /**
+     * A message of each type in the text form, and invalid ones if
+     * requested.
+     */
+    static void addUtf8Rows(bool withInvalid)
+    {
+        QTest::newRow("user") << Chat::UserMessage("John Doe").toUtf8();
+        QTest::newRow("leave") << Chat::LeaveMessage("John Doe").toUtf8();
+        QTest::newRow("text") << Chat::TextMessage("John Doe",
+            1476619200123LL, "Hello, are we still meeting at noon?").toUtf8();
+        QTest::newRow("ack") << Chat::AckMessage("1a2b3c4d",
+            1476619200123LL).toUtf8();
+        QTest::newRow("frag") << Chat::FragmentMessage("John Doe",
+            1476619200123LL, 1, 2, "Hello, are we still meeting at noon?")
+            .toUtf8();
+        QTest::newRow("fragack") << Chat::FragmentAckMessage(
+            "1a2b3c4d", 1476619200123LL, 3).toUtf8();
+
+        if (withInvalid) {
+            QTest::newRow("invalid: unknown type")
+                << QByteArray("hello|John Doe");
+            QTest::newRow("invalid: missing field")
+                << QByteArray("text|John Doe|1476619200123");
+            QTest::newRow("invalid: bad text.id")
+                << QByteArray("ack|1a2b3c4d|14766192001x");
+            QTest::newRow("invalid: bad UTF-8")
+                << QByteArray("user|John \xC0\xAF");
+        }
+    }
+
+    /**
+     * @return Whether the message is valid.
+     */
+    static bool createFromUtf8(const QByteArray &utf8)
+    {
+        try
+        {
+            delete Chat::Message::createFromUtf8(
+                utf8, "5e6f7a8b");
+            return true;
+        }
+        catch (Chat::ParseEx &)
+        {
+            return false;
+        }
+    }
+
+    /**
+     * Calls the function cSampleSize times, and prints the averages per
+     * call: the time in ns (QBENCHMARK reports ms per iteration), and the
+     * heap allocations, if counted in this build (see AllocationCounter).
+     */
+    template<class Function>
+    static void printCostPerMessage(Function function)
+    {
+        const quint64 allocationsBefore = AllocationCounter::getCount();
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < cSampleSize; ++i) {
+            function();
+        }
+        const qint64 ns = timer.nsecsElapsed();
+        const quint64 allocations =
+            AllocationCounter::getCount() - allocationsBefore;
+
+        QDebug debug = qDebug();
+        debug << QTest::currentDataTag()
+            << "| ns/message:" << double(ns) / cSampleSize;
+        if (AllocationCounter::isAvailable()) {
+            debug << "| allocations/message:"
+                << double(allocations) / cSampleSize;
+        } else {
+            debug << "| allocations are not counted in this build";
+        }
+    }
+
+private slots:
+    void benchmarkParse_data()
+    {
+        QTest::addColumn<QByteArray>("payload");
+
+        addRows("user", Chat::UserMessage("John Doe"));
+        addRows("text", Chat::TextMessage("John Doe", 1476619200123LL,
+            "Hello, are we still meeting at noon?"));
+        addRows("ack", Chat::AckMessage("1a2b3c4d",
+            1476619200123LL));
+
+        QTest::newRow("batch of user and 10 acks, text") << buildBatch(false);
+        QTest::newRow("batch of user and 10 acks, binary") << buildBatch(true);
+    }
+
+    void benchmarkParse()
+    {
+        QFETCH(QByteArray, payload);
+
+        int messageCount = 0;
+        QBENCHMARK {
+            messageCount = 0;
+            Chat::Message::Reader reader(payload.constData(), payload.size());
+            while (!reader.atEnd()) {
+                delete reader.next("5e6f7a8b");
+                ++messageCount;
+            }
+        }
+
+        qDebug() << QTest::currentDataTag() << "| bytes on the wire:"
+            << payload.size() << "| messages:" << messageCount;
+    }
+
+    void benchmarkFieldScan_data()
+    {
+        QTest::addColumn<QByteArray>("payload");
+        QTest::addColumn<int>("method");
+
+        addScanRows("user", Chat::UserMessage("John Doe").toUtf8());
+        addScanRows("ack", Chat::AckMessage("1a2b3c4d",
+            1476619200123LL).toUtf8());
+        addScanRows("text", Chat::TextMessage("John Doe", 1476619200123LL,
+            "Hello, are we still meeting at noon?").toUtf8());
+        addScanRows("non-ASCII text", Chat::TextMessage(
+            QString::fromUtf8("\xD0\x98\xD0\xB2\xD0\xB0\xD0\xBD"),
+            1476619200123LL, QString::fromUtf8(
+                "\xD0\x9F\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82, "
+                "\xD0\xB2\xD1\x81\xD1\x82\xD1\x80\xD0\xB5\xD1\x87"
+                "\xD0\xB0\xD0\xB5\xD0\xBC\xD1\x81\xD1\x8F "
+                "\xD0\xB2 \xD0\xBF\xD0\xBE\xD0\xBB\xD0\xB4\xD0\xB5"
+                "\xD0\xBD\xD1\x8C? \xF0\x9F\x98\x80")).toUtf8());
+        addScanRows("batch of user and 10 acks", buildBatch(false));
+    }
+
+    /**
+     * Finds the '|' delimiters of a payload and validates its UTF-8.
+     */
+    void benchmarkFieldScan()
+    {
+        QFETCH(QByteArray, payload);
+        QFETCH(int, method);
+
+        int fieldCount = 0;
+        QBENCHMARK {
+            fieldCount = splitFields(payload, ScanMethod(method));
+        }
+        QVERIFY(fieldCount > 0);
+    }
+
+    void benchmarkParseInPlace_data()
+    {
+        benchmarkParse_data();
+    }
+
+    /**
+     * Without creating Message objects, thus, without allocations.
+     */
+    void benchmarkParseInPlace()
+    {
+        QFETCH(QByteArray, payload);
+
+        QBENCHMARK {
+            Chat::Message::Reader reader(payload.constData(), payload.size());
+            while (!reader.atEnd()) {
+                Chat::MessageView view;
+                QCOMPARE(reader.next(&view), Chat::ParseOk);
+            }
+        }
+    }
+
+    void benchmarkCreateFromUtf8_data()
+    {
+        QTest::addColumn<QByteArray>("utf8");
+
+        addUtf8Rows(/*withInvalid*/ true);
+    }
+
+    /**
+     * Parses a message and creates a Message object, or throws ParseEx if
+     * the message is invalid.
+     */
+    void benchmarkCreateFromUtf8()
+    {
+        QFETCH(QByteArray, utf8);
+
+        QCOMPARE(createFromUtf8(utf8),
+            !QByteArray(QTest::currentDataTag()).startsWith("invalid"));
+
+        QBENCHMARK {
+            createFromUtf8(utf8);
+        }
+        printCostPerMessage([&utf8]() { createFromUtf8(utf8); });
+    }
+
+    void benchmarkToUtf8_data()
+    {
+        QTest::addColumn<QByteArray>("utf8");
+
+        addUtf8Rows(/*withInvalid*/ false);
+    }
+
+    void benchmarkToUtf8()
+    {
+        QFETCH(QByteArray, utf8);
+
+        const QScopedPointer<Chat::Message> message(
+            Chat::Message::createFromUtf8(utf8, "5e6f7a8b"));
+        QByteArray result;
+        QBENCHMARK {
+            result = message->toUtf8();
+        }
+        QCOMPARE(result, utf8);
+        printCostPerMessage([&message]() { message->toUtf8(); });
+    }
+};
+
+#endif // CHATMESSAGESBENCHMARK_H
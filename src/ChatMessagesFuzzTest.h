@@ -0,0 +1,89 @@
+#ifndef CHATMESSAGESFUZZTEST_H
+#define CHATMESSAGESFUZZTEST_H
+
+#include <QtTest>
+
+#include "ChatMessages.h"
+#include "ChatMessagesFuzzer.h"
+
+/**
+ * Runs ChatMessagesFuzzer over the checked-in corpus and over a fixed
+ * sequence of its mutations, thus, the same inputs on each run.
+ */
+class ChatMessagesFuzzTest : public QObject
+{
+    Q_OBJECT
+private:
+    static const int cMutationsPerPayload = 1000;
+
+    /**
+     * @return The payloads by the file names.
+     */
+    static QMap<QString, QByteArray> loadCorpus()
+    {
+        QMap<QString, QByteArray> result;
+        const QDir dir(QFINDTESTDATA("ChatMessagesCorpus"));
+        foreach (const QString &fileName, dir.entryList(QDir::Files)) {
+            QFile file(dir.filePath(fileName));
+            if (file.open(QIODevice::ReadOnly)) {
+                result.insert(fileName, file.readAll());
+            }
+        }
+        return result;
+    }
+
+private slots:
+    void testCorpus_data()
+    {
+        QTest::addColumn<QByteArray>("payload");
+
+        const QMap<QString, QByteArray> corpus = loadCorpus();
+        QVERIFY(!corpus.isEmpty());
+        foreach (const QString &fileName, corpus.keys()) {
+            QTest::newRow(qPrintable(fileName)) << corpus.value(fileName);
+        }
+    }
+
+    void testCorpus()
+    {
+        QFETCH(QByteArray, payload);
+
+        const QString error = ChatMessagesFuzzer::checkPayload(
+            payload.constData(), payload.size());
+        QVERIFY2(error.isEmpty(), qPrintable(error));
+    }
+
+    /**
+     * The corpus should have a valid message of each type in each form.
+     */
+    void testCorpusCoverage()
+    {
+        QSet<QByteArray> types;
+        foreach (const QByteArray &payload, loadCorpus()) {
+            Chat::MessageView view;
+            if (Chat::Message::parse(payload.constData(), payload.size(),
+                    &view) == Chat::ParseOk) {
+
+                types.insert(QByteArray(view.getType())
+                    + (Chat::Message::isBinary(payload) ? ", binary" : ""));
+            }
+        }
+        QCOMPARE(types.size(), 2 * Chat::MessageViewTypes::cSize);
+    }
+
+    void testMutations()
+    {
+        quint32 seed = 1;
+        foreach (const QByteArray &payload, loadCorpus()) {
+            for (int i = 0; i < cMutationsPerPayload; ++i) {
+                const QByteArray mutated =
+                    ChatMessagesFuzzer::mutate(payload, &seed);
+                const QString error = ChatMessagesFuzzer::checkPayload(
+                    mutated.constData(), mutated.size());
+                QVERIFY2(error.isEmpty(), qPrintable(error));
+            }
+        }
+    }
+};
+
+#endif // CHATMESSAGESFUZZTEST_H
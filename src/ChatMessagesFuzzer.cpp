@@ -0,0 +1,148 @@
+#include "ChatMessagesFuzzer.h"
+
+#include <QScopedPointer>
+
+#include "ChatMessages.h"
+
+using namespace Chat;
+
+// The bytes which the parsers tell apart: delimiters, digits, binary form
+// types, varint continuation, UTF-8 lead bytes, and the binary magic.
+static const char cSignificantBytes[] = "|\n-0123456789"
+    "\x00\x01\x02\x03\x04\x05\x06\x07\x08\x09\x7F\x80\xC0\xE0\xF0\xFE\xFF";
+static const int cSignificantByteCount = int(sizeof(cSignificantBytes)) - 1;
+
+static const char cSenderId[] = "5e6f7a8b";
+
+///////////////////////////////////////////////////////////////////////////
+// Utils.
+
+static quint32 nextRandom(quint32 *pSeed)
+{
+    // LCG of Numerical Recipes; its low bits are the least random.
+    *pSeed = *pSeed * 1664525u + 1013904223u;
+    return *pSeed >> 8;
+}
+
+static QString toHex(const QByteArray &bytes)
+{
+    return QString::fromLatin1(bytes.toHex());
+}
+
+/**
+ * @return Empty if the payload parses to the same message.
+ */
+static QString checkReparsed(const Message &message, const QByteArray &payload,
+    const char *form)
+{
+    MessageView view;
+    const ParseStatus status =
+        Message::parse(payload.constData(), payload.size(), &view);
+    if (status != ParseOk) {
+        return QString("The message serialized in the ") + form
+            + " does not parse: " + describeParseStatus(status)
+            + " Serialized (hex): " + toHex(payload);
+    }
+
+    QScopedPointer<Message> reparsed(
+        Message::createFromView(view, message.getSenderId()));
+    if (reparsed->type != message.type
+        || reparsed->toUtf8() != message.toUtf8()) {
+
+        return QString("The message serialized in the ") + form
+            + " parses to another message. Serialized (hex): "
+            + toHex(payload);
+    }
+    return QString();
+}
+
+///////////////////////////////////////////////////////////////////////////
+
+QString ChatMessagesFuzzer::checkPayload(const char *data, int size)
+{
+    const QString payloadHex = " Payload (hex): "
+        + toHex(QByteArray::fromRawData(data, size));
+
+    MessageView view;
+    const ParseStatus status = Message::parse(data, size, &view);
+    const bool binary = Message::isBinary(data, size);
+
+    QScopedPointer<Message> created;
+    try
+    {
+        created.reset(binary
+            ? Message::createFromBinary(data, size, cSenderId)
+            : Message::createFromUtf8(data, size, cSenderId));
+    }
+    catch (ParseEx &)
+    {
+    }
+    if ((status == ParseOk) == created.isNull()) {
+        return "Message::parse() and the factory disagree: "
+            + QString(describeParseStatus(status)) + payloadHex;
+    }
+
+    Message::Reader reader(data, size);
+    for (int i = 0; !reader.atEnd(); ++i) {
+        // Each message takes a byte at least.
+        if (i > size) {
+            return "Message::Reader does not reach the end." + payloadHex;
+        }
+        MessageView next;
+        if (reader.next(&next) == ParseOk) {
+            delete Message::createFromView(next, cSenderId);
+        }
+    }
+
+    if (status != ParseOk) {
+        return QString();
+    }
+    if (view.getType() != created->type) {
+        return "The view and the message are of different types."
+            + payloadHex;
+    }
+
+    QString error = checkReparsed(*created, created->toBinary(),
+        "binary form");
+    if (error.isEmpty() && !binary) {
+        error = checkReparsed(*created, created->toUtf8(), "text form");
+    }
+    const TextMessage *text = dynamic_cast<const TextMessage *>(
+        created.data());
+    if (error.isEmpty() && text != nullptr) {
+        error = checkReparsed(*text, text->toCompressedBinary(),
+            "compressed binary form");
+    }
+    return error.isEmpty() ? error : error + payloadHex;
+}
+
+QByteArray ChatMessagesFuzzer::mutate(const QByteArray &payload,
+    quint32 *pSeed)
+{
+    QByteArray result = payload;
+    const int editCount = 1 + int(nextRandom(pSeed) % 3);
+    for (int i = 0; i < editCount; ++i) {
+        const int pos = result.isEmpty()
+            ? 0 : int(nextRandom(pSeed) % quint32(result.size()));
+        const quint32 random = nextRandom(pSeed);
+        const char byte = (random & 1)
+            ? char(random >> 1)
+            : cSignificantBytes[(random >> 1) % cSignificantByteCount];
+
+        switch (result.isEmpty() ? 1 : nextRandom(pSeed) % 4) {
+            case 0:
+                result[pos] = byte;
+                break;
+            case 1:
+                result.insert(pos, byte);
+                break;
+            case 2:
+                result.remove(pos, 1);
+                break;
+            default:
+                result.truncate(pos);
+                break;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,39 @@
+#ifndef CHATMESSAGESFUZZER_H
+#define CHATMESSAGESFUZZER_H
+
+// Fuzzing of the message parsers; see ChatMessagesFuzzTest and main.cpp.
+
+#include <QString>
+#include <QByteArray>
+
+/**
+ * Checks the parsers against arbitrary payloads. The seed payloads are in
+ * the ChatMessagesCorpus dir: one payload per file, of either form, valid
+ * or not.
+ */
+class ChatMessagesFuzzer
+{
+public:
+    /**
+     * Feeds the payload to all the parsing entry points, and checks that:
+     * - Message::parse() and the Message factories agree on its validity;
+     * - Message::Reader reaches the end of it;
+     * - a valid message, serialized again, parses to the same message (in
+     *   the text form only if it is parsed from the text form, which does
+     *   not allow '|' in the non-last fields).
+     * Reading out of the payload is caught by the sanitizers, if enabled.
+     * @return Description of the failed check; empty if all passed.
+     */
+    static QString checkPayload(const char *data, int size);
+
+    /**
+     * Edits a few bytes at random: replaces, inserts, removes them, or
+     * truncates the payload; the new bytes are often delimiters, digits,
+     * or binary form types and varint bytes.
+     * @param pSeed State of the pseudo-random generator; updated, thus,
+     * the same seed yields the same mutations.
+     */
+    static QByteArray mutate(const QByteArray &payload, quint32 *pSeed);
+};
+
+#endif // CHATMESSAGESFUZZER_H
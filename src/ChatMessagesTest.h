@@ -4,6 +4,8 @@
 #include <QtTest>
 
 #include "ChatMessages.h"
+#include "Transport.h"
+#include "AllocationCounter.h"
 
 using namespace Chat;
 
@@ -42,6 +44,14 @@ private:
             QVERIFY(dynamic_cast<T *>(m.data()) != 0);
 
             QCOMPARE(m->toUtf8(), s.toUtf8());
+
+            // The binary form carries the same fields.
+            const QByteArray binary = m->toBinary();
+            QVERIFY(Message::isBinary(binary));
+            QScopedPointer<Message> b(Message::createFromBinary(
+                binary.constData(), binary.size(), "TEST_senderId"));
+            QVERIFY(dynamic_cast<T *>(b.data()) != 0);
+            QCOMPARE(b->toUtf8(), s.toUtf8());
         }
         catch (ParseEx &e)
         {
@@ -51,6 +61,23 @@ private:
         }
     }
 
+    /**
+     * As Chat::Engine does.
+     * @return Number of messages parsed successfully.
+     */
+    static int readAll(const QByteArray &payload)
+    {
+        int parsedCount = 0;
+        Message::Reader reader(payload.constData(), payload.size());
+        while (!reader.atEnd()) {
+            MessageView view;
+            if (reader.next(&view) == ParseOk) {
+                ++parsedCount;
+            }
+        }
+        return parsedCount;
+    }
+
 private slots:
     void testGenericMessageInvalid()
     {
@@ -106,8 +133,322 @@ private slots:
         testMessageValid<AckMessage>(s);
     }
 
+    void testFragmentMessageInvalid()
+    {
+        QFETCH(QString, s);
+        testMessageInvalid(s);
+    }
+
+    void testFragmentMessageValid()
+    {
+        QFETCH(QString, s);
+        testMessageValid<FragmentMessage>(s);
+    }
+
+    void testFragmentAckMessageValid()
+    {
+        QFETCH(QString, s);
+        testMessageValid<FragmentAckMessage>(s);
+    }
+
+    void testBatch()
+    {
+        const QByteArray user = "user|Bob";
+        const QByteArray ack = "ack|1.1.1.1|1";
+
+        MessageBatch batch(user.size() + 1 + ack.size() + 6);
+        QVERIFY(batch.append(user));
+        QCOMPARE(batch.toPayload(), user);
+        QVERIFY(batch.append(ack));
+        QVERIFY(!batch.append(ack));
+        QCOMPARE(batch.getCount(), 2);
+        QVERIFY(!MessageBatch::canContain("text|nick|1|a\nb"));
+
+        const QByteArray payload = batch.toPayload();
+        QCOMPARE(payload, "batch|" + user + "\n" + ack);
+
+        Message::Reader reader(payload.constData(), payload.size());
+        QScopedPointer<Message> m(reader.next("TEST_senderId"));
+        QVERIFY(dynamic_cast<UserMessage *>(m.data()) != 0);
+        m.reset(reader.next("TEST_senderId"));
+        QVERIFY(dynamic_cast<AckMessage *>(m.data()) != 0);
+        QCOMPARE(m->getSenderId(), QString("TEST_senderId"));
+        QVERIFY(reader.atEnd());
+    }
+
+    void testBatchWithInvalidMessage()
+    {
+        const QByteArray payload = "batch|user|\nleave|Bob";
+        Message::Reader reader(payload.constData(), payload.size());
+
+        bool thrown = false;
+        try
+        {
+            QScopedPointer<Message>(reader.next("TEST_senderId"));
+        }
+        catch (ParseEx &)
+        {
+            thrown = true;
+        }
+        QVERIFY(thrown);
+
+        QScopedPointer<Message> m(reader.next("TEST_senderId"));
+        QVERIFY(dynamic_cast<LeaveMessage *>(m.data()) != 0);
+        QVERIFY(reader.atEnd());
+    }
+
+    void testMessageView()
+    {
+        const QByteArray payload = "text|nick|-5|a|b";
+        MessageView view;
+        QCOMPARE(Message::parse(payload.constData(), payload.size(), &view),
+            ParseOk);
+        QVERIFY(view.getType() == TextMessage::cType);
+        const TextMessageView &text = view.asTextMessage();
+        QCOMPARE(text.textId, qint64(-5));
+        QVERIFY(text.text.equals("a|b"));
+
+        // Fields are viewed in place.
+        QVERIFY(text.senderNick.data == payload.constData() + 5);
+        QVERIFY(text.senderNick.equals("nick"));
+
+        QCOMPARE(Message::parse("ack|x", 5, &view), ParseMissingField);
+        QCOMPARE(Message::parse("user|a|b", 8, &view), ParseTrailingData);
+        QCOMPARE(Message::parse("ack|x|1x", 8, &view), ParseBadTextId);
+        QCOMPARE(Message::parse("hello|x", 7, &view), ParseUnknownType);
+        QCOMPARE(Message::parse("user|\xC0\xAF", 7, &view), ParseBadUtf8);
+        QCOMPARE(Message::parse("\xFE\x01\x01\x05", 4, &view),
+            ParseTruncated);
+    }
+
+    void testMessageViewDispatch()
+    {
+        struct Handler
+        {
+            QByteArray handled;
+
+            void handle(const UserMessageView &m)
+            {
+                handled += "user " + QByteArray(m.senderNick.data,
+                    m.senderNick.size) + ";";
+            }
+
+            void handle(const LeaveMessageView &)
+            {
+                handled += "leave;";
+            }
+
+            void handle(const TextMessageView &)
+            {
+                handled += "text;";
+            }
+
+            void handle(const AckMessageView &m)
+            {
+                handled += "ack " + QByteArray::number(m.textId) + ";";
+            }
+
+            void handle(const FragmentMessageView &m)
+            {
+                handled += "frag " + QByteArray::number(m.index) + "/"
+                    + QByteArray::number(m.count) + ";";
+            }
+
+            void handle(const FragmentAckMessageView &m)
+            {
+                handled += "fragack "
+                    + QByteArray::number(m.receivedFragments) + ";";
+            }
+        } handler;
+
+        const QByteArray payload =
+            "batch|user|Bob\nack|x|7\nfrag|Bob|7|1|2|b\nfragack|x|7|3";
+        Message::Reader reader(payload.constData(), payload.size());
+        while (!reader.atEnd()) {
+            MessageView view;
+            QCOMPARE(reader.next(&view), ParseOk);
+            view.dispatchTo(&handler);
+        }
+        MessageView().dispatchTo(&handler);
+        QCOMPARE(handler.handled,
+            QByteArray("user Bob;ack 7;frag 1/2;fragack 3;"));
+    }
+
+    void testTypeLookup()
+    {
+        MessageView view;
+        QCOMPARE(Message::parse("ack|x|7", 7, &view), ParseOk);
+        QVERIFY(view.getType() == AckMessage::cType);
+        QCOMPARE(view.getTypeIndex(),
+            int(TypeIndexOf<AckMessageView, MessageViewTypes>::value));
+
+        // The type is hashed by its first and last chars and its size:
+        // names of the same hash should not be taken for known types.
+        const QList<QByteArray> unknownTypes = QList<QByteArray>()
+            << "uxer" << "lxxxe" << "txxt" << "axk" << "fxxg" << "fxxxxxk"
+            << "User" << "users" << "batch";
+        foreach (const QByteArray &type, unknownTypes) {
+            const QByteArray payload = type + "|x|1|0|1|x";
+            QCOMPARE(Message::parse(payload.constData(), payload.size(),
+                &view), ParseUnknownType);
+        }
+
+        QVERIFY(MessageView().getType() == nullptr);
+        QCOMPARE(MessageView().getTypeIndex(), -1);
+    }
+
+    void testBinaryMessageInvalid()
+    {
+        QFETCH(QByteArray, hex);
+        const QByteArray binary = QByteArray::fromHex(hex);
+
+        bool thrown = false;
+        try
+        {
+            QScopedPointer<Message>(Message::createFromBinary(
+                binary.constData(), binary.size(), "TEST_senderId"));
+        }
+        catch (ParseEx &)
+        {
+            thrown = true;
+        }
+        QVERIFY(thrown);
+    }
+
+    void testBinaryBatch()
+    {
+        const QByteArray user = UserMessage("Bob").toBinary();
+        const QByteArray text = TextMessage("Bob", -1, "a\nb").toBinary();
+
+        MessageBatch batch(Transport::cMaxDatagramSize, /*binary*/ true);
+        QVERIFY(MessageBatch::canContain(text));
+        QVERIFY(batch.append(user));
+        QCOMPARE(batch.toPayload(), user);
+        QVERIFY(batch.append(text));
+
+        // Each message is prefixed by its size instead of magic and
+        // version.
+        const QByteArray payload = batch.toPayload();
+        QCOMPARE(payload.size(), 3 + user.size() - 1 + text.size() - 1);
+
+        Message::Reader reader(payload.constData(), payload.size());
+        QScopedPointer<Message> m(reader.next("TEST_senderId"));
+        QCOMPARE(m->toUtf8(), QByteArray("user|Bob"));
+        m.reset(reader.next("TEST_senderId"));
+        QCOMPARE(m->toUtf8(), QByteArray("text|Bob|-1|a\nb"));
+        QVERIFY(reader.atEnd());
+    }
+
+    void testCompressedText()
+    {
+        const QString s = "See https://jira.example.com/browse/TICKET-1234,"
+            " the build is failing on build-server-12.corp.local:8080";
+        const TextMessage message("Bob", 7, s);
+        const QByteArray compressed = message.toCompressedBinary();
+        QVERIFY(compressed.size() < message.toBinary().size());
+
+        MessageView view;
+        QCOMPARE(Message::parse(compressed.constData(), compressed.size(),
+            &view), ParseOk);
+        const TextMessageView &text = view.asTextMessage();
+        QVERIFY(text.isTextCompressed);
+        QCOMPARE(text.textId, qint64(7));
+        QCOMPARE(text.decodeText(), s);
+
+        QScopedPointer<Message> m(Message::createFromBinary(
+            compressed.constData(), compressed.size(), "TEST_senderId"));
+        QCOMPARE(m->toUtf8(), message.toUtf8());
+
+        // Not compressed unless it gets shorter.
+        const TextMessage tiny("Bob", 7, "ok");
+        QCOMPARE(tiny.toCompressedBinary(), tiny.toBinary());
+    }
+
+    void testParseDoesNotAllocate()
+    {
+        QFETCH(QByteArray, payload);
+        QFETCH(int, parsedCount);
+        if (!AllocationCounter::isAvailable()) {
+            QSKIP("Allocations are not counted in this build.");
+        }
+
+        // Lazy initialization, if any, is not counted.
+        QCOMPARE(readAll(payload), parsedCount);
+
+        const quint64 allocationsBefore = AllocationCounter::getCount();
+        const int parsed = readAll(payload);
+        MessageView view;
+        Message::parse(payload.constData(), payload.size(), &view);
+        const quint64 allocations =
+            AllocationCounter::getCount() - allocationsBefore;
+
+        QCOMPARE(parsed, parsedCount);
+        QCOMPARE(int(allocations), 0);
+    }
+
     ///////////////////////////////////////////////////////////////////////
 
+    void testParseDoesNotAllocate_data()
+    {
+        QTest::addColumn<QByteArray>("payload");
+        QTest::addColumn<int>("parsedCount");
+
+        QTest::newRow("text") << QByteArray("text|nick|-5|a|b") << 1;
+        QTest::newRow("binary text")
+            << TextMessage("Bob", 7, "Hello").toBinary() << 1;
+        QTest::newRow("batch") << QByteArray(
+            "batch|user|Bob\nack|x|7\nfrag|Bob|7|1|2|b\nfragack|x|7|3")
+            << 4;
+
+        MessageBatch binaryBatch(Transport::cMaxDatagramSize, true);
+        binaryBatch.append(UserMessage("Bob").toBinary());
+        binaryBatch.append(AckMessage("x", 7).toBinary());
+        QTest::newRow("binary batch") << binaryBatch.toPayload() << 2;
+
+        QTest::newRow("invalid: bad text id") << QByteArray("ack|x|1x") << 0;
+        QTest::newRow("invalid: unknown type") << QByteArray("hello|x") << 0;
+        QTest::newRow("invalid: bad UTF-8")
+            << QByteArray("user|\xC0\xAF") << 0;
+        QTest::newRow("invalid: truncated binary")
+            << QByteArray("\xFE\x01\x01\x05", 4) << 0;
+        QTest::newRow("invalid: in batch")
+            << QByteArray("batch|user|Bob\nack|x|1x") << 1;
+    }
+
+    void testBinaryMessageInvalid_data()
+    {
+        QTest::addColumn<QByteArray>("hex");
+
+        // <magic><version><type><fields>
+
+        QTest::newRow("binary: empty") << QByteArray("");
+        QTest::newRow("binary: text form") << QByteArray("7573657221");
+        QTest::newRow("binary: no type") << QByteArray("fe01");
+        QTest::newRow("binary: unknown version")
+            << QByteArray("fe020103426f62");
+        QTest::newRow("binary: unknown type") << QByteArray("fe0109");
+        QTest::newRow("binary: batch type") << QByteArray("fe0105");
+        QTest::newRow("binary: user: no fields") << QByteArray("fe0101");
+        QTest::newRow("binary: user: empty sender.nick")
+            << QByteArray("fe010100");
+        QTest::newRow("binary: user: truncated sender.nick")
+            << QByteArray("fe010104426f62");
+        QTest::newRow("binary: user: trailing bytes")
+            << QByteArray("fe010103426f6200");
+        QTest::newRow("binary: text: no text.id")
+            << QByteArray("fe010303426f62");
+        QTest::newRow("binary: text: truncated varint")
+            << QByteArray("fe010303426f6280");
+        QTest::newRow("binary: ack: too long varint")
+            << QByteArray("fe010401418080808080808080808001");
+        QTest::newRow("binary: compressed text: unsupported dictionary")
+            << QByteArray("fe010603426f6202020261");
+        QTest::newRow("binary: compressed text: distance out of range")
+            << QByteArray("fe010603426f62020103" "01ff7f");
+        QTest::newRow("binary: compressed text: truncated literals")
+            << QByteArray("fe010603426f6202010204" "61");
+    }
+
     void testGenericMessageInvalid_data()
     {
         QTest::addColumn<QString>("s");
@@ -205,6 +546,54 @@ private slots:
             << "ack|1.1.1.1|-9223372036854775809";
     }
 
+    void testFragmentMessageInvalid_data()
+    {
+        QTest::addColumn<QString>("s");
+
+        // frag|<sender.nick>|<text.id>|<fragment.index>|<fragment.count>|
+        //     <fragment>
+
+        QTest::newRow("frag: empty fragment")
+            << "frag|nick|1|0|2|";
+        QTest::newRow("frag: index out of range")
+            << "frag|nick|1|2|2|a";
+        QTest::newRow("frag: negative index")
+            << "frag|nick|1|-1|2|a";
+        QTest::newRow("frag: zero count")
+            << "frag|nick|1|0|0|a";
+        QTest::newRow("frag: too large count")
+            << "frag|nick|1|0|33|a";
+
+        // fragack|<text.sender.id>|<text.id>|<fragments.received>
+
+        QTest::newRow("fragack: no fragments received")
+            << "fragack|1.1.1.1|1|0";
+        QTest::newRow("fragack: too large fragments.received")
+            << "fragack|1.1.1.1|1|4294967296";
+        QTest::newRow("fragack: trailing field")
+            << "fragack|1.1.1.1|1|1|1";
+    }
+
+    void testFragmentMessageValid_data()
+    {
+        QTest::addColumn<QString>("s");
+
+        QTest::newRow("frag: typical")
+            << "frag|John Doe|113326|0|3|some text";
+        QTest::newRow("frag: last of max count, resent")
+            << "frag|nick|-1|31|32|text with '|' and\nnew-line";
+    }
+
+    void testFragmentAckMessageValid_data()
+    {
+        QTest::addColumn<QString>("s");
+
+        QTest::newRow("fragack: typical")
+            << "fragack|192.168.1.100|113326|5";
+        QTest::newRow("fragack: all of max count")
+            << "fragack|1.1.1.1|-1|4294967295";
+    }
+
     void testUserMessageValid_data()
     {
         QTest::addColumn<QString>("s");
@@ -38,6 +38,15 @@ void ContactList::removeExpiredUsers()
     }
 }
 
+void ContactList::removeAllUsers()
+{
+    QHash<QString, Contact> removed;
+    removed.swap(contacts);
+    foreach (const Contact &contact, removed) {
+        emit userLeaves(contact.id, contact.nick);
+    }
+}
+
 QSet<QString> ContactList::buildUserIds()
 {
     QSet<QString> userIds;
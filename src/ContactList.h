@@ -43,6 +43,11 @@ public:
      */
     void removeExpiredUsers();
 
+    /**
+     * Remove all the users, e.g. on leaving the chat channel.
+     */
+    void removeAllUsers();
+
     QSet<QString> buildUserIds();
 
 signals:
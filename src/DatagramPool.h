@@ -0,0 +1,249 @@
+#ifndef DATAGRAMPOOL_H
+#define DATAGRAMPOOL_H
+
+// Preallocated receive buffers, and views of received datagrams.
+
+#include <QtGlobal>
+#include <QByteArray>
+#include <QVector>
+#include <QScopedArrayPointer>
+#include <QHostAddress>
+#include <QMetaType>
+
+#include "SpscRing.h"
+
+/**
+ * Compact binary sender address; does not allocate, unlike QHostAddress
+ * and its string form.
+ */
+struct SenderAddress
+{
+    // IPv4, host byte order.
+    quint32 ip = 0;
+
+    // Transport-specific, e.g. where the sending App receives unicast
+    // datagrams; 0 if not applicable.
+    quint16 port = 0;
+
+    // Transport-specific id of the sending App among the ones sharing the
+    // address (e.g. on the same host); 0 if not applicable.
+    quint32 instance = 0;
+
+    QHostAddress toHostAddress() const
+    {
+        return QHostAddress(ip);
+    }
+
+    bool operator==(const SenderAddress &other) const
+    {
+        return ip == other.ip && port == other.port
+            && instance == other.instance;
+    }
+
+    bool operator!=(const SenderAddress &other) const
+    {
+        return !(*this == other);
+    }
+};
+
+inline uint qHash(const SenderAddress &sender, uint seed = 0)
+{
+    return qHash((quint64(sender.ip) << 32) | sender.instance, seed)
+        ^ sender.port;
+}
+
+// Is an argument of signals, e.g. of Impairment.
+Q_DECLARE_METATYPE(SenderAddress)
+
+/**
+ * MTU-sized receive buffer, owned by DatagramPool.
+ */
+struct DatagramSlot
+{
+    // Max UDP payload in a 1500-byte Ethernet MTU; larger datagrams are
+    // truncated by the kernel and dropped.
+    static const int cCapacity = 1472;
+
+    char data[cCapacity];
+
+    // Negative if the datagram has been truncated or is otherwise invalid.
+    int size = 0;
+
+    SenderAddress sender;
+
+    // Transport channel the datagram has been received on.
+    int channel = 0;
+
+    // Transport-specific index of the receiving socket within the channel
+    // (e.g. of the network interface).
+    int socketIndex = 0;
+
+    // Transport-specific monotonic time (ns) when the receiving thread has
+    // woken up to receive the datagram, for latency accounting.
+    qint64 wakeupNs = 0;
+
+    // Time (ns since the Unix epoch, as CLOCK_REALTIME) when the datagram
+    // has arrived at the host, as stamped by the kernel; 0 if unknown.
+    qint64 kernelTimestampNs = 0;
+
+    // Sent on behalf of the sender by a relay from another network.
+    bool relayed = false;
+};
+
+/**
+ * Immutable view of a received datagram; valid only while the handler
+ * it has been passed to is running.
+ */
+class DatagramView
+{
+public:
+    explicit DatagramView(const DatagramSlot &slot)
+        : dataPtr(slot.data), dataSize(slot.size), senderAddr(slot.sender),
+            channelId(slot.channel), socketIdx(slot.socketIndex),
+            kernelTimestamp(slot.kernelTimestampNs), relayedFlag(slot.relayed)
+    {}
+
+    /**
+     * View of the payload following a transport header of the slot data.
+     */
+    DatagramView(const DatagramSlot &slot, int headerSize)
+        : dataPtr(slot.data + headerSize), dataSize(slot.size - headerSize),
+            senderAddr(slot.sender), channelId(slot.channel),
+            socketIdx(slot.socketIndex),
+            kernelTimestamp(slot.kernelTimestampNs), relayedFlag(slot.relayed)
+    {}
+
+    const char *data() const
+    {
+        return dataPtr;
+    }
+
+    int size() const
+    {
+        return dataSize;
+    }
+
+    const SenderAddress &sender() const
+    {
+        return senderAddr;
+    }
+
+    int channel() const
+    {
+        return channelId;
+    }
+
+    int socketIndex() const
+    {
+        return socketIdx;
+    }
+
+    /**
+     * @return Kernel arrival time, ns since the Unix epoch; 0 if unknown.
+     */
+    qint64 kernelTimestampNs() const
+    {
+        return kernelTimestamp;
+    }
+
+    /**
+     * @return Whether the datagram has been relayed from another network;
+     * then sender() is the address of the App which has sent it there.
+     */
+    bool isRelayed() const
+    {
+        return relayedFlag;
+    }
+
+    /**
+     * @return A deep copy, for the handlers which need to keep the data.
+     */
+    QByteArray toByteArray() const
+    {
+        return QByteArray(dataPtr, dataSize);
+    }
+
+private:
+    const char *const dataPtr;
+    const int dataSize;
+    const SenderAddress senderAddr;
+    const int channelId;
+    const int socketIdx;
+    const qint64 kernelTimestamp;
+    const bool relayedFlag;
+};
+
+/**
+ * Fixed pool of DatagramSlot-s which are recycled after the datagrams are
+ * handled; nothing is allocated after construction.
+ *
+ * The pool can be used from two threads: the receiving one calls
+ * acquire() and recycle(), and the handling one calls release(). If both
+ * are the same thread, all three calls can be used interchangeably.
+ */
+class DatagramPool
+{
+public:
+    explicit DatagramPool(int slotCount)
+        : slotCount(slotCount), storage(new DatagramSlot[slotCount]),
+            freeSlots(slotCount)
+    {
+        spare.reserve(slotCount);
+        for (int i = 0; i < slotCount; ++i) {
+            spare.append(&storage[i]);
+        }
+    }
+
+    /**
+     * Receiving thread.
+     * @return nullptr if all the slots are in use.
+     */
+    DatagramSlot *acquire()
+    {
+        if (!spare.isEmpty()) {
+            DatagramSlot *slot = spare.last();
+            spare.removeLast();
+            return slot;
+        }
+
+        DatagramSlot *slot = nullptr;
+        freeSlots.pop(&slot);
+        return slot;
+    }
+
+    /**
+     * Receiving thread: return a slot which has not been handed over.
+     */
+    void recycle(DatagramSlot *slot)
+    {
+        spare.append(slot);
+    }
+
+    /**
+     * Handling thread: return a slot after its datagram is handled.
+     */
+    void release(DatagramSlot *slot)
+    {
+        // Never fails: the ring has room for all the slots.
+        freeSlots.push(slot);
+    }
+
+    int getSlotCount() const
+    {
+        return slotCount;
+    }
+
+private:
+    const int slotCount;
+    QScopedArrayPointer<DatagramSlot> storage;
+
+    // Slots released by the handling thread.
+    SpscRing<DatagramSlot *> freeSlots;
+
+    // Slots owned by the receiving thread; never reallocates.
+    QVector<DatagramSlot *> spare;
+
+    Q_DISABLE_COPY(DatagramPool)
+};
+
+#endif // DATAGRAMPOOL_H
@@ -0,0 +1,91 @@
+#ifndef DUPLICATEFILTER_H
+#define DUPLICATEFILTER_H
+
+// Cheap detection of datagrams received more than once via different paths.
+
+#include <QtGlobal>
+#include <QVector>
+
+#include "DatagramPool.h"
+
+/**
+ * Remembers hashes of recently received datagrams (including the channel
+ * and the sender instance) in a direct-mapped table, and reports a
+ * datagram as duplicate if the same hash has been seen within the window.
+ * The sender IP is not hashed: a multi-homed App sends the copies from
+ * several IPs.
+ *
+ * Hash collisions in the table only evict older entries, thus, a duplicate
+ * can occasionally pass (the chat protocol tolerates it), but a distinct
+ * datagram is never reported as duplicate unless its 64-bit hash matches.
+ */
+class DuplicateFilter
+{
+public:
+    /**
+     * @param tableSize Rounded up to a power of 2.
+     * @param windowMs Should be less than the period of legitimately
+     * repeated datagrams (e.g. advertising).
+     */
+    DuplicateFilter(int tableSize, qint64 windowMs)
+        : windowMs(windowMs)
+    {
+        int size = 1;
+        while (size < tableSize) {
+            size <<= 1;
+        }
+        mask = size - 1;
+        table.resize(size);
+    }
+
+    /**
+     * @return Whether the datagram has been seen within the window;
+     * otherwise, remembers it.
+     */
+    bool isDuplicate(const DatagramSlot &slot, qint64 nowMs)
+    {
+        const quint64 hash = hashOf(slot);
+        Entry &entry = table[int(hash & mask)];
+
+        if (entry.hash == hash && nowMs - entry.timeMs <= windowMs) {
+            return true;
+        }
+
+        entry.hash = hash;
+        entry.timeMs = nowMs;
+        return false;
+    }
+
+    /**
+     * FNV-1a over the channel, the sender instance and the payload.
+     */
+    static quint64 hashOf(const DatagramSlot &slot)
+    {
+        quint64 hash = Q_UINT64_C(14695981039346656037);
+        hash = mix(hash, &slot.channel, sizeof(slot.channel));
+        hash = mix(hash, &slot.sender.instance, sizeof(slot.sender.instance));
+        return mix(hash, slot.data, slot.size);
+    }
+
+private:
+    struct Entry
+    {
+        quint64 hash = 0;
+        qint64 timeMs = 0;
+    };
+
+    const qint64 windowMs;
+    quint64 mask = 0;
+    QVector<Entry> table;
+
+    static quint64 mix(quint64 hash, const void *data, int size)
+    {
+        const uchar *bytes = static_cast<const uchar *>(data);
+        for (int i = 0; i < size; ++i) {
+            hash = (hash ^ bytes[i]) * Q_UINT64_C(1099511628211);
+        }
+        return hash;
+    }
+};
+
+#endif // DUPLICATEFILTER_H
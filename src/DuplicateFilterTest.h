@@ -0,0 +1,67 @@
+#ifndef DUPLICATEFILTERTEST_H
+#define DUPLICATEFILTERTEST_H
+
+#include <QtTest>
+
+#include "DuplicateFilter.h"
+
+class DuplicateFilterTest : public QObject
+{
+    Q_OBJECT
+private:
+    static void fill(DatagramSlot *slot, const QByteArray &data,
+        quint32 senderInstance, quint32 senderIp = 1)
+    {
+        memcpy(slot->data, data.constData(), data.size());
+        slot->size = data.size();
+        slot->sender.ip = senderIp;
+        slot->sender.port = 42424;
+        slot->sender.instance = senderInstance;
+    }
+
+private slots:
+    void testDuplicateWithinWindow()
+    {
+        DuplicateFilter filter(16, 100);
+        DatagramSlot slot;
+        fill(&slot, "user|nick", 1);
+
+        QVERIFY(!filter.isDuplicate(slot, 1000));
+        QVERIFY(filter.isDuplicate(slot, 1050));
+    }
+
+    void testRepeatAfterWindow()
+    {
+        DuplicateFilter filter(16, 100);
+        DatagramSlot slot;
+        fill(&slot, "user|nick", 1);
+
+        QVERIFY(!filter.isDuplicate(slot, 1000));
+        QVERIFY(!filter.isDuplicate(slot, 1200));
+    }
+
+    void testSamePayloadFromOtherSender()
+    {
+        DuplicateFilter filter(16, 100);
+        DatagramSlot slot;
+        fill(&slot, "ack|1.1.1.1|1", 1);
+        QVERIFY(!filter.isDuplicate(slot, 1000));
+
+        fill(&slot, "ack|1.1.1.1|1", 2);
+        QVERIFY(!filter.isDuplicate(slot, 1000));
+    }
+
+    void testSameSenderFromOtherIp()
+    {
+        DuplicateFilter filter(16, 100);
+        DatagramSlot slot;
+        fill(&slot, "user|nick", 1, 1);
+        QVERIFY(!filter.isDuplicate(slot, 1000));
+
+        // Sent via another interface of the same App.
+        fill(&slot, "user|nick", 1, 2);
+        QVERIFY(filter.isDuplicate(slot, 1000));
+    }
+};
+
+#endif // DUPLICATEFILTERTEST_H
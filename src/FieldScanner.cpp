@@ -0,0 +1,346 @@
+#include "FieldScanner.h"
+
+#include <string.h>
+#include <QtAlgorithms>
+
+// Without -mavx2, the AVX2 chunk scanner is still built, for the CPUs
+// which support it, chosen at run time.
+#if defined(__SSE2__) && !defined(__AVX2__) && defined(__GNUC__)
+#define AVX2_AT_RUNTIME
+#define AVX2_TARGET __attribute__((target("avx2")))
+#else
+#define AVX2_TARGET
+#endif
+
+#if defined(__AVX2__) || defined(AVX2_AT_RUNTIME)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////
+// Chunk scanners: bit k of each mask is of byte k of the chunk.
+
+#if defined(__AVX2__) || defined(AVX2_AT_RUNTIME)
+
+struct Avx2Chunk
+{
+    static const int cSize = 32;
+
+    AVX2_TARGET
+    static inline void scan(const char *chunk, quint64 *pPipes,
+        quint64 *pNewLines, quint64 *pNonAscii)
+    {
+        const __m256i bytes = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(chunk));
+        *pPipes = quint32(_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('|'))));
+        *pNewLines = quint32(_mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n'))));
+        *pNonAscii = quint32(_mm256_movemask_epi8(bytes));
+    }
+
+    AVX2_TARGET
+    static inline bool isAscii(const char *chunk)
+    {
+        return _mm256_movemask_epi8(_mm256_loadu_si256(
+            reinterpret_cast<const __m256i *>(chunk))) == 0;
+    }
+};
+
+#endif
+
+#if defined(__SSE2__)
+
+struct Sse2Chunk
+{
+    static const int cSize = 16;
+
+    static inline void scan(const char *chunk, quint64 *pPipes,
+        quint64 *pNewLines, quint64 *pNonAscii)
+    {
+        const __m128i bytes = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(chunk));
+        *pPipes = quint32(_mm_movemask_epi8(
+            _mm_cmpeq_epi8(bytes, _mm_set1_epi8('|'))));
+        *pNewLines = quint32(_mm_movemask_epi8(
+            _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n'))));
+        *pNonAscii = quint32(_mm_movemask_epi8(bytes));
+    }
+
+    static inline bool isAscii(const char *chunk)
+    {
+        return _mm_movemask_epi8(_mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(chunk))) == 0;
+    }
+};
+
+#endif
+
+struct ScalarChunk
+{
+    static const int cSize = 8;
+
+    static inline void scan(const char *chunk, quint64 *pPipes,
+        quint64 *pNewLines, quint64 *pNonAscii)
+    {
+        *pPipes = 0;
+        *pNewLines = 0;
+        *pNonAscii = 0;
+        for (int k = 0; k < cSize; ++k) {
+            *pPipes |= quint64(chunk[k] == '|') << k;
+            *pNewLines |= quint64(chunk[k] == '\n') << k;
+            *pNonAscii |= quint64(uchar(chunk[k]) >> 7) << k;
+        }
+    }
+
+    static inline bool isAscii(const char *chunk)
+    {
+        quint64 bytes;
+        memcpy(&bytes, chunk, sizeof(bytes));
+        return (bytes & Q_UINT64_C(0x8080808080808080)) == 0;
+    }
+};
+
+// The best one the build targets.
+#if defined(__AVX2__)
+typedef Avx2Chunk BuildChunk;
+#elif defined(__SSE2__)
+typedef Sse2Chunk BuildChunk;
+#else
+typedef ScalarChunk BuildChunk;
+#endif
+
+///////////////////////////////////////////////////////////////////////////
+// Utils.
+
+/**
+ * @return Size of the valid UTF-8 sequence starting at p, or 0 if it is
+ * invalid: truncated, overlong, a surrogate, or above U+10FFFF (RFC 3629).
+ */
+static int utf8SequenceSize(const uchar *p, const uchar *end)
+{
+    const uchar lead = p[0];
+    if (lead < 0x80) {
+        return 1;
+    }
+
+    // Ranges of the second byte; of the others, always [0x80, 0xBF].
+    int size;
+    uchar min = 0x80;
+    uchar max = 0xBF;
+    if (lead >= 0xC2 && lead <= 0xDF) {
+        size = 2;
+    } else if (lead == 0xE0) {
+        size = 3;
+        min = 0xA0;
+    } else if (lead == 0xED) {
+        size = 3;
+        max = 0x9F;
+    } else if (lead >= 0xE1 && lead <= 0xEF) {
+        size = 3;
+    } else if (lead == 0xF0) {
+        size = 4;
+        min = 0x90;
+    } else if (lead == 0xF4) {
+        size = 4;
+        max = 0x8F;
+    } else if (lead >= 0xF1 && lead <= 0xF3) {
+        size = 4;
+    } else {
+        return 0;
+    }
+
+    if (end - p < size || p[1] < min || p[1] > max) {
+        return 0;
+    }
+    for (int i = 2; i < size; ++i) {
+        if (p[i] < 0x80 || p[i] > 0xBF) {
+            return 0;
+        }
+    }
+    return size;
+}
+
+/**
+ * @return Offset of the first bit set within [from, to), or -1.
+ */
+static int findBit(const quint64 *mask, int from, int to)
+{
+    if (from >= to) {
+        return -1;
+    }
+
+    int word = from / 64;
+    quint64 bits = mask[word] & (~quint64(0) << (from % 64));
+    for (;;) {
+        if (bits != 0) {
+            const int offset = word * 64 + int(qCountTrailingZeroBits(bits));
+            return offset < to ? offset : -1;
+        }
+        if (++word * 64 >= to) {
+            return -1;
+        }
+        bits = mask[word];
+    }
+}
+
+/**
+ * Indexes the data like FieldScanner::scan(), in chunks of the scanner;
+ * the masks should be zeroed.
+ * @return Whether the data has invalid UTF-8.
+ */
+template <class Chunk>
+static inline bool scanChunks(const char *data, int size, quint64 *pipes,
+    quint64 *newLines, quint64 *invalid)
+{
+    const uchar *const bytes = reinterpret_cast<const uchar *>(data);
+    bool hasInvalid = false;
+
+    // UTF-8 is valid up to here; a multi-byte sequence validated at the end
+    // of a chunk may extend into the next one.
+    int validated = 0;
+
+    for (int i = 0; i < size; i += Chunk::cSize) {
+        // The tail is padded with zeros, which are neither delimiters, nor
+        // non-ASCII.
+        const char *chunk = data + i;
+        char padded[Chunk::cSize];
+        if (size - i < Chunk::cSize) {
+            memset(padded, 0, Chunk::cSize);
+            memcpy(padded, chunk, size - i);
+            chunk = padded;
+        }
+
+        quint64 chunkPipes;
+        quint64 chunkNewLines;
+        quint64 nonAscii;
+        Chunk::scan(chunk, &chunkPipes, &chunkNewLines, &nonAscii);
+        pipes[i / 64] |= chunkPipes << (i % 64);
+        newLines[i / 64] |= chunkNewLines << (i % 64);
+
+        const int chunkEnd = qMin(i + Chunk::cSize, size);
+        if (nonAscii == 0) {
+            validated = qMax(validated, chunkEnd);
+            continue;
+        }
+        while (validated < chunkEnd) {
+            const int sequenceSize = utf8SequenceSize(
+                bytes + validated, bytes + size);
+            if (sequenceSize == 0) {
+                invalid[validated / 64] |= quint64(1) << (validated % 64);
+                hasInvalid = true;
+                ++validated;
+            } else {
+                validated += sequenceSize;
+            }
+        }
+    }
+    return hasInvalid;
+}
+
+template <class Chunk>
+static inline bool isValidUtf8InChunks(const char *data, int size)
+{
+    const uchar *const bytes = reinterpret_cast<const uchar *>(data);
+    int pos = 0;
+    while (pos < size) {
+        if (size - pos >= Chunk::cSize && Chunk::isAscii(data + pos)) {
+            pos += Chunk::cSize;
+            continue;
+        }
+        const int sequenceSize = utf8SequenceSize(
+            bytes + pos, bytes + size);
+        if (sequenceSize == 0) {
+            return false;
+        }
+        pos += sequenceSize;
+    }
+    return true;
+}
+
+#if defined(AVX2_AT_RUNTIME)
+
+// Flattened, so that the chunk scanner is inlined into the AVX2 code
+// rather than called per chunk.
+
+AVX2_TARGET __attribute__((flatten))
+static bool scanAvx2Chunks(const char *data, int size, quint64 *pipes,
+    quint64 *newLines, quint64 *invalid)
+{
+    return scanChunks<Avx2Chunk>(data, size, pipes, newLines, invalid);
+}
+
+AVX2_TARGET __attribute__((flatten))
+static bool isValidUtf8InAvx2Chunks(const char *data, int size)
+{
+    return isValidUtf8InChunks<Avx2Chunk>(data, size);
+}
+
+static bool isAvx2Supported()
+{
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+
+#endif // defined(AVX2_AT_RUNTIME)
+
+///////////////////////////////////////////////////////////////////////////
+
+FieldScanner::FieldScanner(const char *data, int size)
+    : data(data), indexed(size <= cMaxIndexedSize)
+{
+    if (indexed) {
+        scan(size);
+    }
+}
+
+void FieldScanner::scan(int size)
+{
+    const int words = (size + 63) / 64;
+    memset(pipes, 0, words * sizeof(quint64));
+    memset(newLines, 0, words * sizeof(quint64));
+    memset(invalid, 0, words * sizeof(quint64));
+
+#if defined(AVX2_AT_RUNTIME)
+    if (isAvx2Supported()) {
+        hasInvalid = scanAvx2Chunks(data, size, pipes, newLines, invalid);
+        return;
+    }
+#endif
+    hasInvalid = scanChunks<BuildChunk>(data, size, pipes, newLines,
+        invalid);
+}
+
+bool FieldScanner::isValidUtf8Range(const char *begin, const char *end)
+    const
+{
+    if (!indexed) {
+        return isValidUtf8(begin, int(end - begin));
+    }
+    return !hasInvalid
+        || findBit(invalid, int(begin - data), int(end - data)) == -1;
+}
+
+const char *FieldScanner::findDelimiter(char delimiter, const char *begin,
+    const char *end) const
+{
+    if (!indexed) {
+        return static_cast<const char *>(
+            memchr(begin, delimiter, end - begin));
+    }
+
+    const int offset = findBit(delimiter == '|' ? pipes : newLines,
+        int(begin - data), int(end - data));
+    return offset == -1 ? nullptr : data + offset;
+}
+
+bool FieldScanner::isValidUtf8(const char *data, int size)
+{
+#if defined(AVX2_AT_RUNTIME)
+    if (isAvx2Supported()) {
+        return isValidUtf8InAvx2Chunks(data, size);
+    }
+#endif
+    return isValidUtf8InChunks<BuildChunk>(data, size);
+}
@@ -0,0 +1,72 @@
+#ifndef FIELDSCANNER_H
+#define FIELDSCANNER_H
+
+// One-pass UTF-8 validation and delimiter indexing of text payloads.
+
+#include <QtGlobal>
+
+/**
+ * Scans a payload once, using SIMD with a scalar fallback: validates
+ * UTF-8, and indexes the '|' and '\n' delimiters in bitmaps, thus, the
+ * parser finds each delimiter and checks each field without rescanning
+ * the bytes.
+ *
+ * SSE2 is used if the build targets it (as any x86-64 one does), and AVX2
+ * if the CPU supports it, checked at run time (GCC and Clang builds); a
+ * build with QMAKE_CXXFLAGS+=-mavx2 uses AVX2 without the check, and
+ * requires it.
+ *
+ * Payloads longer than cMaxIndexedSize are not scanned upfront; then the
+ * lookups scan the requested ranges instead.
+ */
+class FieldScanner
+{
+public:
+    // Covers any datagram.
+    static const int cMaxIndexedSize = 2048;
+
+    /**
+     * Scans the data, which should outlive the scanner.
+     */
+    FieldScanner(const char *data, int size);
+
+    /**
+     * @param begin, end Within the scanned data.
+     * @return Whether no invalid UTF-8 sequence starts within the range
+     * (a sequence cut by a delimiter, or by the end of the data, is
+     * invalid).
+     */
+    bool isValidUtf8Range(const char *begin, const char *end) const;
+
+    /**
+     * @param delimiter Either '|' or '\n'.
+     * @param begin, end Within the scanned data.
+     * @return The first delimiter within the range, or nullptr.
+     */
+    const char *findDelimiter(char delimiter, const char *begin,
+        const char *end) const;
+
+    /**
+     * Validate the data without indexing it.
+     */
+    static bool isValidUtf8(const char *data, int size);
+
+private:
+    static const int cMaskWords = cMaxIndexedSize / 64;
+
+    const char *const data;
+    const bool indexed;
+
+    // Bit i of each is of byte i of the data; only the words covering the
+    // data are initialized.
+    quint64 pipes[cMaskWords];
+    quint64 newLines[cMaskWords];
+
+    // Lead bytes of invalid UTF-8 sequences.
+    quint64 invalid[cMaskWords];
+    bool hasInvalid = false;
+
+    void scan(int size);
+};
+
+#endif // FIELDSCANNER_H
@@ -0,0 +1,99 @@
+#ifndef FIELDSCANNERTEST_H
+#define FIELDSCANNERTEST_H
+
+#include <QtTest>
+
+#include "FieldScanner.h"
+
+class FieldScannerTest : public QObject
+{
+    Q_OBJECT
+private:
+    static bool isValid(const QByteArray &bytes)
+    {
+        const FieldScanner scanner(bytes.constData(), bytes.size());
+        const bool valid = scanner.isValidUtf8Range(
+            bytes.constData(), bytes.constData() + bytes.size());
+        if (valid != FieldScanner::isValidUtf8(
+                bytes.constData(), bytes.size())) {
+            qFatal("Indexed and unindexed validation disagree.");
+        }
+        return valid;
+    }
+
+private slots:
+    void testDelimiters()
+    {
+        // Longer than any chunk, so that the delimiters cross the chunks
+        // and the mask words.
+        QByteArray payload(200, 'a');
+        payload[0] = '|';
+        payload[63] = '|';
+        payload[64] = '\n';
+        payload[150] = '|';
+        payload[199] = '|';
+        const char *data = payload.constData();
+        const FieldScanner scanner(data, payload.size());
+        const char *end = data + payload.size();
+
+        QVERIFY(scanner.findDelimiter('|', data, end) == data);
+        QVERIFY(scanner.findDelimiter('|', data + 1, end) == data + 63);
+        QVERIFY(scanner.findDelimiter('|', data + 64, end) == data + 150);
+        QVERIFY(scanner.findDelimiter('|', data + 151, end) == data + 199);
+        QVERIFY(scanner.findDelimiter('|', data + 151, end - 1) == nullptr);
+        QVERIFY(scanner.findDelimiter('|', data + 5, data + 5) == nullptr);
+        QVERIFY(scanner.findDelimiter('\n', data, end) == data + 64);
+        QVERIFY(scanner.findDelimiter('\n', data + 65, end) == nullptr);
+    }
+
+    void testUnindexed()
+    {
+        QByteArray payload(FieldScanner::cMaxIndexedSize + 10, 'a');
+        payload[payload.size() - 3] = '|';
+        const char *data = payload.constData();
+        const FieldScanner scanner(data, payload.size());
+
+        QVERIFY(scanner.findDelimiter('|', data, data + payload.size())
+            == data + payload.size() - 3);
+        QVERIFY(scanner.isValidUtf8Range(data, data + payload.size()));
+    }
+
+    void testUtf8()
+    {
+        QVERIFY(isValid(""));
+        QVERIFY(isValid("plain ASCII"));
+        QVERIFY(isValid(QString::fromUtf8(
+            "\xD0\x9F\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82").toUtf8()));
+        QVERIFY(isValid("\xE2\x82\xAC"));
+        QVERIFY(isValid("\xF0\x9F\x98\x80"));
+        QVERIFY(isValid("\xF4\x8F\xBF\xBF"));
+
+        QVERIFY(!isValid("\x80"));
+        QVERIFY(!isValid("\xC0\xAF")); //< Overlong.
+        QVERIFY(!isValid("\xE0\x80\xAF")); //< Overlong.
+        QVERIFY(!isValid("\xED\xA0\x80")); //< Surrogate.
+        QVERIFY(!isValid("\xF4\x90\x80\x80")); //< Above U+10FFFF.
+        QVERIFY(!isValid("\xF5\x80\x80\x80"));
+        QVERIFY(!isValid("\xE2\x82")); //< Truncated.
+
+        // A sequence crossing a chunk boundary.
+        QByteArray payload(31, 'a');
+        QVERIFY(isValid(payload + "\xF0\x9F\x98\x80" + payload));
+        QVERIFY(!isValid(payload + "\xF0\x9F\x98" + payload));
+    }
+
+    void testUtf8Range()
+    {
+        // A sequence cut by a delimiter is invalid, but only within the
+        // range where it starts.
+        const QByteArray payload = "ok|\xD0|\xD1\x80";
+        const char *data = payload.constData();
+        const FieldScanner scanner(data, payload.size());
+
+        QVERIFY(scanner.isValidUtf8Range(data, data + 2));
+        QVERIFY(!scanner.isValidUtf8Range(data + 3, data + 4));
+        QVERIFY(scanner.isValidUtf8Range(data + 5, data + payload.size()));
+    }
+};
+
+#endif // FIELDSCANNERTEST_H
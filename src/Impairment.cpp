@@ -0,0 +1,117 @@
+#include "Impairment.h"
+
+const Impairment::Settings Impairment::defaultSettings;
+
+Impairment::Impairment(QObject *parent, const Settings &settings)
+    : QObject(parent), settings(settings), random(settings.seed),
+        uniform(0, 1)
+{
+    clock.start();
+
+    releaseTimer.setSingleShot(true);
+    connect(&releaseTimer, SIGNAL(timeout()), this, SLOT(releaseDue()));
+}
+
+bool Impairment::chance(double probability)
+{
+    // Not drawing for zero probability keeps the sequences of the other
+    // decisions independent of disabled impairments.
+    return probability > 0 && uniform(random) < probability;
+}
+
+int Impairment::impair(const char *data, int size, int channel,
+    const SenderAddress &sender)
+{
+    ++stats.datagrams;
+
+    if (burst) {
+        burst = !chance(settings.burstEndProbability);
+    } else {
+        burst = chance(settings.burstStartProbability);
+    }
+
+    if (burst && chance(settings.burstLossProbability)) {
+        ++stats.burstLosses;
+        return 0;
+    }
+
+    if (chance(settings.lossProbability)) {
+        ++stats.randomLosses;
+        return 0;
+    }
+
+    const int copies = chance(settings.duplicationProbability) ? 2 : 1;
+    if (copies == 2) {
+        ++stats.duplicated;
+    }
+
+    const qint64 nowMs = clock.elapsed();
+    int immediate = 0;
+    for (int i = 0; i < copies; ++i) {
+        const qint64 delay = delayOf(size, nowMs);
+        if (delay < 0) {
+            ++stats.queueLosses;
+        } else if (delay == 0) {
+            ++immediate;
+        } else {
+            ++stats.delayed;
+            hold(nowMs + delay, data, size, channel, sender);
+        }
+    }
+    return immediate;
+}
+
+qint64 Impairment::delayOf(int size, qint64 nowMs)
+{
+    double delayMs = settings.delayMs;
+    if (settings.jitterMs > 0) {
+        delayMs += (uniform(random) * 2 - 1) * settings.jitterMs;
+    }
+
+    if (chance(settings.reorderProbability)) {
+        ++stats.reordered;
+        delayMs += settings.reorderDelayMs;
+    }
+
+    if (settings.bandwidthBytesPerSec > 0) {
+        const double queueDelayMs = qMax(0.0, linkFreeAtMs - nowMs);
+        if (queueDelayMs > settings.maxQueueDelayMs) {
+            return -1;
+        }
+
+        const double transmitMs =
+            size * 1000.0 / settings.bandwidthBytesPerSec;
+        linkFreeAtMs = nowMs + queueDelayMs + transmitMs;
+        delayMs += queueDelayMs + transmitMs;
+    }
+
+    return qMax(qint64(0), qint64(delayMs + 0.5));
+}
+
+void Impairment::hold(qint64 dueMs, const char *data, int size, int channel,
+    const SenderAddress &sender)
+{
+    held.insert(qMakePair(dueMs, heldSequence++),
+        Held{QByteArray(data, size), channel, sender});
+
+    const qint64 firstDueMs = held.firstKey().first;
+    const int timeoutMs = int(qMax(qint64(0), firstDueMs - clock.elapsed()));
+    if (!releaseTimer.isActive()
+        || releaseTimer.remainingTime() > timeoutMs) {
+
+        releaseTimer.start(timeoutMs);
+    }
+}
+
+void Impairment::releaseDue()
+{
+    while (!held.isEmpty() && held.firstKey().first <= clock.elapsed()) {
+        const Held datagram = held.take(held.firstKey());
+        emit released(datagram.datagram, datagram.channel, datagram.sender);
+    }
+
+    if (!held.isEmpty()) {
+        releaseTimer.start(int(qMax(qint64(0),
+            held.firstKey().first - clock.elapsed())));
+    }
+}
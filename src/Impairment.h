@@ -0,0 +1,148 @@
+#ifndef IMPAIRMENT_H
+#define IMPAIRMENT_H
+
+// Simulator of network impairments, for testing against UDP unreliability.
+
+#include <QObject>
+#include <QByteArray>
+
+#include "DatagramPool.h"
+
+// private:
+#include <random>
+#include <QMap>
+#include <QPair>
+#include <QTimer>
+#include <QElapsedTimer>
+
+/**
+ * Passes datagrams through a simulated impaired link: each datagram can be
+ * lost (at random, or in bursts per the Gilbert-Elliott model), delayed
+ * with jitter, held back to be reordered, duplicated, and queued behind
+ * the previous ones on a link of limited bandwidth.
+ *
+ * The random decisions are reproducible for the same seed and the same
+ * sequence of datagrams (but not the timing-dependent bandwidth queueing).
+ *
+ * The copies which can be passed right away are only counted by impair(),
+ * so that the caller can pass the original without copying; delayed
+ * copies are emitted via released() later.
+ */
+class Impairment : public QObject
+{
+    Q_OBJECT
+public:
+    struct Settings
+    {
+        quint32 seed = 1;
+
+        // Probability of losing each datagram independently.
+        double lossProbability = 0;
+
+        // Gilbert-Elliott model: probabilities of the transitions between
+        // the Good and the Bad state (per datagram), and of losing a
+        // datagram in the Bad state (the Good state loses none).
+        double burstStartProbability = 0;
+        double burstEndProbability = 1;
+        double burstLossProbability = 1;
+
+        // Each datagram is delayed by delayMs +- a uniformly random
+        // jitter of up to jitterMs.
+        int delayMs = 0;
+        int jitterMs = 0;
+
+        // Probability of holding a datagram back by reorderDelayMs, so
+        // that the subsequent ones overtake it.
+        double reorderProbability = 0;
+        int reorderDelayMs = 50;
+
+        // Probability of passing an extra copy of a datagram.
+        double duplicationProbability = 0;
+
+        // Zero means unlimited. Datagrams which would wait for the link
+        // longer than maxQueueDelayMs are lost (tail drop).
+        int bandwidthBytesPerSec = 0;
+        int maxQueueDelayMs = 1000;
+
+        bool isEnabled() const
+        {
+            return lossProbability > 0 || burstStartProbability > 0
+                || delayMs > 0 || jitterMs > 0 || reorderProbability > 0
+                || duplicationProbability > 0 || bandwidthBytesPerSec > 0;
+        }
+    };
+
+    static const Settings defaultSettings;
+
+    struct Stats
+    {
+        quint64 datagrams = 0;
+        quint64 randomLosses = 0;
+        quint64 burstLosses = 0;
+        quint64 queueLosses = 0;
+        quint64 reordered = 0;
+        quint64 duplicated = 0;
+        quint64 delayed = 0;
+    };
+
+    Impairment(QObject *parent, const Settings &settings);
+
+    /**
+     * @return Number of copies of the datagram to pass right away (0, 1
+     * or 2); the delayed copies are held (copied) and emitted later.
+     */
+    int impair(const char *data, int size, int channel,
+        const SenderAddress &sender);
+
+    Stats getStats() const
+    {
+        return stats;
+    }
+
+signals:
+    /**
+     * Emitted for each delayed copy when its time comes.
+     */
+    void released(QByteArray datagram, int channel, SenderAddress sender);
+
+private slots:
+    void releaseDue();
+
+private:
+    const Settings settings;
+    Stats stats;
+
+    std::mt19937 random;
+    std::uniform_real_distribution<double> uniform;
+    bool burst = false;
+
+    QElapsedTimer clock;
+
+    // Time when the link finishes transmitting the queued datagrams.
+    double linkFreeAtMs = 0;
+
+    struct Held
+    {
+        QByteArray datagram;
+        int channel;
+        SenderAddress sender;
+    };
+
+    // Keyed by due time and sequence number, to keep the order of the
+    // datagrams due at the same time.
+    QMap<QPair<qint64, quint64>, Held> held;
+    quint64 heldSequence = 0;
+    QTimer releaseTimer;
+
+    bool chance(double probability);
+
+    /**
+     * @return Delay of a copy in ms, or -1 if it is lost.
+     */
+    qint64 delayOf(int size, qint64 nowMs);
+
+    void hold(qint64 dueMs, const char *data, int size, int channel,
+        const SenderAddress &sender);
+};
+
+#endif // IMPAIRMENT_H
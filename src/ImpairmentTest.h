@@ -0,0 +1,92 @@
+#ifndef IMPAIRMENTTEST_H
+#define IMPAIRMENTTEST_H
+
+#include <QtTest>
+
+#include "Impairment.h"
+
+class ImpairmentTest : public QObject
+{
+    Q_OBJECT
+private:
+    static const int cCount = 1000;
+
+    /**
+     * @return Number of copies passed right away, over cCount datagrams.
+     */
+    static int impairMany(Impairment *impairment)
+    {
+        int passed = 0;
+        for (int i = 0; i < cCount; ++i) {
+            passed += impairment->impair("user|nick", 9, 0, SenderAddress());
+        }
+        return passed;
+    }
+
+private slots:
+    void testDisabledPassesAll()
+    {
+        QVERIFY(!Impairment::defaultSettings.isEnabled());
+
+        Impairment impairment(nullptr, Impairment::defaultSettings);
+        QCOMPARE(impairMany(&impairment), cCount);
+    }
+
+    void testRandomLossIsReproducible()
+    {
+        Impairment::Settings settings;
+        settings.lossProbability = 0.3;
+
+        Impairment first(nullptr, settings);
+        Impairment second(nullptr, settings);
+        const int passed = impairMany(&first);
+
+        QCOMPARE(impairMany(&second), passed);
+        QVERIFY(passed > cCount * 6 / 10 && passed < cCount * 8 / 10);
+        QCOMPARE(int(first.getStats().randomLosses), cCount - passed);
+    }
+
+    void testBurstLoss()
+    {
+        // Bursts of 10 datagrams on average, every 100 datagrams.
+        Impairment::Settings settings;
+        settings.burstStartProbability = 0.01;
+        settings.burstEndProbability = 0.1;
+
+        Impairment impairment(nullptr, settings);
+        const int passed = impairMany(&impairment);
+
+        QVERIFY(passed < cCount);
+        QCOMPARE(int(impairment.getStats().burstLosses), cCount - passed);
+        QCOMPARE(int(impairment.getStats().randomLosses), 0);
+    }
+
+    void testDuplication()
+    {
+        Impairment::Settings settings;
+        settings.duplicationProbability = 1;
+
+        Impairment impairment(nullptr, settings);
+        QCOMPARE(impairMany(&impairment), cCount * 2);
+    }
+
+    void testDelay()
+    {
+        Impairment::Settings settings;
+        settings.delayMs = 20;
+
+        Impairment impairment(nullptr, settings);
+        QSignalSpy released(&impairment,
+            SIGNAL(released(QByteArray,int,SenderAddress)));
+
+        QCOMPARE(impairment.impair("a", 1, 0, SenderAddress()), 0);
+        QCOMPARE(impairment.impair("b", 1, 0, SenderAddress()), 0);
+        QVERIFY(released.isEmpty());
+
+        QTRY_COMPARE(released.size(), 2);
+        QCOMPARE(released.at(0).at(0).toByteArray(), QByteArray("a"));
+        QCOMPARE(released.at(1).at(0).toByteArray(), QByteArray("b"));
+    }
+};
+
+#endif // IMPAIRMENTTEST_H
@@ -0,0 +1,110 @@
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+// Cheap accumulation of latency distributions.
+
+#include <QtGlobal>
+#include <QString>
+
+/**
+ * Histogram with power-of-2 buckets of microseconds: bucket 0 counts the
+ * latencies below 1 us, bucket i > 0 counts the ones in [2^(i-1), 2^i) us,
+ * and the last bucket also counts all the larger ones. Adding a sample does
+ * not allocate; percentiles are reported as bucket upper bounds.
+ */
+class LatencyHistogram
+{
+public:
+    static const int cBucketCount = 32;
+
+    /**
+     * Negative latencies (e.g. after the wall clock has been adjusted) are
+     * counted as zero.
+     */
+    void add(qint64 latencyNs)
+    {
+        latencyNs = qMax(qint64(0), latencyNs);
+        ++buckets[bucketOf(latencyNs)];
+        ++count;
+        totalNs += quint64(latencyNs);
+        maxNs = qMax(maxNs, latencyNs);
+    }
+
+    quint64 getCount() const
+    {
+        return count;
+    }
+
+    quint64 getBucketCount(int bucket) const
+    {
+        return buckets[bucket];
+    }
+
+    /**
+     * @return Exclusive upper bound of the bucket, except the last one.
+     */
+    static qint64 getBucketUpperBoundNs(int bucket)
+    {
+        return (qint64(1) << bucket) * 1000;
+    }
+
+    qint64 getMaxNs() const
+    {
+        return maxNs;
+    }
+
+    qint64 getMeanNs() const
+    {
+        return count == 0 ? 0 : qint64(totalNs / count);
+    }
+
+    /**
+     * @param percentile In [0, 100].
+     * @return Upper bound of the bucket containing the percentile, but not
+     * more than the max; 0 if empty.
+     */
+    qint64 getPercentileNs(double percentile) const
+    {
+        const quint64 rank = quint64(percentile / 100 * count);
+        quint64 seen = 0;
+        for (int i = 0; i < cBucketCount; ++i) {
+            seen += buckets[i];
+            if (seen > rank || seen == count) {
+                return qMin(maxNs, getBucketUpperBoundNs(i));
+            }
+        }
+        return maxNs;
+    }
+
+    /**
+     * E.g. "n=10 mean=12us p50<=16us p99<=64us max=50us".
+     */
+    QString toString() const
+    {
+        return QString("n=%1 mean=%2us p50<=%3us p99<=%4us max=%5us")
+            .arg(count)
+            .arg(getMeanNs() / 1000)
+            .arg(getPercentileNs(50) / 1000)
+            .arg(getPercentileNs(99) / 1000)
+            .arg(maxNs / 1000);
+    }
+
+private:
+    quint64 buckets[cBucketCount] = {};
+    quint64 count = 0;
+    quint64 totalNs = 0;
+    qint64 maxNs = 0;
+
+    static int bucketOf(qint64 latencyNs)
+    {
+        qint64 us = latencyNs / 1000;
+        int bucket = 0;
+        while (us > 0 && bucket < cBucketCount - 1) {
+            us >>= 1;
+            ++bucket;
+        }
+        return bucket;
+    }
+};
+
+#endif // LATENCYHISTOGRAM_H
@@ -0,0 +1,47 @@
+#ifndef LATENCYHISTOGRAMTEST_H
+#define LATENCYHISTOGRAMTEST_H
+
+#include <QtTest>
+
+#include "LatencyHistogram.h"
+
+class LatencyHistogramTest : public QObject
+{
+    Q_OBJECT
+private slots:
+    void testBuckets()
+    {
+        LatencyHistogram histogram;
+        histogram.add(-5);
+        histogram.add(999);
+        histogram.add(1000);
+        histogram.add(3999);
+        histogram.add(qint64(1) << 62);
+
+        QCOMPARE(int(histogram.getCount()), 5);
+        QCOMPARE(int(histogram.getBucketCount(0)), 2);
+        QCOMPARE(int(histogram.getBucketCount(1)), 1);
+        QCOMPARE(int(histogram.getBucketCount(2)), 1);
+        QCOMPARE(int(histogram.getBucketCount(
+            LatencyHistogram::cBucketCount - 1)), 1);
+    }
+
+    void testPercentiles()
+    {
+        LatencyHistogram histogram;
+        QCOMPARE(histogram.getPercentileNs(50), qint64(0));
+
+        for (int i = 0; i < 99; ++i) {
+            histogram.add(1500);
+        }
+        histogram.add(100 * 1000);
+
+        QCOMPARE(histogram.getPercentileNs(50), qint64(2000));
+        QCOMPARE(histogram.getPercentileNs(99), qint64(100 * 1000));
+        QCOMPARE(histogram.getPercentileNs(100), qint64(100 * 1000));
+        QCOMPARE(histogram.getMaxNs(), qint64(100 * 1000));
+        QCOMPARE(histogram.getMeanNs(), qint64(2485));
+    }
+};
+
+#endif // LATENCYHISTOGRAMTEST_H
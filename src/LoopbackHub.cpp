@@ -0,0 +1,272 @@
+#include "LoopbackHub.h"
+
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QHostAddress>
+
+const LoopbackHub::Settings LoopbackHub::defaultSettings;
+
+///////////////////////////////////////////////////////////////////////////
+// Utils.
+
+static void busyWait(int ns)
+{
+    if (ns <= 0) {
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    while (timer.nsecsElapsed() < ns) {
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////
+// LoopbackHub.
+
+LoopbackHub::LoopbackHub(QObject *parent, const Settings &settings)
+    : QObject(parent), settings(settings), lastIp(settings.firstIp - 1)
+{
+}
+
+LoopbackHub::~LoopbackHub()
+{
+    Q_ASSERT(transports.isEmpty());
+}
+
+quint32 LoopbackHub::attach(LoopbackTransport *transport)
+{
+    transports.append(transport);
+    return ++lastIp;
+}
+
+void LoopbackHub::detach(LoopbackTransport *transport)
+{
+    transports.removeOne(transport);
+}
+
+bool LoopbackHub::isAttached(quint32 ip) const
+{
+    foreach (const LoopbackTransport *transport, transports) {
+        if (transport->ownIp == ip) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void LoopbackHub::enqueue(const PendingDatagram &datagram)
+{
+    ++stats.datagramsSent;
+    pending.append(datagram);
+
+    if (pending.size() == 1) {
+        QTimer::singleShot(0, this, SLOT(deliverPending()));
+    }
+}
+
+int LoopbackHub::deliverPending()
+{
+    const quint64 deliveredBefore = stats.datagramsDelivered;
+
+    while (!pending.isEmpty()) {
+        QList<PendingDatagram> delivering;
+        delivering.swap(pending);
+
+        foreach (const PendingDatagram &datagram, delivering) {
+            deliver(datagram);
+        }
+    }
+
+    return int(stats.datagramsDelivered - deliveredBefore);
+}
+
+void LoopbackHub::deliver(const PendingDatagram &datagram)
+{
+    memcpy(slot.data, datagram.data.constData(), datagram.data.size());
+    slot.size = datagram.data.size();
+    slot.sender.ip = (datagram.originIp != 0)
+        ? datagram.originIp : datagram.senderIp;
+    slot.sender.port = 0;
+    slot.relayed = datagram.originIp != 0;
+
+    // Indexed: a handler may delete a transport.
+    for (int i = 0; i < transports.size(); ++i) {
+        LoopbackTransport *transport = transports.at(i);
+        if (transport->ownIp == datagram.senderIp || (datagram.recipientIp
+            != 0 && transport->ownIp != datagram.recipientIp)) {
+
+            continue;
+        }
+
+        slot.channel = transport->channelIds.value(datagram.channelName, -1);
+        if (slot.channel == -1) {
+            continue;
+        }
+
+        if (!transport->isAddressedToThis(datagram.data)
+            || transport->droppedIps.contains(datagram.senderIp)) {
+
+            ++stats.datagramsFiltered;
+            continue;
+        }
+
+        busyWait(settings.fanOutCostNs);
+        ++stats.datagramsDelivered;
+        emit transport->datagramReceived(DatagramView(slot));
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////
+// LoopbackTransport.
+
+LoopbackTransport::LoopbackTransport(QObject *parent, LoopbackHub *hub)
+    : Transport(parent), hub(hub), ownIp(hub->attach(this))
+{
+    channelIds.insert(QString(), cDefaultChannel);
+}
+
+LoopbackTransport::~LoopbackTransport()
+{
+    hub->detach(this);
+}
+
+QString LoopbackTransport::getOwnId() const
+{
+    return QHostAddress(ownIp).toString();
+}
+
+bool LoopbackTransport::isOwnId(const QString &id) const
+{
+    return QHostAddress(id).toIPv4Address() == ownIp;
+}
+
+QStringList LoopbackTransport::getOwnIds() const
+{
+    QStringList ids;
+    ids.append(getOwnId());
+    return ids;
+}
+
+QString LoopbackTransport::senderIdOf(const SenderAddress &sender) const
+{
+    return sender.toHostAddress().toString();
+}
+
+quint32 LoopbackTransport::getOwnKey() const
+{
+    return ownIp;
+}
+
+quint32 LoopbackTransport::keyOf(const SenderAddress &sender) const
+{
+    return sender.ip;
+}
+
+int LoopbackTransport::joinChannel(const QString &name)
+    throw (NetworkEx)
+{
+    auto it = channelIds.constFind(name);
+    if (it != channelIds.constEnd()) {
+        return it.value();
+    }
+
+    const int id = nextChannelId++;
+    channelIds.insert(name, id);
+    return id;
+}
+
+void LoopbackTransport::leaveChannel(int channel)
+{
+    if (channel == cDefaultChannel) {
+        return;
+    }
+
+    QString name;
+    if (findChannelName(channel, &name)) {
+        channelIds.remove(name);
+    }
+}
+
+void LoopbackTransport::setAddressedFilter(
+    const QByteArray &addressedPrefix, const QList<QByteArray> &addressees)
+{
+    this->addressedPrefix = addressedPrefix;
+    this->addressees = addressees;
+}
+
+void LoopbackTransport::setDroppedSenders(const QList<quint32> &keys)
+{
+    droppedIps = keys;
+}
+
+bool LoopbackTransport::findChannelName(int channel, QString *pName) const
+{
+    for (auto it = channelIds.constBegin(); it != channelIds.constEnd();
+        ++it) {
+
+        if (it.value() == channel) {
+            *pName = it.key();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool LoopbackTransport::isAddressedToThis(const QByteArray &datagram) const
+{
+    if (addressedPrefix.isEmpty() || !datagram.startsWith(addressedPrefix)) {
+        return true;
+    }
+
+    foreach (const QByteArray &addressee, addressees) {
+        if (datagram.size() >= addressedPrefix.size() + addressee.size()
+            && memcmp(datagram.constData() + addressedPrefix.size(),
+                addressee.constData(), addressee.size()) == 0) {
+
+            return true;
+        }
+    }
+    return false;
+}
+
+void LoopbackTransport::sendDatagram(const QByteArray &datagram,
+    int channel)
+    throw (NetworkEx)
+{
+    enqueue(datagram, 0, 0, channel);
+}
+
+void LoopbackTransport::sendDatagramTo(const QByteArray &datagram,
+    const SenderAddress &recipient, int channel)
+    throw (NetworkEx)
+{
+    enqueue(datagram, hub->isAttached(recipient.ip) ? recipient.ip : 0, 0,
+        channel);
+}
+
+void LoopbackTransport::relayDatagram(const QByteArray &datagram,
+    const SenderAddress &origin, int channel)
+    throw (NetworkEx)
+{
+    enqueue(datagram, 0, origin.ip, channel);
+}
+
+void LoopbackTransport::enqueue(const QByteArray &datagram,
+    quint32 recipientIp, quint32 originIp, int channel)
+    throw (NetworkEx)
+{
+    if (datagram.size() > DatagramSlot::cCapacity) {
+        throw NetworkEx("Unable to send datagram of " +
+            QString::number(datagram.size()) + " bytes.");
+    }
+
+    QString name;
+    if (!findChannelName(channel, &name)) {
+        throw NetworkEx("Unable to send datagram: channel "
+            + QString::number(channel) + " is not joined.");
+    }
+
+    hub->enqueue(LoopbackHub::PendingDatagram{
+        ownIp, recipientIp, originIp, name, datagram});
+}
@@ -0,0 +1,202 @@
+#ifndef LOOPBACKHUB_H
+#define LOOPBACKHUB_H
+
+// In-process transport, for running many Apps without any network.
+
+#include <QObject>
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QList>
+
+#include "Transport.h"
+
+// private:
+#include <QHash>
+#include "DatagramPool.h"
+
+class LoopbackTransport;
+
+/**
+ * Delivers datagrams sent by each of its LoopbackTransport-s to all other
+ * transports which have joined the same channel (by name), reliably and
+ * in order.
+ *
+ * Datagrams are queued on sending, and delivered on returning to the event
+ * loop, or when deliverPending() is called; thus, handlers can send
+ * datagrams without recursion. Each transport gets a distinct fake IPv4 as
+ * its own id, from Settings::firstIp on.
+ */
+class LoopbackHub : public QObject
+{
+    Q_OBJECT
+public:
+    struct Settings
+    {
+        // Busy-waited per delivered datagram, modelling the per-recipient
+        // cost of fan-out (e.g. a receive syscall and a copy).
+        int fanOutCostNs = 0;
+
+        // Hubs modelling distinct networks (e.g. bridged by a Relay)
+        // should have distinct ranges. 10.0.0.1 by default.
+        quint32 firstIp = 0x0A000001;
+    };
+
+    static const Settings defaultSettings;
+
+    struct Stats
+    {
+        quint64 datagramsSent = 0;
+
+        // Over all the recipients.
+        quint64 datagramsDelivered = 0;
+
+        // Dropped by the addressed filters of the recipients, or as sent
+        // by their dropped senders.
+        quint64 datagramsFiltered = 0;
+    };
+
+    LoopbackHub(QObject *parent, const Settings &settings);
+
+    /**
+     * All the transports should be deleted before the hub.
+     */
+    virtual ~LoopbackHub() override;
+
+    Stats getStats() const
+    {
+        return stats;
+    }
+
+public slots:
+    /**
+     * Deliver the queued datagrams, including the ones sent by the
+     * handlers meanwhile, until the queue is empty. Should not be called
+     * from the handlers.
+     * @return Number of datagrams delivered (over all the recipients).
+     */
+    int deliverPending();
+
+private:
+    friend class LoopbackTransport;
+
+    const Settings settings;
+    Stats stats;
+
+    QList<LoopbackTransport *> transports;
+    quint32 lastIp;
+
+    struct PendingDatagram
+    {
+        quint32 senderIp;
+
+        // 0 means all the transports in the channel.
+        quint32 recipientIp;
+
+        // Of the App the datagram is relayed from; 0 if not relayed.
+        quint32 originIp;
+
+        QString channelName;
+        QByteArray data;
+    };
+    QList<PendingDatagram> pending;
+
+    // Reused for each delivery.
+    DatagramSlot slot;
+
+    quint32 attach(LoopbackTransport *transport);
+    void detach(LoopbackTransport *transport);
+    bool isAttached(quint32 ip) const;
+    void enqueue(const PendingDatagram &datagram);
+    void deliver(const PendingDatagram &datagram);
+};
+
+/**
+ * Transport of a single App attached to a LoopbackHub.
+ */
+class LoopbackTransport : public Transport
+{
+    Q_OBJECT
+public:
+    LoopbackTransport(QObject *parent, LoopbackHub *hub);
+
+    virtual ~LoopbackTransport() override;
+
+    virtual QString getOwnId() const override;
+    virtual bool isOwnId(const QString &id) const override;
+    virtual QStringList getOwnIds() const override;
+    virtual QString senderIdOf(const SenderAddress &sender) const override;
+
+    /**
+     * @return The fake IP.
+     */
+    virtual quint32 getOwnKey() const override;
+
+    virtual quint32 keyOf(const SenderAddress &sender) const override;
+
+    virtual int joinChannel(const QString &name)
+        throw (NetworkEx) override;
+
+    virtual void leaveChannel(int channel) override;
+
+    /**
+     * Filtering is performed by the hub before delivery.
+     */
+    virtual void setAddressedFilter(const QByteArray &addressedPrefix,
+        const QList<QByteArray> &addressees) override;
+
+    /**
+     * Like setAddressedFilter(). Relayed datagrams are dropped by the key
+     * of the relaying App.
+     */
+    virtual void setDroppedSenders(const QList<quint32> &keys) override;
+
+    /**
+     * The datagram is queued and delivered asynchronously.
+     * @throw NetworkEx also if the datagram is larger than a DatagramSlot.
+     */
+    virtual void sendDatagram(const QByteArray &datagram,
+        int channel = cDefaultChannel)
+        throw (NetworkEx) override;
+
+    /**
+     * Delivered only to the transport with the IP of the recipient, or to
+     * all if there is none (e.g. the recipient is relayed from another
+     * hub).
+     */
+    virtual void sendDatagramTo(const QByteArray &datagram,
+        const SenderAddress &recipient, int channel = cDefaultChannel)
+        throw (NetworkEx) override;
+
+    /**
+     * The instance of the origin is not preserved: ids are IPs.
+     */
+    virtual void relayDatagram(const QByteArray &datagram,
+        const SenderAddress &origin, int channel = cDefaultChannel)
+        throw (NetworkEx) override;
+
+private:
+    friend class LoopbackHub;
+
+    LoopbackHub *const hub;
+    const quint32 ownIp;
+
+    // Name -> id; the default channel has the empty name.
+    QHash<QString, int> channelIds;
+    int nextChannelId = cDefaultChannel + 1;
+
+    QByteArray addressedPrefix;
+    QList<QByteArray> addressees;
+
+    QList<quint32> droppedIps;
+
+    bool findChannelName(int channel, QString *pName) const;
+
+    void enqueue(const QByteArray &datagram, quint32 recipientIp,
+        quint32 originIp, int channel)
+        throw (NetworkEx);
+
+    bool isAddressedToThis(const QByteArray &datagram) const;
+};
+
+#endif // LOOPBACKHUB_H
@@ -0,0 +1,480 @@
+#ifndef MESSAGESCHEMA_H
+#define MESSAGESCHEMA_H
+
+// Compile-time declaration of the message types, which generates their
+// serializers, parsers and dispatch. Used by ChatMessages.cpp only.
+
+#include "ChatMessages.h"
+
+#include <type_traits>
+
+namespace Chat {
+
+#define RETURN_IF_FAILED(parsing) do { \
+    const ParseStatus status = (parsing); \
+    if (status != ParseOk) { \
+        return status; \
+    } \
+} while (0)
+
+// Magic and version, followed by the type.
+static const char cBinaryMagic = char(0xFE);
+static const char cBinaryVersion = 1;
+static const int cBinaryPrefixSize = 2;
+static const int cBinaryHeaderSize = cBinaryPrefixSize + 1;
+
+/**
+ * A field of a message type: the member of the View, converted by the
+ * Codec, which should provide:
+ *
+ * typedef <type of the member> Value;
+ *
+ * static ParseStatus parseUtf8(const char **pPos, const char *end,
+ *     const FieldScanner &scanner, bool isLast, Value *pValue);
+ *     Parses the field of the text form, and its delimiter, if any; a last
+ *     field should extend to the end.
+ *
+ * static ParseStatus parseBinary(const char **pPos, const char *end,
+ *     Value *pValue);
+ *
+ * static <constructor arg type> decode(const Value &value);
+ *     Converts the value to the arg of the Message constructor.
+ *
+ * static void appendUtf8(QByteArray *pBytes, const <arg type> &value);
+ * static void appendBinary(QByteArray *pBytes, const <arg type> &value);
+ *     Append the value of the Message member, without a delimiter.
+ *
+ * Codecs can be derived from each other, hiding some of the functions.
+ */
+template<class View, class Codec, typename Codec::Value View::*member>
+struct Field
+{
+    typedef Codec FieldCodec;
+
+    static ParseStatus parseUtf8(const char **pPos, const char *end,
+        const FieldScanner &scanner, bool isLast, View *pView)
+    {
+        return Codec::parseUtf8(pPos, end, scanner, isLast, &(pView->*member));
+    }
+
+    static ParseStatus parseBinary(const char **pPos, const char *end,
+        View *pView)
+    {
+        return Codec::parseBinary(pPos, end, &(pView->*member));
+    }
+
+    static auto decode(const View &view)
+        -> decltype(Codec::decode(view.*member))
+    {
+        return Codec::decode(view.*member);
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Recursion over the fields of a schema.
+
+template<class View, class... Fields>
+struct FieldParser;
+
+template<class View>
+struct FieldParser<View>
+{
+    static ParseStatus parseUtf8(const char **, const char *,
+        const FieldScanner &, View *)
+    {
+        return ParseOk;
+    }
+
+    static ParseStatus parseBinary(const char **, const char *, View *)
+    {
+        return ParseOk;
+    }
+};
+
+template<class View, class Head, class... Tail>
+struct FieldParser<View, Head, Tail...>
+{
+    static ParseStatus parseUtf8(const char **pPos, const char *end,
+        const FieldScanner &scanner, View *pView)
+    {
+        RETURN_IF_FAILED(Head::parseUtf8(
+            pPos, end, scanner, /*isLast*/ sizeof...(Tail) == 0, pView));
+        return FieldParser<View, Tail...>::parseUtf8(
+            pPos, end, scanner, pView);
+    }
+
+    static ParseStatus parseBinary(const char **pPos, const char *end,
+        View *pView)
+    {
+        RETURN_IF_FAILED(Head::parseBinary(pPos, end, pView));
+        return FieldParser<View, Tail...>::parseBinary(pPos, end, pView);
+    }
+};
+
+template<class... Fields>
+struct FieldSerializer;
+
+template<>
+struct FieldSerializer<>
+{
+    static void appendUtf8(QByteArray *)
+    {}
+
+    static void appendBinary(QByteArray *)
+    {}
+};
+
+template<class Head, class... Tail>
+struct FieldSerializer<Head, Tail...>
+{
+    template<class Value, class... Values>
+    static void appendUtf8(QByteArray *pBytes, const Value &value,
+        const Values &... values)
+    {
+        pBytes->append('|');
+        Head::FieldCodec::appendUtf8(pBytes, value);
+        FieldSerializer<Tail...>::appendUtf8(pBytes, values...);
+    }
+
+    template<class Value, class... Values>
+    static void appendBinary(QByteArray *pBytes, const Value &value,
+        const Values &... values)
+    {
+        Head::FieldCodec::appendBinary(pBytes, value);
+        FieldSerializer<Tail...>::appendBinary(pBytes, values...);
+    }
+};
+
+/**
+ * Decodes the fields one by one, accumulating them as args, then passes
+ * them to the constructor.
+ */
+template<class M, class View, class... Fields>
+struct MessageCreator;
+
+template<class M, class View>
+struct MessageCreator<M, View>
+{
+    template<class... Args>
+    static Message *create(const View &, const QString &senderId,
+        const Args &... args)
+    {
+        return new M(args..., senderId);
+    }
+};
+
+template<class M, class View, class Head, class... Tail>
+struct MessageCreator<M, View, Head, Tail...>
+{
+    template<class... Args>
+    static Message *create(const View &view, const QString &senderId,
+        const Args &... args)
+    {
+        return MessageCreator<M, View, Tail...>::create(
+            view, senderId, args..., Head::decode(view));
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////
+
+/**
+ * Base of the schema of a message type (CRTP): its fields, in the order of
+ * both the serialized forms and the args of the M constructor (followed by
+ * senderId).
+ *
+ * The Schema should provide:
+ *
+ * static constexpr const char *name();
+ *     The type in the text form; not needed for a binary-only schema.
+ *
+ * static const char cBinaryType;
+ *
+ * static ParseStatus finishParsing(View *pView);
+ *     Optional: checks across the fields, or sets the View members which
+ *     are not fields.
+ */
+template<class Schema, class M, class V, class... Fields>
+struct MessageSchema
+{
+    typedef M MessageType;
+    typedef V View;
+
+private:
+    typedef FieldParser<View, Fields...> Parser;
+
+public:
+    static ParseStatus finishParsing(View *)
+    {
+        return ParseOk;
+    }
+
+    /**
+     * @param values The members of the message, in the order of Fields.
+     */
+    template<class... Values>
+    static QByteArray toUtf8(const Values &... values)
+    {
+        static_assert(sizeof...(Values) == sizeof...(Fields),
+            "Each field should have a value.");
+        QByteArray result(Schema::name());
+        FieldSerializer<Fields...>::appendUtf8(&result, values...);
+        return result;
+    }
+
+    template<class... Values>
+    static QByteArray toBinary(const Values &... values)
+    {
+        static_assert(sizeof...(Values) == sizeof...(Fields),
+            "Each field should have a value.");
+        QByteArray result;
+        result.append(cBinaryMagic);
+        result.append(cBinaryVersion);
+        result.append(Schema::cBinaryType);
+        FieldSerializer<Fields...>::appendBinary(&result, values...);
+        return result;
+    }
+
+    /**
+     * @param pos Past the type and its delimiter.
+     */
+    static ParseStatus parseUtf8(const char *pos, const char *end,
+        const FieldScanner &scanner, MessageView *pView)
+    {
+        View view;
+        RETURN_IF_FAILED(Parser::parseUtf8(&pos, end, scanner, &view));
+        RETURN_IF_FAILED(Schema::finishParsing(&view));
+        *pView = MessageView(view);
+        return ParseOk;
+    }
+
+    /**
+     * @param pos Past the type byte.
+     */
+    static ParseStatus parseBinary(const char *pos, const char *end,
+        MessageView *pView)
+    {
+        View view;
+        RETURN_IF_FAILED(Parser::parseBinary(&pos, end, &view));
+        if (pos != end) {
+            return ParseTrailingData;
+        }
+        RETURN_IF_FAILED(Schema::finishParsing(&view));
+        *pView = MessageView(view);
+        return ParseOk;
+    }
+
+    static Message *create(const MessageView &view, const QString &senderId)
+    {
+        return MessageCreator<M, View, Fields...>::create(
+            view.as<View>(), senderId);
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Recursion over a TypeList of schemas.
+
+/**
+ * Each schema should have the view at the same index in MessageViewTypes,
+ * thus, the view type index selects the schema.
+ */
+template<class Schemas, class Views>
+struct SchemasMatchViews;
+
+template<>
+struct SchemasMatchViews<TypeList<>, TypeList<>> : std::true_type
+{};
+
+template<class Schema, class... Schemas, class View, class... Views>
+struct SchemasMatchViews<TypeList<Schema, Schemas...>,
+    TypeList<View, Views...>>
+    : std::integral_constant<bool,
+        std::is_same<typename Schema::View, View>::value
+        && SchemasMatchViews<TypeList<Schemas...>,
+            TypeList<Views...>>::value>
+{};
+
+template<class List>
+struct SchemaAt;
+
+template<>
+struct SchemaAt<TypeList<>>
+{
+    static Message::Type getType(int)
+    {
+        return nullptr;
+    }
+
+    static Message *create(int, const MessageView &, const QString &)
+    {
+        return nullptr;
+    }
+};
+
+template<class Head, class... Tail>
+struct SchemaAt<TypeList<Head, Tail...>>
+{
+    static Message::Type getType(int index)
+    {
+        return index == 0
+            ? Head::MessageType::cType
+            : SchemaAt<TypeList<Tail...>>::getType(index - 1);
+    }
+
+    static Message *create(int index, const MessageView &view,
+        const QString &senderId)
+    {
+        return index == 0
+            ? Head::create(view, senderId)
+            : SchemaAt<TypeList<Tail...>>::create(index - 1, view, senderId);
+    }
+};
+
+/**
+ * Checks the binary types of the schemas, and fills the table of parsers
+ * indexed by them.
+ */
+template<class List>
+struct BinaryTypes;
+
+template<>
+struct BinaryTypes<TypeList<>>
+{
+    static constexpr bool isMissing(char)
+    {
+        return true;
+    }
+
+    static constexpr bool areUnique()
+    {
+        return true;
+    }
+
+    static constexpr int maxType()
+    {
+        return 0;
+    }
+
+    template<class Parser>
+    static void fill(Parser *)
+    {}
+};
+
+template<class Head, class... Tail>
+struct BinaryTypes<TypeList<Head, Tail...>>
+{
+    typedef BinaryTypes<TypeList<Tail...>> TailTypes;
+
+    static constexpr bool isMissing(char type)
+    {
+        return Head::cBinaryType != type && TailTypes::isMissing(type);
+    }
+
+    static constexpr bool areUnique()
+    {
+        return TailTypes::isMissing(Head::cBinaryType)
+            && TailTypes::areUnique();
+    }
+
+    static constexpr int maxType()
+    {
+        return int(Head::cBinaryType) > TailTypes::maxType()
+            ? int(Head::cBinaryType) : TailTypes::maxType();
+    }
+
+    template<class Parser>
+    static void fill(Parser *parsers)
+    {
+        parsers[int(Head::cBinaryType)] = &Head::parseBinary;
+        TailTypes::fill(parsers);
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////
+// Perfect hash of the text form type names.
+
+constexpr int typeNameSize(const char *name)
+{
+    return *name == '\0' ? 0 : 1 + typeNameSize(name + 1);
+}
+
+/**
+ * Of the first and the last chars and the size, thus, does not depend on
+ * the name size otherwise.
+ * @param size Not 0.
+ * @return Within [0, 1 << bits).
+ */
+constexpr quint32 typeNameHash(
+    quint32 seed, int bits, const char *name, int size)
+{
+    return ((quint32(uchar(name[0])) | (quint32(uchar(name[size - 1])) << 8)
+        | (quint32(size) << 16)) ^ seed) * 2654435761u >> (32 - bits);
+}
+
+/**
+ * Finds a seed of typeNameHash() without collisions of the schema names.
+ */
+template<class List, int bits>
+struct TypeNameHash;
+
+template<int bits>
+struct TypeNameHash<TypeList<>, bits>
+{
+    static constexpr bool isMissing(quint32, quint32)
+    {
+        return true;
+    }
+
+    static constexpr bool isPerfect(quint32)
+    {
+        return true;
+    }
+
+    template<class Slot>
+    static void fill(quint32, Slot *)
+    {}
+};
+
+template<class Head, class... Tail, int bits>
+struct TypeNameHash<TypeList<Head, Tail...>, bits>
+{
+    typedef TypeNameHash<TypeList<Tail...>, bits> TailHash;
+
+    static constexpr quint32 of(quint32 seed)
+    {
+        return typeNameHash(
+            seed, bits, Head::name(), typeNameSize(Head::name()));
+    }
+
+    static constexpr bool isMissing(quint32 seed, quint32 hash)
+    {
+        return of(seed) != hash && TailHash::isMissing(seed, hash);
+    }
+
+    static constexpr bool isPerfect(quint32 seed)
+    {
+        return TailHash::isMissing(seed, of(seed)) && TailHash::isPerfect(seed);
+    }
+
+    /**
+     * @return The first perfect seed not below the given one; the search
+     * depth is limited by the compiler.
+     */
+    static constexpr quint32 findSeed(quint32 seed = 0)
+    {
+        return isPerfect(seed) ? seed : findSeed(seed + 1);
+    }
+
+    template<class Slot>
+    static void fill(quint32 seed, Slot *slots)
+    {
+        Slot &slot = slots[of(seed)];
+        slot.name = Head::name();
+        slot.nameSize = typeNameSize(Head::name());
+        slot.parse = &Head::parseUtf8;
+        TailHash::fill(seed, slots);
+    }
+};
+
+} // namespace Chat
+
+#endif // MESSAGESCHEMA_H
@@ -14,7 +14,44 @@ HEADERS = \
     ReliableTextReceiverTest.h \
     ChatEngine.h \
     AboutDialog.h \
-    WelcomeDialog.h
+    WelcomeDialog.h \
+    RunBenchmarks.h \
+    BatchedUdpSocket.h \
+    BatchedUdpSocketBenchmark.h \
+    SpscRing.h \
+    SpscRingTest.h \
+    DatagramPool.h \
+    DuplicateFilter.h \
+    DuplicateFilterTest.h \
+    SocketFilter.h \
+    SocketFilterTest.h \
+    Transport.h \
+    LoopbackHub.h \
+    ChatEngineBenchmark.h \
+    Impairment.h \
+    ImpairmentTest.h \
+    SendPacer.h \
+    SendPacerTest.h \
+    SharedMemoryTransport.h \
+    SharedMemoryTransportTest.h \
+    LatencyHistogram.h \
+    LatencyHistogramTest.h \
+    Relay.h \
+    RelayTest.h \
+    RunRelay.h \
+    ChatMessagesBenchmark.h \
+    FieldScanner.h \
+    FieldScannerTest.h \
+    TextCompressor.h \
+    TextCompressorTest.h \
+    TextReassembler.h \
+    TextReassemblerTest.h \
+    TypeList.h \
+    MessageSchema.h \
+    AllocationCounter.h \
+    ChatMessagesFuzzer.h \
+    ChatMessagesFuzzTest.h \
+    ChatEngineTest.h
 
 SOURCES = \
     main.cpp \
@@ -27,7 +64,21 @@ SOURCES = \
     ContactList.cpp \
     ChatEngine.cpp \
     AboutDialog.cpp \
-    WelcomeDialog.cpp
+    WelcomeDialog.cpp \
+    RunBenchmarks.cpp \
+    BatchedUdpSocket.cpp \
+    SocketFilter.cpp \
+    LoopbackHub.cpp \
+    Impairment.cpp \
+    SendPacer.cpp \
+    SharedMemoryTransport.cpp \
+    Relay.cpp \
+    RunRelay.cpp \
+    FieldScanner.cpp \
+    TextCompressor.cpp \
+    TextReassembler.cpp \
+    AllocationCounter.cpp \
+    ChatMessagesFuzzer.cpp
 
 FORMS = MainDialog.ui \
     AboutDialog.ui \
@@ -1,145 +1,1600 @@
 #include "Multicaster.h"
 
+#include <random>
+
 #include <QtNetwork>
 
-// Logs regular datagrams.
-#define LOG(ARGS) \
-//    qDebug() << ARGS
+#include "BatchedUdpSocket.h"
+#include "DuplicateFilter.h"
+#include "SocketFilter.h"
+#include "SpscRing.h"
+
+#ifdef Q_OS_LINUX
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#endif
+
+// Logs regular datagrams.
+#define LOG(ARGS) \
+//    qDebug() << ARGS
+
+const Multicaster::Settings Multicaster::defaultSettings;
+
+// Enough to tell apart the datagrams arriving within duplicateWindowMs.
+static const int cDuplicateFilterTableSize = 4096;
+
+// Instance id, unicast port and channel tag as 8, 4 and 4 hex digits, and
+// '|'; or '>' followed by the origin IP and instance id as 8 hex digits
+// each, and '|'.
+static const int cInstanceHexSize = 8;
+static const int cPortHexSize = 4;
+static const int cChannelTagHexSize = 4;
+static const int cInstanceHeaderSize =
+    cInstanceHexSize + cPortHexSize + cChannelTagHexSize + 1;
+static const int cRelayedHeaderSize = cInstanceHeaderSize + 17;
+static const char cRelayedMarker = '>';
+
+static_assert(cRelayedHeaderSize <= Transport::cMaxHeaderSize,
+    "A relayed datagram of any size should fit into a DatagramSlot.");
+
+///////////////////////////////////////////////////////////////////////////
+// Utils.
+
+static const char cHexDigits[] = "0123456789abcdef";
+
+static QByteArray toHex(quint32 value, int digitCount)
+{
+    QByteArray hex(digitCount, '0');
+    for (int i = 0; i < digitCount; ++i) {
+        hex[i] = cHexDigits[(value >> (4 * (digitCount - 1 - i))) & 0xF];
+    }
+    return hex;
+}
+
+/**
+ * Does not allocate.
+ * @return false if not all the chars are lowercase hex digits.
+ */
+static bool parseHex(const char *data, int digitCount, quint32 *pValue)
+{
+    quint32 value = 0;
+    for (int i = 0; i < digitCount; ++i) {
+        const char c = data[i];
+        quint32 digit;
+        if (c >= '0' && c <= '9') {
+            digit = quint32(c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            digit = quint32(c - 'a' + 10);
+        } else {
+            return false;
+        }
+        value = (value << 4) | digit;
+    }
+    *pValue = value;
+    return true;
+}
+
+static bool isRelayedHeader(const char *data)
+{
+    return data[cInstanceHeaderSize - 1] == cRelayedMarker;
+}
+
+/**
+ * Does not allocate.
+ * @return false if the datagram does not start with an instance header.
+ */
+static bool parseInstanceHeader(const char *data, int size,
+    quint32 *pInstanceId, quint16 *pUnicastPort, quint16 *pChannelTag)
+{
+    quint32 port;
+    quint32 channelTag;
+    if (size < cInstanceHeaderSize
+        || (data[cInstanceHeaderSize - 1] != '|' && !isRelayedHeader(data))
+        || !parseHex(data, cInstanceHexSize, pInstanceId)
+        || !parseHex(data + cInstanceHexSize, cPortHexSize, &port)
+        || !parseHex(data + cInstanceHexSize + cPortHexSize,
+            cChannelTagHexSize, &channelTag)) {
+
+        return false;
+    }
+    *pUnicastPort = quint16(port);
+    *pChannelTag = quint16(channelTag);
+    return true;
+}
+
+/**
+ * Does not allocate. The origin is not reachable via unicast.
+ * @return false if the relayed header is incomplete.
+ */
+static bool parseRelayedOrigin(const char *data, int size,
+    SenderAddress *pOrigin)
+{
+    const char *origin = data + cInstanceHeaderSize;
+    if (size < cRelayedHeaderSize || data[cRelayedHeaderSize - 1] != '|'
+        || !parseHex(origin, 8, &pOrigin->ip)
+        || !parseHex(origin + 8, cInstanceHexSize, &pOrigin->instance)) {
+
+        return false;
+    }
+    pOrigin->port = 0;
+    return true;
+}
+
+static int headerSizeOf(const DatagramSlot &slot)
+{
+    return slot.relayed ? cRelayedHeaderSize : cInstanceHeaderSize;
+}
+
+/**
+ * FNV-1a: unlike qHash(), is not seeded per process.
+ */
+static quint32 hashChannelName(const QString &name)
+{
+    quint32 hash = 2166136261u;
+    foreach (char c, name.toUtf8()) {
+        hash = (hash ^ uchar(c)) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Tells apart the channels hashed onto the same group and port; built of
+ * the hash bits which do not choose them (with the default settings).
+ */
+static quint16 channelTagOf(const QString &name)
+{
+    return quint16(hashChannelName(name) >> 16);
+}
+
+static quint32 generateInstanceId()
+{
+    std::random_device device;
+    std::uniform_int_distribution<quint32> distribution(1, 0xFFFFFFFF);
+    return distribution(device);
+}
+
+///////////////////////////////////////////////////////////////////////////
+
+#ifdef Q_OS_LINUX
+
+/**
+ * Runs the receive/send loop over batchedSockets of all the channels,
+ * poll()-ing the sockets and an eventfd which is signalled when datagrams
+ * are queued for sending, or when the channels change.
+ *
+ * Received datagrams which pass acceptDatagram() are pushed to
+ * receiveRing, and Multicaster::drainReceiveRing() is invoked (queued) on
+ * the thread of Multicaster, at most once per non-empty ring. Datagrams to
+ * send are pushed to sendRing by Multicaster::sendDatagram().
+ */
+class Multicaster::IoThread : public QThread
+{
+public:
+    // Slots are acquired from Multicaster::pool by the I/O thread, and
+    // released by Multicaster::drainReceiveRing().
+    SpscRing<DatagramSlot *> receiveRing;
+    SpscRing<OutgoingDatagram> sendRing;
+
+    QAtomicInt receiveNotifyPending;
+    QAtomicInteger<quint64> receiveRingDrops;
+    QAtomicInteger<quint64> sendRingDrops;
+    QAtomicInteger<quint64> receivePoolExhaustions;
+    QAtomicInt receiveRingPeakOccupancy;
+
+    // Should be set under channelsMutex, followed by wakeUp().
+    QAtomicInt channelsChanged;
+
+    QAtomicInteger<quint64> busyPollMisses;
+    QAtomicInteger<quint64> busyPollSleeps;
+
+    IoThread(Multicaster *multicaster)
+        : receiveRing(multicaster->settings.ioRingCapacity),
+            sendRing(multicaster->settings.ioRingCapacity),
+            channelsChanged(1),
+            multicaster(multicaster),
+            wakeupFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+    {}
+
+    virtual ~IoThread() override
+    {
+        stopRequested.storeRelease(1);
+        wakeUp();
+        wait();
+
+        if (wakeupFd != -1) {
+            ::close(wakeupFd);
+        }
+    }
+
+    bool isValid() const
+    {
+        return wakeupFd != -1;
+    }
+
+    void wakeUp()
+    {
+        eventfd_write(wakeupFd, 1);
+    }
+
+    /**
+     * @return CPU time consumed by the thread so far; 0 if not started.
+     */
+    quint64 getCpuUs() const
+    {
+        clockid_t clockId;
+        timespec time;
+        if (!threadIdValid.loadAcquire()
+            || pthread_getcpuclockid(threadId, &clockId) != 0
+            || clock_gettime(clockId, &time) == -1) {
+
+            return 0;
+        }
+        return quint64(time.tv_sec) * 1000000 + quint64(time.tv_nsec) / 1000;
+    }
+
+    /**
+     * Called on the thread of Multicaster.
+     * @return false if the ring is full (the datagram is dropped).
+     */
+    bool send(const OutgoingDatagram &datagram)
+    {
+        if (!sendRing.push(datagram)) {
+            sendRingDrops.fetchAndAddRelaxed(1);
+            return false;
+        }
+
+        if (sendWakeupPending.testAndSetOrdered(0, 1)) {
+            wakeUp();
+        }
+        return true;
+    }
+
+protected:
+    virtual void run() override
+    {
+        threadId = pthread_self();
+        threadIdValid.storeRelease(1);
+
+        const Settings &settings = multicaster->settings;
+        const qint64 busyPollIdleNs = qint64(settings.busyPollIdleUs) * 1000;
+        bool busyPolling = false;
+        qint64 lastReceivedNs = 0;
+
+        while (!stopRequested.loadAcquire()) {
+            if (channelsChanged.loadAcquire()) {
+                updatePolledSending();
+            }
+
+            const int r = poll(fds.data(), fds.size(), busyPolling ? 0 : -1);
+            if (r == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                emit multicaster->networkError(
+                    "I/O thread stopped: poll() failed.");
+                return;
+            }
+
+            const qint64 wakeupNs = multicaster->latencyClock.nsecsElapsed();
+            if (r == 0) {
+                busyPollMisses.fetchAndAddRelaxed(1);
+                if (wakeupNs - lastReceivedNs > busyPollIdleNs) {
+                    busyPollSleeps.fetchAndAddRelaxed(1);
+                    busyPolling = false;
+                }
+                continue;
+            }
+
+            if (fds.last().revents & POLLIN) {
+                eventfd_t value;
+                eventfd_read(wakeupFd, &value);
+            }
+
+            sendPending();
+
+            bool pushed = false;
+            for (int i = 0; i < polled.size(); ++i) {
+                if (fds[i].revents & POLLIN) {
+                    pushed = receivePending(polled.at(i), wakeupNs)
+                        || pushed;
+                    busyPolling = settings.busyPoll;
+                    lastReceivedNs = wakeupNs;
+                }
+            }
+
+            const int occupancy = receiveRing.size();
+            if (occupancy > receiveRingPeakOccupancy.load()) {
+                receiveRingPeakOccupancy.store(occupancy);
+            }
+
+            if (pushed && receiveNotifyPending.testAndSetOrdered(0, 1)) {
+                QMetaObject::invokeMethod(multicaster, "drainReceiveRing",
+                    Qt::QueuedConnection);
+            }
+        }
+
+        // Send the datagrams queued before stopping, e.g. the "leave"
+        // message of the closing App.
+        if (channelsChanged.loadAcquire()) {
+            updatePolledSending();
+        } else {
+            sendPending();
+        }
+    }
+
+private:
+    Multicaster *const multicaster;
+    const int wakeupFd;
+
+    QAtomicInt sendWakeupPending;
+    QAtomicInt stopRequested;
+
+    pthread_t threadId;
+    QAtomicInt threadIdValid;
+
+    // Copy of the channels' sockets, owned by the I/O thread.
+    struct Polled
+    {
+        BatchedUdpSocket *socket;
+        SocketCounters *counters;
+        int socketIndex;
+        int channel;
+        QHostAddress groupAddress;
+        quint16 port;
+        quint16 channelTag;
+    };
+    QVector<Polled> polled;
+
+    // For each of polled, then for the eventfd.
+    QVector<pollfd> fds;
+
+    // Reused by the I/O thread.
+    QList<OutgoingDatagram> toSend;
+    QList<OutgoingDatagram> keptToSend;
+    QList<QByteArray> channelDatagrams;
+
+    /**
+     * Sends the datagrams queued to the channels being left while their
+     * sockets are still polled, then the ones to the joined channels.
+     */
+    void updatePolledSending()
+    {
+        sendPending();
+        updatePolled();
+        sendPending();
+    }
+
+    bool isPolled(int channel) const
+    {
+        foreach (const Polled &candidate, polled) {
+            if (candidate.channel == channel) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void updatePolled()
+    {
+        QMutexLocker locker(&multicaster->channelsMutex);
+        channelsChanged.storeRelease(0);
+
+        polled.clear();
+        foreach (const Channel *channel, multicaster->channels) {
+            for (int i = 0; i < channel->batchedSockets.size(); ++i) {
+                polled.append(Polled{channel->batchedSockets.at(i),
+                    channel->counters.at(i), i, channel->id,
+                    channel->groupAddress, channel->port,
+                    channel->tag});
+            }
+        }
+
+        fds.resize(polled.size() + 1);
+        for (int i = 0; i < fds.size(); ++i) {
+            fds[i].fd = (i < polled.size())
+                ? polled.at(i).socket->socketDescriptor() : wakeupFd;
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+        }
+
+        // Not polled anymore, thus, not used by this thread; deleted on the
+        // thread of Multicaster.
+        if (!multicaster->retiredChannels.isEmpty()) {
+            multicaster->releasedRetiredChannels =
+                multicaster->retiredChannels.size();
+            QMetaObject::invokeMethod(multicaster, "deleteRetiredChannels",
+                Qt::QueuedConnection);
+        }
+    }
+
+    /**
+     * @return Whether any datagram has been pushed to receiveRing.
+     */
+    bool receivePending(const Polled &from, qint64 wakeupNs)
+    {
+        DatagramPool *const pool = multicaster->pool.data();
+        const int batchSize = multicaster->settings.ioBatchSize;
+        QVarLengthArray<DatagramSlot *, 64> batch(batchSize);
+        bool pushed = false;
+
+        int r;
+        do {
+            // The pool is sized so that it never runs out while the ring
+            // has room.
+            int count = 0;
+            while (count < batchSize
+                && (batch[count] = pool->acquire()) != nullptr) {
+
+                ++count;
+            }
+
+            if (count == 0) {
+                // Not a socket error: the datagrams wait in the socket
+                // until slots are released.
+                receivePoolExhaustions.fetchAndAddRelaxed(1);
+                break;
+            }
+
+            r = from.socket->receiveBatch(batch.data(), count);
+            if (r == -1) {
+                // Ignore errors.
+                qDebug() << "Multicaster::IoThread::receivePending()"
+                    << from.socket->errorString() << ". Ignored.";
+                r = 0;
+            }
+
+            for (int i = 0; i < count; ++i) {
+                DatagramSlot *slot = batch[i];
+                slot->channel = from.channel;
+                slot->socketIndex = from.socketIndex;
+                slot->wakeupNs = wakeupNs;
+                if (i < r && multicaster->acceptDatagram(
+                    *slot, from.port, from.channelTag, from.counters)) {
+
+                    if (receiveRing.push(slot)) {
+                        pushed = true;
+                        continue;
+                    }
+                    receiveRingDrops.fetchAndAddRelaxed(1);
+                }
+                pool->recycle(slot);
+            }
+        } while (r == batchSize);
+
+        return pushed;
+    }
+
+    void sendPending()
+    {
+        // Reset before draining, so that a datagram pushed after draining
+        // leads to a new wakeup.
+        sendWakeupPending.storeRelease(0);
+
+        OutgoingDatagram datagram;
+        while (sendRing.pop(&datagram)) {
+            toSend.append(datagram);
+        }
+        if (toSend.isEmpty()) {
+            return;
+        }
+
+        // Datagrams to the channels left meanwhile are dropped, but the
+        // ones to the channels joined meanwhile are kept until they are
+        // polled.
+        const bool updatePending = channelsChanged.loadAcquire();
+        foreach (const Polled &to, polled) {
+            channelDatagrams.clear();
+            foreach (const OutgoingDatagram &outgoing, toSend) {
+                if (outgoing.channel == to.channel) {
+                    channelDatagrams.append(outgoing.data);
+                }
+            }
+
+            if (!channelDatagrams.isEmpty() && !to.socket->sendBatch(
+                channelDatagrams, to.groupAddress, to.port)) {
+
+                // Signal is delivered to the receivers' threads (queued).
+                emit multicaster->networkError("Unable to send datagrams: "
+                    + to.socket->errorString());
+            }
+        }
+        if (updatePending) {
+            foreach (const OutgoingDatagram &outgoing, toSend) {
+                if (!isPolled(outgoing.channel)) {
+                    keptToSend.append(outgoing);
+                }
+            }
+        }
+        toSend.swap(keptToSend);
+        keptToSend.clear();
+        channelDatagrams.clear();
+    }
+};
+
+#else // Q_OS_LINUX
+
+// Never instantiated: ioThread is not supported.
+class Multicaster::IoThread
+{
+};
+
+#endif // Q_OS_LINUX
+
+///////////////////////////////////////////////////////////////////////////
+
+Multicaster::Multicaster(QObject *parent, const Settings &settings)
+    throw (NetworkEx, NoSuitableInterfaceEx)
+    : Transport(parent), settings(settings)
+
+{
+    chooseNetworkInterfaces();
+
+    instanceId = (settings.instanceId != 0)
+        ? settings.instanceId : generateInstanceId();
+    instanceHex = toHex(instanceId, cInstanceHexSize);
+
+    if (chosenIfaces.size() > 1) {
+        duplicateFilter.reset(new DuplicateFilter(
+            cDuplicateFilterTableSize, settings.duplicateWindowMs));
+        duplicateFilterTimer.start();
+    }
+
+#ifdef Q_OS_LINUX
+    batchedIo = settings.batchedIo;
+#endif
+
+    if (settings.pacing) {
+        sendPacer = new SendPacer(this, settings.pacer);
+        connect(sendPacer, SIGNAL(released(QByteArray,int,SenderAddress)),
+            this, SLOT(sendPaced(QByteArray,int,SenderAddress)));
+    }
+
+    if (settings.sendImpairment.isEnabled()) {
+        sendImpairment = new Impairment(this, settings.sendImpairment);
+        connect(sendImpairment,
+            SIGNAL(released(QByteArray,int,SenderAddress)),
+            this, SLOT(sendImpaired(QByteArray,int,SenderAddress)));
+    }
+    if (settings.receiveImpairment.isEnabled()) {
+        receiveImpairment = new Impairment(this, settings.receiveImpairment);
+        connect(receiveImpairment,
+            SIGNAL(released(QByteArray,int,SenderAddress)),
+            this, SLOT(deliverImpaired(QByteArray,int,SenderAddress)));
+    }
+
+    latencyClock.start();
+#ifdef Q_OS_LINUX
+    receiveBufferDropsAtStart = SocketFilter::getReceiveBufferDropCount();
+#endif
+
+    channels.append(openChannel(
+        QString(), settings.groupAddress, settings.port));
+
+    if (batchedIo && settings.ioThread) {
+        startIoThread();
+    } else {
+        pool.reset(new DatagramPool(batchedIo ? settings.ioBatchSize : 1));
+    }
+}
+
+Multicaster::~Multicaster()
+{
+    // The event loop may not run anymore to flush the queue, e.g. after
+    // the "leave" message of the closing App.
+    try {
+        sendQueuedDatagrams();
+    } catch (NetworkEx &e) {
+        // Ignore errors.
+        qDebug() << "Multicaster::~Multicaster()" << e.what() << ". Ignored.";
+    }
+
+    // Stop the I/O thread (which sends what is left in its ring) before
+    // the sockets it uses are destroyed.
+    ioThread.reset();
+
+    qDeleteAll(channels);
+    qDeleteAll(retiredChannels);
+}
+
+Multicaster::Stats Multicaster::getStats() const
+{
+    Stats stats;
+    stats.deliveries = deliveries;
+    stats.deliveryLatencyTotalNs = deliveryLatencyTotalNs;
+    stats.deliveryLatencyMaxNs = deliveryLatencyMaxNs;
+#ifdef Q_OS_LINUX
+    if (ioThread) {
+        stats.receiveRingOccupancy = ioThread->receiveRing.size();
+        stats.sendRingOccupancy = ioThread->sendRing.size();
+        stats.receiveRingPeakOccupancy =
+            ioThread->receiveRingPeakOccupancy.load();
+        stats.receiveRingDrops = ioThread->receiveRingDrops.load();
+        stats.sendRingDrops = ioThread->sendRingDrops.load();
+        stats.receivePoolExhaustions =
+            ioThread->receivePoolExhaustions.load();
+        stats.ioThreadCpuUs = ioThread->getCpuUs();
+        stats.busyPollMisses = ioThread->busyPollMisses.load();
+        stats.busyPollSleeps = ioThread->busyPollSleeps.load();
+    }
+
+    stats.receiveBufferDrops = qMax(receiveBufferDropsAtStart,
+        SocketFilter::getReceiveBufferDropCount()) - receiveBufferDropsAtStart;
+#endif
+
+    foreach (const Channel *channel, channels) {
+        for (int i = 0; i < channel->counters.size(); ++i) {
+            const SocketCounters *counters = channel->counters.at(i);
+            SocketStats socketStats;
+            socketStats.channelName = channel->name;
+            socketStats.ifaceName = (i < chosenIfaces.size())
+                ? chosenIfaces.at(i).iface.name() : QString("unicast");
+            socketStats.received = counters->received.load();
+            socketStats.wrongPort = counters->wrongPort.load();
+            socketStats.self = counters->self.load();
+            socketStats.parseFailed = counters->parseFailed.load();
+            socketStats.malformed = counters->malformed.load();
+            socketStats.otherChannel = counters->otherChannel.load();
+#ifdef Q_OS_LINUX
+            if (i < channel->batchedSockets.size()) {
+                socketStats.kernelDrops =
+                    channel->batchedSockets.at(i)->getStats().kernelDrops;
+            } else if (i < channel->sockets.size()) {
+                socketStats.kernelDrops = SocketFilter::getKernelDropCount(
+                    int(channel->sockets.at(i)->socketDescriptor()));
+            } else if (channel->unicastSocket != nullptr) {
+                socketStats.kernelDrops = SocketFilter::getKernelDropCount(
+                    int(channel->unicastSocket->socketDescriptor()));
+            }
+#endif
+            stats.sockets.append(socketStats);
+        }
+    }
+
+    if (sendPacer != nullptr) {
+        stats.pacer = sendPacer->getStats();
+    }
+    if (sendImpairment != nullptr) {
+        stats.sendImpairment = sendImpairment->getStats();
+    }
+    if (receiveImpairment != nullptr) {
+        stats.receiveImpairment = receiveImpairment->getStats();
+    }
+    return stats;
+}
+
+void Multicaster::channelAddressOf(const QString &name,
+    const Settings &settings, QHostAddress *pGroupAddress, quint16 *pPort)
+{
+    const quint32 hash = hashChannelName(name);
+    *pGroupAddress = QHostAddress(settings.channelGroupBase.toIPv4Address()
+        + hash % quint32(settings.channelGroupCount));
+    *pPort = quint16(settings.port + 1
+        + (hash / quint32(settings.channelGroupCount))
+            % quint32(settings.channelPortCount));
+}
+
+int Multicaster::joinChannel(const QString &name)
+    throw (NetworkEx)
+{
+    if (name.isEmpty()) {
+        return cDefaultChannel;
+    }
+
+    foreach (const Channel *channel, channels) {
+        if (channel->name == name) {
+            return channel->id;
+        }
+    }
+
+    QHostAddress groupAddress;
+    quint16 port;
+    channelAddressOf(name, settings, &groupAddress, &port);
+    Channel *channel = openChannel(name, groupAddress, port);
+
+    {
+        QMutexLocker locker(&channelsMutex);
+        channels.append(channel);
+#ifdef Q_OS_LINUX
+        if (ioThread) {
+            ioThread->channelsChanged.storeRelease(1);
+        }
+#endif
+    }
+
+#ifdef Q_OS_LINUX
+    if (ioThread) {
+        ioThread->wakeUp();
+    }
+#endif
+
+    qDebug() << "Multicaster::joinChannel()" << name << "->"
+        << groupAddress << port;
+    return channel->id;
+}
+
+void Multicaster::leaveChannel(int id)
+{
+    Channel *channel = findChannel(id);
+    if (id == cDefaultChannel || channel == nullptr) {
+        return;
+    }
+
+    // E.g. the "leave" message to the channel; the I/O thread sends its
+    // queue before updating the channels.
+    flushSendQueue();
+
+    // Done with the channel before it is published to the I/O thread.
+    foreach (QSocketNotifier *notifier, channel->notifiers) {
+        notifier->setEnabled(false);
+        notifier->deleteLater();
+    }
+    foreach (QUdpSocket *socket, channel->sockets) {
+        socket->deleteLater();
+    }
+    channel->unicastSocket->deleteLater();
+
+    {
+        QMutexLocker locker(&channelsMutex);
+        channels.removeOne(channel);
+        // The sockets can be in use up the stack (or by the I/O thread).
+        retiredChannels.append(channel);
+#ifdef Q_OS_LINUX
+        if (ioThread) {
+            ioThread->channelsChanged.storeRelease(1);
+        } else
+#endif
+        {
+            releasedRetiredChannels = retiredChannels.size();
+        }
+    }
+
+#ifdef Q_OS_LINUX
+    if (ioThread) {
+        // Acknowledges the retirement, then deleteRetiredChannels() runs.
+        ioThread->wakeUp();
+    } else
+#endif
+    {
+        QTimer::singleShot(0, this, SLOT(deleteRetiredChannels()));
+    }
+}
+
+void Multicaster::deleteRetiredChannels()
+{
+    // Queued, thus, the channels are not in use up the stack anymore.
+    QList<Channel *> released;
+    {
+        QMutexLocker locker(&channelsMutex);
+        released = retiredChannels.mid(0, releasedRetiredChannels);
+        retiredChannels = retiredChannels.mid(releasedRetiredChannels);
+        releasedRetiredChannels = 0;
+    }
+    qDeleteAll(released);
+}
+
+Multicaster::Channel::~Channel()
+{
+    qDeleteAll(batchedSockets);
+    qDeleteAll(counters);
+}
+
+Multicaster::Channel *Multicaster::findChannel(int id) const
+{
+    foreach (Channel *channel, channels) {
+        if (channel->id == id) {
+            return channel;
+        }
+    }
+    return nullptr;
+}
+
+Multicaster::Channel *Multicaster::openChannel(const QString &name,
+    const QHostAddress &groupAddress, quint16 port)
+    throw (NetworkEx)
+{
+    QScopedPointer<Channel> channel(new Channel);
+    channel->id = nextChannelId++;
+    channel->name = name;
+    channel->tag = channelTagOf(name);
+    channel->groupAddress = groupAddress;
+    channel->port = port;
+    for (int i = 0; i <= chosenIfaces.size(); ++i) {
+        channel->counters.append(new SocketCounters);
+    }
+
+    try {
+        if (batchedIo) {
+            openBatchedSockets(channel.data());
+        } else {
+            openSockets(channel.data());
+        }
+        openUnicastSocket(channel.data());
+    } catch (NetworkEx &) {
+        qDeleteAll(channel->notifiers);
+        qDeleteAll(channel->sockets);
+        delete channel->unicastSocket;
+        throw;
+    }
+
+    attachSocketFilter(channel.data());
+    return channel.take();
+}
+
+void Multicaster::setAddressedFilter(const QByteArray &addressedPrefix,
+    const QList<QByteArray> &addressees)
+{
+    this->addressedPrefix = addressedPrefix;
+    this->addressees = addressees;
+
+    foreach (const Channel *channel, channels) {
+        attachSocketFilter(channel);
+    }
+}
+
+void Multicaster::setDroppedSenders(const QList<quint32> &keys)
+{
+    droppedInstanceHexes.clear();
+    foreach (quint32 key, keys) {
+        if (key != instanceId) {
+            droppedInstanceHexes.append(toHex(key, cInstanceHexSize));
+        }
+    }
+
+    foreach (const Channel *channel, channels) {
+        attachSocketFilter(channel);
+    }
+}
 
-// Allows to log datagrams "wasted" as requested by debug settings.
-#define DEBUG_LOG_WASTED(ARGS) \
-    qDebug() << ARGS
+void Multicaster::attachSocketFilter(const Channel *channel)
+{
+#ifdef Q_OS_LINUX
+    if (!settings.kernelFilter) {
+        return;
+    }
 
-const Multicaster::Settings Multicaster::defaultSettings;
+    SocketFilter filter(QList<QByteArray>() << instanceHex
+        << droppedInstanceHexes, cInstanceHeaderSize, addressedPrefix,
+        addressees, cRelayedHeaderSize, cRelayedMarker);
 
-Multicaster::Multicaster(QObject *parent, const Settings &settings)
-    throw (NetworkEx, NoSuitableInterfaceEx)
-    : QObject(parent), settings(settings)
+    QList<int> socketDescriptors;
+    foreach (const QUdpSocket *socket, channel->sockets) {
+        socketDescriptors.append(int(socket->socketDescriptor()));
+    }
+    foreach (const BatchedUdpSocket *socket, channel->batchedSockets) {
+        socketDescriptors.append(socket->socketDescriptor());
+    }
+    socketDescriptors.append(int(channel->unicastSocket->socketDescriptor()));
+
+    foreach (int socketDescriptor, socketDescriptors) {
+        if (!filter.attachTo(socketDescriptor)) {
+            // Ignore errors.
+            qDebug() << "Multicaster::attachSocketFilter()"
+                << filter.errorString() << ". Ignored.";
+            return;
+        }
+    }
+#else
+    Q_UNUSED(channel);
+#endif
+}
+
+void Multicaster::openSockets(Channel *channel)
+    throw (NetworkEx)
+{
+    foreach (const Iface &chosen, chosenIfaces) {
+        QUdpSocket *socket = new QUdpSocket(this);
+        channel->sockets.append(socket);
+
+        if (!socket->bind(chosen.ip, channel->port,
+            QUdpSocket::ShareAddress | QUdpSocket::ReuseAddressHint)) {
+
+            throw NetworkEx("Unable to bind UDP socket to port " +
+                QString::number(channel->port) +
+                " on iface with own IP " +
+                chosen.ip.toString() + ".");
+        }
+
+        if (settings.receiveBufferSize > 0) {
+            socket->setSocketOption(
+                QAbstractSocket::ReceiveBufferSizeSocketOption,
+                settings.receiveBufferSize);
+        }
+        if (settings.sendBufferSize > 0) {
+            socket->setSocketOption(
+                QAbstractSocket::SendBufferSizeSocketOption,
+                settings.sendBufferSize);
+        }
+
+        if (!socket->joinMulticastGroup(
+            channel->groupAddress, chosen.iface)) {
+
+            throw NetworkEx("Unable to join multicast group "
+                + channel->groupAddress.toString() + " on iface \""
+                + chosen.iface.name() + "\".");
+        }
+        socket->setMulticastInterface(chosen.iface);
+
+        connect(socket, SIGNAL(readyRead()),
+            this, SLOT(readyRead()));
+    }
+}
 
+void Multicaster::openBatchedSockets(Channel *channel)
+    throw (NetworkEx)
 {
-    chooseNetworkInterface();
+#ifdef Q_OS_LINUX
+    foreach (const Iface &chosen, chosenIfaces) {
+        BatchedUdpSocket *socket = new BatchedUdpSocket(settings.ioBatchSize);
+        channel->batchedSockets.append(socket);
+
+        // Linux delivers multicast datagrams only to sockets bound to the
+        // wildcard (or the group) address, thus, not binding to the iface
+        // IP; the socket is tied to the iface by joining the group on it.
+        if (!socket->bind(QHostAddress::AnyIPv4, channel->port)) {
+            throw NetworkEx("Unable to bind UDP socket to port " +
+                QString::number(channel->port) + ": " +
+                socket->errorString() + ".");
+        }
+
+        if (!socket->setBufferSizes(
+            settings.receiveBufferSize, settings.sendBufferSize)) {
 
-    socket = new QUdpSocket(this);
+            throw NetworkEx("Unable to set socket buffer sizes: " +
+                socket->errorString() + ".");
+        }
+
+        if (settings.ioThread && settings.busyPoll
+            && !socket->setBusyPoll(settings.busyPollUs)) {
+
+            // Busy polling in userspace still avoids sleeping.
+            qDebug() << "Multicaster::openBatchedSockets()"
+                << socket->errorString() << ". Ignored.";
+        }
 
-    if (!socket->bind(ownIp, settings.port,
-        QUdpSocket::ShareAddress | QUdpSocket::ReuseAddressHint)) {
+        if (!socket->joinMulticastGroup(channel->groupAddress, chosen.ip)) {
+            throw NetworkEx("Unable to join multicast group "
+                + channel->groupAddress.toString() + " on iface \""
+                + chosen.iface.name() + "\": "
+                + socket->errorString() + ".");
+        }
 
-        throw NetworkEx("Unable to bind UDP socket to port " +
-            QString::number(settings.port) +
-            " on iface with own IP " +
-            ownIp.toString() + ".");
+        if (!settings.ioThread) {
+            QSocketNotifier *notifier = new QSocketNotifier(
+                socket->socketDescriptor(), QSocketNotifier::Read, this);
+            channel->notifiers.append(notifier);
+            connect(notifier, SIGNAL(activated(int)),
+                this, SLOT(batchedReadyRead(int)));
+        }
     }
+#else
+    Q_UNUSED(channel);
+#endif
+}
 
-    if (!socket->joinMulticastGroup(settings.groupAddress, chosenIface)) {
-        throw NetworkEx("Unable to join multicast group "
-            + settings.groupAddress.toString() + " on iface \""
-            + chosenIface.name() + "\".");
+void Multicaster::openUnicastSocket(Channel *channel)
+    throw (NetworkEx)
+{
+    channel->unicastSocket = new QUdpSocket(this);
+    if (!channel->unicastSocket->bind(QHostAddress::AnyIPv4, 0)) {
+        throw NetworkEx("Unable to bind unicast UDP socket: "
+            + channel->unicastSocket->errorString() + ".");
     }
 
-    connect(socket, SIGNAL(readyRead()),
+    connect(channel->unicastSocket, SIGNAL(readyRead()),
         this, SLOT(readyRead()));
+
+    channel->header = instanceHex
+        + toHex(channel->unicastSocket->localPort(), cPortHexSize)
+        + toHex(channel->tag, cChannelTagHexSize) + '|';
 }
 
-void Multicaster::sendDatagram(const QByteArray &datagram)
+void Multicaster::startIoThread()
     throw (NetworkEx)
 {
-    // Debug.
-    if (settings.debugWasteEachNthDatagramSent > 0)
-    {
-        static int count = 0;
-        if (++count % settings.debugWasteEachNthDatagramSent == 0)
-        {
-            DEBUG_LOG_WASTED("-x->" << datagram);
-            return;
-        }
+#ifdef Q_OS_LINUX
+    ioThread.reset(new IoThread(this));
+    if (!ioThread->isValid()) {
+        throw NetworkEx("Unable to create eventfd for I/O thread.");
+    }
+
+    // Slots can be held by: the ring, the batch being received, and the
+    // datagram being delivered.
+    pool.reset(new DatagramPool(ioThread->receiveRing.capacity()
+        + settings.ioBatchSize + 1));
+
+    ioThread->start();
+#endif
+}
+
+const Multicaster::Channel *Multicaster::findChannelToSend(int channel,
+    const QByteArray &datagram) const
+    throw (NetworkEx)
+{
+    const Channel *to = findChannel(channel);
+    if (to == nullptr) {
+        throw NetworkEx("Unable to send datagram: channel "
+            + QString::number(channel) + " is not joined.");
+    }
+    if (datagram.size() > cMaxDatagramSize) {
+        throw NetworkEx("Unable to send datagram: it is larger than "
+            + QString::number(cMaxDatagramSize) + " bytes.");
     }
+    return to;
+}
+
+void Multicaster::sendDatagram(const QByteArray &datagram, int channel)
+    throw (NetworkEx)
+{
+    const Channel *to = findChannelToSend(channel, datagram);
 
     LOG("--->" << datagram);
 
-    qint64 r = socket->writeDatagram(
-        datagram, settings.groupAddress, settings.port);
-    if (r == -1) {
-        throw NetworkEx("Unable to send datagram.");
+    sendFramed(to->header + datagram, to);
+}
+
+void Multicaster::relayDatagram(const QByteArray &datagram,
+    const SenderAddress &origin, int channel)
+    throw (NetworkEx)
+{
+    const Channel *to = findChannelToSend(channel, datagram);
+
+    LOG("--->" << datagram << "relayed from"
+        << qUtf8Printable(origin.toHostAddress().toString()));
+
+    QByteArray framed = to->header;
+    framed[cInstanceHeaderSize - 1] = cRelayedMarker;
+    framed += toHex(origin.ip, 8) + toHex(origin.instance, cInstanceHexSize)
+        + '|' + datagram;
+
+    // Otherwise truncated, or dropped, by the receivers.
+    if (framed.size() > DatagramSlot::cCapacity) {
+        throw NetworkEx("Unable to relay datagram: with the header, it is "
+            "larger than " + QString::number(DatagramSlot::cCapacity)
+            + " bytes.");
+    }
+    sendFramed(framed, to);
+}
+
+void Multicaster::sendFramed(const QByteArray &framed, const Channel *to,
+    const SenderAddress &recipient)
+    throw (NetworkEx)
+{
+    if (sendPacer != nullptr
+        && !sendPacer->admit(framed, to->id, recipient)) {
+
+        // Queued (or dropped).
+        return;
+    }
+
+    impairAndDispatch(framed, to, recipient);
+}
+
+void Multicaster::sendDatagramTo(const QByteArray &datagram,
+    const SenderAddress &recipient, int channel)
+    throw (NetworkEx)
+{
+    const Channel *to = findChannel(channel);
+    if (to == nullptr || recipient.port == 0) {
+        sendDatagram(datagram, channel);
+        return;
+    }
+    if (datagram.size() > cMaxDatagramSize) {
+        throw NetworkEx("Unable to send datagram: it is larger than "
+            + QString::number(cMaxDatagramSize) + " bytes.");
+    }
+
+    LOG("--->" << datagram << "to"
+        << qUtf8Printable(recipient.toHostAddress().toString()));
+
+    sendFramed(to->header + datagram, to, recipient);
+}
+
+void Multicaster::sendPaced(QByteArray datagram, int channel,
+    SenderAddress recipient)
+{
+    const Channel *to = findChannel(channel);
+    if (to == nullptr) {
+        // The channel has been left.
+        return;
+    }
+
+    try {
+        impairAndDispatch(datagram, to, recipient);
+    } catch (NetworkEx &e) {
+        emit networkError(e.what());
+    }
+}
+
+void Multicaster::impairAndDispatch(const QByteArray &datagram,
+    const Channel *to, const SenderAddress &recipient)
+    throw (NetworkEx)
+{
+    const int copies = (sendImpairment != nullptr)
+        ? sendImpairment->impair(datagram.constData(), datagram.size(),
+            to->id, recipient)
+        : 1;
+    for (int i = 0; i < copies; ++i) {
+        if (recipient.port != 0) {
+            unicastDatagram(datagram, to, recipient);
+        } else {
+            dispatchDatagram(datagram, to);
+        }
+    }
+}
+
+void Multicaster::sendImpaired(QByteArray datagram, int channel,
+    SenderAddress recipient)
+{
+    const Channel *to = findChannel(channel);
+    if (to == nullptr) {
+        // The channel has been left.
+        return;
+    }
+
+    try {
+        if (recipient.port != 0) {
+            unicastDatagram(datagram, to, recipient);
+        } else {
+            dispatchDatagram(datagram, to);
+        }
+    } catch (NetworkEx &e) {
+        emit networkError(e.what());
+    }
+}
+
+void Multicaster::dispatchDatagram(const QByteArray &datagram,
+    const Channel *to)
+    throw (NetworkEx)
+{
+    const int channel = to->id;
+
+#ifdef Q_OS_LINUX
+    if (ioThread) {
+        if (!ioThread->send(OutgoingDatagram{datagram, channel})) {
+            qDebug() << "Multicaster::sendDatagram()"
+                << "Send ring is full; datagram dropped.";
+        }
+        return;
+    }
+#endif
+
+    if (batchedIo) {
+        sendQueue.append(OutgoingDatagram{datagram, channel});
+        if (sendQueue.size() >= settings.ioBatchSize) {
+            sendQueuedDatagrams();
+        } else if (sendQueue.size() == 1) {
+            QTimer::singleShot(0, this, SLOT(flushSendQueue()));
+        }
+        return;
+    }
+
+    // A failing socket does not prevent sending via the others; the
+    // datagram is lost only if all of them fail.
+    QStringList errors;
+    foreach (QUdpSocket *socket, to->sockets) {
+        qint64 r = socket->writeDatagram(
+            datagram, to->groupAddress, to->port);
+        if (r == -1) {
+            errors.append(socket->errorString());
+        }
+        else if (r != datagram.size()) {
+            errors.append("Sent " + QString::number(r) + " of "
+                + QString::number(datagram.size()) + " bytes");
+        }
+    }
+
+    if (!errors.isEmpty() && errors.size() == to->sockets.size()) {
+        throw NetworkEx("Unable to send datagram: " + errors.join("; "));
+    }
+    if (!errors.isEmpty()) {
+        qDebug() << "Multicaster::sendDatagram()"
+            << "Unable to send datagram via some interfaces:"
+            << errors.join("; ") << ". Ignored.";
+    }
+}
+
+void Multicaster::unicastDatagram(const QByteArray &datagram,
+    const Channel *to, const SenderAddress &recipient)
+    throw (NetworkEx)
+{
+    qint64 r = to->unicastSocket->writeDatagram(
+        datagram, recipient.toHostAddress(), recipient.port);
+    if (r != datagram.size()) {
+        throw NetworkEx("Unable to send datagram to "
+            + recipient.toHostAddress().toString() + ": "
+            + to->unicastSocket->errorString() + ".");
+    }
+}
+
+void Multicaster::sendQueuedDatagrams()
+    throw (NetworkEx)
+{
+#ifdef Q_OS_LINUX
+    if (sendQueue.isEmpty()) {
+        return;
+    }
+
+    QList<OutgoingDatagram> queued;
+    queued.swap(sendQueue);
+
+    // Datagrams to the channels left meanwhile are dropped. A failing
+    // socket does not prevent sending via the others; the errors are
+    // reported at once.
+    QStringList errors;
+    QList<QByteArray> datagrams;
+    foreach (const Channel *channel, channels) {
+        datagrams.clear();
+        foreach (const OutgoingDatagram &outgoing, queued) {
+            if (outgoing.channel == channel->id) {
+                datagrams.append(outgoing.data);
+            }
+        }
+        if (datagrams.isEmpty()) {
+            continue;
+        }
+
+        foreach (BatchedUdpSocket *socket, channel->batchedSockets) {
+            if (!socket->sendBatch(
+                datagrams, channel->groupAddress, channel->port)) {
+
+                errors.append(socket->errorString());
+            }
+        }
+    }
+
+    if (!errors.isEmpty()) {
+        throw NetworkEx("Unable to send datagrams: " + errors.join("; "));
     }
-    else if (r != datagram.size()) {
-        throw NetworkEx("Unable to send datagram of " +
-            QString::number(datagram.size()) + " bytes.");
+#endif
+}
+
+void Multicaster::flushSendQueue()
+{
+    try {
+        sendQueuedDatagrams();
+    } catch (NetworkEx &e) {
+        emit networkError(e.what());
     }
 }
 
 void Multicaster::readyRead()
 {
+    QUdpSocket *socket = static_cast<QUdpSocket *>(sender());
+    const qint64 wakeupNs = latencyClock.nsecsElapsed();
+
+    // If the channel is left by a handler of a datagram, it is retired,
+    // thus, remains valid until returning to the event loop.
+    const Channel *found = nullptr;
+    int socketIndex = -1;
+    foreach (const Channel *channel, channels) {
+        if (channel->sockets.contains(socket)) {
+            found = channel;
+            socketIndex = channel->sockets.indexOf(socket);
+        } else if (channel->unicastSocket == socket) {
+            found = channel;
+            socketIndex = chosenIfaces.size();
+        }
+    }
+    if (!found) {
+        // The channel has been left.
+        return;
+    }
+    const quint16 port = (socket == found->unicastSocket) ? 0 : found->port;
+
+    // In ioThread mode, the pool is used by the I/O thread.
+    DatagramPool *const slotPool = ioThread ? nullptr : pool.data();
+
     while (socket->hasPendingDatagrams()) {
-        QByteArray datagram;
-        datagram.resize(socket->pendingDatagramSize());
+        DatagramSlot *slot = slotPool ? slotPool->acquire() : &unicastSlot;
+        const qint64 size = socket->pendingDatagramSize();
 
         QHostAddress senderAddr;
         quint16 senderPort;
 
         // Here it is assumed that if a datagram is fragmented, it can
         // be dismissed and treated as a UDP unreliability
-        qint64 r = socket->readDatagram(datagram.data(), datagram.size(),
+        qint64 r = socket->readDatagram(slot->data, DatagramSlot::cCapacity,
             &senderAddr, &senderPort);
-        if (r != datagram.size())
+        if (r != size)
         {
             // Ignore errors and datagrams of incorrect size.
             qDebug() << "Multicaster::readyRead()"
                 << "readDatagram() returned" << r << ", but"
-                << datagram.size() << "expected. Ignored.";
+                << size << "expected. Ignored.";
+            if (slotPool) {
+                slotPool->recycle(slot);
+            }
             return;
         }
 
-        if (senderPort != settings.port) {
-            // Ignore datagrams sent from unknown ports.
-            qDebug() << "Multicaster::readyRead()"
-                << "Received datagram from port" << senderPort
-                << ", but expected port is" << settings.port
-                << ". Ignored.";
-            return;
-        }
+        slot->size = int(r);
+        slot->sender.ip = senderAddr.toIPv4Address();
+        slot->sender.port = senderPort;
+        slot->channel = found->id;
+        slot->socketIndex = socketIndex;
+        slot->wakeupNs = wakeupNs;
 
-        if (senderAddr == ownIp) {
-            // Ignore datagrams sent by this host to itself.
-            return;
+        // QUdpSocket does not report it.
+        slot->kernelTimestampNs = 0;
+
+        if (acceptDatagram(*slot, port, found->tag,
+            found->counters.at(socketIndex))) {
+
+            deliverDatagram(*slot);
         }
+        if (slotPool) {
+            slotPool->recycle(slot);
+        }
+    }
+}
 
-        // Debug.
-        if (settings.debugWasteEachNthDatagramReceived > 0)
-        {
-            static int count = 0;
-            if (++count % settings.debugWasteEachNthDatagramReceived == 0)
-            {
-                DEBUG_LOG_WASTED("    " << datagram << "<-x-"
-                    << qUtf8Printable(senderAddr.toString()));
+void Multicaster::batchedReadyRead(int socketDescriptor)
+{
+#ifdef Q_OS_LINUX
+    foreach (const Channel *channel, channels) {
+        for (int i = 0; i < channel->batchedSockets.size(); ++i) {
+            if (channel->batchedSockets.at(i)->socketDescriptor()
+                == socketDescriptor) {
+
+                receiveBatches(channel, i);
                 return;
             }
         }
+    }
+#else
+    Q_UNUSED(socketDescriptor);
+#endif
+}
+
+void Multicaster::receiveBatches(const Channel *channel, int socketIndex)
+{
+#ifdef Q_OS_LINUX
+    // If the channel is left by a handler of a datagram, it is retired,
+    // thus, remains valid until returning to the event loop.
+    BatchedUdpSocket *batchedSocket = channel->batchedSockets.at(socketIndex);
+    SocketCounters *counters = channel->counters.at(socketIndex);
+    const qint64 wakeupNs = latencyClock.nsecsElapsed();
+    const int batchSize = settings.ioBatchSize;
+    QVarLengthArray<DatagramSlot *, 64> batch(batchSize);
+
+    // Stop after a short batch: the queue is likely drained, and the
+    // notifier will fire again otherwise.
+    int r;
+    do {
+        // All the slots are recycled before the next batch.
+        for (int i = 0; i < batchSize; ++i) {
+            batch[i] = pool->acquire();
+        }
+
+        r = batchedSocket->receiveBatch(batch.data(), batchSize);
+        if (r == -1) {
+            // Ignore errors.
+            qDebug() << "Multicaster::receiveBatches()"
+                << batchedSocket->errorString() << ". Ignored.";
+        }
+
+        for (int i = 0; i < batchSize; ++i) {
+            batch[i]->channel = channel->id;
+            batch[i]->socketIndex = socketIndex;
+            batch[i]->wakeupNs = wakeupNs;
+            if (i < r && acceptDatagram(*batch[i], channel->port,
+                channel->tag, counters)) {
+
+                deliverDatagram(*batch[i]);
+            }
+            pool->recycle(batch[i]);
+        }
+    } while (r == batchSize);
+#else
+    Q_UNUSED(channel);
+    Q_UNUSED(socketIndex);
+#endif
+}
+
+void Multicaster::drainReceiveRing()
+{
+#ifdef Q_OS_LINUX
+    // Reset before draining, so that a datagram pushed after draining
+    // leads to a new invocation.
+    ioThread->receiveNotifyPending.storeRelease(0);
+
+    DatagramSlot *slot = nullptr;
+    while (ioThread->receiveRing.pop(&slot)) {
+        deliverDatagram(*slot);
+        pool->release(slot);
+    }
+#endif
+}
+
+bool Multicaster::acceptDatagram(DatagramSlot &slot, quint16 port,
+    quint16 channelTag, SocketCounters *counters)
+{
+    ++counters->received;
+
+    if (slot.size < 0) {
+        // Ignore truncated datagrams.
+        qDebug() << "Multicaster::acceptDatagram()"
+            << "Received datagram larger than" << DatagramSlot::cCapacity
+            << "bytes. Ignored.";
+        return false;
+    }
+
+    if (port != 0 && slot.sender.port != port) {
+        ++counters->wrongPort;
+
+        // Ignore datagrams sent from unknown ports.
+        qDebug() << "Multicaster::acceptDatagram()"
+            << "Received datagram from port" << slot.sender.port
+            << ", but expected port is" << port
+            << ". Ignored.";
+        return false;
+    }
+
+    quint16 receivedChannelTag;
+    if (!parseInstanceHeader(slot.data, slot.size, &slot.sender.instance,
+        &slot.sender.port, &receivedChannelTag)) {
+
+        ++counters->malformed;
+        return false;
+    }
+
+    if (receivedChannelTag != channelTag) {
+        // Ignore datagrams of other channels hashed onto the same group
+        // and port.
+        ++counters->otherChannel;
+        return false;
+    }
+
+    if (slot.sender.instance == instanceId) {
+        ++counters->self;
+
+        // Ignore datagrams sent by this App to itself.
+        return false;
+    }
+
+    slot.relayed = isRelayedHeader(slot.data);
+    if (slot.relayed) {
+        if (!parseRelayedOrigin(slot.data, slot.size, &slot.sender)) {
+            ++counters->malformed;
+            return false;
+        }
+
+        if (slot.sender.instance == instanceId) {
+            // Ignore datagrams of this App relayed back.
+            ++counters->self;
+            return false;
+        }
+    }
+
+    if (duplicateFilter && duplicateFilter->isDuplicate(
+        slot, duplicateFilterTimer.elapsed())) {
+
+        // Ignore datagrams already received via another interface.
+        return false;
+    }
+
+    return true;
+}
+
+void Multicaster::deliverDatagram(const DatagramSlot &slot)
+{
+    LOG("    " << QByteArray(slot.data, slot.size) << "<---"
+        << qUtf8Printable(slot.sender.toHostAddress().toString()));
+
+    const quint64 latencyNs = quint64(qMax(qint64(0),
+        latencyClock.nsecsElapsed() - slot.wakeupNs));
+    ++deliveries;
+    deliveryLatencyTotalNs += latencyNs;
+    deliveryLatencyMaxNs = qMax(deliveryLatencyMaxNs, latencyNs);
+
+    int copies = 1;
+    if (receiveImpairment != nullptr) {
+        copies = receiveImpairment->impair(
+            slot.data, slot.size, slot.channel, slot.sender);
+    }
+
+    for (int i = 0; i < copies; ++i) {
+        emit datagramReceived(DatagramView(slot, headerSizeOf(slot)));
+    }
+}
+
+void Multicaster::deliverImpaired(QByteArray datagram, int channel,
+    SenderAddress sender)
+{
+    if (findChannel(channel) == nullptr) {
+        // The channel has been left.
+        return;
+    }
+
+    memcpy(impairedSlot.data, datagram.constData(), datagram.size());
+    impairedSlot.size = datagram.size();
+    impairedSlot.sender = sender;
+    impairedSlot.channel = channel;
+    impairedSlot.relayed = isRelayedHeader(impairedSlot.data);
+    emit datagramReceived(DatagramView(impairedSlot,
+        headerSizeOf(impairedSlot)));
+}
 
-        LOG("    " << datagram << "<---"
-            << qUtf8Printable(senderAddr.toString()));
+void Multicaster::reportDeliveryFeedback(int ackedCount, int unackedCount)
+{
+    if (sendPacer != nullptr) {
+        sendPacer->reportFeedback(ackedCount, unackedCount);
+    }
+}
+
+void Multicaster::reportUnparsable(const DatagramView &datagram)
+{
+    const Channel *channel = findChannel(datagram.channel());
+    if (channel != nullptr
+        && datagram.socketIndex() < channel->counters.size()) {
 
-        emit datagramReceived(datagram, senderAddr.toString());
+        ++channel->counters.at(datagram.socketIndex())->parseFailed;
     }
 }
 
-QString Multicaster::getOwnId()
+QString Multicaster::getOwnId() const
+{
+    return QString::fromLatin1(instanceHex);
+}
+
+bool Multicaster::isOwnId(const QString &id) const
+{
+    return id == QLatin1String(instanceHex);
+}
+
+QStringList Multicaster::getOwnIds() const
+{
+    return QStringList() << getOwnId();
+}
+
+QString Multicaster::senderIdOf(const SenderAddress &sender) const
+{
+    return QString::fromLatin1(toHex(sender.instance, cInstanceHexSize));
+}
+
+quint32 Multicaster::getOwnKey() const
+{
+    return instanceId;
+}
+
+quint32 Multicaster::keyOf(const SenderAddress &sender) const
+{
+    return sender.instance;
+}
+
+QHostAddress Multicaster::getOwnAddress() const
+{
+    return chosenIfaces.first().ip;
+}
+
+bool Multicaster::isSameHost(const SenderAddress &sender) const
 {
-    return ownIp.toString();
+    return ownIpv4s.contains(sender.ip);
 }
 
 /**
- * Limitations of the current implementation: if there is more than one
- * suitable network interfaces, an exception is thrown. In future, some
- * mean of allowing the user to choose among them can be provided.
+ * If settings.interfaceNames is empty, all the suitable interfaces are
+ * chosen, otherwise, only the named ones.
  */
-void Multicaster::chooseNetworkInterface()
+void Multicaster::chooseNetworkInterfaces()
     throw (NoSuitableInterfaceEx)
 {
-    ownIp = QHostAddress::Null;
+    chosenIfaces.clear();
+    ownIpv4s.clear();
 
     foreach (const QNetworkInterface &iface,
         QNetworkInterface::allInterfaces()) {
 
+        if (!settings.interfaceNames.isEmpty()
+            && !settings.interfaceNames.contains(iface.name())) {
+
+            continue;
+        }
+
         if (iface.flags() & QNetworkInterface::IsUp
             && iface.flags() & QNetworkInterface::IsRunning) {
 
@@ -149,22 +1604,25 @@ void Multicaster::chooseNetworkInterface()
                 if (entry.ip().protocol() == QUdpSocket::IPv4Protocol
                     && entry.ip() != QHostAddress::LocalHost) {
 
-                    if (!ownIp.isNull()) {
-                        throw NoSuitableInterfaceEx(
-                            "More than one suitable network interfaces found.");
+                    if (chosenIfaces.isEmpty()
+                        || chosenIfaces.last().iface.index()
+                            != iface.index()) {
+
+                        // The first IPv4 of the iface is used for it.
+                        chosenIfaces.append(Iface{iface, entry.ip()});
                     }
-                    chosenIface = iface;
-                    ownIp = entry.ip();
+                    ownIpv4s.append(entry.ip().toIPv4Address());
                 }
             }
         }
     }
 
-    if (ownIp.isNull()) {
+    if (chosenIfaces.isEmpty()) {
         throw NoSuitableInterfaceEx("No suitable networks found.");
     }
 
-    qDebug() << "Multicaster::chooseNetworkInterface() ownIp:"
-         << ownIp << "; chosenIface:" << chosenIface;
+    foreach (const Iface &chosen, chosenIfaces) {
+        qDebug() << "Multicaster::chooseNetworkInterfaces() ip:"
+            << chosen.ip << "; iface:" << chosen.iface;
+    }
 }
-
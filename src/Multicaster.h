@@ -4,16 +4,55 @@
 #include <QObject>
 #include <QByteArray>
 #include <QString>
+#include <QStringList>
+#include <QList>
+#include <QVector>
+#include <QScopedPointer>
+
+#include "Transport.h"
+#include "DatagramPool.h"
+#include "Impairment.h"
+#include "SendPacer.h"
 
 // private:
 #include <QHostAddress>
 #include <QNetworkInterface>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QAtomicInteger>
 class QUdpSocket;
+class QSocketNotifier;
+class BatchedUdpSocket;
+class DuplicateFilter;
 
 /**
  * Mechanism which sends and receives multicast messages (unreliably).
+ *
+ * The group is joined on each of the chosen network interfaces, with a
+ * socket per interface; datagrams are sent via all of them.
+ *
+ * Besides the default channel (the group of Settings), named channels can
+ * be joined and left at runtime. Each name is hashed onto its own group
+ * and port, thus, traffic of channels not joined by the host is dropped
+ * by the NIC and the kernel (IGMP filtering) instead of being parsed.
+ *
+ * Each sent datagram starts with the instance id of the sender, as 8 hex
+ * digits, so that Apps on the same host (sharing the IP and the port) can
+ * tell each other and their own datagrams apart; then with the port of the
+ * sender's unicast socket in the channel, and a tag of the channel name
+ * (telling apart the channels hashed onto the same group and port), as 4
+ * hex digits each, and '|'.
+ * Relayed datagrams have '>' instead, followed by the IP and the instance
+ * id of the origin, as 8 hex digits each, and '|'.
+ *
+ * Each channel also has a unicast socket on an ephemeral port, for
+ * sendDatagramTo(); the received datagrams get this port as the port of
+ * SenderAddress.
+ *
+ * The header is not versioned: Apps which do not send it are counted as
+ * malformed, and can not talk to this one.
  */
-class Multicaster : public QObject
+class Multicaster : public Transport
 {
     Q_OBJECT
 public:
@@ -24,19 +63,169 @@ public:
 
         quint16 port = 42424;
 
-        // Debug: Non-zero values allow testing against UDP unreliability.
-        int debugWasteEachNthDatagramSent = 7;
-        int debugWasteEachNthDatagramReceived = 7;
+        // Id of this App among the ones on the same host; 0 means random.
+        // Starts the header of each datagram, which the Apps identifying
+        // each other by IP (older than the header) neither send nor
+        // expect: the two can not talk, thus, should not share
+        // groupAddress and port.
+        quint32 instanceId = 0;
+
+        // Named channels are hashed onto groups channelGroupBase + [0,
+        // channelGroupCount) and ports port + [1, channelPortCount].
+        QHostAddress channelGroupBase = QHostAddress("239.255.43.0");
+        int channelGroupCount = 256;
+        int channelPortCount = 64;
+
+        // Names of interfaces to join the group on; empty means all the
+        // suitable (up, running, having a non-loopback IPv4) interfaces.
+        QStringList interfaceNames;
+
+        // A datagram received again (from the same sender, e.g. via
+        // another interface) within this period is dropped; should be
+        // less than the period of repeated messages, e.g. advertising.
+        int duplicateWindowMs = 200;
+
+        // Linux only (ignored elsewhere): drain the socket with recvmmsg()
+        // and send queued datagrams with sendmmsg(), instead of issuing
+        // QUdpSocket calls per datagram.
+        bool batchedIo = true;
+
+        // Max number of datagrams per recvmmsg()/sendmmsg() call.
+        int ioBatchSize = 32;
+
+        // Linux only, requires batchedIo: run the socket and the
+        // receive/send loops on a dedicated thread, passing datagrams via
+        // lock-free rings, so that a busy GUI thread does not delay
+        // draining the kernel buffer.
+        bool ioThread = false;
+
+        // Capacity of each of the receive and send rings (ioThread only).
+        int ioRingCapacity = 1024;
+
+        // Requires ioThread: instead of sleeping in poll(), the I/O thread
+        // keeps polling without blocking (burning a core) until nothing
+        // has been received for busyPollIdleUs, then blocks until the next
+        // datagram. The sockets get SO_BUSY_POLL of busyPollUs; failing to
+        // set it (e.g. without CAP_NET_ADMIN) is ignored.
+        bool busyPoll = false;
+        int busyPollUs = 50;
+        int busyPollIdleUs = 2000;
+
+        // SO_RCVBUF and SO_SNDBUF of each socket; zero means the system
+        // default. A larger receive buffer absorbs longer stalls of the
+        // receiving thread.
+        int receiveBufferSize = 0;
+        int sendBufferSize = 0;
+
+        // Linux only: attach a socket filter which drops own looped back
+        // datagrams, the ones of setDroppedSenders(), and the ones not
+        // addressed to this instance (see setAddressedFilter()), in the
+        // kernel.
+        bool kernelFilter = true;
+
+        // Pace the sent datagrams, at the rate adapting to the feedback
+        // reported via reportDeliveryFeedback().
+        bool pacing = true;
+        SendPacer::Settings pacer;
+
+        // Simulated impairments of the sent and the received datagrams,
+        // for testing against UDP unreliability; disabled by default.
+        Impairment::Settings sendImpairment;
+        Impairment::Settings receiveImpairment;
     };
 
     static const Settings defaultSettings;
 
-    class NetworkEx : public std::runtime_error
+    /**
+     * Counters of a socket, to tell apart the datagrams lost in the
+     * network from the ones dropped on this host.
+     */
+    struct SocketStats
     {
-    public:
-        NetworkEx(const QString &what)
-            : std::runtime_error(what.toStdString())
-        {}
+        QString channelName;
+        QString ifaceName;
+
+        // Datagrams which have reached userspace, including the ones
+        // counted below.
+        quint64 received = 0;
+
+        // Linux only: datagrams which have never reached userspace,
+        // because the receive buffer was full, or (with kernelFilter) as
+        // intended by the socket filter; the kernel does not tell them
+        // apart, see Stats::receiveBufferDrops. Taken from SO_RXQ_OVFL with
+        // batchedIo, otherwise, from SO_MEMINFO.
+        quint64 kernelDrops = 0;
+
+        // Sent from a port other than the channel's one.
+        quint64 wrongPort = 0;
+
+        // Sent by this App (not dropped by the socket filter).
+        quint64 self = 0;
+
+        // Not starting with a valid header, e.g. of other applications,
+        // or of the Apps older than the header.
+        quint64 malformed = 0;
+
+        // Of another channel hashed onto the same group and port.
+        quint64 otherChannel = 0;
+
+        // Reported via reportUnparsable().
+        quint64 parseFailed = 0;
+    };
+
+    struct Stats
+    {
+        // The ioThread mode only; zero in other modes.
+
+        // Datagrams waiting in the rings at the moment.
+        int receiveRingOccupancy = 0;
+        int sendRingOccupancy = 0;
+
+        // Max receiveRingOccupancy observed by the I/O thread.
+        int receiveRingPeakOccupancy = 0;
+
+        // Datagrams dropped because the ring was full.
+        quint64 receiveRingDrops = 0;
+        quint64 sendRingDrops = 0;
+
+        // Times receiving has stopped because the pool of slots was empty;
+        // the datagrams are left in the socket (until the kernel drops
+        // them, see receiveBufferDrops).
+        quint64 receivePoolExhaustions = 0;
+
+        // Linux only: datagrams dropped since the start because the receive
+        // buffer was full, over all the UDP sockets of the host (including
+        // the ones of other applications); unlike SocketStats::kernelDrops,
+        // excludes the ones dropped by the socket filters.
+        quint64 receiveBufferDrops = 0;
+
+        // Per socket of the joined channels, in the order of joining, then
+        // of the chosen interfaces, followed by the unicast socket (named
+        // "unicast").
+        QList<SocketStats> sockets;
+
+        // From the wakeup of the receiving thread to emitting
+        // datagramReceived(), over the delivered datagrams (except the
+        // ones delayed by receiveImpairment). In the ioThread mode,
+        // includes waking up the thread of Multicaster.
+        quint64 deliveries = 0;
+        quint64 deliveryLatencyTotalNs = 0;
+        quint64 deliveryLatencyMaxNs = 0;
+
+        // The ioThread mode only: CPU time consumed by the I/O thread.
+        quint64 ioThreadCpuUs = 0;
+
+        // busyPoll only: polls which have found nothing, and returns to
+        // blocking after busyPollIdleUs.
+        quint64 busyPollMisses = 0;
+        quint64 busyPollSleeps = 0;
+
+        // Zero unless pacing is enabled.
+        SendPacer::Stats pacer;
+
+        // Zero unless the impairments are enabled.
+        Impairment::Stats sendImpairment;
+        Impairment::Stats receiveImpairment;
     };
 
     class NoSuitableInterfaceEx : public std::runtime_error
@@ -49,38 +238,339 @@ public:
 
     /**
      * @throw NoSuitableInterfaceEx if no network interface is found
-     * suitable for multicast communication.
+     * suitable for multicast communication (or none of the requested).
      * @throw NetworkEx if any network error has occurred.
      */
     Multicaster(QObject *parent, const Settings &settings)
         throw (NetworkEx, NoSuitableInterfaceEx);
 
     /**
-     * @return Id which other instances receive as senderId.
+     * @return The instance id, as 8 hex digits; the same on all the chosen
+     * interfaces.
      */
-    QString getOwnId();
+    virtual QString getOwnId() const override;
 
-    void sendDatagram(const QByteArray &datagram)
-        throw (NetworkEx);
+    virtual bool isOwnId(const QString &id) const override;
+
+    virtual QStringList getOwnIds() const override;
+
+    /**
+     * @return The instance id of the sender; its IP is only the address to
+     * reply to (see sendDatagramTo()).
+     */
+    virtual QString senderIdOf(const SenderAddress &sender) const override;
+
+    /**
+     * @return The instance id.
+     */
+    virtual quint32 getOwnKey() const override;
+
+    virtual quint32 keyOf(const SenderAddress &sender) const override;
+
+    /**
+     * @return IP of the first chosen interface, e.g. for display.
+     */
+    QHostAddress getOwnAddress() const;
+
+    virtual bool isSameHost(const SenderAddress &sender) const override;
+
+    /**
+     * Group address and port of a named channel; the same on all hosts
+     * with the same settings.
+     */
+    static void channelAddressOf(const QString &name,
+        const Settings &settings,
+        QHostAddress *pGroupAddress, quint16 *pPort);
+
+    /**
+     * Join the group of the named channel on all the chosen interfaces.
+     */
+    virtual int joinChannel(const QString &name)
+        throw (NetworkEx) override;
+
+    /**
+     * Datagrams queued for sending (see sendDatagram()) are sent first,
+     * but the ones held by pacing or by the send impairment are dropped.
+     */
+    virtual void leaveChannel(int channel) override;
+
+    /**
+     * With batchedIo, the datagram is queued and sent on returning to the
+     * event loop (or right away when the queue reaches ioBatchSize); then
+     * errors of deferred sending are reported via networkError(), for any
+     * datagram (e.g. also for the control messages of Chat::Engine, which
+     * ignores the errors of sending them right away). A socket failing to
+     * send does not prevent sending via the others; without batchedIo,
+     * the error is thrown only if all of them fail.
+     */
+    virtual void sendDatagram(const QByteArray &datagram,
+        int channel = cDefaultChannel)
+        throw (NetworkEx) override;
+
+    /**
+     * Paced like sendDatagram().
+     */
+    virtual void relayDatagram(const QByteArray &datagram,
+        const SenderAddress &origin, int channel = cDefaultChannel)
+        throw (NetworkEx) override;
+
+    /**
+     * Sent via the unicast socket of the channel, paced like
+     * sendDatagram(); falls back to sendDatagram() if the recipient port
+     * is unknown.
+     */
+    virtual void sendDatagramTo(const QByteArray &datagram,
+        const SenderAddress &recipient, int channel = cDefaultChannel)
+        throw (NetworkEx) override;
+
+    /**
+     * With kernelFilter, the kernel drops such datagrams in all the
+     * channels (including those joined later); otherwise, does nothing.
+     * Should be called again when own ids change.
+     */
+    virtual void setAddressedFilter(const QByteArray &addressedPrefix,
+        const QList<QByteArray> &addressees) override;
+
+    /**
+     * Like setAddressedFilter(): by the kernel, with kernelFilter. Relayed
+     * datagrams are dropped by the key of the relaying App.
+     */
+    virtual void setDroppedSenders(const QList<quint32> &keys) override;
+
+    virtual void reportUnparsable(const DatagramView &datagram) override;
+
+    virtual void reportDeliveryFeedback(
+        int ackedCount, int unackedCount) override;
+
+    virtual ~Multicaster() override;
 
-signals:
     /**
-     * Receive datagrams from _other_ instances of the application, thus,
-     * filtering out datagrams from a host with the same address and port.
+     * Can be called from the thread of this object at any time.
      */
-    void datagramReceived(QByteArray datagram, QString senderId);
+    Stats getStats() const;
+
+    // Signals of Transport are emitted on the thread of this object, even
+    // in ioThread mode; datagrams from own IPs are filtered out.
 
 private slots:
     void readyRead();
+    void batchedReadyRead(int socketDescriptor);
+    void flushSendQueue();
+    void drainReceiveRing();
+    void deleteRetiredChannels();
+    void sendPaced(QByteArray datagram, int channel,
+        SenderAddress recipient);
+    void sendImpaired(QByteArray datagram, int channel,
+        SenderAddress recipient);
+    void deliverImpaired(QByteArray datagram, int channel,
+        SenderAddress sender);
 
 private:
     const Settings settings;
-    QHostAddress ownIp = QHostAddress::Null;
-    QUdpSocket *socket = nullptr;
-    QNetworkInterface chosenIface;
 
-    void chooseNetworkInterface()
+    struct Iface
+    {
+        QNetworkInterface iface;
+        // Used for sending and joining the group.
+        QHostAddress ip;
+    };
+
+    QList<Iface> chosenIfaces;
+
+    // Whether BatchedUdpSocket is used instead of QUdpSocket.
+    bool batchedIo = false;
+
+    // IPs of all the chosen interfaces.
+    QVector<quint32> ownIpv4s;
+
+    // Received datagrams starting with instanceHex are own ones.
+    quint32 instanceId;
+    QByteArray instanceHex;
+
+    // Updated by the receiving thread, read by getStats().
+    struct SocketCounters
+    {
+        QAtomicInteger<quint64> received;
+        QAtomicInteger<quint64> wrongPort;
+        QAtomicInteger<quint64> self;
+        QAtomicInteger<quint64> parseFailed;
+        QAtomicInteger<quint64> malformed;
+        QAtomicInteger<quint64> otherChannel;
+    };
+
+    struct Channel
+    {
+        int id;
+        QHostAddress groupAddress;
+        quint16 port;
+        QString name;
+
+        // Of the name; is in the header of the datagrams in the channel.
+        quint16 tag;
+
+        // Per chosen interface; owned here. If batchedIo is enabled and
+        // supported, batchedSockets are used instead of sockets.
+        QList<QUdpSocket *> sockets;
+        QList<BatchedUdpSocket *> batchedSockets;
+        QList<QSocketNotifier *> notifiers;
+        QList<SocketCounters *> counters;
+
+        // Owned here; receives the datagrams sent via sendDatagramTo(),
+        // counted by the last of counters.
+        QUdpSocket *unicastSocket = nullptr;
+
+        // Prepended to each datagram sent to the channel.
+        QByteArray header;
+
+        // QObject-s are deleted as children of Multicaster.
+        ~Channel();
+    };
+
+    struct OutgoingDatagram
+    {
+        QByteArray data;
+        int channel;
+    };
+
+    // Owned here. In ioThread mode, modified under channelsMutex, and read
+    // by the I/O thread under it.
+    QList<Channel *> channels;
+    int nextChannelId = cDefaultChannel;
+    QMutex channelsMutex;
+
+    // Left channels, deleted by deleteRetiredChannels() on the thread of
+    // this Multicaster, once their sockets are surely not used anymore.
+    // Under channelsMutex: the first releasedRetiredChannels of them are
+    // not polled by the I/O thread anymore (the I/O thread only
+    // acknowledges it, the channels may still be in use up the stack).
+    QList<Channel *> retiredChannels;
+    int releasedRetiredChannels = 0;
+
+    QList<OutgoingDatagram> sendQueue;
+
+    // Of setAddressedFilter().
+    QByteArray addressedPrefix;
+    QList<QByteArray> addressees;
+
+    // Of setDroppedSenders(), as instance headers start.
+    QList<QByteArray> droppedInstanceHexes;
+
+    // Created if enabled in settings; owned here.
+    SendPacer *sendPacer = nullptr;
+    Impairment *sendImpairment = nullptr;
+    Impairment *receiveImpairment = nullptr;
+
+    // Receives the datagrams released by receiveImpairment.
+    DatagramSlot impairedSlot;
+
+    // Receives the datagrams of unicast sockets in ioThread mode.
+    DatagramSlot unicastSlot;
+
+    // Receive buffers for all the modes.
+    QScopedPointer<DatagramPool> pool;
+
+    // Of Stats::receiveBufferDrops.
+    quint64 receiveBufferDropsAtStart = 0;
+
+    // Clock of DatagramSlot::wakeupNs; read by the I/O thread too.
+    QElapsedTimer latencyClock;
+    quint64 deliveries = 0;
+    quint64 deliveryLatencyTotalNs = 0;
+    quint64 deliveryLatencyMaxNs = 0;
+
+    // Used if more than one interface is chosen.
+    QScopedPointer<DuplicateFilter> duplicateFilter;
+    QElapsedTimer duplicateFilterTimer;
+
+    // Drives batchedSockets if ioThread is enabled and supported.
+    class IoThread;
+    QScopedPointer<IoThread> ioThread;
+
+    void chooseNetworkInterfaces()
         throw (NoSuitableInterfaceEx);
+
+    Channel *findChannel(int id) const;
+
+    /**
+     * @throw NetworkEx if the channel is not joined, or the datagram is
+     * too large.
+     */
+    const Channel *findChannelToSend(int channel,
+        const QByteArray &datagram) const
+        throw (NetworkEx);
+
+    /**
+     * @return The new channel, owned by the caller.
+     */
+    Channel *openChannel(const QString &name,
+        const QHostAddress &groupAddress, quint16 port)
+        throw (NetworkEx);
+
+    void openSockets(Channel *channel)
+        throw (NetworkEx);
+
+    void openBatchedSockets(Channel *channel)
+        throw (NetworkEx);
+
+    /**
+     * Also builds the header of the channel.
+     */
+    void openUnicastSocket(Channel *channel)
+        throw (NetworkEx);
+
+    /**
+     * Failing to attach the filter is not an error: datagrams are then
+     * filtered in userspace.
+     */
+    void attachSocketFilter(const Channel *channel);
+
+    void startIoThread()
+        throw (NetworkEx);
+
+    void receiveBatches(const Channel *channel, int socketIndex);
+
+    void sendQueuedDatagrams()
+        throw (NetworkEx);
+
+    /**
+     * Send the datagram having the header; to the recipient only if its
+     * port is not zero.
+     */
+    void sendFramed(const QByteArray &framed, const Channel *to,
+        const SenderAddress &recipient = SenderAddress())
+        throw (NetworkEx);
+
+    /**
+     * Send the datagram after pacing; via the unicast socket if the
+     * recipient port is not zero.
+     */
+    void impairAndDispatch(const QByteArray &datagram, const Channel *to,
+        const SenderAddress &recipient)
+        throw (NetworkEx);
+
+    /**
+     * Send the datagram after the impairment.
+     */
+    void dispatchDatagram(const QByteArray &datagram, const Channel *to)
+        throw (NetworkEx);
+
+    void unicastDatagram(const QByteArray &datagram, const Channel *to,
+        const SenderAddress &recipient)
+        throw (NetworkEx);
+
+    /**
+     * Thread-safe: is called on the I/O thread in ioThread mode. Sets the
+     * sender instance of the slot, and the sender port to the unicast one.
+     * @param port Port of the channel the datagram is received on; 0 for
+     * the unicast socket, which accepts any.
+     * @param channelTag Tag of the channel the datagram is received on.
+     * @param counters Of the receiving socket.
+     * @return Whether the datagram should be delivered.
+     */
+    bool acceptDatagram(DatagramSlot &slot, quint16 port,
+        quint16 channelTag, SocketCounters *counters);
+
+    void deliverDatagram(const DatagramSlot &slot);
 };
 
 #endif // MULTICASTER_H
@@ -0,0 +1,249 @@
+#include "Relay.h"
+
+#include <string.h>
+
+#include <QUdpSocket>
+#include <QtEndian>
+#include <QDebug>
+
+#include "DuplicateFilter.h"
+
+const Relay::Settings Relay::defaultSettings;
+
+// "MCRL", and the format version.
+static const char cPacketMagic[] = "MCRL";
+static const int cPacketMagicSize = 4;
+static const char cPacketVersion = 1;
+static const int cPacketHeaderSize = cPacketMagicSize + 1;
+
+// Origin IPv4, origin instance id, channel name size, datagram size.
+static const int cFrameHeaderSize = 4 + 4 + 1 + 2;
+
+static const int cMaxChannelNameSize = 255;
+
+// Enough to tell apart the datagrams arriving within duplicateWindowMs.
+static const int cDuplicateFilterTableSize = 4096;
+
+///////////////////////////////////////////////////////////////////////////
+// Utils.
+
+static void appendBigEndian(QByteArray *pBytes, quint32 value, int size)
+{
+    uchar bytes[4];
+    qToBigEndian<quint32>(value, bytes);
+    pBytes->append(reinterpret_cast<const char *>(bytes) + 4 - size, size);
+}
+
+static quint32 readBigEndian(const char *data, int size)
+{
+    uchar bytes[4] = {0, 0, 0, 0};
+    memcpy(bytes + 4 - size, data, size);
+    return qFromBigEndian<quint32>(bytes);
+}
+
+///////////////////////////////////////////////////////////////////////////
+
+Relay::Relay(QObject *parent, const Settings &settings,
+    Transport *transport)
+    throw (Transport::NetworkEx)
+    : QObject(parent), settings(settings), transport(transport),
+        socket(new QUdpSocket(this)),
+        duplicateFilter(new DuplicateFilter(
+            cDuplicateFilterTableSize, settings.duplicateWindowMs))
+{
+    if (!socket->bind(settings.address, settings.port)) {
+        throw Transport::NetworkEx("Unable to bind relay UDP socket to port "
+            + QString::number(settings.port) + ": "
+            + socket->errorString() + ".");
+    }
+    connect(socket, SIGNAL(readyRead()), this, SLOT(peerReadyRead()));
+
+    channelNames.insert(Transport::cDefaultChannel, QString());
+    foreach (const QString &name, settings.channels) {
+        if (name.toUtf8().size() > cMaxChannelNameSize) {
+            throw Transport::NetworkEx("Channel name \"" + name
+                + "\" is too long to relay.");
+        }
+        channelNames.insert(transport->joinChannel(name), name);
+    }
+
+    // Datagrams addressed to any App are relayed.
+    connect(transport, SIGNAL(datagramReceived(DatagramView)),
+        this, SLOT(localDatagramReceived(DatagramView)));
+
+    batchTimer.setSingleShot(true);
+    batchTimer.setInterval(settings.batchPeriodMs);
+    connect(&batchTimer, SIGNAL(timeout()), this, SLOT(flush()));
+
+    duplicateFilterTimer.start();
+}
+
+Relay::~Relay()
+{
+}
+
+void Relay::addPeer(const QHostAddress &address, quint16 port)
+{
+    if (!isPeer(address, port)) {
+        peers.append(Peer{address, port});
+    }
+}
+
+quint16 Relay::getPort() const
+{
+    return socket->localPort();
+}
+
+bool Relay::isPeer(const QHostAddress &address, quint16 port) const
+{
+    foreach (const Peer &peer, peers) {
+        if (peer.address == address && peer.port == port) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Relay::localDatagramReceived(const DatagramView &datagram)
+{
+    if (datagram.isRelayed()) {
+        ++stats.relayedNotForwarded;
+        return;
+    }
+
+    auto it = channelNames.constFind(datagram.channel());
+    if (it == channelNames.constEnd() || peers.isEmpty()) {
+        return;
+    }
+
+    const QByteArray channelName = it.value().toUtf8();
+    const int frameSize = cFrameHeaderSize + channelName.size()
+        + datagram.size();
+    if (!packet.isEmpty()
+        && packet.size() + frameSize > settings.maxPacketSize) {
+
+        flush();
+    }
+    if (packet.isEmpty()) {
+        packet.append(cPacketMagic, cPacketMagicSize);
+        packet.append(cPacketVersion);
+    }
+
+    appendBigEndian(&packet, datagram.sender().ip, 4);
+    appendBigEndian(&packet, datagram.sender().instance, 4);
+    appendBigEndian(&packet, quint32(channelName.size()), 1);
+    appendBigEndian(&packet, quint32(datagram.size()), 2);
+    packet.append(channelName);
+    packet.append(datagram.data(), datagram.size());
+    ++stats.datagramsForwarded;
+
+    if (settings.batchPeriodMs <= 0) {
+        flush();
+    } else if (!batchTimer.isActive()) {
+        batchTimer.start();
+    }
+}
+
+void Relay::flush()
+{
+    batchTimer.stop();
+    if (packet.isEmpty()) {
+        return;
+    }
+
+    foreach (const Peer &peer, peers) {
+        if (socket->writeDatagram(packet, peer.address, peer.port)
+            != packet.size()) {
+
+            // Ignore errors: forwarding is as unreliable as multicast.
+            qDebug() << "Relay::flush() Unable to send packet to"
+                << peer.address.toString() << peer.port << ":"
+                << socket->errorString();
+            continue;
+        }
+        ++stats.packetsSent;
+    }
+    packet.clear();
+}
+
+void Relay::peerReadyRead()
+{
+    while (socket->hasPendingDatagrams()) {
+        QByteArray received;
+        received.resize(int(socket->pendingDatagramSize()));
+        QHostAddress senderAddress;
+        quint16 senderPort;
+        const qint64 r = socket->readDatagram(received.data(),
+            received.size(), &senderAddress, &senderPort);
+        if (r < 0) {
+            return;
+        }
+        received.resize(int(r));
+
+        if (!isPeer(senderAddress, senderPort) || !relayPacket(received)) {
+            ++stats.packetsDropped;
+            continue;
+        }
+        ++stats.packetsReceived;
+    }
+}
+
+bool Relay::relayPacket(const QByteArray &received)
+{
+    if (received.size() < cPacketHeaderSize
+        || memcmp(received.constData(), cPacketMagic, cPacketMagicSize) != 0
+        || received.at(cPacketMagicSize) != cPacketVersion) {
+
+        return false;
+    }
+
+    const char *data = received.constData();
+    int offset = cPacketHeaderSize;
+    while (offset < received.size()) {
+        if (received.size() - offset < cFrameHeaderSize) {
+            return false;
+        }
+        SenderAddress origin;
+        origin.ip = readBigEndian(data + offset, 4);
+        origin.instance = readBigEndian(data + offset + 4, 4);
+        const int nameSize = int(readBigEndian(data + offset + 8, 1));
+        const int dataSize = int(readBigEndian(data + offset + 9, 2));
+        offset += cFrameHeaderSize;
+
+        if (received.size() - offset < nameSize + dataSize
+            || dataSize > Transport::cMaxDatagramSize) {
+
+            return false;
+        }
+        const QString channelName = QString::fromUtf8(
+            data + offset, nameSize);
+        const char *datagram = data + offset + nameSize;
+        offset += nameSize + dataSize;
+
+        slot.channel = channelNames.key(channelName, -1);
+        if (slot.channel == -1) {
+            ++stats.framesDropped;
+            continue;
+        }
+
+        memcpy(slot.data, datagram, dataSize);
+        slot.size = dataSize;
+        slot.sender = origin;
+        if (duplicateFilter->isDuplicate(
+            slot, duplicateFilterTimer.elapsed())) {
+
+            ++stats.duplicatesDropped;
+            continue;
+        }
+
+        try {
+            transport->relayDatagram(
+                QByteArray(datagram, dataSize), origin, slot.channel);
+            ++stats.datagramsRelayed;
+        } catch (Transport::NetworkEx &e) {
+            // Ignore errors.
+            qDebug() << "Relay: Unable to relay datagram:" << e.what();
+        }
+    }
+    return true;
+}
@@ -0,0 +1,169 @@
+#ifndef RELAY_H
+#define RELAY_H
+
+// Bridge between chat networks which multicast does not cross.
+
+#include <QObject>
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QHostAddress>
+
+#include "Transport.h"
+#include "DatagramPool.h"
+
+// private:
+#include <QHash>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QScopedPointer>
+class QUdpSocket;
+class DuplicateFilter;
+
+/**
+ * Forwards the datagrams received via the local transport (e.g. a
+ * Multicaster joined in one subnet) to the peer relays over UDP unicast,
+ * and sends the datagrams received from the peers via the local transport
+ * on behalf of their origins (Transport::relayDatagram()), thus, Apps in
+ * all the networks chat as in one.
+ *
+ * Datagrams are coalesced into packets per batch period. Loops do not
+ * amplify traffic:
+ * - Datagrams received from the peers are never forwarded to the peers,
+ *   thus, each relay should be peered with the relays of all the other
+ *   networks (but not with the ones of its own).
+ * - Relayed datagrams received via the local transport (e.g. sent by
+ *   another relay in the same network) are not forwarded.
+ * - A datagram received again from any peer within the duplicate window
+ *   is dropped (e.g. when two relays serve the same network; then, the
+ *   Apps there still receive the datagrams of other networks twice).
+ *
+ * Packets are accepted only from the added peers. A packet is "MCRL" and
+ * a version byte, followed by frames: the IPv4 and the instance id of the
+ * origin, the channel name size, the datagram size, the channel name and
+ * the datagram; the integers are big-endian, of 4, 4, 1 and 2 bytes.
+ */
+class Relay : public QObject
+{
+    Q_OBJECT
+public:
+    struct Settings
+    {
+        // Of the socket exchanging packets with the peers; port 0 means
+        // an ephemeral one.
+        QHostAddress address = QHostAddress::AnyIPv4;
+        quint16 port = 42500;
+
+        // Named channels to relay, besides the default one.
+        QStringList channels;
+
+        // Datagrams to forward are coalesced within this period into
+        // packets of up to maxPacketSize bytes (except a single larger
+        // datagram); 0 means forwarding each right away.
+        int batchPeriodMs = 2;
+        int maxPacketSize = 1472;
+
+        int duplicateWindowMs = 1000;
+    };
+
+    static const Settings defaultSettings;
+
+    struct Stats
+    {
+        // Received via the local transport and sent to the peers.
+        quint64 datagramsForwarded = 0;
+
+        // Relayed datagrams received via the local transport.
+        quint64 relayedNotForwarded = 0;
+
+        // Over all the peers.
+        quint64 packetsSent = 0;
+        quint64 packetsReceived = 0;
+
+        // Received from the peers and sent via the local transport.
+        quint64 datagramsRelayed = 0;
+
+        quint64 duplicatesDropped = 0;
+
+        // From unknown senders, malformed, or of channels not relayed.
+        quint64 packetsDropped = 0;
+        quint64 framesDropped = 0;
+    };
+
+    /**
+     * @param transport Should support relayDatagram(); not owned here.
+     * @throw Transport::NetworkEx if the socket can not be bound, or a
+     * channel can not be joined.
+     */
+    Relay(QObject *parent, const Settings &settings, Transport *transport)
+        throw (Transport::NetworkEx);
+
+    virtual ~Relay() override;
+
+    /**
+     * Peers are identified by the address and the port of their sockets.
+     */
+    void addPeer(const QHostAddress &address, quint16 port);
+
+    /**
+     * @return Port of the socket, e.g. if bound to an ephemeral one.
+     */
+    quint16 getPort() const;
+
+    Stats getStats() const
+    {
+        return stats;
+    }
+
+public slots:
+    /**
+     * Send the coalesced datagrams to the peers right away.
+     */
+    void flush();
+
+private slots:
+    void localDatagramReceived(const DatagramView &datagram);
+    void peerReadyRead();
+
+private:
+    const Settings settings;
+    Stats stats;
+
+    // Neither created nor owned here.
+    Transport *const transport;
+
+    // Is QObject, owned here.
+    QUdpSocket *socket;
+
+    struct Peer
+    {
+        QHostAddress address;
+        quint16 port;
+    };
+    QList<Peer> peers;
+
+    // Transport channel id -> name; the default channel has the empty
+    // name.
+    QHash<int, QString> channelNames;
+
+    // Frames waiting for batchTimer, following the packet header; empty
+    // if none.
+    QByteArray packet;
+    QTimer batchTimer;
+
+    QScopedPointer<DuplicateFilter> duplicateFilter;
+    QElapsedTimer duplicateFilterTimer;
+
+    // Reused for duplicate detection.
+    DatagramSlot slot;
+
+    bool isPeer(const QHostAddress &address, quint16 port) const;
+
+    /**
+     * @return false if the packet is malformed.
+     */
+    bool relayPacket(const QByteArray &received);
+};
+
+#endif // RELAY_H
@@ -0,0 +1,157 @@
+#ifndef RELAYTEST_H
+#define RELAYTEST_H
+
+#include <QtTest>
+
+#include "Relay.h"
+#include "LoopbackHub.h"
+
+/**
+ * Collects the datagrams received by an App.
+ */
+class ReceivedDatagrams : public QObject
+{
+    Q_OBJECT
+public:
+    QList<QByteArray> data;
+    QList<quint32> senderIps;
+    QList<SenderAddress> senders;
+    int relayedCount = 0;
+
+    explicit ReceivedDatagrams(Transport *transport)
+    {
+        connect(transport, SIGNAL(datagramReceived(DatagramView)),
+            this, SLOT(datagramReceived(DatagramView)));
+    }
+
+private slots:
+    void datagramReceived(const DatagramView &datagram)
+    {
+        data.append(datagram.toByteArray());
+        senderIps.append(datagram.sender().ip);
+        senders.append(datagram.sender());
+        relayedCount += datagram.isRelayed() ? 1 : 0;
+    }
+};
+
+/**
+ * Each network is a LoopbackHub; relays exchange packets via UDP on
+ * localhost.
+ */
+class RelayTest : public QObject
+{
+    Q_OBJECT
+private:
+    static LoopbackHub::Settings buildHubSettings(quint32 firstIp)
+    {
+        LoopbackHub::Settings settings;
+        settings.firstIp = firstIp;
+        return settings;
+    }
+
+    static Relay::Settings buildRelaySettings()
+    {
+        Relay::Settings settings;
+        settings.address = QHostAddress(QHostAddress::LocalHost);
+        settings.port = 0;
+        return settings;
+    }
+
+    static void connectPeers(Relay *first, Relay *second)
+    {
+        first->addPeer(QHostAddress(QHostAddress::LocalHost),
+            second->getPort());
+        second->addPeer(QHostAddress(QHostAddress::LocalHost),
+            first->getPort());
+    }
+
+private slots:
+    void testBatchedForwarding()
+    {
+        LoopbackHub hubA(nullptr, buildHubSettings(0x0A000001));
+        LoopbackHub hubB(nullptr, buildHubSettings(0x0A010001));
+        LoopbackTransport appA(nullptr, &hubA);
+        LoopbackTransport appB(nullptr, &hubB);
+        LoopbackTransport relayTransportA(nullptr, &hubA);
+        LoopbackTransport relayTransportB(nullptr, &hubB);
+        Relay relayA(nullptr, buildRelaySettings(), &relayTransportA);
+        Relay relayB(nullptr, buildRelaySettings(), &relayTransportB);
+        connectPeers(&relayA, &relayB);
+        ReceivedDatagrams receivedB(&appB);
+
+        appA.sendDatagram("user|a");
+        appA.sendDatagram("text|hello");
+        appA.sendDatagram("ack|10.1.0.1|1");
+
+        QTRY_COMPARE(receivedB.data.size(), 3);
+        QCOMPARE(receivedB.data.at(1), QByteArray("text|hello"));
+        QCOMPARE(receivedB.senderIps.at(1), quint32(0x0A000001));
+        QCOMPARE(receivedB.relayedCount, 3);
+
+        QCOMPARE(int(relayA.getStats().datagramsForwarded), 3);
+        QCOMPARE(int(relayA.getStats().packetsSent), 1);
+        QCOMPARE(int(relayB.getStats().datagramsRelayed), 3);
+    }
+
+    void testFullSizeDatagram()
+    {
+        LoopbackHub hubA(nullptr, buildHubSettings(0x0A000001));
+        LoopbackHub hubB(nullptr, buildHubSettings(0x0A010001));
+        LoopbackTransport appA(nullptr, &hubA);
+        LoopbackTransport appB(nullptr, &hubB);
+        LoopbackTransport relayTransportA(nullptr, &hubA);
+        LoopbackTransport relayTransportB(nullptr, &hubB);
+        Relay relayA(nullptr, buildRelaySettings(), &relayTransportA);
+        Relay relayB(nullptr, buildRelaySettings(), &relayTransportB);
+        connectPeers(&relayA, &relayB);
+        ReceivedDatagrams receivedB(&appB);
+
+        // As large as a batch or a fragment the Engine sends; the relayed
+        // header of any transport fits into the rest of the slot.
+        QByteArray datagram = "text|";
+        datagram += QByteArray(Transport::cMaxDatagramSize - datagram.size(),
+            'x');
+        appA.sendDatagram(datagram);
+
+        QTRY_COMPARE(receivedB.data.size(), 1);
+        QCOMPARE(receivedB.data.first(), datagram);
+        QCOMPARE(receivedB.relayedCount, 1);
+        QCOMPARE(int(relayB.getStats().packetsDropped), 0);
+    }
+
+    void testNoAmplification()
+    {
+        // Network B is served by two relays.
+        LoopbackHub hubA(nullptr, buildHubSettings(0x0A000001));
+        LoopbackHub hubB(nullptr, buildHubSettings(0x0A010001));
+        LoopbackTransport appA(nullptr, &hubA);
+        LoopbackTransport appB(nullptr, &hubB);
+        LoopbackTransport relayTransportA(nullptr, &hubA);
+        LoopbackTransport relayTransportB1(nullptr, &hubB);
+        LoopbackTransport relayTransportB2(nullptr, &hubB);
+        Relay relayA(nullptr, buildRelaySettings(), &relayTransportA);
+        Relay relayB1(nullptr, buildRelaySettings(), &relayTransportB1);
+        Relay relayB2(nullptr, buildRelaySettings(), &relayTransportB2);
+        connectPeers(&relayA, &relayB1);
+        connectPeers(&relayA, &relayB2);
+        ReceivedDatagrams receivedA(&appA);
+        ReceivedDatagrams receivedB(&appB);
+
+        appA.sendDatagram("text|from a");
+        QTRY_COMPARE(receivedB.data.size(), 2);
+
+        // Neither relay of B forwards what the other one has relayed.
+        QTRY_COMPARE(int(relayB1.getStats().relayedNotForwarded
+            + relayB2.getStats().relayedNotForwarded), 2);
+        QCOMPARE(int(relayB1.getStats().packetsSent), 0);
+        QCOMPARE(int(relayB2.getStats().packetsSent), 0);
+
+        appB.sendDatagram("text|from b");
+        QTRY_COMPARE(int(relayA.getStats().duplicatesDropped), 1);
+        QCOMPARE(receivedA.data, QList<QByteArray>() << "text|from b");
+        QCOMPARE(int(relayA.getStats().packetsSent), 2);
+        QCOMPARE(receivedB.data.size(), 2);
+    }
+};
+
+#endif // RELAYTEST_H
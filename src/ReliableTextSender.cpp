@@ -3,6 +3,51 @@
 #include <QTimer>
 #include <QDebug>
 
+// Bits of a fragment mask.
+static const int cMaxFragmentCount = int(sizeof(quint32) * 8);
+
+ReliableTextSender::ReliableTextSender(QObject *parent,
+    const Settings &settings,
+    const QString &ownSenderId, const QString &text,
+    const QSet<QString> &userIdsToWaitAck)
+    : QObject(parent),
+        settings(settings), ownSenderId(ownSenderId), text(text),
+        fragments(text.toUtf8().size() > settings.maxFragmentUtf8Size
+            ? splitIntoFragments(text, settings.maxFragmentUtf8Size)
+            : QStringList()),
+        allFragments(fragments.size() >= cMaxFragmentCount
+            ? ~quint32(0) : (quint32(1) << fragments.size()) - 1),
+        userIdsToWaitAck(userIdsToWaitAck)
+{
+    Q_ASSERT(fragments.size() <= cMaxFragmentCount);
+}
+
+QStringList ReliableTextSender::splitIntoFragments(const QString &text,
+    int maxFragmentUtf8Size)
+{
+    // Leaves room for any UTF-8 char.
+    Q_ASSERT(maxFragmentUtf8Size >= 4);
+
+    const QByteArray utf8 = text.toUtf8();
+    QStringList result;
+    int pos = 0;
+    do {
+        int fragmentEnd = qMin(pos + maxFragmentUtf8Size, utf8.size());
+
+        // Continuation bytes are 10xxxxxx.
+        while (fragmentEnd < utf8.size()
+            && (uchar(utf8[fragmentEnd]) & 0xC0) == 0x80) {
+
+            --fragmentEnd;
+        }
+
+        result.append(QString::fromUtf8(
+            utf8.constData() + pos, fragmentEnd - pos));
+        pos = fragmentEnd;
+    } while (pos < utf8.size());
+    return result;
+}
+
 void ReliableTextSender::start()
 {
     QElapsedTimer timeOfFirstAttempt;
@@ -11,7 +56,7 @@ void ReliableTextSender::start()
 
     if (userIdsToWaitAck.isEmpty()) {
         // On empty contact list, just send the message once and finish.
-        emit needToSendText(text, sentTextId);
+        send(sentTextId);
         emit finished(userIdsToWaitAck);
         return;
     }
@@ -38,7 +83,7 @@ void ReliableTextSender::attemptToSendText()
             << qUtf8Printable("#" + QString::number(attempt))
             << ">>>" << userIdsToWaitAck;
 
-        emit finished(userIdsToWaitAck);
+        finish();
         return;
     }
 
@@ -49,7 +94,8 @@ void ReliableTextSender::attemptToSendText()
         << qUtf8Printable("#" + QString::number(attempt))
         << ">>>" << userIdsToWaitAck;
 
-    emit needToSendText(text, textIdToSend);
+    ackedCounts.append(0);
+    send(textIdToSend);
 
     QTimer::singleShot(settings.attemptPeriodMs,
         this, SLOT(attemptToSendText()));
@@ -59,15 +105,78 @@ void ReliableTextSender::handleAck(
     const QString &textSenderId, qint64 textId, const QString &senderId)
 {
     if (textSenderId != ownSenderId || abs(textId) != sentTextId
-        || userIdsToWaitAck.isEmpty()) {
+        || userIdsToWaitAck.isEmpty() || !fragments.isEmpty()) {
 
         return;
     }
 
-    userIdsToWaitAck.remove(senderId);
+    userReceived(senderId);
+}
+
+void ReliableTextSender::handleFragmentAck(const QString &textSenderId,
+    qint64 textId, quint32 receivedFragments, const QString &senderId)
+{
+    if (textSenderId != ownSenderId || abs(textId) != sentTextId
+        || fragments.isEmpty() || !userIdsToWaitAck.contains(senderId)) {
+
+        return;
+    }
+
+    quint32 &received = userReceivedFragments[senderId];
+    received |= receivedFragments & allFragments;
+    if (received == allFragments) {
+        userReceived(senderId);
+    }
+}
+
+void ReliableTextSender::send(qint64 textId)
+{
+    if (fragments.isEmpty()) {
+        emit needToSendText(text, textId);
+        return;
+    }
+
+    // The fragments acked by all the users are not resent.
+    quint32 missing = userIdsToWaitAck.isEmpty() ? allFragments : 0;
+    foreach (const QString &userId, userIdsToWaitAck) {
+        missing |= allFragments & ~userReceivedFragments.value(userId);
+    }
+
+    for (int i = 0; i < fragments.size(); ++i) {
+        if (missing & (quint32(1) << i)) {
+            emit needToSendFragment(fragments[i], textId, i,
+                fragments.size());
+        }
+    }
+}
+
+void ReliableTextSender::userReceived(const QString &senderId)
+{
+    userReceivedFragments.remove(senderId);
+    if (userIdsToWaitAck.remove(senderId)) {
+        ++ackedCounts.last();
+    }
 
     if (userIdsToWaitAck.isEmpty()) {
         // Delivered to everyone.
-        emit finished(userIdsToWaitAck);
+        finish();
     }
 }
+
+void ReliableTextSender::finish()
+{
+    // Users which have acked during the attempts after each one.
+    int ackedLater = 0;
+    foreach (int ackedCount, ackedCounts) {
+        ackedLater += ackedCount;
+    }
+
+    foreach (int ackedCount, ackedCounts) {
+        ackedLater -= ackedCount;
+        if (ackedCount + ackedLater > 0) {
+            emit attemptCompleted(ackedCount, ackedLater);
+        }
+    }
+
+    emit finished(userIdsToWaitAck);
+}
@@ -6,6 +6,9 @@
 #include <QObject>
 #include <QString>
 #include <QSet>
+#include <QHash>
+#include <QList>
+#include <QStringList>
 #include <QElapsedTimer>
 
 /**
@@ -13,9 +16,16 @@
  * sending mechanism: the text is sent possibly several times until it is
  * acked by all of the users.
  *
+ * A text longer than Settings::maxFragmentUtf8Size is split into
+ * fragments, each acked separately: each attempt resends only the
+ * fragments which some of the users have not acked yet, and a user is
+ * considered to have received the text when all of its fragments are
+ * acked.
+ *
  * This component does not perform actual text sending and ack receiving:
- * it rather emits sendText() signal and offers handleAck() method to
- * delegate these actions to its user.
+ * it rather emits needToSendText() and needToSendFragment() signals and
+ * offers handleAck() and handleFragmentAck() methods to delegate these
+ * actions to its user.
  *
  * A new object of this class should be created for sending new text, and
  * can be deleted via deleteLater() after it emits finished().
@@ -28,16 +38,24 @@ public:
     {
         int maxAttempts;
         int attemptPeriodMs;
+        int maxFragmentUtf8Size;
     };
 
+    /**
+     * @param text Should fit into Chat::FragmentMessage::cMaxCount
+     * fragments.
+     */
     ReliableTextSender(QObject *parent,
         const Settings &settings,
         const QString &ownSenderId, const QString &text,
-        const QSet<QString> &userIdsToWaitAck)
-        : QObject(parent),
-            settings(settings), ownSenderId(ownSenderId), text(text),
-            userIdsToWaitAck(userIdsToWaitAck)
-    {}
+        const QSet<QString> &userIdsToWaitAck);
+
+    /**
+     * Splits the text at UTF-8 char boundaries.
+     * @return A single fragment if the text fits.
+     */
+    static QStringList splitIntoFragments(const QString &text,
+        int maxFragmentUtf8Size);
 
     /**
      * Should be called once, after signals are connected.
@@ -50,6 +68,13 @@ public:
     void handleAck(const QString &textSenderId, qint64 textId,
         const QString &senderId);
 
+    /**
+     * Should be called each time a fragment ack is received from a user.
+     * @param receivedFragments Bit i is set if fragment i is received.
+     */
+    void handleFragmentAck(const QString &textSenderId, qint64 textId,
+        quint32 receivedFragments, const QString &senderId);
+
 signals:
     /**
      * Emitted when an attempt to send the text should be performed.
@@ -57,6 +82,13 @@ signals:
      */
     void needToSendText(QString text, qint64 textId);
 
+    /**
+     * Emitted instead of needToSendText() for each fragment of a long text
+     * to be sent during an attempt.
+     */
+    void needToSendFragment(QString fragment, qint64 textId, int index,
+        int count);
+
     /**
      * Emitted when the text is acked by all users (then failedUserIds is
      * empty), or the timeout has expired (then failedUserIds contains Ids
@@ -65,6 +97,16 @@ signals:
      */
     void finished(QSet<QString> failedUserIds);
 
+    /**
+     * Emitted for each attempt right before finished(), for congestion
+     * control: ackedCount users have acked during the attempt, and
+     * unackedCount have not, but have acked during a later one. The users
+     * which have never acked (e.g. have left without the "leave" message)
+     * are not counted: they would report loss on every attempt of every
+     * text, however low the rate is.
+     */
+    void attemptCompleted(int ackedCount, int unackedCount);
+
 private slots:
     void attemptToSendText();
 
@@ -73,13 +115,29 @@ private:
     const QString ownSenderId;
     const QString text;
 
+    // Empty unless the text is fragmented.
+    const QStringList fragments;
+
+    // Bit i is set for each fragment i.
+    const quint32 allFragments;
+
     QSet<QString> userIdsToWaitAck;
 
+    // Of the users in userIdsToWaitAck which have acked some fragments.
+    QHash<QString, quint32> userReceivedFragments;
+
     int attempt = 0;
 
+    // For each attempt so far, users which have acked during it.
+    QList<int> ackedCounts;
+
     // Time stamp of first sending attempt is used as textId for the first
     // attempt, and further attempts use its negated value as textId.
     qint64 sentTextId = 0;
+
+    void send(qint64 textId);
+    void userReceived(const QString &senderId);
+    void finish();
 };
 
 #endif // RELIABLETEXTSENDER_H
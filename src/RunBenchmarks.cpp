@@ -0,0 +1,34 @@
+#include <QtTest/QtTest>
+
+#include "iostream"
+
+#include "BatchedUdpSocketBenchmark.h"
+#include "ChatEngineBenchmark.h"
+#include "ChatMessagesBenchmark.h"
+
+template<class Benchmark>
+static int runBenchmark(int argc, char *argv[])
+{
+    Benchmark benchmark;
+    return QTest::qExec(&benchmark, argc, argv);
+}
+
+/**
+ * Each benchmark class should be registered in this function. Command
+ * line args are passed to QTest, e.g. "-iterations 1000" or "-callgrind".
+ */
+int runBenchmarks(int argc, char *argv[])
+{
+    int result = 0;
+
+#ifdef Q_OS_LINUX
+    result += runBenchmark<BatchedUdpSocketBenchmark>(argc, argv);
+#endif
+    result += runBenchmark<ChatEngineBenchmark>(argc, argv);
+    result += runBenchmark<ChatMessagesBenchmark>(argc, argv);
+
+    if (result > 0) {
+        std::cout << "\nATTENTION: " << result << " benchmark(s) failed.\n\n";
+    }
+    return result;
+}
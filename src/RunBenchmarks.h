@@ -0,0 +1,8 @@
+#ifndef RUNBENCHMARKS_H
+#define RUNBENCHMARKS_H
+
+// Benchmark launcher.
+
+int runBenchmarks(int argc, char *argv[]);
+
+#endif // RUNBENCHMARKS_H
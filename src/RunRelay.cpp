@@ -0,0 +1,56 @@
+#include <QCoreApplication>
+#include <QStringList>
+
+#include "iostream"
+
+#include "RunRelay.h"
+#include "Multicaster.h"
+#include "Relay.h"
+
+static int printUsage()
+{
+    std::cerr << "Usage: MultiChat <port> [<peer IPv4>:<peer port>]...\n"
+        "Relays the default chat channel of this network to the peer\n"
+        "relays, and theirs to this network.\n";
+    return 2;
+}
+
+int runRelay()
+{
+    const QStringList args = QCoreApplication::arguments();
+    if (args.size() < 2) {
+        return printUsage();
+    }
+
+    bool ok;
+    Relay::Settings settings;
+    settings.port = quint16(args.at(1).toUInt(&ok));
+    if (!ok) {
+        return printUsage();
+    }
+
+    try {
+        Multicaster multicaster(nullptr, Multicaster::defaultSettings);
+        Relay relay(nullptr, settings, &multicaster);
+
+        for (int i = 2; i < args.size(); ++i) {
+            const QStringList parts = args.at(i).split(':');
+            QHostAddress address;
+            const quint16 port = (parts.size() == 2)
+                ? quint16(parts.at(1).toUInt(&ok)) : 0;
+            if (port == 0 || !ok || !address.setAddress(parts.at(0))) {
+                return printUsage();
+            }
+            relay.addPeer(address, port);
+        }
+
+        std::cout << "Relaying via port " << relay.getPort() << " to "
+            << (args.size() - 2) << " peer(s).\n";
+        return QCoreApplication::exec();
+    } catch (Multicaster::NoSuitableInterfaceEx &e) {
+        std::cerr << e.what() << "\n";
+    } catch (Transport::NetworkEx &e) {
+        std::cerr << e.what() << "\n";
+    }
+    return 1;
+}
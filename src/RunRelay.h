@@ -0,0 +1,11 @@
+#ifndef RUNRELAY_H
+#define RUNRELAY_H
+
+// Relay launcher.
+
+/**
+ * Takes the args of the existing QCoreApplication, and runs its event loop.
+ */
+int runRelay();
+
+#endif // RUNRELAY_H
@@ -4,6 +4,21 @@
 
 #include "ChatMessagesTest.h"
 #include "ReliableTextReceiverTest.h"
+#include "SpscRingTest.h"
+#include "DuplicateFilterTest.h"
+#include "ImpairmentTest.h"
+#include "SendPacerTest.h"
+#include "SharedMemoryTransportTest.h"
+#include "LatencyHistogramTest.h"
+#include "RelayTest.h"
+#include "FieldScannerTest.h"
+#include "TextCompressorTest.h"
+#include "TextReassemblerTest.h"
+#include "ChatMessagesFuzzTest.h"
+#include "ChatEngineTest.h"
+#ifdef Q_OS_LINUX
+#include "SocketFilterTest.h"
+#endif
 
 template<class Test>
 static int runTest()
@@ -21,6 +36,21 @@ int runTests()
 
     result += runTest<ChatMessageTest>();
     result += runTest<ReliableTextReceiverTest>();
+    result += runTest<SpscRingTest>();
+    result += runTest<DuplicateFilterTest>();
+    result += runTest<ImpairmentTest>();
+    result += runTest<SendPacerTest>();
+    result += runTest<SharedMemoryTransportTest>();
+    result += runTest<LatencyHistogramTest>();
+    result += runTest<RelayTest>();
+    result += runTest<FieldScannerTest>();
+    result += runTest<TextCompressorTest>();
+    result += runTest<TextReassemblerTest>();
+    result += runTest<ChatMessagesFuzzTest>();
+    result += runTest<ChatEngineTest>();
+#ifdef Q_OS_LINUX
+    result += runTest<SocketFilterTest>();
+#endif
 
     if (result > 0) {
         std::cout << "\nATTENTION: " << result << " test(s) failed.\n\n";
@@ -0,0 +1,103 @@
+#include "SendPacer.h"
+
+#include <QtMath>
+
+#include "DatagramPool.h"
+
+const SendPacer::Settings SendPacer::defaultSettings;
+
+SendPacer::SendPacer(QObject *parent, const Settings &settings)
+    : QObject(parent), settings(settings),
+        rateBytesPerSec(settings.initialRateBytesPerSec),
+        tokens(qMax(settings.burstBytes, DatagramSlot::cCapacity))
+{
+    clock.start();
+
+    releaseTimer.setSingleShot(true);
+    connect(&releaseTimer, SIGNAL(timeout()), this, SLOT(releaseDue()));
+}
+
+bool SendPacer::admit(const QByteArray &datagram, int channel,
+    const SenderAddress &recipient)
+{
+    ++stats.datagrams;
+    refill();
+
+    // Queued datagrams go first, to keep the order.
+    if (queue.isEmpty() && tokens >= datagram.size()) {
+        tokens -= datagram.size();
+        return true;
+    }
+
+    if (queue.size() >= settings.maxQueueSize) {
+        ++stats.queueDrops;
+        return false;
+    }
+
+    ++stats.queued;
+    queue.append(Queued{datagram, channel, recipient});
+    scheduleRelease();
+    return false;
+}
+
+void SendPacer::reportFeedback(int ackedCount, int unackedCount)
+{
+    const int total = ackedCount + unackedCount;
+    if (total == 0) {
+        return;
+    }
+
+    const double lossFraction = double(unackedCount) / total;
+    if (lossFraction > settings.lossThreshold) {
+        // At most halved, like TCP on a loss event.
+        ++stats.rateDecreases;
+        rateBytesPerSec = qMax(double(settings.minRateBytesPerSec),
+            rateBytesPerSec * qMax(0.5, 1 - lossFraction));
+    } else {
+        ++stats.rateIncreases;
+        rateBytesPerSec = qMin(double(settings.maxRateBytesPerSec),
+            rateBytesPerSec + settings.rateIncreaseBytesPerSec);
+    }
+
+    // The release time depends on the rate.
+    scheduleRelease();
+}
+
+SendPacer::Stats SendPacer::getStats() const
+{
+    Stats result = stats;
+    result.rateBytesPerSec = int(rateBytesPerSec);
+    result.queueSize = queue.size();
+    return result;
+}
+
+void SendPacer::refill()
+{
+    const qint64 nowNs = clock.nsecsElapsed();
+    const double capacity = qMax(settings.burstBytes, DatagramSlot::cCapacity);
+    tokens = qMin(capacity,
+        tokens + (nowNs - lastRefillNs) * rateBytesPerSec / 1e9);
+    lastRefillNs = nowNs;
+}
+
+void SendPacer::scheduleRelease()
+{
+    if (queue.isEmpty()) {
+        return;
+    }
+
+    const double missing = queue.first().datagram.size() - tokens;
+    releaseTimer.start(qMax(0, qCeil(missing * 1000 / rateBytesPerSec)));
+}
+
+void SendPacer::releaseDue()
+{
+    refill();
+    while (!queue.isEmpty() && tokens >= queue.first().datagram.size()) {
+        const Queued queued = queue.takeFirst();
+        tokens -= queued.datagram.size();
+        emit released(queued.datagram, queued.channel, queued.recipient);
+    }
+
+    scheduleRelease();
+}
@@ -0,0 +1,127 @@
+#ifndef SENDPACER_H
+#define SENDPACER_H
+
+// Rate limiter of sent datagrams, adapting to the loss reported by users.
+
+#include <QObject>
+#include <QByteArray>
+
+#include "DatagramPool.h"
+
+// private:
+#include <QList>
+#include <QTimer>
+#include <QElapsedTimer>
+
+/**
+ * Paces sent datagrams with a token bucket: a datagram passes if the
+ * bucket holds enough bytes, otherwise it is queued until the bucket is
+ * refilled at the current rate. Thus, bursts (e.g. retransmits of several
+ * texts at once) are spread over time instead of overflowing the receive
+ * buffers of slow receivers.
+ *
+ * The rate adapts to the feedback of reliable delivery (AIMD, in the
+ * spirit of TFMCC, which tracks the slowest receiver): it is decreased in
+ * proportion to the fraction of recipients which have not acked in time,
+ * and increased by a constant step when all have acked.
+ *
+ * Like Impairment, the datagrams which can pass right away are only
+ * admitted, so that the caller can send the original without copying; the
+ * queued ones are emitted via released() later. Unicast datagrams share
+ * the bucket with the multicast ones.
+ */
+class SendPacer : public QObject
+{
+    Q_OBJECT
+public:
+    struct Settings
+    {
+        // Rate is kept within [minRate, maxRate].
+        int initialRateBytesPerSec = 1024 * 1024;
+        int minRateBytesPerSec = 64 * 1024;
+        int maxRateBytesPerSec = 64 * 1024 * 1024;
+
+        // Capacity of the bucket: max burst sent at once after idling;
+        // raised to the max datagram size if less.
+        int burstBytes = 16 * 1024;
+
+        // Datagrams exceeding the queue are dropped (tail drop).
+        int maxQueueSize = 1024;
+
+        // Fraction of unacked recipients up to which the feedback is
+        // treated as no loss, e.g. a late ack of a single user out of many.
+        double lossThreshold = 0.05;
+
+        // Added to the rate on each feedback with no loss.
+        int rateIncreaseBytesPerSec = 64 * 1024;
+    };
+
+    static const Settings defaultSettings;
+
+    struct Stats
+    {
+        // Admitted; of them, queued, and dropped since the queue was full.
+        quint64 datagrams = 0;
+        quint64 queued = 0;
+        quint64 queueDrops = 0;
+        quint64 rateIncreases = 0;
+        quint64 rateDecreases = 0;
+
+        // At the moment.
+        int rateBytesPerSec = 0;
+        int queueSize = 0;
+    };
+
+    SendPacer(QObject *parent, const Settings &settings);
+
+    /**
+     * @param recipient Of a unicast datagram; zero port for multicast.
+     * @return Whether the datagram can be sent right away; otherwise, it
+     * is queued (copied) and emitted later, or dropped if the queue is
+     * full.
+     */
+    bool admit(const QByteArray &datagram, int channel,
+        const SenderAddress &recipient = SenderAddress());
+
+    /**
+     * Account the outcome of a reliable delivery attempt: the number of
+     * recipients which have acked in time, and which have not. See
+     * ReliableTextSender::attemptCompleted().
+     */
+    void reportFeedback(int ackedCount, int unackedCount);
+
+    Stats getStats() const;
+
+signals:
+    /**
+     * Emitted for each queued datagram when the bucket allows.
+     */
+    void released(QByteArray datagram, int channel,
+        SenderAddress recipient);
+
+private slots:
+    void releaseDue();
+
+private:
+    const Settings settings;
+    Stats stats;
+
+    double rateBytesPerSec;
+    double tokens;
+    QElapsedTimer clock;
+    qint64 lastRefillNs = 0;
+
+    struct Queued
+    {
+        QByteArray datagram;
+        int channel;
+        SenderAddress recipient;
+    };
+    QList<Queued> queue;
+    QTimer releaseTimer;
+
+    void refill();
+    void scheduleRelease();
+};
+
+#endif // SENDPACER_H
@@ -0,0 +1,135 @@
+#ifndef SENDPACERTEST_H
+#define SENDPACERTEST_H
+
+#include <QtTest>
+
+#include "SendPacer.h"
+#include "ReliableTextSender.h"
+
+class SendPacerTest : public QObject
+{
+    Q_OBJECT
+private:
+    static SendPacer::Settings buildSettings()
+    {
+        SendPacer::Settings settings;
+        settings.initialRateBytesPerSec = 100 * 1000;
+        settings.minRateBytesPerSec = 10 * 1000;
+        settings.maxRateBytesPerSec = 200 * 1000;
+        settings.burstBytes = 2000;
+        settings.rateIncreaseBytesPerSec = 50 * 1000;
+        return settings;
+    }
+
+private slots:
+    void testBurstThenQueue()
+    {
+        SendPacer pacer(nullptr, buildSettings());
+        QSignalSpy released(&pacer,
+            SIGNAL(released(QByteArray,int,SenderAddress)));
+
+        const QByteArray datagram(1000, 'x');
+        QVERIFY(pacer.admit(datagram, 0));
+        QVERIFY(pacer.admit(datagram, 0));
+
+        // The bucket is empty; 1000 bytes take 10 ms at 100 KB/s.
+        SenderAddress recipient;
+        recipient.ip = 0x0A000005;
+        recipient.port = 5000;
+        QVERIFY(!pacer.admit(datagram, 1));
+        QVERIFY(!pacer.admit(datagram, 2, recipient));
+        QCOMPARE(pacer.getStats().queueSize, 2);
+
+        QTRY_COMPARE(released.size(), 2);
+        QCOMPARE(released.at(0).at(1).toInt(), 1);
+        QCOMPARE(released.at(0).at(2).value<SenderAddress>().port,
+            quint16(0));
+        QCOMPARE(released.at(1).at(1).toInt(), 2);
+        QVERIFY(released.at(1).at(2).value<SenderAddress>() == recipient);
+        QCOMPARE(int(pacer.getStats().queued), 2);
+    }
+
+    void testQueueDrops()
+    {
+        SendPacer::Settings settings = buildSettings();
+        settings.maxQueueSize = 1;
+        SendPacer pacer(nullptr, settings);
+
+        const QByteArray datagram(2000, 'x');
+        QVERIFY(pacer.admit(datagram, 0));
+        QVERIFY(!pacer.admit(datagram, 1));
+        QVERIFY(!pacer.admit(datagram, 2));
+
+        const SendPacer::Stats stats = pacer.getStats();
+        QCOMPARE(int(stats.datagrams), 3);
+        QCOMPARE(int(stats.queued), 1);
+        QCOMPARE(int(stats.queueDrops), 1);
+        QCOMPARE(stats.queueSize, 1);
+    }
+
+    void testRateAdaptsToLoss()
+    {
+        SendPacer pacer(nullptr, buildSettings());
+
+        // Half of the recipients have not acked.
+        pacer.reportFeedback(5, 5);
+        QCOMPARE(pacer.getStats().rateBytesPerSec, 50 * 1000);
+
+        for (int i = 0; i < 10; ++i) {
+            pacer.reportFeedback(0, 10);
+        }
+        QCOMPARE(pacer.getStats().rateBytesPerSec, 10 * 1000);
+
+        // A loss within the threshold counts as none.
+        pacer.reportFeedback(99, 1);
+        QCOMPARE(pacer.getStats().rateBytesPerSec, 60 * 1000);
+
+        for (int i = 0; i < 10; ++i) {
+            pacer.reportFeedback(10, 0);
+        }
+        QCOMPARE(pacer.getStats().rateBytesPerSec, 200 * 1000);
+        QCOMPARE(int(pacer.getStats().rateDecreases), 11);
+    }
+
+    void testSilentPeerNotReported()
+    {
+        SendPacer pacer(nullptr, buildSettings());
+        const ReliableTextSender::Settings senderSettings{3, 50, 1000};
+
+        for (int i = 0; i < 5; ++i) {
+            ReliableTextSender sender(nullptr, senderSettings, "own", "Hi",
+                QSet<QString>() << "a" << "b" << "silent");
+            QSignalSpy textSent(&sender,
+                SIGNAL(needToSendText(QString,qint64)));
+            QSignalSpy attempts(&sender, SIGNAL(attemptCompleted(int,int)));
+            QSignalSpy finished(&sender, SIGNAL(finished(QSet<QString>)));
+            sender.start();
+
+            const qint64 textId = textSent.at(0).at(1).toLongLong();
+            sender.handleAck("own", textId, "a");
+
+            // "b" has missed the first attempt.
+            QVERIFY(textSent.wait());
+            sender.handleAck("own", -textId, "b");
+
+            QVERIFY(finished.wait());
+            QCOMPARE(attempts.size(), 2);
+            QCOMPARE(attempts.at(0).at(0).toInt(), 1);
+            QCOMPARE(attempts.at(0).at(1).toInt(), 1);
+            QCOMPARE(attempts.at(1).at(0).toInt(), 1);
+            QCOMPARE(attempts.at(1).at(1).toInt(), 0);
+
+            foreach (const QList<QVariant> &attempt, attempts) {
+                pacer.reportFeedback(attempt.at(0).toInt(),
+                    attempt.at(1).toInt());
+            }
+        }
+
+        // Each text halves the rate once, for the lost first attempt, and
+        // restores it once; the silent peer adds no decreases.
+        QCOMPARE(int(pacer.getStats().rateDecreases), 5);
+        QCOMPARE(int(pacer.getStats().rateIncreases), 5);
+    }
+};
+
+#endif // SENDPACERTEST_H
@@ -0,0 +1,593 @@
+#include "SharedMemoryTransport.h"
+
+#include <atomic>
+#include <string.h>
+
+#include <QCoreApplication>
+#include <QAtomicInteger>
+#include <QThread>
+#include <QSystemSemaphore>
+#include <QDebug>
+
+#ifdef Q_OS_UNIX
+#include <errno.h>
+#include <signal.h>
+#endif
+
+const SharedMemoryTransport::Settings SharedMemoryTransport::defaultSettings;
+
+// Distinguishes local senders, which share the host IP; never the IP of a
+// received datagram.
+static const quint32 cLocalSenderIp = 0;
+
+// "MCSM", and the layout version.
+static const quint32 cMagic = 0x4D43534D;
+static const quint32 cVersion = 4;
+
+// Fits a quint64 mask.
+static const int cMaxInstances = 64;
+
+// Including the terminating zero.
+static const int cMaxIdsSize = 256;
+
+// Separates the own ids of an App.
+static const char cIdSeparator = '\n';
+
+struct SharedMemoryTransport::Header
+{
+    quint32 magic;
+    quint32 version;
+    quint32 ringCapacity;
+
+    // Of the Apps having taken the slots; zero for free slots. Modified
+    // under the lock.
+    qint64 pids[cMaxInstances];
+
+    // Own ids of the Apps in the remote transport (the first one is the
+    // main one), UTF-8, separated by cIdSeparator; written before the App
+    // sends anything.
+    char ids[cMaxInstances][cMaxIdsSize];
+
+    // Own keys of the Apps in the remote transport; written with the ids.
+    quint32 keys[cMaxInstances];
+
+    // Incremented whenever a slot is taken or freed, under the lock.
+    QAtomicInt registrations;
+
+    // Set by an App which waits for a wakeup; taken by the writer which
+    // wakes it up.
+    QAtomicInt sleeping[cMaxInstances];
+
+    // Total size of the datagrams ever appended; the ring position is
+    // taken modulo ringCapacity. Modified under the lock, read without it.
+    QAtomicInteger<quint64> writePosition;
+};
+
+/**
+ * Followed by the channel name, then by the datagram.
+ */
+struct RecordHeader
+{
+    // Including this header.
+    quint32 size;
+    quint16 senderSlot;
+    quint16 channelNameSize;
+
+    // Own key of the sender; tells apart the Apps which have taken the
+    // slot in turn.
+    quint32 senderKey;
+};
+
+static const int cMaxChannelNameSize = 255;
+static const int cMaxRecordSize = int(sizeof(RecordHeader))
+    + cMaxChannelNameSize + DatagramSlot::cCapacity;
+
+///////////////////////////////////////////////////////////////////////////
+// Utils.
+
+static bool isProcessAlive(qint64 pid)
+{
+#ifdef Q_OS_UNIX
+    return kill(pid_t(pid), 0) == 0 || errno != ESRCH;
+#else
+    // Slots of crashed Apps are not reclaimed.
+    Q_UNUSED(pid);
+    return true;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////
+
+/**
+ * Waits on the semaphore of the own slot, and makes the transport read the
+ * ring after each wakeup.
+ */
+class SharedMemoryTransport::Waiter : public QThread
+{
+public:
+    Waiter(SharedMemoryTransport *transport, const QString &key)
+        : transport(transport), key(key),
+            semaphore(key, 0, QSystemSemaphore::Create)
+    {}
+
+    virtual ~Waiter() override
+    {
+        stopRequested.storeRelease(1);
+        wakeUp(key);
+        wait();
+    }
+
+    static void wakeUp(const QString &key)
+    {
+        // Removes the semaphore on destruction only if has created it,
+        // i.e. if the App of the slot is gone.
+        QSystemSemaphore(key, 0, QSystemSemaphore::Open).release();
+    }
+
+protected:
+    virtual void run() override
+    {
+        while (semaphore.acquire()) {
+            if (stopRequested.loadAcquire()) {
+                return;
+            }
+            QMetaObject::invokeMethod(transport, "receivePending",
+                Qt::QueuedConnection);
+        }
+        qDebug() << "SharedMemoryTransport: Unable to wait for wakeups:"
+            << semaphore.errorString();
+    }
+
+private:
+    SharedMemoryTransport *const transport;
+    const QString key;
+    QSystemSemaphore semaphore;
+    QAtomicInt stopRequested;
+};
+
+///////////////////////////////////////////////////////////////////////////
+
+SharedMemoryTransport::SharedMemoryTransport(QObject *parent,
+    const Settings &settings, Transport *remote)
+    throw (NetworkEx)
+    : Transport(parent), settings(settings), remote(remote),
+        memory(settings.key)
+{
+    attach();
+
+    channelNames.insert(cDefaultChannel, QString());
+
+    // Handlers of remote datagrams receive them from this transport.
+    connect(remote, SIGNAL(datagramReceived(DatagramView)),
+        this, SLOT(remoteDatagramReceived(DatagramView)));
+    connect(remote, SIGNAL(networkError(QString)),
+        this, SIGNAL(networkError(QString)));
+    updateDroppedSenders();
+
+    connect(&pollTimer, SIGNAL(timeout()), this, SLOT(receivePending()));
+    pollTimer.start(settings.pollPeriodMs);
+
+    waiter.reset(new Waiter(this, wakeupKey(ownSlot)));
+    waiter->start();
+    sleepUntilAppended();
+}
+
+SharedMemoryTransport::~SharedMemoryTransport()
+{
+    waiter.reset();
+
+    memory.lock();
+    header()->pids[ownSlot] = 0;
+    header()->sleeping[ownSlot].storeRelease(0);
+    header()->registrations.fetchAndAddOrdered(1);
+    memory.unlock();
+}
+
+void SharedMemoryTransport::attach()
+    throw (NetworkEx)
+{
+    const QByteArray ownId = remote->getOwnId().toUtf8();
+    if (ownId.size() >= cMaxIdsSize) {
+        throw NetworkEx("Own id \"" + remote->getOwnId()
+            + "\" is too long for shared memory.");
+    }
+
+    // The other ids are registered as long as they fit.
+    QByteArray ownIds = ownId;
+    foreach (const QString &id, remote->getOwnIds()) {
+        const QByteArray utf8 = id.toUtf8();
+        if (utf8 != ownId
+            && ownIds.size() + 1 + utf8.size() < cMaxIdsSize) {
+
+            ownIds += cIdSeparator + utf8;
+        }
+    }
+
+    const int size = int(sizeof(Header)) + settings.ringCapacity;
+    if (!memory.create(size)) {
+        if (memory.error() != QSharedMemory::AlreadyExists
+            || !memory.attach()) {
+
+            throw NetworkEx("Unable to attach to shared memory \""
+                + settings.key + "\": " + memory.errorString());
+        }
+        if (memory.size() < size) {
+            throw NetworkEx("Shared memory \"" + settings.key
+                + "\" is smaller than expected.");
+        }
+    }
+
+    memory.lock();
+    Header *h = header();
+
+    // The App which has created the segment may not have locked it yet.
+    if (h->magic != cMagic || h->version != cVersion) {
+        memset(memory.data(), 0, size);
+        h->magic = cMagic;
+        h->version = cVersion;
+        h->ringCapacity = quint32(settings.ringCapacity);
+    } else if (h->ringCapacity != quint32(settings.ringCapacity)) {
+        memory.unlock();
+        throw NetworkEx("Shared memory \"" + settings.key
+            + "\" is used with another ring capacity.");
+    }
+
+    for (int i = 0; i < cMaxInstances && ownSlot == -1; ++i) {
+        if (h->pids[i] == 0 || !isProcessAlive(h->pids[i])) {
+            ownSlot = i;
+            h->pids[i] = QCoreApplication::applicationPid();
+            memset(h->ids[i], 0, cMaxIdsSize);
+            memcpy(h->ids[i], ownIds.constData(), ownIds.size());
+            h->keys[i] = remote->getOwnKey();
+            h->sleeping[i].storeRelease(0);
+            h->registrations.fetchAndAddOrdered(1);
+        }
+    }
+    readPosition = h->writePosition.load();
+    memory.unlock();
+
+    if (ownSlot == -1) {
+        throw NetworkEx("All " + QString::number(cMaxInstances)
+            + " slots of shared memory \"" + settings.key + "\" are taken.");
+    }
+}
+
+SharedMemoryTransport::Header *SharedMemoryTransport::header() const
+{
+    return static_cast<Header *>(const_cast<void *>(memory.constData()));
+}
+
+QString SharedMemoryTransport::wakeupKey(int slot) const
+{
+    return settings.key + ".wakeup." + QString::number(slot);
+}
+
+char *SharedMemoryTransport::ring() const
+{
+    return reinterpret_cast<char *>(header()) + sizeof(Header);
+}
+
+void SharedMemoryTransport::readRing(quint64 position, void *data,
+    int size) const
+{
+    const int offset = int(position % quint64(settings.ringCapacity));
+    const int first = qMin(size, settings.ringCapacity - offset);
+    memcpy(data, ring() + offset, first);
+    memcpy(static_cast<char *>(data) + first, ring(), size - first);
+}
+
+void SharedMemoryTransport::writeRing(quint64 position, const void *data,
+    int size)
+{
+    const int offset = int(position % quint64(settings.ringCapacity));
+    const int first = qMin(size, settings.ringCapacity - offset);
+    memcpy(ring() + offset, data, first);
+    memcpy(ring(), static_cast<const char *>(data) + first, size - first);
+}
+
+QString SharedMemoryTransport::getOwnId() const
+{
+    return remote->getOwnId();
+}
+
+bool SharedMemoryTransport::isOwnId(const QString &id) const
+{
+    return remote->isOwnId(id);
+}
+
+QStringList SharedMemoryTransport::getOwnIds() const
+{
+    return remote->getOwnIds();
+}
+
+quint32 SharedMemoryTransport::getOwnKey() const
+{
+    return remote->getOwnKey();
+}
+
+quint32 SharedMemoryTransport::keyOf(const SenderAddress &sender) const
+{
+    return (sender.ip == cLocalSenderIp)
+        ? sender.instance : remote->keyOf(sender);
+}
+
+QString SharedMemoryTransport::senderIdOf(const SenderAddress &sender) const
+{
+    if (sender.ip == cLocalSenderIp) {
+        // The main id.
+        const char *ids = header()->ids[sender.port % cMaxInstances];
+        const int size = int(strnlen(ids, cMaxIdsSize));
+        const char *end = static_cast<const char *>(
+            memchr(ids, cIdSeparator, size));
+        return QString::fromUtf8(ids, end != nullptr ? int(end - ids) : size);
+    }
+    return remote->senderIdOf(sender);
+}
+
+int SharedMemoryTransport::joinChannel(const QString &name)
+    throw (NetworkEx)
+{
+    if (name.toUtf8().size() > cMaxChannelNameSize) {
+        throw NetworkEx("Channel name is too long.");
+    }
+
+    const int channel = remote->joinChannel(name);
+    channelNames.insert(channel, name);
+    return channel;
+}
+
+void SharedMemoryTransport::leaveChannel(int channel)
+{
+    if (channel == cDefaultChannel) {
+        return;
+    }
+
+    remote->leaveChannel(channel);
+    channelNames.remove(channel);
+}
+
+void SharedMemoryTransport::setAddressedFilter(
+    const QByteArray &addressedPrefix, const QList<QByteArray> &addressees)
+{
+    this->addressedPrefix = addressedPrefix;
+    this->addressees = addressees;
+    remote->setAddressedFilter(addressedPrefix, addressees);
+}
+
+bool SharedMemoryTransport::isAddressedToThis(const char *data,
+    int size) const
+{
+    if (addressedPrefix.isEmpty() || size < addressedPrefix.size()
+        || memcmp(data, addressedPrefix.constData(),
+            addressedPrefix.size()) != 0) {
+
+        return true;
+    }
+
+    foreach (const QByteArray &addressee, addressees) {
+        if (size >= addressedPrefix.size() + addressee.size()
+            && memcmp(data + addressedPrefix.size(),
+                addressee.constData(), addressee.size()) == 0) {
+
+            return true;
+        }
+    }
+    return false;
+}
+
+void SharedMemoryTransport::sendDatagram(const QByteArray &datagram,
+    int channel)
+    throw (NetworkEx)
+{
+    appendToRing(datagram, channel);
+    remote->sendDatagram(datagram, channel);
+}
+
+void SharedMemoryTransport::sendDatagramTo(const QByteArray &datagram,
+    const SenderAddress &recipient, int channel)
+    throw (NetworkEx)
+{
+    if (recipient.ip == cLocalSenderIp) {
+        // Other local Apps drop it via the addressed filter, if any.
+        appendToRing(datagram, channel);
+    } else {
+        remote->sendDatagramTo(datagram, recipient, channel);
+    }
+}
+
+void SharedMemoryTransport::appendToRing(const QByteArray &datagram,
+    int channel)
+    throw (NetworkEx)
+{
+    if (!channelNames.contains(channel)) {
+        throw NetworkEx("Unable to send datagram: channel "
+            + QString::number(channel) + " is not joined.");
+    }
+    if (datagram.size() > DatagramSlot::cCapacity) {
+        throw NetworkEx("Unable to send datagram: it is larger than "
+            + QString::number(DatagramSlot::cCapacity) + " bytes.");
+    }
+
+    const QByteArray channelName = channelNames.value(channel).toUtf8();
+    RecordHeader record;
+    record.size = quint32(sizeof(record) + channelName.size()
+        + datagram.size());
+    record.senderSlot = quint16(ownSlot);
+    record.channelNameSize = quint16(channelName.size());
+    record.senderKey = remote->getOwnKey();
+
+    memory.lock();
+    Header *h = header();
+    quint64 position = h->writePosition.load();
+    writeRing(position, &record, sizeof(record));
+    position += sizeof(record);
+    writeRing(position, channelName.constData(), channelName.size());
+    position += channelName.size();
+    writeRing(position, datagram.constData(), datagram.size());
+    position += datagram.size();
+    h->writePosition.storeRelease(position);
+
+    // Orders the store above before the loads of sleeping, against the
+    // reverse order in sleepUntilAppended().
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    quint64 slotsToWake = 0;
+    for (int i = 0; i < cMaxInstances; ++i) {
+        if (i != ownSlot && h->sleeping[i].load() != 0
+            && h->sleeping[i].fetchAndStoreOrdered(0) != 0) {
+
+            slotsToWake |= quint64(1) << i;
+        }
+    }
+    memory.unlock();
+
+    for (int i = 0; i < cMaxInstances; ++i) {
+        if (slotsToWake & (quint64(1) << i)) {
+            Waiter::wakeUp(wakeupKey(i));
+        }
+    }
+
+    ++stats.datagramsSent;
+}
+
+void SharedMemoryTransport::receivePending()
+{
+    updateDroppedSenders();
+    deliverAppended();
+    sleepUntilAppended();
+}
+
+void SharedMemoryTransport::updateDroppedSenders()
+{
+    const Header *h = header();
+    const int registrations = h->registrations.loadAcquire();
+    if (registrations == seenRegistrations) {
+        return;
+    }
+    seenRegistrations = registrations;
+
+    // Read without the lock, like in isRegistered().
+    QList<quint32> keys;
+    for (int i = 0; i < cMaxInstances; ++i) {
+        if (i != ownSlot && h->pids[i] != 0) {
+            keys.append(h->keys[i]);
+        }
+    }
+    remote->setDroppedSenders(keys);
+}
+
+void SharedMemoryTransport::sleepUntilAppended()
+{
+    Header *h = header();
+    h->sleeping[ownSlot].fetchAndStoreOrdered(1);
+    if (h->writePosition.loadAcquire() != readPosition
+        && h->sleeping[ownSlot].fetchAndStoreOrdered(0) != 0) {
+
+        // Appended meanwhile, and no writer is waking this App up.
+        QMetaObject::invokeMethod(this, "receivePending",
+            Qt::QueuedConnection);
+    }
+}
+
+void SharedMemoryTransport::deliverAppended()
+{
+    Header *h = header();
+    const quint64 writePosition = h->writePosition.loadAcquire();
+
+    if (writePosition - readPosition > quint64(settings.ringCapacity)) {
+        ++stats.overruns;
+        readPosition = writePosition;
+        return;
+    }
+
+    char channelName[cMaxChannelNameSize];
+    while (readPosition < writePosition) {
+        RecordHeader record;
+        readRing(readPosition, &record, sizeof(record));
+        const int dataSize = int(record.size) - int(sizeof(record))
+            - record.channelNameSize;
+        if (record.channelNameSize > cMaxChannelNameSize
+            || dataSize < 0 || dataSize > DatagramSlot::cCapacity) {
+
+            // Overwritten while reading the header.
+            ++stats.overruns;
+            readPosition = writePosition;
+            return;
+        }
+
+        readRing(readPosition + sizeof(record), channelName,
+            record.channelNameSize);
+        readRing(readPosition + sizeof(record) + record.channelNameSize,
+            slot.data, dataSize);
+
+        // The copies are valid if the writer has not reached the record
+        // meanwhile (it may be writing up to cMaxRecordSize bytes ahead).
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (h->writePosition.load() + cMaxRecordSize
+            > readPosition + quint64(settings.ringCapacity)) {
+
+            ++stats.overruns;
+            readPosition = h->writePosition.loadAcquire();
+            return;
+        }
+        readPosition += record.size;
+
+        if (record.senderSlot == ownSlot) {
+            continue;
+        }
+
+        const int channel = channelNames.key(QString::fromUtf8(
+            channelName, record.channelNameSize), -1);
+        if (channel == -1 || !isAddressedToThis(slot.data, dataSize)) {
+            ++stats.datagramsFiltered;
+            continue;
+        }
+
+        ++stats.datagramsReceived;
+        slot.size = dataSize;
+        slot.sender.ip = cLocalSenderIp;
+        slot.sender.port = record.senderSlot;
+        slot.sender.instance = record.senderKey;
+        slot.channel = channel;
+        emit datagramReceived(DatagramView(slot));
+    }
+}
+
+void SharedMemoryTransport::remoteDatagramReceived(
+    const DatagramView &datagram)
+{
+    if (remote->isSameHost(datagram.sender())
+        && isRegistered(datagram.sender())) {
+
+        ++stats.sameHostDropped;
+        return;
+    }
+    emit datagramReceived(datagram);
+}
+
+bool SharedMemoryTransport::isRegistered(const SenderAddress &sender) const
+{
+    const quint32 senderKey = remote->keyOf(sender);
+    const Header *h = header();
+
+    // Read without the lock: a slot which is being taken meanwhile may be
+    // missed, and its datagram delivered twice.
+    for (int i = 0; i < cMaxInstances; ++i) {
+        if (h->keys[i] == senderKey && h->pids[i] != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void SharedMemoryTransport::reportUnparsable(const DatagramView &datagram)
+{
+    if (datagram.sender().ip != cLocalSenderIp) {
+        remote->reportUnparsable(datagram);
+    }
+}
+
+void SharedMemoryTransport::reportDeliveryFeedback(int ackedCount,
+    int unackedCount)
+{
+    remote->reportDeliveryFeedback(ackedCount, unackedCount);
+}
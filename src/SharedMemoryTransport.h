@@ -0,0 +1,220 @@
+#ifndef SHAREDMEMORYTRANSPORT_H
+#define SHAREDMEMORYTRANSPORT_H
+
+// Transport which exchanges datagrams between Apps on the same host via
+// shared memory, and with remote Apps via another transport.
+
+#include <QObject>
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QList>
+
+#include "Transport.h"
+#include "DatagramPool.h"
+
+// private:
+#include <QHash>
+#include <QTimer>
+#include <QSharedMemory>
+#include <QScopedPointer>
+
+/**
+ * Apps on the same host rendezvous in a shared memory segment (by key),
+ * each taking a slot of its instance table; datagrams are appended to a
+ * ring in the same segment, which is read by all the Apps. Thus, local
+ * fan-out costs a copy per recipient instead of a loopback datagram.
+ *
+ * Datagrams are also sent via the remote transport (not owned here), and
+ * the ones received from it are passed through, except the ones sent by
+ * the Apps registered in the segment, which arrive via shared memory. The
+ * remote transport is asked to drop the latter before delivery (see
+ * Transport::setDroppedSenders()), e.g. in the kernel. The Apps on the
+ * same host which are not registered (e.g. of another OS user, which can
+ * not attach to the segment) are reached via the remote transport both
+ * ways.
+ *
+ * A reader which has read the whole ring sleeps on a system semaphore of
+ * its slot until a writer wakes it up. Writers never wait for readers; a
+ * reader which lags behind by more than the ring capacity skips the
+ * overwritten datagrams (counted as overruns).
+ *
+ * Ids and keys are the ones of the remote transport: each App publishes
+ * its own in its slot.
+ */
+class SharedMemoryTransport : public Transport
+{
+    Q_OBJECT
+public:
+    struct Settings
+    {
+        // Apps with the same key exchange datagrams locally.
+        QString key = "MultiChat";
+
+        int ringCapacity = 1024 * 1024;
+
+        // Backstop for the wakeups, e.g. if the semaphore is unavailable.
+        int pollPeriodMs = 1000;
+    };
+
+    static const Settings defaultSettings;
+
+    struct Stats
+    {
+        quint64 datagramsSent = 0;
+        quint64 datagramsReceived = 0;
+
+        // Dropped by the addressed filter, or of channels not joined.
+        quint64 datagramsFiltered = 0;
+
+        // Times the ring has been overwritten before reading.
+        quint64 overruns = 0;
+
+        // Received via the remote transport from the Apps registered in
+        // the segment, not dropped by it before delivery (e.g. meanwhile
+        // registered).
+        quint64 sameHostDropped = 0;
+    };
+
+    /**
+     * @throw NetworkEx if the shared memory segment can not be created or
+     * attached to, all the slots are taken, or the own id of the remote
+     * transport is too long.
+     */
+    SharedMemoryTransport(QObject *parent, const Settings &settings,
+        Transport *remote)
+        throw (NetworkEx);
+
+    virtual ~SharedMemoryTransport() override;
+
+    virtual QString getOwnId() const override;
+    virtual bool isOwnId(const QString &id) const override;
+    virtual QStringList getOwnIds() const override;
+    virtual QString senderIdOf(const SenderAddress &sender) const override;
+
+    virtual quint32 getOwnKey() const override;
+
+    /**
+     * Local senders have their own keys as the instance, thus, an App
+     * taking the slot of another one is another sender.
+     */
+    virtual quint32 keyOf(const SenderAddress &sender) const override;
+
+    virtual int joinChannel(const QString &name)
+        throw (NetworkEx) override;
+
+    virtual void leaveChannel(int channel) override;
+
+    /**
+     * Local datagrams are filtered before delivery.
+     */
+    virtual void setAddressedFilter(const QByteArray &addressedPrefix,
+        const QList<QByteArray> &addressees) override;
+
+    /**
+     * @throw NetworkEx also if the datagram is larger than a DatagramSlot.
+     */
+    virtual void sendDatagram(const QByteArray &datagram,
+        int channel = cDefaultChannel)
+        throw (NetworkEx) override;
+
+    /**
+     * Sends to a local App via shared memory, to a remote one via the
+     * remote transport.
+     */
+    virtual void sendDatagramTo(const QByteArray &datagram,
+        const SenderAddress &recipient, int channel = cDefaultChannel)
+        throw (NetworkEx) override;
+
+    virtual void reportUnparsable(const DatagramView &datagram) override;
+
+    virtual void reportDeliveryFeedback(
+        int ackedCount, int unackedCount) override;
+
+    Stats getStats() const
+    {
+        return stats;
+    }
+
+public slots:
+    /**
+     * Deliver the datagrams appended by other local Apps since the last
+     * call; called upon wakeups.
+     */
+    void receivePending();
+
+private slots:
+    void remoteDatagramReceived(const DatagramView &datagram);
+
+private:
+    const Settings settings;
+    Stats stats;
+
+    // Neither created nor owned here.
+    Transport *const remote;
+
+    QSharedMemory memory;
+    int ownSlot = -1;
+    QTimer pollTimer;
+
+    class Waiter;
+    QScopedPointer<Waiter> waiter;
+
+    // Position in the ring of the next datagram to read.
+    quint64 readPosition = 0;
+
+    // Header::registrations as of the last updateDroppedSenders().
+    int seenRegistrations = -1;
+
+    // Channels joined via the remote transport: id -> name; the default
+    // channel has the empty name.
+    QHash<int, QString> channelNames;
+
+    QByteArray addressedPrefix;
+    QList<QByteArray> addressees;
+
+    // Reused for each delivery.
+    DatagramSlot slot;
+
+    void attach()
+        throw (NetworkEx);
+
+    struct Header;
+    Header *header() const;
+    char *ring() const;
+
+    QString wakeupKey(int slot) const;
+
+    void readRing(quint64 position, void *data, int size) const;
+    void writeRing(quint64 position, const void *data, int size);
+
+    /**
+     * @throw NetworkEx if the channel is not joined, or the datagram is
+     * larger than a DatagramSlot.
+     */
+    void appendToRing(const QByteArray &datagram, int channel)
+        throw (NetworkEx);
+
+    void deliverAppended();
+
+    /**
+     * Makes the remote transport drop the datagrams of the other registered
+     * Apps, if they have changed.
+     */
+    void updateDroppedSenders();
+
+    /**
+     * Asks the writers for a wakeup, unless something has been appended
+     * meanwhile.
+     */
+    void sleepUntilAppended();
+
+    bool isAddressedToThis(const char *data, int size) const;
+
+    /**
+     * @return Whether the sender is an App registered in the segment.
+     */
+    bool isRegistered(const SenderAddress &sender) const;
+};
+
+#endif // SHAREDMEMORYTRANSPORT_H
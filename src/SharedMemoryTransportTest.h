@@ -0,0 +1,197 @@
+#ifndef SHAREDMEMORYTRANSPORTTEST_H
+#define SHAREDMEMORYTRANSPORTTEST_H
+
+#include <QtTest>
+
+#include "SharedMemoryTransport.h"
+#include "LoopbackHub.h"
+#include "RelayTest.h"
+
+/**
+ * Puts all the Apps of a LoopbackHub on the same host.
+ */
+class SameHostTransport : public LoopbackTransport
+{
+public:
+    explicit SameHostTransport(LoopbackHub *hub)
+        : LoopbackTransport(nullptr, hub)
+    {}
+
+    virtual bool isSameHost(const SenderAddress &sender) const override
+    {
+        Q_UNUSED(sender);
+        return true;
+    }
+};
+
+/**
+ * Each App has its own LoopbackHub as the remote transport, thus, the
+ * datagrams can reach another App only via shared memory.
+ */
+class SharedMemoryTransportTest : public QObject
+{
+    Q_OBJECT
+private:
+    static SharedMemoryTransport::Settings buildSettings()
+    {
+        SharedMemoryTransport::Settings settings;
+        settings.key = "MultiChatTest."
+            + QString::number(QCoreApplication::applicationPid());
+        settings.ringCapacity = 64 * 1024;
+        return settings;
+    }
+
+private slots:
+    void testLocalDelivery()
+    {
+        LoopbackHub firstHub(nullptr, LoopbackHub::defaultSettings);
+        LoopbackHub secondHub(nullptr, LoopbackHub::defaultSettings);
+        LoopbackTransport firstRemote(nullptr, &firstHub);
+        LoopbackTransport secondRemote(nullptr, &secondHub);
+
+        SharedMemoryTransport first(nullptr, buildSettings(), &firstRemote);
+        SharedMemoryTransport second(nullptr, buildSettings(),
+            &secondRemote);
+
+        second.joinChannel("room");
+        second.setAddressedFilter("ack|", QList<QByteArray>());
+
+        first.sendDatagram("ack|someone else|1");
+        first.sendDatagram("user|nick");
+        first.sendDatagram("text|hello", first.joinChannel("room"));
+        first.sendDatagram("text|elsewhere", first.joinChannel("other"));
+
+        second.receivePending();
+        QCOMPARE(int(second.getStats().datagramsReceived), 2);
+        QCOMPARE(int(second.getStats().datagramsFiltered), 2);
+
+        // The own datagrams are skipped.
+        first.receivePending();
+        QCOMPARE(int(first.getStats().datagramsReceived), 0);
+        QCOMPARE(int(second.getStats().overruns), 0);
+    }
+
+    void testOverrun()
+    {
+        LoopbackHub hub(nullptr, LoopbackHub::defaultSettings);
+        LoopbackTransport firstRemote(nullptr, &hub);
+        LoopbackTransport secondRemote(nullptr, &hub);
+
+        SharedMemoryTransport first(nullptr, buildSettings(), &firstRemote);
+        SharedMemoryTransport second(nullptr, buildSettings(),
+            &secondRemote);
+
+        const QByteArray datagram(1000, 'x');
+        for (int i = 0; i < 100; ++i) {
+            first.sendDatagram(datagram);
+        }
+        hub.deliverPending();
+
+        second.receivePending();
+        QCOMPARE(int(second.getStats().overruns), 1);
+        QCOMPARE(int(second.getStats().datagramsReceived), 0);
+
+        first.sendDatagram(datagram);
+        second.receivePending();
+        QCOMPARE(int(second.getStats().datagramsReceived), 1);
+    }
+
+    void testWakeup()
+    {
+        LoopbackHub firstHub(nullptr, LoopbackHub::defaultSettings);
+        LoopbackHub secondHub(nullptr, LoopbackHub::defaultSettings);
+        LoopbackTransport firstRemote(nullptr, &firstHub);
+        LoopbackTransport secondRemote(nullptr, &secondHub);
+
+        SharedMemoryTransport::Settings settings = buildSettings();
+        settings.pollPeriodMs = 60 * 1000;
+        SharedMemoryTransport first(nullptr, settings, &firstRemote);
+        SharedMemoryTransport second(nullptr, settings, &secondRemote);
+
+        first.sendDatagram("user|nick");
+        QTRY_COMPARE_WITH_TIMEOUT(
+            int(second.getStats().datagramsReceived), 1, 1000);
+
+        // Sleeps again.
+        first.sendDatagram("user|nick");
+        QTRY_COMPARE_WITH_TIMEOUT(
+            int(second.getStats().datagramsReceived), 2, 1000);
+    }
+
+    void testSameHostUnregistered()
+    {
+        LoopbackHub hub(nullptr, LoopbackHub::defaultSettings);
+        SameHostTransport firstRemote(&hub);
+        SameHostTransport secondRemote(&hub);
+
+        // E.g. an App which has failed to attach to the segment.
+        SameHostTransport unregistered(&hub);
+
+        SharedMemoryTransport first(nullptr, buildSettings(), &firstRemote);
+        SharedMemoryTransport second(nullptr, buildSettings(),
+            &secondRemote);
+        ReceivedDatagrams receivedFirst(&first);
+        ReceivedDatagrams received(&second);
+        ReceivedDatagrams receivedUnregistered(&unregistered);
+
+        first.sendDatagram("user|first");
+        second.sendDatagram("user|second");
+        unregistered.sendDatagram("user|unregistered");
+        hub.deliverPending();
+        first.receivePending();
+        second.receivePending();
+
+        // The datagrams of the registered Apps arrive once, via shared
+        // memory: the hub drops the one of the first App; the first App
+        // drops the one of the second App, which has registered after it.
+        QCOMPARE(int(hub.getStats().datagramsFiltered), 1);
+        QCOMPARE(int(first.getStats().sameHostDropped), 1);
+        QCOMPARE(int(second.getStats().sameHostDropped), 0);
+        QCOMPARE(received.data, QList<QByteArray>()
+            << "user|unregistered" << "user|first");
+        QCOMPARE(receivedFirst.data, QList<QByteArray>()
+            << "user|unregistered" << "user|second");
+        QCOMPARE(receivedUnregistered.data,
+            QList<QByteArray>() << "user|first" << "user|second");
+
+        // Since the first App has looked, the hub drops both ways.
+        second.sendDatagram("user|second");
+        hub.deliverPending();
+        QCOMPARE(int(hub.getStats().datagramsFiltered), 2);
+        QCOMPARE(int(first.getStats().sameHostDropped), 1);
+    }
+
+    void testSlotReuse()
+    {
+        LoopbackHub hub(nullptr, LoopbackHub::defaultSettings);
+        LoopbackTransport receiverRemote(nullptr, &hub);
+        LoopbackTransport firstRemote(nullptr, &hub);
+        LoopbackTransport secondRemote(nullptr, &hub);
+
+        SharedMemoryTransport receiver(nullptr, buildSettings(),
+            &receiverRemote);
+        ReceivedDatagrams received(&receiver);
+        {
+            SharedMemoryTransport first(nullptr, buildSettings(),
+                &firstRemote);
+            first.sendDatagram("user|first");
+        }
+        SharedMemoryTransport second(nullptr, buildSettings(),
+            &secondRemote);
+        second.sendDatagram("user|second");
+        receiver.receivePending();
+
+        // The second App has taken the slot of the first one, but is
+        // another sender (e.g. for caching the ids by sender).
+        QCOMPARE(received.data,
+            QList<QByteArray>() << "user|first" << "user|second");
+        QCOMPARE(received.senders.at(0).port, received.senders.at(1).port);
+        QVERIFY(!(received.senders.at(0) == received.senders.at(1)));
+        QCOMPARE(receiver.keyOf(received.senders.at(0)),
+            firstRemote.getOwnKey());
+        QCOMPARE(receiver.keyOf(received.senders.at(1)),
+            secondRemote.getOwnKey());
+    }
+};
+
+#endif // SHAREDMEMORYTRANSPORTTEST_H
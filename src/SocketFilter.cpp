@@ -0,0 +1,266 @@
+#include "SocketFilter.h"
+
+#ifdef Q_OS_LINUX
+
+#include <QFile>
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <linux/sock_diag.h>
+
+#ifndef SO_MEMINFO
+#define SO_MEMINFO 55
+#endif
+
+///////////////////////////////////////////////////////////////////////////
+// Utils.
+
+// For UDP sockets, offsets are relative to the UDP header.
+static const quint32 cPayloadOffset = 8;
+
+static const quint32 cAccept = 0xFFFFFFFF;
+static const quint32 cDrop = 0;
+
+/**
+ * Builds a program with forward jumps to labels, resolving the jump
+ * offsets (which are limited to 255 instructions) at the end.
+ */
+class ProgramBuilder
+{
+public:
+    int newLabel()
+    {
+        labelPositions.append(-1);
+        return labelPositions.size() - 1;
+    }
+
+    void placeLabel(int label)
+    {
+        labelPositions[label] = instructions.size();
+    }
+
+    void statement(quint16 code, quint32 k)
+    {
+        append(code, k, -1, -1);
+    }
+
+    /**
+     * A label of -1 means the next instruction.
+     */
+    void jump(quint16 code, quint32 k, int trueLabel, int falseLabel)
+    {
+        append(code, k, trueLabel, falseLabel);
+    }
+
+    /**
+     * Jump to mismatchLabel unless the bytes at the offset equal these.
+     * Loads bytes up to 4 at a time.
+     */
+    void compareBytes(quint32 offset, const QByteArray &bytes,
+        int mismatchLabel)
+    {
+        int i = 0;
+        while (i < bytes.size()) {
+            const int width = (bytes.size() - i >= 4) ? 4
+                : (bytes.size() - i >= 2) ? 2 : 1;
+
+            quint32 value = 0;
+            for (int j = 0; j < width; ++j) {
+                value = (value << 8) | uchar(bytes.at(i + j));
+            }
+
+            const quint16 size = (width == 4) ? BPF_W
+                : (width == 2) ? BPF_H : BPF_B;
+            statement(BPF_LD | size | BPF_ABS, offset + i);
+            jump(BPF_JMP | BPF_JEQ | BPF_K, value, -1, mismatchLabel);
+            i += width;
+        }
+    }
+
+    /**
+     * @return Empty if a jump is too long.
+     */
+    QVector<sock_filter> build() const
+    {
+        QVector<sock_filter> result;
+        for (int i = 0; i < instructions.size(); ++i) {
+            const Instruction &instruction = instructions.at(i);
+            sock_filter filter = instruction.filter;
+            if (!resolve(instruction.trueLabel, i, &filter.jt)
+                || !resolve(instruction.falseLabel, i, &filter.jf)) {
+
+                return QVector<sock_filter>();
+            }
+            result.append(filter);
+        }
+        return result;
+    }
+
+private:
+    struct Instruction
+    {
+        sock_filter filter;
+        int trueLabel;
+        int falseLabel;
+    };
+
+    QVector<Instruction> instructions;
+    QVector<int> labelPositions;
+
+    void append(quint16 code, quint32 k, int trueLabel, int falseLabel)
+    {
+        sock_filter filter;
+        filter.code = code;
+        filter.jt = 0;
+        filter.jf = 0;
+        filter.k = k;
+        instructions.append(Instruction{filter, trueLabel, falseLabel});
+    }
+
+    bool resolve(int label, int position, quint8 *pOffset) const
+    {
+        if (label == -1) {
+            return true;
+        }
+        const int offset = labelPositions.at(label) - (position + 1);
+        if (offset < 0 || offset > 255) {
+            return false;
+        }
+        *pOffset = quint8(offset);
+        return true;
+    }
+};
+
+/**
+ * Drops the datagram if its payload at prefixOffset starts with
+ * addressedPrefix not followed by any of addressees; otherwise, jumps to
+ * acceptLabel.
+ */
+static void buildAddressedCheck(ProgramBuilder *pBuilder,
+    quint32 prefixOffset, const QByteArray &addressedPrefix,
+    const QList<QByteArray> &addressees, int acceptLabel)
+{
+    ProgramBuilder &builder = *pBuilder;
+    builder.statement(BPF_LD | BPF_W | BPF_LEN, 0);
+    builder.jump(BPF_JMP | BPF_JGE | BPF_K,
+        prefixOffset + addressedPrefix.size(), -1, acceptLabel);
+    builder.compareBytes(prefixOffset, addressedPrefix, acceptLabel);
+
+    const quint32 addresseeOffset = prefixOffset + addressedPrefix.size();
+    foreach (const QByteArray &addressee, addressees) {
+        const int nextLabel = builder.newLabel();
+        builder.statement(BPF_LD | BPF_W | BPF_LEN, 0);
+        builder.jump(BPF_JMP | BPF_JGE | BPF_K,
+            addresseeOffset + addressee.size(), -1, nextLabel);
+        builder.compareBytes(addresseeOffset, addressee, nextLabel);
+        builder.statement(BPF_RET | BPF_K, cAccept);
+        builder.placeLabel(nextLabel);
+    }
+    builder.statement(BPF_RET | BPF_K, cDrop);
+}
+
+///////////////////////////////////////////////////////////////////////////
+
+SocketFilter::SocketFilter(const QList<QByteArray> &droppedPrefixes,
+    int headerSize, const QByteArray &addressedPrefix,
+    const QList<QByteArray> &addressees, int relayedHeaderSize,
+    char relayedMarker)
+{
+    ProgramBuilder builder;
+    const int acceptLabel = builder.newLabel();
+
+    // Loading beyond the datagram would drop it, thus, the length is
+    // checked before each comparison.
+    foreach (const QByteArray &droppedPrefix, droppedPrefixes) {
+        const int notDroppedLabel = builder.newLabel();
+        builder.statement(BPF_LD | BPF_W | BPF_LEN, 0);
+        builder.jump(BPF_JMP | BPF_JGE | BPF_K,
+            cPayloadOffset + droppedPrefix.size(), -1, notDroppedLabel);
+        builder.compareBytes(cPayloadOffset, droppedPrefix, notDroppedLabel);
+        builder.statement(BPF_RET | BPF_K, cDrop);
+        builder.placeLabel(notDroppedLabel);
+    }
+
+    if (!addressedPrefix.isEmpty() && relayedHeaderSize != 0
+        && headerSize > 0) {
+
+        const int notRelayedLabel = builder.newLabel();
+        builder.statement(BPF_LD | BPF_W | BPF_LEN, 0);
+        builder.jump(BPF_JMP | BPF_JGE | BPF_K,
+            cPayloadOffset + quint32(headerSize), -1, notRelayedLabel);
+        builder.compareBytes(cPayloadOffset + quint32(headerSize) - 1,
+            QByteArray(1, relayedMarker), notRelayedLabel);
+        buildAddressedCheck(&builder,
+            cPayloadOffset + quint32(relayedHeaderSize), addressedPrefix,
+            addressees, acceptLabel);
+        builder.placeLabel(notRelayedLabel);
+    }
+
+    if (!addressedPrefix.isEmpty()) {
+        buildAddressedCheck(&builder, cPayloadOffset + quint32(headerSize),
+            addressedPrefix, addressees, acceptLabel);
+    }
+
+    builder.placeLabel(acceptLabel);
+    builder.statement(BPF_RET | BPF_K, cAccept);
+
+    program = builder.build();
+    if (program.isEmpty()) {
+        error = "Socket filter is too long.";
+    }
+}
+
+bool SocketFilter::attachTo(int socketDescriptor)
+{
+    if (!isValid()) {
+        return false;
+    }
+
+    sock_fprog fprog;
+    fprog.len = quint16(program.size());
+    fprog.filter = program.data();
+    if (setsockopt(socketDescriptor, SOL_SOCKET, SO_ATTACH_FILTER,
+        &fprog, sizeof(fprog)) == -1) {
+
+        error = "setsockopt(SO_ATTACH_FILTER) failed: "
+            + QString::fromLocal8Bit(strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+quint64 SocketFilter::getKernelDropCount(int socketDescriptor)
+{
+    quint32 meminfo[SK_MEMINFO_VARS];
+    socklen_t size = sizeof(meminfo);
+    if (getsockopt(socketDescriptor, SOL_SOCKET, SO_MEMINFO,
+        meminfo, &size) == -1 || size <= SK_MEMINFO_DROPS * sizeof(quint32)) {
+
+        return 0;
+    }
+    return meminfo[SK_MEMINFO_DROPS];
+}
+
+quint64 SocketFilter::getReceiveBufferDropCount()
+{
+    QFile file("/proc/net/snmp");
+    if (!file.open(QIODevice::ReadOnly)) {
+        return 0;
+    }
+
+    // A line of the counter names is followed by a line of their values.
+    const QList<QByteArray> lines = file.readAll().split('\n');
+    for (int i = 0; i + 1 < lines.size(); ++i) {
+        if (lines.at(i).startsWith("Udp: ")) {
+            const int index = lines.at(i).split(' ').indexOf("RcvbufErrors");
+            const QList<QByteArray> values = lines.at(i + 1).split(' ');
+            return (index != -1 && index < values.size())
+                ? values.at(index).toULongLong() : 0;
+        }
+    }
+    return 0;
+}
+
+#endif // Q_OS_LINUX
@@ -0,0 +1,93 @@
+#ifndef SOCKETFILTER_H
+#define SOCKETFILTER_H
+
+// Classic BPF program dropping unwanted datagrams in the kernel (Linux).
+
+#include <QtGlobal>
+#ifdef Q_OS_LINUX
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QVector>
+
+// private:
+#include <linux/filter.h>
+
+/**
+ * Socket filter which is run by the kernel for each datagram arriving at a
+ * UDP socket, before the datagram is queued to the socket; datagrams
+ * dropped by it never wake up the receiving thread.
+ *
+ * A datagram is dropped if:
+ * - its payload starts with any of droppedPrefixes (e.g. the own instance
+ *   header of looped back own datagrams), or
+ * - its payload after a header of headerSize bytes starts with
+ *   addressedPrefix, which is not followed by any of addressees (e.g. an
+ *   ack of a text sent by another App). Optionally, the header is longer
+ *   if marked so (e.g. for relayed datagrams).
+ *
+ * Errors are reported QUdpSocket-style: the method returns false, and
+ * errorString() describes the error.
+ */
+class SocketFilter
+{
+public:
+    /**
+     * @param droppedPrefixes Empty means no datagrams are dropped this way.
+     * @param addressedPrefix Empty means all datagrams are addressed to
+     * everyone.
+     * @param relayedHeaderSize If not 0, the header is of this size
+     * instead, when its byte at headerSize - 1 is relayedMarker.
+     */
+    SocketFilter(const QList<QByteArray> &droppedPrefixes, int headerSize,
+        const QByteArray &addressedPrefix,
+        const QList<QByteArray> &addressees,
+        int relayedHeaderSize = 0, char relayedMarker = 0);
+
+    /**
+     * @return false if the conditions do not fit in a BPF program.
+     */
+    bool isValid() const
+    {
+        return !program.isEmpty();
+    }
+
+    int getInstructionCount() const
+    {
+        return program.size();
+    }
+
+    /**
+     * Attach to the socket, replacing the filter attached before.
+     */
+    bool attachTo(int socketDescriptor);
+
+    QString errorString() const
+    {
+        return error;
+    }
+
+    /**
+     * @return Number of datagrams dropped by the kernel for the socket,
+     * either by its filter or because its receive buffer was full (the
+     * kernel does not tell them apart); 0 if the kernel does not report it.
+     */
+    static quint64 getKernelDropCount(int socketDescriptor);
+
+    /**
+     * @return Number of datagrams dropped by the kernel because the receive
+     * buffer of a UDP socket was full, over all the sockets of the host (in
+     * the network namespace), excluding the ones dropped by filters; 0 if
+     * the kernel does not report it.
+     */
+    static quint64 getReceiveBufferDropCount();
+
+private:
+    QVector<sock_filter> program;
+    QString error;
+};
+
+#endif // Q_OS_LINUX
+
+#endif // SOCKETFILTER_H
@@ -0,0 +1,153 @@
+#ifndef SOCKETFILTERTEST_H
+#define SOCKETFILTERTEST_H
+
+#include <QtTest>
+
+#include "SocketFilter.h"
+#include "BatchedUdpSocket.h"
+#include "DatagramPool.h"
+
+// Passes all the filters of the tests: proves that a filter does not just
+// drop everything.
+static const char cControl[] = "0000002b|control";
+
+/**
+ * Runs the filter in the kernel, on loopback. Besides the datagrams which
+ * pass, checks the drop count of the socket, as a kernel not running the
+ * filter would not drop anything.
+ */
+class SocketFilterTest : public QObject
+{
+    Q_OBJECT
+private:
+    static const quint16 cPort = 42426;
+
+    /**
+     * Sends the datagrams, followed by cControl.
+     * @param pReceived Payloads which have passed the filter.
+     * @param pDropCount Datagrams dropped by the kernel meanwhile.
+     * @return false if unable to send, or to attach the filter.
+     */
+    static bool sendFiltered(const SocketFilter &filter,
+        const QList<QByteArray> &datagrams, QList<QByteArray> *pReceived,
+        quint64 *pDropCount)
+    {
+        const QHostAddress loopback(QHostAddress::LocalHost);
+        BatchedUdpSocket receiver(64);
+        BatchedUdpSocket sender(64);
+        if (!receiver.bind(loopback, cPort) || !sender.bind(loopback, 0)) {
+            return false;
+        }
+
+        SocketFilter attached = filter;
+        const quint64 dropCountBefore =
+            SocketFilter::getKernelDropCount(receiver.socketDescriptor());
+        if (!attached.attachTo(receiver.socketDescriptor())
+            || !sender.sendBatch(QList<QByteArray>(datagrams) << cControl,
+                loopback, cPort)) {
+
+            return false;
+        }
+
+        DatagramPool pool(64);
+        QVector<DatagramSlot *> batch;
+        for (int i = 0; i < 64; ++i) {
+            batch.append(pool.acquire());
+        }
+
+        pReceived->clear();
+        const int count = receiver.receiveBatch(batch.data(), batch.size());
+        for (int i = 0; i < count; ++i) {
+            pReceived->append(DatagramView(*batch.at(i)).toByteArray());
+        }
+        *pDropCount = SocketFilter::getKernelDropCount(
+            receiver.socketDescriptor()) - dropCountBefore;
+        return true;
+    }
+
+private slots:
+    void testAddressed()
+    {
+        SocketFilter filter(QList<QByteArray>(), 0, "ack|",
+            QList<QByteArray>() << "10.0.0.5|" << "192.168.1.10|");
+        QVERIFY(filter.isValid());
+
+        QList<QByteArray> received;
+        quint64 dropCount;
+        QVERIFY(sendFiltered(filter,
+            QList<QByteArray>() << "user|nick" << "ack|10.0.0.5|1"
+                << "ack|10.0.0.6|1" << "ack|192.168.1.10|2"
+                << "ack|10.0.0.5" << "ack",
+            &received, &dropCount));
+
+        QCOMPARE(received, QList<QByteArray>() << "user|nick"
+            << "ack|10.0.0.5|1" << "ack|192.168.1.10|2" << "ack"
+            << cControl);
+        QCOMPARE(dropCount, quint64(2));
+    }
+
+    void testDroppedPrefixAndHeader()
+    {
+        SocketFilter filter(QList<QByteArray>() << "0000002a|", 9, "ack|",
+            QList<QByteArray>() << "10.0.0.5|");
+
+        QList<QByteArray> received;
+        quint64 dropCount;
+        QVERIFY(sendFiltered(filter,
+            QList<QByteArray>() << "0000002a|user|nick"
+                << "0000002b|user|nick" << "0000002b|ack|10.0.0.5|1"
+                << "0000002b|ack|10.0.0.6|1" << "0000002a",
+            &received, &dropCount));
+
+        QCOMPARE(received, QList<QByteArray>() << "0000002b|user|nick"
+            << "0000002b|ack|10.0.0.5|1" << "0000002a" << cControl);
+        QCOMPARE(dropCount, quint64(2));
+    }
+
+    void testDroppedPrefixes()
+    {
+        // E.g. the own instance, and the ones of the other Apps on the host
+        // which arrive via shared memory.
+        QList<QByteArray> droppedPrefixes;
+        for (int i = 0; i < 64; ++i) {
+            droppedPrefixes.append(QByteArray::number(0x100 + i, 16)
+                .rightJustified(8, '0'));
+        }
+        SocketFilter filter(droppedPrefixes, 9, QByteArray(),
+            QList<QByteArray>());
+        QVERIFY(filter.isValid());
+
+        QList<QByteArray> received;
+        quint64 dropCount;
+        QVERIFY(sendFiltered(filter,
+            QList<QByteArray>() << "00000100|user|nick"
+                << "0000013f|user|nick" << "00000140|user|nick"
+                << "0000013", &received, &dropCount));
+
+        QCOMPARE(received, QList<QByteArray>() << "00000140|user|nick"
+            << "0000013" << cControl);
+        QCOMPARE(dropCount, quint64(2));
+    }
+
+    void testRelayedHeader()
+    {
+        SocketFilter filter(QList<QByteArray>() << "0000002a", 9, "ack|",
+            QList<QByteArray>() << "10.0.0.5|", 18, '>');
+
+        QList<QByteArray> received;
+        quint64 dropCount;
+        QVERIFY(sendFiltered(filter,
+            QList<QByteArray>() << "0000002b>0a000007|ack|10.0.0.5|1"
+                << "0000002b>0a000007|ack|10.0.0.6|1"
+                << "0000002b>0a000007|user|nick" << "0000002b>0a00"
+                << "0000002b|ack|10.0.0.6|1",
+            &received, &dropCount));
+
+        QCOMPARE(received, QList<QByteArray>()
+            << "0000002b>0a000007|ack|10.0.0.5|1"
+            << "0000002b>0a000007|user|nick" << "0000002b>0a00" << cControl);
+        QCOMPARE(dropCount, quint64(2));
+    }
+};
+
+#endif // SOCKETFILTERTEST_H
@@ -0,0 +1,96 @@
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+// Bounded lock-free queue for passing values between two threads.
+
+#include <QScopedArrayPointer>
+#include <QAtomicInteger>
+
+/**
+ * Single-producer/single-consumer ring buffer: push() should be called
+ * from one thread only, and pop() from one (other) thread only. Neither
+ * call blocks or allocates; push() fails when the ring is full.
+ *
+ * T should be default-constructible and assignable; popped slots are
+ * reset to T() to release resources (e.g. shared QByteArray data) early.
+ */
+template<typename T>
+class SpscRing
+{
+public:
+    /**
+     * @param capacity Rounded up to a power of 2.
+     */
+    explicit SpscRing(int capacity)
+        : mask(roundUpToPowerOf2(capacity) - 1), items(new T[mask + 1])
+    {}
+
+    int capacity() const
+    {
+        return mask + 1;
+    }
+
+    /**
+     * Approximate when called concurrently with push() or pop().
+     */
+    int size() const
+    {
+        return int(tail.loadAcquire() - head.loadAcquire());
+    }
+
+    /**
+     * Producer side.
+     * @return false if the ring is full (the value is not queued).
+     */
+    bool push(const T &value)
+    {
+        const quint32 t = tail.load();
+        if (t - head.loadAcquire() > mask) {
+            return false;
+        }
+        items[t & mask] = value;
+        tail.storeRelease(t + 1);
+        return true;
+    }
+
+    /**
+     * Consumer side.
+     * @return false if the ring is empty.
+     */
+    bool pop(T *pValue)
+    {
+        const quint32 h = head.load();
+        if (h == tail.loadAcquire()) {
+            return false;
+        }
+        T &slot = items[h & mask];
+        *pValue = slot;
+        slot = T();
+        head.storeRelease(h + 1);
+        return true;
+    }
+
+private:
+    const quint32 mask;
+    QScopedArrayPointer<T> items;
+
+    // Written only by the consumer and the producer, respectively; kept on
+    // separate cache lines to avoid false sharing.
+    char padding1[64];
+    QAtomicInteger<quint32> head;
+    char padding2[64];
+    QAtomicInteger<quint32> tail;
+
+    static quint32 roundUpToPowerOf2(int n)
+    {
+        quint32 result = 1;
+        while (result < quint32(n)) {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    Q_DISABLE_COPY(SpscRing)
+};
+
+#endif // SPSCRING_H
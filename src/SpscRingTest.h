@@ -0,0 +1,85 @@
+#ifndef SPSCRINGTEST_H
+#define SPSCRINGTEST_H
+
+#include <QtTest>
+#include <QThread>
+
+#include "SpscRing.h"
+
+class SpscRingTest : public QObject
+{
+    Q_OBJECT
+private:
+    class Producer : public QThread
+    {
+    public:
+        Producer(SpscRing<int> *ring, int count)
+            : ring(ring), count(count)
+        {}
+
+    protected:
+        virtual void run() override
+        {
+            for (int i = 1; i <= count; ) {
+                if (ring->push(i)) {
+                    ++i;
+                }
+            }
+        }
+
+    private:
+        SpscRing<int> *const ring;
+        const int count;
+    };
+
+private slots:
+    void testCapacityIsRoundedUp()
+    {
+        SpscRing<int> ring(5);
+        QCOMPARE(ring.capacity(), 8);
+    }
+
+    void testFullAndEmpty()
+    {
+        SpscRing<int> ring(4);
+        int value = 0;
+        QVERIFY(!ring.pop(&value));
+
+        for (int i = 0; i < 4; ++i) {
+            QVERIFY(ring.push(i));
+        }
+        QVERIFY(!ring.push(4));
+        QCOMPARE(ring.size(), 4);
+
+        for (int i = 0; i < 4; ++i) {
+            QVERIFY(ring.pop(&value));
+            QCOMPARE(value, i);
+        }
+        QVERIFY(!ring.pop(&value));
+        QCOMPARE(ring.size(), 0);
+    }
+
+    void testTwoThreadsKeepOrder()
+    {
+        const int count = 100000;
+        SpscRing<int> ring(64);
+        Producer producer(&ring, count);
+        producer.start();
+
+        int received = 0;
+        bool inOrder = true;
+        while (received < count) {
+            int value;
+            if (ring.pop(&value)) {
+                ++received;
+                inOrder = inOrder && value == received;
+            }
+        }
+
+        producer.wait();
+        QVERIFY(inOrder);
+        QCOMPARE(ring.size(), 0);
+    }
+};
+
+#endif // SPSCRINGTEST_H
@@ -0,0 +1,271 @@
+#include "TextCompressor.h"
+
+#include <QVector>
+
+/**
+ * ATTENTION: Any change requires incrementing cDictionaryVersion.
+ *
+ * The most frequent fragments are at the end, to be reached by shorter
+ * distances.
+ */
+static const char cDictionary[] =
+    "Traceback (most recent call last):\n  File \""
+    "\", line \n    raise \nException in thread \"main\" "
+    "java.lang.NullPointerException\n\tat java.lang.IllegalStateException"
+    "\n\tat org.springframework.\n\tat com.\n\t... more\nCaused by: "
+    "terminate called after throwing an instance of 'std::runtime_error'"
+    "\n  what():  Segmentation fault (core dumped)\n#0  0x0000 in  () from "
+    "/usr/lib/x86_64-linux-gnu/lib.so\nAssertion failed: , file , line "
+    "undefined reference to `error: expected ';' before warning: unused "
+    "variable No such file or directory\nPermission denied\nConnection "
+    "refused\nConnection timed out\nNot Found\nInternal Server Error\n"
+    "HTTP/1.1 404 500 502 503 GET /api/v1/ POST /api/ "
+    "Content-Type: application/json\n{\"id\": \"name\": \"status\": "
+    "\"error\": \"message\": null, true, false, }\n"
+    "git pull --rebase origin master\ngit push origin HEAD:refs/for/"
+    "git checkout -b git commit -m \"Merge branch 'release/' into "
+    "sudo systemctl restart sudo apt-get install ssh root@ "
+    "docker ps -a\ndocker logs -f kubectl get pods -n kubectl logs "
+    "C:\\Users\\C:\\Program Files\\/home/user//var/log/syslog/tmp/"
+    ".example.com.corp.local.internal:8080:443localhost127.0.0.1 "
+    "192.168.0.192.168.1.10.0.0.build-server-dev-prod-test-staging-db-"
+    "https://jira.https://github.com/https://www./browse/TICKET-BUG-"
+    "/issues//pull/#L.cpp.h.py.java.js.log.txt.xml"
+    "2016-10-16 12:00:00,000 ERROR WARN INFO DEBUG FATAL "
+    "Please review the Could you please Can you check Thanks!Thank you "
+    "the build is failing on the tests are failing since commit "
+    " is fixed in the latest version, see the ticket for details. "
+    "and the of the to the in the is not for the on the that ";
+
+static const int cDictionarySize = int(sizeof(cDictionary)) - 1;
+
+static const int cHashBits = 12;
+static const int cMaxChainLength = 32;
+
+///////////////////////////////////////////////////////////////////////////
+// Utils.
+
+static void appendVarint(QByteArray *pBytes, quint64 value)
+{
+    while (value >= 0x80) {
+        pBytes->append(char((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    pBytes->append(char(value));
+}
+
+static int varintSize(quint64 value)
+{
+    int size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        ++size;
+    }
+    return size;
+}
+
+/**
+ * @param pPos After parsing, is set past the varint.
+ * @return false if truncated, or exceeding maxValue.
+ */
+static bool parseSize(const char **pPos, const char *end, int maxValue,
+    int *pValue)
+{
+    quint64 result = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (*pPos == end) {
+            return false;
+        }
+        const uchar byte = uchar(*(*pPos)++);
+        result |= quint64(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            if (result > quint64(maxValue)) {
+                return false;
+            }
+            *pValue = int(result);
+            return true;
+        }
+    }
+    return false;
+}
+
+static int hashAt(const char *p)
+{
+    const quint32 bytes = quint32(uchar(p[0]))
+        | (quint32(uchar(p[1])) << 8) | (quint32(uchar(p[2])) << 16);
+    return int((bytes * 2654435761u) >> (32 - cHashBits));
+}
+
+static void appendLiterals(QByteArray *pResult, const char *data, int size)
+{
+    if (size > 0) {
+        appendVarint(pResult, quint64(size) << 1);
+        pResult->append(data, size);
+    }
+}
+
+/**
+ * Calls tokenHandler(literals, size) for each literal run, and
+ * tokenHandler(nullptr, size, distance) for each match.
+ * @return false if the data is malformed.
+ */
+template<class TokenHandler>
+static bool forEachToken(const char *data, int size,
+    TokenHandler tokenHandler)
+{
+    const char *pos = data;
+    const char *const end = data + size;
+    int decompressedSize = 0;
+    while (pos != end) {
+        int header = 0;
+        if (!parseSize(&pos, end,
+                TextCompressor::cMaxDecompressedSize * 2 + 1, &header)) {
+
+            return false;
+        }
+        const int tokenSize = (header & 1)
+            ? (header >> 1) + TextCompressor::cMinMatchSize
+            : (header >> 1);
+        if (tokenSize == 0
+            || decompressedSize + tokenSize
+                > TextCompressor::cMaxDecompressedSize) {
+
+            return false;
+        }
+
+        if (header & 1) {
+            int distance = 0;
+            if (!parseSize(&pos, end, cDictionarySize + decompressedSize,
+                    &distance)
+                || distance == 0) {
+
+                return false;
+            }
+            tokenHandler(nullptr, tokenSize, distance);
+        } else {
+            if (tokenSize > end - pos) {
+                return false;
+            }
+            tokenHandler(pos, tokenSize, 0);
+            pos += tokenSize;
+        }
+        decompressedSize += tokenSize;
+    }
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////
+
+QByteArray TextCompressor::compress(const QByteArray &utf8)
+{
+    if (utf8.size() > cMaxDecompressedSize) {
+        return QByteArray();
+    }
+
+    // Hash chains over the dictionary followed by the text.
+    const QByteArray window =
+        QByteArray::fromRawData(cDictionary, cDictionarySize) + utf8;
+    const char *const bytes = window.constData();
+    const int windowSize = window.size();
+    QVector<int> heads(1 << cHashBits, -1);
+    QVector<int> previous(windowSize, -1);
+
+    auto insert = [&](int pos) {
+        if (pos + cMinMatchSize <= windowSize) {
+            int &head = heads[hashAt(bytes + pos)];
+            previous[pos] = head;
+            head = pos;
+        }
+    };
+
+    for (int pos = 0; pos < cDictionarySize; ++pos) {
+        insert(pos);
+    }
+
+    QByteArray result;
+    int literalsStart = cDictionarySize;
+    int pos = cDictionarySize;
+    while (pos < windowSize) {
+        int bestSize = 0;
+        int bestDistance = 0;
+        if (pos + cMinMatchSize <= windowSize) {
+            int candidate = heads[hashAt(bytes + pos)];
+            for (int i = 0; i < cMaxChainLength && candidate != -1; ++i) {
+                int matchSize = 0;
+                while (pos + matchSize < windowSize
+                    && bytes[candidate + matchSize]
+                        == bytes[pos + matchSize]) {
+
+                    ++matchSize;
+                }
+                if (matchSize > bestSize) {
+                    bestSize = matchSize;
+                    bestDistance = pos - candidate;
+                }
+                candidate = previous[candidate];
+            }
+        }
+
+        // A match shorter than its token, and the literal run it splits,
+        // does not pay off.
+        if (bestSize < cMinMatchSize
+            || bestSize <= varintSize(quint64(bestDistance)) + 1) {
+
+            insert(pos);
+            ++pos;
+            continue;
+        }
+
+        appendLiterals(&result, bytes + literalsStart, pos - literalsStart);
+        appendVarint(&result,
+            (quint64(bestSize - cMinMatchSize) << 1) | 1);
+        appendVarint(&result, quint64(bestDistance));
+        for (int i = 0; i < bestSize; ++i) {
+            insert(pos + i);
+        }
+        pos += bestSize;
+        literalsStart = pos;
+
+        if (result.size() >= utf8.size()) {
+            return QByteArray();
+        }
+    }
+    appendLiterals(&result, bytes + literalsStart, pos - literalsStart);
+
+    return result.size() < utf8.size() ? result : QByteArray();
+}
+
+int TextCompressor::decompressedSize(const char *data, int size)
+{
+    int result = 0;
+    const bool valid = forEachToken(data, size,
+        [&result](const char *, int tokenSize, int) {
+            result += tokenSize;
+        });
+    return valid ? result : -1;
+}
+
+QByteArray TextCompressor::decompress(const char *data, int size)
+{
+    const int resultSize = decompressedSize(data, size);
+    if (resultSize <= 0) {
+        return QByteArray();
+    }
+
+    QByteArray result;
+    result.reserve(resultSize);
+    forEachToken(data, size,
+        [&result](const char *literals, int tokenSize, int distance) {
+            if (literals != nullptr) {
+                result.append(literals, tokenSize);
+                return;
+            }
+            // Byte by byte: the match can overlap the bytes it produces.
+            for (int i = 0; i < tokenSize; ++i) {
+                const int from = result.size() - distance;
+                result.append(from >= 0
+                    ? result.at(from) : cDictionary[cDictionarySize + from]);
+            }
+        });
+    return result;
+}
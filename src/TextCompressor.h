@@ -0,0 +1,61 @@
+#ifndef TEXTCOMPRESSOR_H
+#define TEXTCOMPRESSOR_H
+
+// Compression of chat texts against a shared dictionary.
+
+#include <QByteArray>
+
+/**
+ * LZ77 compression of short texts, where matches can refer both to the
+ * preceding bytes of the text and to a built-in dictionary of fragments
+ * typical for the chat traffic (ticket ids, hostnames, URLs, stack
+ * traces). Thus, even a text of a few dozen bytes is shrunk, which a
+ * general-purpose compressor starting from scratch can not do.
+ *
+ * The compressed form is a sequence of tokens, each starting with a
+ * varint (LEB128, as in the binary form of Chat::Message) <header>:
+ * - If the low bit of <header> is 0: <header> >> 1 literal bytes follow.
+ * - Otherwise: a match of (<header> >> 1) + cMinMatchSize bytes, followed
+ *   by the varint <distance> back from the current end of the dictionary
+ *   concatenated with the decompressed bytes; the match can overlap the
+ *   bytes it produces.
+ *
+ * The dictionary is versioned: changing it requires incrementing
+ * cDictionaryVersion, and the compressed data is decodable only by an App
+ * of the same version.
+ */
+class TextCompressor
+{
+public:
+    static const int cDictionaryVersion = 1;
+
+    static const int cMinMatchSize = 3;
+
+    // The longest text the chat sends: FragmentMessage::cMaxCount
+    // fragments of Transport::cMaxDatagramSize - 160 bytes (checked in
+    // ChatEngine.cpp). Texts are compressed only up to this size, and
+    // compressed data which would decompress to more is malformed, thus, a
+    // small datagram can not make the receiver allocate much.
+    static const int cMaxDecompressedSize = 32 * (1424 - 160);
+
+    /**
+     * @return Compressed data, or an empty array if compression does not
+     * shrink the text, or if the text exceeds cMaxDecompressedSize.
+     */
+    static QByteArray compress(const QByteArray &utf8);
+
+    /**
+     * Checks the compressed data without decompressing it, thus, without
+     * allocating memory.
+     * @return Size of the decompressed data, or -1 if the data is
+     * malformed.
+     */
+    static int decompressedSize(const char *data, int size);
+
+    /**
+     * @return Empty array if the data is malformed.
+     */
+    static QByteArray decompress(const char *data, int size);
+};
+
+#endif // TEXTCOMPRESSOR_H
@@ -0,0 +1,125 @@
+#ifndef TEXTCOMPRESSORTEST_H
+#define TEXTCOMPRESSORTEST_H
+
+#include <QtTest>
+
+#include "TextCompressor.h"
+
+class TextCompressorTest : public QObject
+{
+    Q_OBJECT
+private:
+    static void appendVarint(QByteArray *pBytes, quint64 value)
+    {
+        while (value >= 0x80) {
+            pBytes->append(char((value & 0x7F) | 0x80));
+            value >>= 7;
+        }
+        pBytes->append(char(value));
+    }
+
+    /**
+     * @return Compressed form of a literal 'a' repeated by a match which
+     * overlaps it, size bytes in total.
+     */
+    static QByteArray repeatedA(int size)
+    {
+        QByteArray result("\x02" "a", 2);
+        appendVarint(&result,
+            (quint64(size - 1 - TextCompressor::cMinMatchSize) << 1) | 1);
+        appendVarint(&result, 1);
+        return result;
+    }
+
+private slots:
+    void testRoundTrip_data()
+    {
+        QTest::addColumn<QByteArray>("utf8");
+
+        QTest::newRow("ticket")
+            << QByteArray("Could you please check TICKET-1234?");
+        QTest::newRow("stack trace")
+            << QByteArray("Exception in thread \"main\" "
+                "java.lang.NullPointerException\n"
+                "\tat com.example.Foo.bar(Foo.java:42)\n"
+                "\tat com.example.Main.main(Main.java:7)");
+        QTest::newRow("repeated")
+            << QByteArray(200, 'a');
+        QTest::newRow("non-ASCII, repeated")
+            << QString::fromUtf8("\xD0\x9F\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5"
+                "\xD1\x82, \xD0\x9F\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82!")
+                .toUtf8();
+    }
+
+    void testRoundTrip()
+    {
+        QFETCH(QByteArray, utf8);
+
+        const QByteArray compressed = TextCompressor::compress(utf8);
+        QVERIFY(!compressed.isEmpty());
+        QVERIFY(compressed.size() < utf8.size());
+        QCOMPARE(TextCompressor::decompressedSize(
+            compressed.constData(), compressed.size()), utf8.size());
+        QCOMPARE(TextCompressor::decompress(
+            compressed.constData(), compressed.size()), utf8);
+    }
+
+    void testIncompressible()
+    {
+        QVERIFY(TextCompressor::compress("").isEmpty());
+        QVERIFY(TextCompressor::compress("ok").isEmpty());
+        QVERIFY(TextCompressor::compress("q7Zx").isEmpty());
+    }
+
+    void testMalformed()
+    {
+        // Zero-size literal run.
+        QCOMPARE(TextCompressor::decompressedSize("\x00", 1), -1);
+
+        // Truncated literals.
+        QCOMPARE(TextCompressor::decompressedSize("\x04" "a", 2), -1);
+
+        // Match without a distance.
+        QCOMPARE(TextCompressor::decompressedSize("\x01", 1), -1);
+
+        // Match before the start of the dictionary.
+        QCOMPARE(TextCompressor::decompressedSize("\x01\xFF\x7F", 3), -1);
+
+        QVERIFY(TextCompressor::decompress("\x04" "a", 2).isEmpty());
+    }
+
+    void testSizeLimit()
+    {
+        const int maxSize = TextCompressor::cMaxDecompressedSize;
+
+        QByteArray bomb = repeatedA(maxSize);
+        QCOMPARE(TextCompressor::decompressedSize(
+            bomb.constData(), bomb.size()), maxSize);
+        QCOMPARE(TextCompressor::decompress(bomb.constData(), bomb.size()),
+            QByteArray(maxSize, 'a'));
+
+        QByteArray literals;
+        appendVarint(&literals, quint64(maxSize) << 1);
+        literals.append(QByteArray(maxSize, 'q'));
+        QCOMPARE(TextCompressor::decompressedSize(
+            literals.constData(), literals.size()), maxSize);
+
+        // A few bytes should not make the receiver allocate more.
+        bomb = repeatedA(maxSize + 1);
+        QCOMPARE(TextCompressor::decompressedSize(
+            bomb.constData(), bomb.size()), -1);
+        QVERIFY(TextCompressor::decompress(
+            bomb.constData(), bomb.size()).isEmpty());
+        bomb = repeatedA(1024 * 1024 * 1024);
+        QCOMPARE(TextCompressor::decompressedSize(
+            bomb.constData(), bomb.size()), -1);
+
+        // Nor is a longer text sent compressed.
+        QVERIFY(!TextCompressor::compress(QByteArray(maxSize, 'a'))
+            .isEmpty());
+        QVERIFY(TextCompressor::compress(QByteArray(maxSize + 1, 'a'))
+            .isEmpty());
+    }
+};
+
+#endif // TEXTCOMPRESSORTEST_H
@@ -0,0 +1,145 @@
+#include "TextReassembler.h"
+
+#include <QHash>
+
+// Bits of a fragment mask.
+static const int cMaxFragmentCount = int(sizeof(quint32) * 8);
+
+static quint32 allFragments(int count)
+{
+    return count >= cMaxFragmentCount
+        ? ~quint32(0) : (quint32(1) << count) - 1;
+}
+
+quint32 TextReassembler::handleFragment(const QString &senderId,
+    qint64 textId, int index, int count, const QByteArray &fragment,
+    QByteArray *pCompletedText)
+{
+    Q_ASSERT(index >= 0 && index < count && count <= cMaxFragmentCount);
+    pCompletedText->clear();
+    textId = qAbs(textId);
+
+    foreach (const CompletedRecord &record, completedRecords) {
+        if (record.textId == textId && record.senderId == senderId) {
+            // Resent because the ack has been lost.
+            return allFragments(record.count);
+        }
+    }
+
+    int i = findPartialText(senderId, textId);
+    if (i == -1) {
+        if (fragment.size() > settings.maxBufferedUtf8SizePerSender) {
+            return 0;
+        }
+        if (partialTextCount(senderId)
+            >= settings.maxPartialTextsPerSender) {
+
+            dropOldestPartialText(senderId);
+        } else if (partialTexts.size() >= settings.maxPartialTexts) {
+            dropOldestPartialText(senderWithMostPartialTexts());
+        }
+        partialTexts.append(PartialText{senderId, textId, 0, 0,
+            QVector<QByteArray>(count)});
+        i = partialTexts.size() - 1;
+    }
+
+    if (partialTexts[i].fragments.size() != count) {
+        // Inconsistent with the fragments received before.
+        return 0;
+    }
+
+    const quint32 bit = quint32(1) << index;
+    if ((partialTexts[i].receivedFragments & bit) == 0) {
+        while (bufferedUtf8Size(senderId) + fragment.size()
+            > settings.maxBufferedUtf8SizePerSender) {
+
+            dropOldestPartialText(senderId);
+            i = findPartialText(senderId, textId);
+            if (i == -1) {
+                // This text was the oldest one.
+                return 0;
+            }
+        }
+
+        PartialText &partialText = partialTexts[i];
+        partialText.fragments[index] = fragment;
+        partialText.utf8Size += fragment.size();
+        partialText.receivedFragments |= bit;
+    }
+
+    const quint32 receivedFragments = partialTexts[i].receivedFragments;
+    if (receivedFragments != allFragments(count)) {
+        return receivedFragments;
+    }
+
+    foreach (const QByteArray &part, partialTexts[i].fragments) {
+        pCompletedText->append(part);
+    }
+    partialTexts.removeAt(i);
+
+    completedRecords.append(CompletedRecord{senderId, textId, count});
+    if (completedRecords.size() > settings.maxStoredCompletedRecords) {
+        completedRecords.removeFirst();
+    }
+    return receivedFragments;
+}
+
+int TextReassembler::findPartialText(const QString &senderId,
+    qint64 textId) const
+{
+    for (int i = 0; i < partialTexts.size(); ++i) {
+        if (partialTexts[i].textId == textId
+            && partialTexts[i].senderId == senderId) {
+
+            return i;
+        }
+    }
+    return -1;
+}
+
+int TextReassembler::bufferedUtf8Size(const QString &senderId) const
+{
+    int result = 0;
+    foreach (const PartialText &partialText, partialTexts) {
+        if (partialText.senderId == senderId) {
+            result += partialText.utf8Size;
+        }
+    }
+    return result;
+}
+
+int TextReassembler::partialTextCount(const QString &senderId) const
+{
+    int result = 0;
+    foreach (const PartialText &partialText, partialTexts) {
+        if (partialText.senderId == senderId) {
+            ++result;
+        }
+    }
+    return result;
+}
+
+QString TextReassembler::senderWithMostPartialTexts() const
+{
+    QHash<QString, int> counts;
+    QString result;
+    int maxCount = 0;
+    foreach (const PartialText &partialText, partialTexts) {
+        const int count = ++counts[partialText.senderId];
+        if (count > maxCount) {
+            maxCount = count;
+            result = partialText.senderId;
+        }
+    }
+    return result;
+}
+
+void TextReassembler::dropOldestPartialText(const QString &senderId)
+{
+    for (int i = 0; i < partialTexts.size(); ++i) {
+        if (partialTexts[i].senderId == senderId) {
+            partialTexts.removeAt(i);
+            return;
+        }
+    }
+}
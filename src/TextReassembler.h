@@ -0,0 +1,90 @@
+#ifndef TEXTREASSEMBLER_H
+#define TEXTREASSEMBLER_H
+
+// Component which reassembles the texts sent in fragments.
+
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <QList>
+
+/**
+ * Collects the fragments of texts (see ReliableTextSender) received from
+ * an unreliable receiving mechanism, which can lose, reorder and
+ * duplicate them, and yields each text once, when all its fragments are
+ * received.
+ *
+ * The buffered fragments are bounded per sender and in total: the oldest
+ * partial texts are dropped to make room. Their fragments are not acked
+ * any more, thus, the sender resends them. A sender can not make room at
+ * the expense of the senders with fewer partial texts.
+ */
+class TextReassembler
+{
+public:
+    struct Settings
+    {
+        // Partial texts of a sender are dropped, the oldest first, when
+        // their fragments would exceed this size.
+        int maxBufferedUtf8SizePerSender;
+
+        // Of a sender; its oldest is dropped beyond this.
+        int maxPartialTextsPerSender;
+
+        // Of all the senders; beyond this, the oldest of the sender with
+        // the most is dropped.
+        int maxPartialTexts;
+
+        // Completed texts are remembered to ack the fragments resent by
+        // their senders; old records are forgot beyond this.
+        int maxStoredCompletedRecords;
+    };
+
+    explicit TextReassembler(const Settings &settings)
+        : settings(settings)
+    {}
+
+    /**
+     * Should be called each time a fragment is received from a user.
+     * @param textId Of any sign: resent fragments have it negated.
+     * @param pCompletedText Set to the UTF-8 of the whole text if this
+     * fragment completes it; otherwise, left empty.
+     * @return The fragments of the text received so far (bit i for
+     * fragment i), to be acked; 0 if the fragment is dropped.
+     */
+    quint32 handleFragment(const QString &senderId, qint64 textId,
+        int index, int count, const QByteArray &fragment,
+        QByteArray *pCompletedText);
+
+private:
+    const Settings settings;
+
+    struct PartialText
+    {
+        QString senderId;
+        qint64 textId;
+        quint32 receivedFragments;
+        int utf8Size;
+        QVector<QByteArray> fragments;
+    };
+
+    // The oldest first.
+    QList<PartialText> partialTexts;
+
+    struct CompletedRecord
+    {
+        QString senderId;
+        qint64 textId;
+        int count;
+    };
+
+    QList<CompletedRecord> completedRecords;
+
+    int findPartialText(const QString &senderId, qint64 textId) const;
+    int bufferedUtf8Size(const QString &senderId) const;
+    int partialTextCount(const QString &senderId) const;
+    QString senderWithMostPartialTexts() const;
+    void dropOldestPartialText(const QString &senderId);
+};
+
+#endif // TEXTREASSEMBLER_H
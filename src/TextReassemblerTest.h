@@ -0,0 +1,111 @@
+#ifndef TEXTREASSEMBLERTEST_H
+#define TEXTREASSEMBLERTEST_H
+
+#include <QtTest>
+
+#include "TextReassembler.h"
+#include "ReliableTextSender.h"
+
+class TextReassemblerTest : public QObject
+{
+    Q_OBJECT
+private:
+    static TextReassembler::Settings settings(int maxBufferedUtf8Size = 1000)
+    {
+        return TextReassembler::Settings{maxBufferedUtf8Size, 3, 4, 10};
+    }
+
+private slots:
+    void testSplitIntoFragments()
+    {
+        const QStringList fragments =
+            ReliableTextSender::splitIntoFragments("abcdefghij", 4);
+        QCOMPARE(fragments, QStringList() << "abcd" << "efgh" << "ij");
+
+        // Multi-byte chars are not cut.
+        const QString text = QString::fromUtf8("a\xD0\x9F\xD1\x80\xE2\x82\xAC");
+        QCOMPARE(ReliableTextSender::splitIntoFragments(text, 4),
+            QStringList() << QString::fromUtf8("a\xD0\x9F")
+                << QString::fromUtf8("\xD1\x80") << QString::fromUtf8(
+                    "\xE2\x82\xAC"));
+    }
+
+    void testReorderedAndDuplicated()
+    {
+        TextReassembler r(settings());
+        QByteArray text;
+
+        QCOMPARE(r.handleFragment("a", 10, 2, 3, "ij", &text), 4u);
+        QVERIFY(text.isEmpty());
+        QCOMPARE(r.handleFragment("a", 10, 0, 3, "abcd", &text), 5u);
+        QCOMPARE(r.handleFragment("a", -10, 0, 3, "abcd", &text), 5u);
+        QVERIFY(text.isEmpty());
+
+        // Another sender's text with the same id is apart.
+        QCOMPARE(r.handleFragment("b", 10, 1, 3, "xxxx", &text), 2u);
+
+        QCOMPARE(r.handleFragment("a", -10, 1, 3, "efgh", &text), 7u);
+        QCOMPARE(text, QByteArray("abcdefghij"));
+
+        // Resent after completion: acked, but not yielded again.
+        QCOMPARE(r.handleFragment("a", -10, 1, 3, "efgh", &text), 7u);
+        QVERIFY(text.isEmpty());
+    }
+
+    void testInconsistentCount()
+    {
+        TextReassembler r(settings());
+        QByteArray text;
+
+        QCOMPARE(r.handleFragment("a", 10, 0, 3, "abcd", &text), 1u);
+        QCOMPARE(r.handleFragment("a", 10, 1, 2, "efgh", &text), 0u);
+    }
+
+    void testBufferBound()
+    {
+        TextReassembler r(settings(10));
+        QByteArray text;
+
+        QCOMPARE(r.handleFragment("a", 1, 0, 2, "12345", &text), 1u);
+        QCOMPARE(r.handleFragment("a", 2, 0, 2, "12345", &text), 1u);
+
+        // Drops the oldest text of the sender.
+        QCOMPARE(r.handleFragment("a", 2, 1, 2, "678", &text), 3u);
+        QCOMPARE(text, QByteArray("12345678"));
+        QCOMPARE(r.handleFragment("a", 1, 1, 2, "678", &text), 2u);
+        QVERIFY(text.isEmpty());
+
+        // Other senders have their own room.
+        QCOMPARE(r.handleFragment("b", 1, 0, 2, "1234567890", &text), 1u);
+
+        // Never fits.
+        QCOMPARE(r.handleFragment("a", 3, 0, 2, "12345678901", &text), 0u);
+    }
+
+    void testPartialTextsBound()
+    {
+        TextReassembler r(settings());
+        QByteArray text;
+
+        QCOMPARE(r.handleFragment("b", 1, 0, 2, "b1", &text), 1u);
+
+        // Drops the oldest text of the sender beyond its bound.
+        for (int textId = 1; textId <= 4; ++textId) {
+            QCOMPARE(r.handleFragment("a", textId, 0, 2, "a", &text), 1u);
+        }
+        QCOMPARE(r.handleFragment("a", 1, 1, 2, "a", &text), 2u);
+        QVERIFY(text.isEmpty());
+
+        // Beyond the total bound, drops the oldest text of the sender with
+        // the most, not the oldest one of all.
+        QCOMPARE(r.handleFragment("c", 1, 0, 2, "c1", &text), 1u);
+        QCOMPARE(r.handleFragment("b", 1, 1, 2, "b2", &text), 3u);
+        QCOMPARE(text, QByteArray("b1b2"));
+        QCOMPARE(r.handleFragment("a", 3, 1, 2, "a", &text), 2u);
+        QVERIFY(text.isEmpty());
+        QCOMPARE(r.handleFragment("a", 4, 1, 2, "a", &text), 3u);
+        QCOMPARE(text, QByteArray("aa"));
+    }
+};
+
+#endif // TEXTREASSEMBLERTEST_H
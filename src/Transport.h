@@ -0,0 +1,210 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+// Interface of the mechanism which delivers datagrams between Apps.
+
+#include <stdexcept>
+
+#include <QObject>
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QList>
+
+#include "DatagramPool.h"
+
+/**
+ * Sends datagrams to all other Apps in the same channel, and receives
+ * theirs (unreliably). Apps are identified by ids which are derived from
+ * their sender addresses.
+ *
+ * Implemented by Multicaster (over the network), and by LoopbackTransport
+ * (in-process, e.g. for simulating many Apps).
+ */
+class Transport : public QObject
+{
+    Q_OBJECT
+public:
+    class NetworkEx : public std::runtime_error
+    {
+    public:
+        NetworkEx(const QString &what)
+            : std::runtime_error(what.toStdString())
+        {}
+    };
+
+    // Channel which is always joined.
+    static const int cDefaultChannel = 0;
+
+    // Max size of the header a transport adds to a datagram, including
+    // the relayed one (see relayDatagram()).
+    static const int cMaxHeaderSize = 48;
+
+    // Max size of a datagram to send; the rest of a DatagramSlot is left
+    // for the headers of the transports.
+    static const int cMaxDatagramSize =
+        DatagramSlot::cCapacity - cMaxHeaderSize;
+
+    Transport(QObject *parent)
+        : QObject(parent)
+    {}
+
+    virtual ~Transport() override
+    {}
+
+    /**
+     * @return Id which other Apps receive as senderId.
+     */
+    virtual QString getOwnId() const = 0;
+
+    /**
+     * @return Whether the id is one of the ids other Apps may receive as
+     * senderId of this one.
+     */
+    virtual bool isOwnId(const QString &id) const = 0;
+
+    /**
+     * @return All the ids for which isOwnId() is true.
+     */
+    virtual QStringList getOwnIds() const = 0;
+
+    /**
+     * @return Id of the sender of a received datagram, comparable to the
+     * result of getOwnId() of the sender. Allocates, thus, is worth
+     * caching (by the sender address).
+     */
+    virtual QString senderIdOf(const SenderAddress &sender) const = 0;
+
+    /**
+     * @return Binary form of getOwnId(), which other Apps get as keyOf() of
+     * the datagrams of this one.
+     */
+    virtual quint32 getOwnKey() const = 0;
+
+    /**
+     * @return Binary form of senderIdOf(), without allocating; equal keys
+     * mean equal ids.
+     */
+    virtual quint32 keyOf(const SenderAddress &sender) const = 0;
+
+    /**
+     * @return Whether the sender of a received datagram is another App on
+     * the same host.
+     */
+    virtual bool isSameHost(const SenderAddress &sender) const
+    {
+        Q_UNUSED(sender);
+        return false;
+    }
+
+    /**
+     * @return Id of the channel, to send datagrams to and to tell the
+     * received ones; the id of the already joined channel of this name;
+     * cDefaultChannel for the empty name.
+     * @throw NetworkEx if any network error has occurred.
+     */
+    virtual int joinChannel(const QString &name)
+        throw (NetworkEx) = 0;
+
+    /**
+     * Stop receiving datagrams of the channel. The default channel can not
+     * be left.
+     */
+    virtual void leaveChannel(int channel) = 0;
+
+    /**
+     * Optionally, drop the received datagrams which start with
+     * addressedPrefix not followed by any of addressees, before they are
+     * delivered. Empty addressedPrefix disables such filtering.
+     */
+    virtual void setAddressedFilter(const QByteArray &addressedPrefix,
+        const QList<QByteArray> &addressees) = 0;
+
+    /**
+     * Optionally, drop the received datagrams sent by the Apps with these
+     * keys (see getOwnKey()) before they are delivered, e.g. the ones which
+     * arrive another way. Replaces the keys set before.
+     */
+    virtual void setDroppedSenders(const QList<quint32> &keys)
+    {
+        Q_UNUSED(keys);
+    }
+
+    /**
+     * @throw NetworkEx if the channel is not joined, or if any network
+     * error has occurred.
+     */
+    virtual void sendDatagram(const QByteArray &datagram,
+        int channel = cDefaultChannel)
+        throw (NetworkEx) = 0;
+
+    /**
+     * Send the datagram to a single App: the sender of a received
+     * datagram, in the channel. By default (and whenever the transport can
+     * not reach the App directly) the datagram is sent to all the Apps in
+     * the channel like by sendDatagram(), thus, other Apps should tolerate
+     * it (e.g. via the addressed filter).
+     * @throw NetworkEx if the channel is not joined, or if any network
+     * error has occurred.
+     */
+    virtual void sendDatagramTo(const QByteArray &datagram,
+        const SenderAddress &recipient, int channel = cDefaultChannel)
+        throw (NetworkEx)
+    {
+        Q_UNUSED(recipient);
+        sendDatagram(datagram, channel);
+    }
+
+    /**
+     * Send the datagram to all the Apps in the channel on behalf of an App
+     * in another network (see Relay): they receive it as sent by the
+     * origin, and marked as relayed.
+     * @throw NetworkEx also if the transport does not support relaying.
+     */
+    virtual void relayDatagram(const QByteArray &datagram,
+        const SenderAddress &origin, int channel = cDefaultChannel)
+        throw (NetworkEx)
+    {
+        Q_UNUSED(datagram);
+        Q_UNUSED(origin);
+        Q_UNUSED(channel);
+        throw NetworkEx("Relaying is not supported by the transport.");
+    }
+
+    /**
+     * Account a received datagram which the user has failed to parse; can
+     * be called only while handling datagramReceived().
+     */
+    virtual void reportUnparsable(const DatagramView &datagram)
+    {
+        Q_UNUSED(datagram);
+    }
+
+    /**
+     * Account the outcome of a reliable delivery attempt, e.g. for
+     * congestion control: the number of recipients which have acked in
+     * time, and which have not.
+     */
+    virtual void reportDeliveryFeedback(int ackedCount, int unackedCount)
+    {
+        Q_UNUSED(ackedCount);
+        Q_UNUSED(unackedCount);
+    }
+
+signals:
+    /**
+     * Receive datagrams from _other_ Apps.
+     *
+     * ATTENTION: The view refers to a buffer which is reused after the
+     * signal returns, thus, should be connected directly (from the thread
+     * of this object), and the data should be copied if needed later.
+     */
+    void datagramReceived(const DatagramView &datagram);
+
+    /**
+     * Error sending datagrams asynchronously.
+     */
+    void networkError(QString errorMessage);
+};
+
+#endif // TRANSPORT_H
@@ -0,0 +1,109 @@
+#ifndef TYPELIST_H
+#define TYPELIST_H
+
+// Compile-time lists of types, e.g. of the message types.
+
+/**
+ * Has no values: the types are accessed via the templates below.
+ */
+template<class... Types>
+struct TypeList
+{
+    static const int cSize = sizeof...(Types);
+};
+
+/**
+ * TypeIndexOf<T, List>::value is the index of T in the List; does not
+ * compile if the List does not contain T.
+ */
+template<class T, class List>
+struct TypeIndexOf;
+
+template<class T, class... Tail>
+struct TypeIndexOf<T, TypeList<T, Tail...>>
+{
+    static const int value = 0;
+};
+
+template<class T, class Head, class... Tail>
+struct TypeIndexOf<T, TypeList<Head, Tail...>>
+{
+    static const int value = 1 + TypeIndexOf<T, TypeList<Tail...>>::value;
+};
+
+/**
+ * TypeAt<i, List>::Type is the type at the index i of the List.
+ */
+template<int i, class List>
+struct TypeAt;
+
+template<class Head, class... Tail>
+struct TypeAt<0, TypeList<Head, Tail...>>
+{
+    typedef Head Type;
+};
+
+template<int i, class Head, class... Tail>
+struct TypeAt<i, TypeList<Head, Tail...>>
+{
+    typedef typename TypeAt<i - 1, TypeList<Tail...>>::Type Type;
+};
+
+/**
+ * Max size and alignment of the types, for a storage of a value of any of
+ * them.
+ */
+template<class List>
+struct TypeListStorage;
+
+template<>
+struct TypeListStorage<TypeList<>>
+{
+    static const int cSize = 1;
+    static const int cAlignment = 1;
+};
+
+template<class Head, class... Tail>
+struct TypeListStorage<TypeList<Head, Tail...>>
+{
+private:
+    typedef TypeListStorage<TypeList<Tail...>> TailStorage;
+
+public:
+    static const int cSize = int(sizeof(Head)) > TailStorage::cSize
+        ? int(sizeof(Head)) : TailStorage::cSize;
+    static const int cAlignment = int(alignof(Head)) > TailStorage::cAlignment
+        ? int(alignof(Head)) : TailStorage::cAlignment;
+};
+
+/**
+ * Calls pHandler->handle() overloaded for the type at the index, resolved
+ * at compile time, with the value at the address.
+ */
+template<class List>
+struct TypeListDispatcher;
+
+template<>
+struct TypeListDispatcher<TypeList<>>
+{
+    template<class Handler>
+    static void dispatch(int, const void *, Handler *)
+    {}
+};
+
+template<class Head, class... Tail>
+struct TypeListDispatcher<TypeList<Head, Tail...>>
+{
+    template<class Handler>
+    static void dispatch(int index, const void *value, Handler *pHandler)
+    {
+        if (index == 0) {
+            pHandler->handle(*static_cast<const Head *>(value));
+        } else {
+            TypeListDispatcher<TypeList<Tail...>>::dispatch(
+                index - 1, value, pHandler);
+        }
+    }
+};
+
+#endif // TYPELIST_H
@@ -20,11 +20,22 @@ WelcomeDialog::WelcomeDialog(QWidget *parent, const QString &title)
         return;
     }
 
+    try {
+        localTransport = new SharedMemoryTransport(this,
+            SharedMemoryTransport::defaultSettings, multicaster);
+    } catch (Transport::NetworkEx &e) {
+        // Not fatal: the Apps on the same host are reached via multicast,
+        // and pass it through their local transport, since this App is
+        // not registered in it.
+        qDebug() << "Local transport is not available:" << e.what();
+    }
+
     startButton->setEnabled(true);
     nickEdit->setEnabled(true);
     ipValueLabel->setStyleSheet(
         "QLabel { color: darkgreen; font-weight: bold; }");
-    ipValueLabel->setText(multicaster->getOwnId());
+    ipValueLabel->setText(multicaster->getOwnAddress().toString()
+        + " (" + multicaster->getOwnId() + ")");
 }
 
 void WelcomeDialog::handleMulticasterError(const QString &message)
@@ -48,7 +59,8 @@ void WelcomeDialog::startButtonClicked()
 {
     try {
         chatEngine = new Chat::Engine(this, Chat::Engine::defaultSettings,
-            nickEdit->text(), multicaster);
+            nickEdit->text(), localTransport != nullptr
+                ? static_cast<Transport *>(localTransport) : multicaster);
     } catch (Chat::BadValueEx &) {
         QMessageBox::critical(this, windowTitle(),
             tr("Your nick should not be empty, too long or contain '|' characters."));
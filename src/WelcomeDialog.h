@@ -4,10 +4,12 @@
 #include "ui_WelcomeDialog.h"
 
 #include "Multicaster.h"
+#include "SharedMemoryTransport.h"
 #include "ChatEngine.h"
 
 /**
- * Create Multicaster and Chat::Manager, asking the user for nick and
+ * Create Multicaster (with SharedMemoryTransport on top, for the Apps on
+ * the same host) and Chat::Manager, asking the user for nick and
  * reporting possible errors. These components are owned by this dialog.
  *
  * After the dialog is accepted, the owned Chat::Manager is created but not
@@ -31,6 +33,7 @@ private slots:
 private:
     // Created and owned here as QObjects.
     Multicaster *multicaster = nullptr;
+    SharedMemoryTransport *localTransport = nullptr;
     Chat::Engine *chatEngine = nullptr;
 
     void handleMulticasterError(const QString &message);
@@ -2,13 +2,75 @@
 // QMAKE_CXXFLAGS+=-DRUNTESTS
 #ifdef RUNTESTS
 
+#include <QCoreApplication>
+
 #include "RunTests.h"
+#include "DatagramPool.h"
 
-int main()
+int main(int argc, char *argv[])
 {
+    // Timers, sockets and QTRY_COMPARE() need the event loop.
+    QCoreApplication app(argc, argv);
+
+    // Watched by QSignalSpy.
+    qRegisterMetaType<SenderAddress>();
+
     return runTests();
 }
 
+#elif defined(RUNBENCHMARKS)
+// To run benchmarks, define a build configuration with the following
+// option: QMAKE_CXXFLAGS+=-DRUNBENCHMARKS
+
+#include <QCoreApplication>
+
+#include "RunBenchmarks.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    return runBenchmarks(argc, argv);
+}
+
+#elif defined(RUNRELAY)
+// To run a relay which bridges chat networks, define a build configuration
+// with the following option: QMAKE_CXXFLAGS+=-DRUNRELAY
+
+#include <QCoreApplication>
+
+#include "RunRelay.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    return runRelay();
+}
+
+#elif defined(RUNFUZZER)
+// To fuzz the message parsers with libFuzzer (clang), define a build
+// configuration with the following options:
+// QMAKE_CXXFLAGS+=-DRUNFUZZER -fsanitize=fuzzer,address
+// QMAKE_LFLAGS+=-fsanitize=fuzzer,address
+// and run it with a dir for the new inputs, followed by the checked-in
+// corpus, which is only read, e.g.: MultiChat new-corpus ChatMessagesCorpus
+// libFuzzer provides main().
+
+#include <stdint.h>
+#include <stddef.h>
+#include <QtGlobal>
+
+#include "ChatMessagesFuzzer.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    const QString error = ChatMessagesFuzzer::checkPayload(
+        reinterpret_cast<const char *>(data), int(size));
+    if (!error.isEmpty()) {
+        qFatal("%s", qPrintable(error));
+    }
+    return 0;
+}
+
 #else // RUNTESTS
 ///////////////////////////////////////////////////////////////////////////
 